@@ -3,5 +3,6 @@
 #include "UltimateSF.h"
 #include "Modules/ModuleManager.h"
 
+DEFINE_LOG_CATEGORY(LogUltimateSF);
+
 IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, UltimateSF, "UltimateSF" );
- 
\ No newline at end of file
@@ -0,0 +1,209 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFArenaMovement.h"
+#include "UltimateSF.h"
+#include "Engine/EngineTypes.h"
+#include "HAL/IConsoleManager.h"
+#include "UObject/CoreNet.h"
+
+static TAutoConsoleVariable<bool> CVarArenaMovementMeasure(
+	TEXT("usf.ArenaMovement.Measure"),
+	false,
+	TEXT("Compare every arena movement update against the default FRepMovement encoding on the server, see usf.ArenaMovement.Report."));
+
+static uint8 BitsFor(float Size, float Resolution)
+{
+	const uint32 Steps = (uint32)FMath::Clamp(FMath::CeilToDouble(Size / FMath::Max(Resolution, 0.01f)), 1.0, (double)(1u << 30));
+	return (uint8)FMath::Max(1u, FMath::CeilLogTwo(Steps + 1));
+}
+
+uint8 FUltimateSFArenaBounds::GetBitsXY() const
+{
+	return BitsFor(FMath::Max(Max.X - Min.X, Max.Y - Min.Y), Resolution);
+}
+
+uint8 FUltimateSFArenaBounds::GetBitsZ() const
+{
+	return BitsFor(Max.Z - Min.Z, Resolution);
+}
+
+static int16 QuantizeVelocity(double Velocity)
+{
+	return (int16)FMath::Clamp(FMath::RoundToInt(Velocity), (int32)MIN_int16, (int32)MAX_int16);
+}
+
+FUltimateSFArenaMovement FUltimateSFArenaMovement::Make(const FUltimateSFArenaBounds& Bounds, const FRepMovement& Movement)
+{
+	FUltimateSFArenaMovement Result;
+	Result.BitsXY = Bounds.GetBitsXY();
+	Result.BitsZ = Bounds.GetBitsZ();
+
+	const FVector Local = (Movement.Location - Bounds.Min) / FMath::Max(Bounds.Resolution, 0.01f);
+	const uint32 MaxXY = (1u << Result.BitsXY) - 1;
+	const uint32 MaxZ = (1u << Result.BitsZ) - 1;
+	Result.bOutside = Local.X < 0.0 || Local.Y < 0.0 || Local.Z < 0.0 || Local.X > MaxXY || Local.Y > MaxXY || Local.Z > MaxZ;
+	if (Result.bOutside)
+	{
+		Result.OutsideLocation = Movement.Location;
+	}
+	else
+	{
+		Result.X = (uint32)FMath::RoundToInt(Local.X);
+		Result.Y = (uint32)FMath::RoundToInt(Local.Y);
+		Result.Z = (uint32)FMath::RoundToInt(Local.Z);
+	}
+
+	Result.Yaw = (uint8)(FMath::RoundToInt(FRotator::ClampAxis(Movement.Rotation.Yaw) * (256.f / 360.f)) & 0xFF);
+	Result.VelocityX = QuantizeVelocity(Movement.LinearVelocity.X);
+	Result.VelocityY = QuantizeVelocity(Movement.LinearVelocity.Y);
+	Result.VelocityZ = QuantizeVelocity(Movement.LinearVelocity.Z);
+	return Result;
+}
+
+FVector FUltimateSFArenaMovement::GetLocation(const FUltimateSFArenaBounds& Bounds) const
+{
+	return bOutside ? OutsideLocation : Bounds.Min + FVector(X, Y, Z) * Bounds.Resolution;
+}
+
+bool FUltimateSFArenaMovement::operator==(const FUltimateSFArenaMovement& Other) const
+{
+	return X == Other.X && Y == Other.Y && Z == Other.Z && BitsXY == Other.BitsXY && BitsZ == Other.BitsZ
+		&& bOutside == Other.bOutside && OutsideLocation == Other.OutsideLocation && Yaw == Other.Yaw
+		&& VelocityX == Other.VelocityX && VelocityY == Other.VelocityY && VelocityZ == Other.VelocityZ;
+}
+
+static void SerializeVelocity(FArchive& Ar, int16& Velocity)
+{
+	//Zigzag so slow movement either way packs into a byte or two
+	uint32 ZigZag = (uint32)(((int32)Velocity << 1) ^ ((int32)Velocity >> 31));
+	Ar.SerializeIntPacked(ZigZag);
+	Velocity = (int16)((int32)(ZigZag >> 1) ^ -(int32)(ZigZag & 1));
+}
+
+bool FUltimateSFArenaMovement::NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess)
+{
+	//Outside flag, bits per axis and which velocity parts follow
+	uint32 Header = 0;
+	if (Ar.IsSaving())
+	{
+		Header = (bOutside ? 1 : 0) | (BitsXY & 31) << 1 | (BitsZ & 31) << 6
+			| (VelocityX != 0 || VelocityY != 0 ? 1 : 0) << 11 | (VelocityZ != 0 ? 1 : 0) << 12;
+	}
+	Ar.SerializeBits(&Header, 13);
+	bOutside = (Header & 1) != 0;
+	BitsXY = (Header >> 1) & 31;
+	BitsZ = (Header >> 6) & 31;
+
+	if (bOutside)
+	{
+		bOutSuccess = SerializePackedVector<1, 24>(OutsideLocation, Ar);
+	}
+	else
+	{
+		if (Ar.IsLoading())
+		{
+			X = Y = Z = 0;
+		}
+		Ar.SerializeBits(&X, BitsXY);
+		Ar.SerializeBits(&Y, BitsXY);
+		Ar.SerializeBits(&Z, BitsZ);
+		bOutSuccess = true;
+	}
+
+	Ar << Yaw;
+
+	if (Header & (1 << 11))
+	{
+		SerializeVelocity(Ar, VelocityX);
+		SerializeVelocity(Ar, VelocityY);
+	}
+	else
+	{
+		VelocityX = VelocityY = 0;
+	}
+	if (Header & (1 << 12))
+	{
+		SerializeVelocity(Ar, VelocityZ);
+	}
+	else
+	{
+		VelocityZ = 0;
+	}
+
+	bOutSuccess &= !Ar.IsError();
+	return true;
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Measurement***
+/// </summary>
+
+FUltimateSFArenaMovementStats& FUltimateSFArenaMovementStats::Get()
+{
+	static FUltimateSFArenaMovementStats Stats;
+	return Stats;
+}
+
+bool FUltimateSFArenaMovementStats::IsMeasuring()
+{
+	return CVarArenaMovementMeasure.GetValueOnGameThread();
+}
+
+void FUltimateSFArenaMovementStats::Measure(const FUltimateSFArenaBounds& Bounds, const FUltimateSFArenaMovement& Movement, const FRepMovement& Default)
+{
+	bool bSuccess = true;
+
+	FNetBitWriter ArenaWriter(nullptr, 512);
+	FUltimateSFArenaMovement Written = Movement;
+	Written.NetSerialize(ArenaWriter, nullptr, bSuccess);
+
+	FNetBitWriter DefaultWriter(nullptr, 1024);
+	FRepMovement DefaultCopy = Default;
+	DefaultCopy.NetSerialize(DefaultWriter, nullptr, bSuccess);
+
+	//Decoded the way a client reads it
+	FNetBitReader Reader(nullptr, ArenaWriter.GetData(), ArenaWriter.GetNumBits());
+	FUltimateSFArenaMovement Read;
+	Read.NetSerialize(Reader, nullptr, bSuccess);
+	const float Error = (float)FVector::Dist(Read.GetLocation(Bounds), Default.Location);
+
+	++Updates;
+	ArenaBits += ArenaWriter.GetNumBits();
+	DefaultBits += DefaultWriter.GetNumBits();
+	ErrorSum += Error;
+	MaxError = FMath::Max(MaxError, Error);
+	OutsideUpdates += Movement.bOutside ? 1 : 0;
+}
+
+static FAutoConsoleCommand ArenaMovementReportCommand(
+	TEXT("usf.ArenaMovement.Report"),
+	TEXT("Logs the bits per update of the arena movement profile against the default FRepMovement, and its position error"),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		const FUltimateSFArenaMovementStats& Stats = FUltimateSFArenaMovementStats::Get();
+		if (Stats.Updates == 0)
+		{
+			UE_LOG(LogUltimateSF, Log, TEXT("usf.ArenaMovement.Report: no updates measured, set usf.ArenaMovement.Measure 1 on the server"));
+			return;
+		}
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.ArenaMovement.Report: %llu updates, %.1f bits per update vs %.1f default (%.0f%% saved), %llu outside the arena"),
+			Stats.Updates, (double)Stats.ArenaBits / Stats.Updates, (double)Stats.DefaultBits / Stats.Updates,
+			Stats.DefaultBits > 0 ? 100.0 * (1.0 - (double)Stats.ArenaBits / Stats.DefaultBits) : 0.0, Stats.OutsideUpdates);
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.ArenaMovement.Report: position error avg %.3f cm, max %.3f cm"), Stats.ErrorSum / Stats.Updates, Stats.MaxError);
+	}));
+
+static FAutoConsoleCommand ArenaMovementResetCommand(
+	TEXT("usf.ArenaMovement.Reset"),
+	TEXT("Clears the usf.ArenaMovement.Report totals"),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		FUltimateSFArenaMovementStats::Get() = FUltimateSFArenaMovementStats();
+	}));
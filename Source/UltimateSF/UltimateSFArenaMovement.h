@@ -0,0 +1,99 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/NetSerialization.h"
+#include "UltimateSFArenaMovement.generated.h"
+
+struct FRepMovement;
+
+/* Box fighters are replicated in, and the position step inside it. Replicated once per fighter, not per update */
+USTRUCT()
+struct FUltimateSFArenaBounds
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	FVector_NetQuantize Min = FVector_NetQuantize(-4000.f, -4000.f, -1000.f);
+
+	UPROPERTY()
+	FVector_NetQuantize Max = FVector_NetQuantize(4000.f, 4000.f, 1000.f);
+
+	/* Position step in cm, positions inside the box are off by at most half of it */
+	UPROPERTY()
+	float Resolution = 1.f;
+
+	/* Bits per axis that cover the box at Resolution */
+	uint8 GetBitsXY() const;
+	uint8 GetBitsZ() const;
+};
+
+/**
+ * Movement of a fighter relative to its arena, replicated to simulated proxies instead of FRepMovement.
+ * Position is a grid index inside the arena box sized to the box (an 80 m arena at 1 cm needs 13 bits for X and Y),
+ * rotation is the yaw as one byte since fighters never pitch or roll, and velocity is skipped when the fighter
+ * stands still and its Z when it is on the ground. Outside the box the position falls back to a packed vector.
+ */
+USTRUCT()
+struct FUltimateSFArenaMovement
+{
+	GENERATED_BODY()
+
+	uint32 X = 0;
+	uint32 Y = 0;
+	uint32 Z = 0;
+	uint8 BitsXY = 0;
+	uint8 BitsZ = 0;
+
+	bool bOutside = false;
+	FVector OutsideLocation = FVector::ZeroVector;
+
+	uint8 Yaw = 0;
+
+	/* cm/s */
+	int16 VelocityX = 0;
+	int16 VelocityY = 0;
+	int16 VelocityZ = 0;
+
+	static FUltimateSFArenaMovement Make(const FUltimateSFArenaBounds& Bounds, const FRepMovement& Movement);
+
+	FVector GetLocation(const FUltimateSFArenaBounds& Bounds) const;
+	float GetYaw() const { return Yaw * (360.f / 256.f); }
+	FVector GetVelocity() const { return FVector(VelocityX, VelocityY, VelocityZ); }
+
+	bool operator==(const FUltimateSFArenaMovement& Other) const;
+
+	bool NetSerialize(FArchive& Ar, class UPackageMap* Map, bool& bOutSuccess);
+};
+
+template<>
+struct TStructOpsTypeTraits<FUltimateSFArenaMovement> : public TStructOpsTypeTraitsBase2<FUltimateSFArenaMovement>
+{
+	enum
+	{
+		WithNetSerializer = true,
+		WithIdenticalViaEquality = true
+	};
+};
+
+/**
+ * Server side comparison of the arena profile against the default FRepMovement, fed from PreReplication
+ * while usf.ArenaMovement.Measure is on. usf.ArenaMovement.Report logs it, usf.ArenaMovement.Reset clears it.
+ */
+struct FUltimateSFArenaMovementStats
+{
+	uint64 Updates = 0;
+	uint64 ArenaBits = 0;
+	uint64 DefaultBits = 0;
+	double ErrorSum = 0.0;
+	float MaxError = 0.f;
+	uint64 OutsideUpdates = 0;
+
+	static FUltimateSFArenaMovementStats& Get();
+
+	static bool IsMeasuring();
+
+	/* Serializes both encodings and decodes the arena one to measure its position error */
+	void Measure(const FUltimateSFArenaBounds& Bounds, const FUltimateSFArenaMovement& Movement, const FRepMovement& Default);
+};
@@ -0,0 +1,165 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFBotController.h"
+#include "UltimateSFBotSubsystem.h"
+#include "UltimateSFCharacter.h"
+
+AUltimateSFBotController::AUltimateSFBotController()
+{
+	//The subsystem ticks bots in a batch, nothing to do per controller
+	PrimaryActorTick.bCanEverTick = false;
+	bWantsPlayerState = true;
+}
+
+AUltimateSFCharacter* AUltimateSFBotController::GetFighter() const
+{
+	return Cast<AUltimateSFCharacter>(GetPawn());
+}
+
+void AUltimateSFBotController::OnPossess(APawn* InPawn)
+{
+	Super::OnPossess(InPawn);
+
+	if (AUltimateSFCharacter* Fighter = GetFighter())
+	{
+		//Bots are always fighting, there is no blueprint toggle to put them in combat mode
+		Fighter->bIsCombatMode = true;
+		Fighter->C_MaxWalkSpeed(Fighter->DefaultCombatSpeed);
+	}
+
+	if (UUltimateSFBotSubsystem* Bots = GetWorld()->GetSubsystem<UUltimateSFBotSubsystem>())
+	{
+		Bots->RegisterBot(this);
+	}
+}
+
+void AUltimateSFBotController::OnUnPossess()
+{
+	if (UUltimateSFBotSubsystem* Bots = GetWorld()->GetSubsystem<UUltimateSFBotSubsystem>())
+	{
+		Bots->UnregisterBot(this);
+	}
+
+	ReleaseDirectionKeys();
+
+	Super::OnUnPossess();
+}
+
+void AUltimateSFBotController::ReleaseDirectionKeys()
+{
+	AUltimateSFCharacter* Fighter = GetFighter();
+	if (Fighter == nullptr)
+	{
+		return;
+	}
+
+	if (Fighter->bIsW) { Fighter->IsWReleased(); }
+	if (Fighter->bIsA) { Fighter->IsAReleased(); }
+	if (Fighter->bIsS) { Fighter->IsSReleased(); }
+	if (Fighter->bIsD) { Fighter->IsDReleased(); }
+	if (Fighter->bIsSprinting) { Fighter->SprintStopped(); }
+}
+
+void AUltimateSFBotController::ExecuteAction(EUltimateSFBotAction Action, AUltimateSFCharacter* Target)
+{
+	AUltimateSFCharacter* Fighter = GetFighter();
+	if (Fighter == nullptr)
+	{
+		return;
+	}
+
+	ReleaseDirectionKeys();
+	CurrentAction = Action;
+	CurrentTarget = Target;
+
+	//Face the target the same way the mouse would
+	if (Target)
+	{
+		const FVector ToTarget = Target->GetActorLocation() - Fighter->GetActorLocation();
+		SetControlRotation(FRotator(0.f, ToTarget.Rotation().Yaw, 0.f));
+	}
+
+	//Attacks pick their variant from the held keys and mouse, randomize them like a player would
+	Fighter->MouseYVal = FMath::FRandRange(-0.3f, 0.3f);
+
+	switch (Action)
+	{
+	case EUltimateSFBotAction::Approach:
+		Fighter->IsWPressed();
+		break;
+
+	case EUltimateSFBotAction::Retreat:
+		Fighter->IsSPressed();
+		break;
+
+	case EUltimateSFBotAction::Strafe:
+		StrafeSign = FMath::RandBool() ? 1.f : -1.f;
+		StrafeSign > 0.f ? Fighter->IsDPressed() : Fighter->IsAPressed();
+		break;
+
+	case EUltimateSFBotAction::Punch:
+		switch (FMath::RandRange(0, 2))
+		{
+		case 0: Fighter->IsAPressed(); break;
+		case 1: Fighter->IsDPressed(); break;
+		default: break;
+		}
+		Fighter->LeftMouseAttack();
+		break;
+
+	case EUltimateSFBotAction::Kick:
+		switch (FMath::RandRange(0, 2))
+		{
+		case 0: Fighter->IsAPressed(); break;
+		case 1: Fighter->IsDPressed(); break;
+		default: break;
+		}
+		Fighter->RightMouseAttack();
+		break;
+
+	case EUltimateSFBotAction::Dodge:
+		FMath::RandBool() ? Fighter->IsDPressed() : Fighter->IsAPressed();
+		Fighter->DodgingFire();
+		break;
+
+	case EUltimateSFBotAction::Sprint:
+		Fighter->IsWPressed();
+		Fighter->SprintStarted();
+		break;
+
+	default:
+		break;
+	}
+}
+
+void AUltimateSFBotController::UpdateMovement(float DeltaTime)
+{
+	AUltimateSFCharacter* Fighter = GetFighter();
+	AUltimateSFCharacter* Target = CurrentTarget.Get();
+	if (Fighter == nullptr || Target == nullptr)
+	{
+		return;
+	}
+
+	const FVector ToTarget = (Target->GetActorLocation() - Fighter->GetActorLocation()).GetSafeNormal2D();
+	SetControlRotation(FRotator(0.f, ToTarget.Rotation().Yaw, 0.f));
+
+	switch (CurrentAction)
+	{
+	case EUltimateSFBotAction::Approach:
+	case EUltimateSFBotAction::Sprint:
+		Fighter->AddMovementInput(ToTarget, 1.f);
+		break;
+
+	case EUltimateSFBotAction::Retreat:
+		Fighter->AddMovementInput(-ToTarget, 1.f);
+		break;
+
+	case EUltimateSFBotAction::Strafe:
+		Fighter->AddMovementInput(FVector::CrossProduct(FVector::UpVector, ToTarget) * StrafeSign, 1.f);
+		break;
+
+	default:
+		break;
+	}
+}
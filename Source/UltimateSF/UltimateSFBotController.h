@@ -0,0 +1,82 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AIController.h"
+#include "UltimateSFBotController.generated.h"
+
+class AUltimateSFCharacter;
+
+/* What a bot is doing until its next decision */
+UENUM(BlueprintType)
+enum class EUltimateSFBotAction : uint8
+{
+	Idle,
+	Approach,
+	Retreat,
+	Strafe,
+	Punch,
+	Kick,
+	Dodge,
+	Sprint,
+
+	MAX UMETA(Hidden)
+};
+
+/**
+ * Headless sparring / load generation bot.
+ * Drives AUltimateSFCharacter through the same entry points the PlayerInputComponent binds (IsWPressed, LeftMouseAttack, DodgingFire, SprintStarted, ...),
+ * so everything downstream of input (RPCs, montages, timers) runs exactly as it does for a human.
+ * The bot never decides on its own: UUltimateSFBotSubsystem scores every bot in one batch per tick and hands each one an action.
+ */
+UCLASS()
+class AUltimateSFBotController : public AAIController
+{
+	GENERATED_BODY()
+
+public:
+	AUltimateSFBotController();
+
+	/* Utility weights, the bot's "personality" */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Bot)
+		float Aggression = 1.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Bot)
+		float Caution = 1.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Bot)
+		float Mobility = 1.f;
+
+	/* Seconds between decisions */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Bot)
+		float ReactionTime = 0.25f;
+
+	/* Distance the bot likes to fight at */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Bot)
+		float PreferredRange = 120.f;
+
+	AUltimateSFCharacter* GetFighter() const;
+
+	/* Presses/releases the inputs for a newly chosen action */
+	void ExecuteAction(EUltimateSFBotAction Action, AUltimateSFCharacter* Target);
+
+	/* Called every tick by the subsystem to keep moving while the current action lasts */
+	void UpdateMovement(float DeltaTime);
+
+	EUltimateSFBotAction GetCurrentAction() const { return CurrentAction; }
+
+	/* World time of the next decision, owned by the subsystem */
+	float NextDecisionTime = 0.f;
+
+protected:
+	virtual void OnPossess(APawn* InPawn) override;
+	virtual void OnUnPossess() override;
+
+private:
+	void ReleaseDirectionKeys();
+
+	EUltimateSFBotAction CurrentAction = EUltimateSFBotAction::Idle;
+	TWeakObjectPtr<AUltimateSFCharacter> CurrentTarget;
+	float StrafeSign = 1.f;
+};
@@ -0,0 +1,232 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFBotSubsystem.h"
+#include "UltimateSF.h"
+#include "UltimateSFCharacter.h"
+#include "EngineUtils.h"
+#include "GameFramework/GameModeBase.h"
+#include "GameFramework/PlayerStart.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/CommandLine.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF Bots"), STATGROUP_UltimateSFBots, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Bot Decisions"), STAT_UltimateSFBotDecisions, STATGROUP_UltimateSFBots);
+DECLARE_CYCLE_STAT(TEXT("Bot Movement"), STAT_UltimateSFBotMovement, STATGROUP_UltimateSFBots);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Bots"), STAT_UltimateSFNumBots, STATGROUP_UltimateSFBots);
+
+TStatId UUltimateSFBotSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UUltimateSFBotSubsystem, STATGROUP_Tickables);
+}
+
+void UUltimateSFBotSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	//Load test servers start their bots from the command line, e.g. -nullrhi -UltimateSFBots=200
+	int32 NumBots = 0;
+	if (InWorld.GetNetMode() != NM_Client && FParse::Value(FCommandLine::Get(), TEXT("UltimateSFBots="), NumBots) && NumBots > 0)
+	{
+		const int32 Spawned = SpawnBots(NumBots);
+		UE_LOG(LogUltimateSF, Log, TEXT("Spawned %d bots from the command line"), Spawned);
+	}
+}
+
+void UUltimateSFBotSubsystem::RegisterBot(AUltimateSFBotController* Bot)
+{
+	Bots.AddUnique(Bot);
+}
+
+void UUltimateSFBotSubsystem::UnregisterBot(AUltimateSFBotController* Bot)
+{
+	Bots.RemoveSingleSwap(Bot);
+}
+
+void UUltimateSFBotSubsystem::GatherFighters()
+{
+	Fighters.Reset();
+	FighterLocations.Reset();
+
+	for (TActorIterator<AUltimateSFCharacter> It(GetWorld()); It; ++It)
+	{
+		//Parked and knocked down fighters are no one to approach or strike
+		if (It->IsPooled() || It->bIsRagdollMode)
+		{
+			continue;
+		}
+		Fighters.Add(*It);
+		FighterLocations.Add(It->GetActorLocation());
+	}
+}
+
+void UUltimateSFBotSubsystem::Tick(float DeltaTime)
+{
+	SET_DWORD_STAT(STAT_UltimateSFNumBots, Bots.Num());
+
+	Bots.RemoveAllSwap([](const TWeakObjectPtr<AUltimateSFBotController>& Bot) { return !Bot.IsValid() || Bot->GetFighter() == nullptr; });
+	if (Bots.Num() == 0)
+	{
+		return;
+	}
+
+	{
+		SCOPE_CYCLE_COUNTER(STAT_UltimateSFBotDecisions);
+
+		//Only bots whose reaction time has run out decide this tick
+		const float Now = GetWorld()->GetTimeSeconds();
+		DecidingBots.Reset();
+		for (int32 BotIndex = 0; BotIndex < Bots.Num(); ++BotIndex)
+		{
+			if (Bots[BotIndex]->NextDecisionTime <= Now)
+			{
+				DecidingBots.Add(BotIndex);
+			}
+		}
+
+		if (DecidingBots.Num() > 0)
+		{
+			GatherFighters();
+			ScoreActions(DecidingBots.Num());
+
+			for (int32 Decision = 0; Decision < DecidingBots.Num(); ++Decision)
+			{
+				AUltimateSFBotController* Bot = Bots[DecidingBots[Decision]].Get();
+
+				const float* BotScores = &Scores[Decision * NumActions];
+				int32 BestAction = 0;
+				for (int32 Action = 1; Action < NumActions; ++Action)
+				{
+					BestAction = BotScores[Action] > BotScores[BestAction] ? Action : BestAction;
+				}
+
+				AUltimateSFCharacter* Target = Targets[Decision] != INDEX_NONE ? Fighters[Targets[Decision]] : nullptr;
+				Bot->ExecuteAction(static_cast<EUltimateSFBotAction>(BestAction), Target);
+				Bot->NextDecisionTime = Now + Bot->ReactionTime * FMath::FRandRange(0.75f, 1.25f);
+			}
+		}
+	}
+
+	{
+		SCOPE_CYCLE_COUNTER(STAT_UltimateSFBotMovement);
+
+		for (const TWeakObjectPtr<AUltimateSFBotController>& Bot : Bots)
+		{
+			Bot->UpdateMovement(DeltaTime);
+		}
+	}
+}
+
+void UUltimateSFBotSubsystem::ScoreActions(int32 NumDeciding)
+{
+	Targets.SetNumUninitialized(NumDeciding);
+	TargetDistances.SetNumUninitialized(NumDeciding);
+	Scores.SetNumUninitialized(NumDeciding * NumActions);
+
+	//Pass 1: nearest opponent for every deciding bot
+	for (int32 Decision = 0; Decision < NumDeciding; ++Decision)
+	{
+		const AUltimateSFCharacter* Self = Bots[DecidingBots[Decision]]->GetFighter();
+		const FVector SelfLocation = Self->GetActorLocation();
+
+		int32 BestTarget = INDEX_NONE;
+		float BestDistSq = MAX_flt;
+		for (int32 FighterIndex = 0; FighterIndex < Fighters.Num(); ++FighterIndex)
+		{
+			const float DistSq = FVector::DistSquared2D(SelfLocation, FighterLocations[FighterIndex]);
+			const bool bCloser = Fighters[FighterIndex] != Self && DistSq < BestDistSq;
+			BestTarget = bCloser ? FighterIndex : BestTarget;
+			BestDistSq = bCloser ? DistSq : BestDistSq;
+		}
+
+		Targets[Decision] = BestTarget;
+		TargetDistances[Decision] = BestTarget != INDEX_NONE ? FMath::Sqrt(BestDistSq) : MAX_flt;
+	}
+
+	//Pass 2: utility of every action
+	for (int32 Decision = 0; Decision < NumDeciding; ++Decision)
+	{
+		const AUltimateSFBotController* Bot = Bots[DecidingBots[Decision]].Get();
+		const AUltimateSFCharacter* Self = Bot->GetFighter();
+		const AUltimateSFCharacter* Target = Targets[Decision] != INDEX_NONE ? Fighters[Targets[Decision]] : nullptr;
+		float* BotScores = &Scores[Decision * NumActions];
+
+		const float Range = FMath::Max(Bot->PreferredRange, 1.f);
+		const float Distance = TargetDistances[Decision];
+		const float InRange = (Target != nullptr && Distance <= Range * 1.2f) ? 1.f : 0.f;
+		const float TooClose = (Target != nullptr && Distance < Range * 0.5f) ? 1.f : 0.f;
+		const float TargetAttacking = (Target != nullptr && (Target->bIsPunching || Target->bIsKicking)) ? 1.f : 0.f;
+		const float DodgeBonus = Self->bHasDodged ? 1.f : 0.f;
+		const float Busy = (Self->bIsPunching || Self->bIsKicking || Self->bIsDodging || Self->bIsRagdollMode) ? 1.f : 0.f;
+		const float HasTarget = Target != nullptr ? 1.f : 0.f;
+
+		BotScores[(int32)EUltimateSFBotAction::Idle] = 0.05f + Busy;
+		BotScores[(int32)EUltimateSFBotAction::Approach] = HasTarget * Bot->Mobility * FMath::Clamp((Distance - Range) / Range, 0.f, 1.f);
+		BotScores[(int32)EUltimateSFBotAction::Sprint] = HasTarget * Bot->Mobility * FMath::Clamp((Distance - 4.f * Range) / (4.f * Range), 0.f, 1.f) * 1.2f;
+		BotScores[(int32)EUltimateSFBotAction::Retreat] = Bot->Caution * TooClose * 0.5f;
+		BotScores[(int32)EUltimateSFBotAction::Strafe] = HasTarget * Bot->Mobility * 0.2f;
+		BotScores[(int32)EUltimateSFBotAction::Punch] = Bot->Aggression * InRange * (0.8f + 0.7f * DodgeBonus);
+		BotScores[(int32)EUltimateSFBotAction::Kick] = Bot->Aggression * InRange * (0.6f + 0.9f * DodgeBonus);
+		BotScores[(int32)EUltimateSFBotAction::Dodge] = Bot->Caution * InRange * (0.1f + 0.9f * TargetAttacking);
+
+		//A little noise so identical bots do not move in lockstep
+		for (int32 Action = 0; Action < NumActions; ++Action)
+		{
+			BotScores[Action] += FMath::FRand() * 0.2f;
+		}
+	}
+}
+
+int32 UUltimateSFBotSubsystem::SpawnBots(int32 Count)
+{
+	UWorld* World = GetWorld();
+	AGameModeBase* GameMode = World->GetAuthGameMode();
+	if (GameMode == nullptr || GameMode->DefaultPawnClass == nullptr)
+	{
+		return 0;
+	}
+
+	TArray<APlayerStart*> Starts;
+	for (TActorIterator<APlayerStart> It(World); It; ++It)
+	{
+		Starts.Add(*It);
+	}
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+
+	int32 Spawned = 0;
+	for (int32 BotIndex = 0; BotIndex < Count; ++BotIndex)
+	{
+		const FVector Origin = Starts.Num() > 0 ? Starts[BotIndex % Starts.Num()]->GetActorLocation() : FVector::ZeroVector;
+		const FVector Offset = FVector(FMath::FRandRange(-1000.f, 1000.f), FMath::FRandRange(-1000.f, 1000.f), 0.f);
+
+		APawn* Pawn = World->SpawnActor<APawn>(GameMode->DefaultPawnClass, Origin + Offset, FRotator::ZeroRotator, SpawnParams);
+		if (Pawn == nullptr)
+		{
+			continue;
+		}
+
+		AUltimateSFBotController* Bot = World->SpawnActor<AUltimateSFBotController>(SpawnParams);
+		Bot->Possess(Pawn);
+		++Spawned;
+	}
+	return Spawned;
+}
+
+//e.g. "usf.Bots.Spawn 200" on a server started with -nullrhi
+static FAutoConsoleCommandWithWorldAndArgs SpawnBotsCommand(
+	TEXT("usf.Bots.Spawn"),
+	TEXT("Spawns N bot fighters in the current world (server only)."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (World == nullptr || World->GetNetMode() == NM_Client)
+		{
+			return;
+		}
+
+		if (UUltimateSFBotSubsystem* BotSubsystem = World->GetSubsystem<UUltimateSFBotSubsystem>())
+		{
+			const int32 Spawned = BotSubsystem->SpawnBots(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1);
+			UE_LOG(LogUltimateSF, Log, TEXT("usf.Bots.Spawn: spawned %d bots, %d total"), Spawned, BotSubsystem->GetNumBots());
+		}
+	}));
@@ -0,0 +1,51 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UltimateSFBotController.h"
+#include "UltimateSFBotSubsystem.generated.h"
+
+class AUltimateSFCharacter;
+
+/**
+ * Runs every bot's decision making in one pass per tick.
+ * Bot state is gathered into flat arrays, each action gets a utility score per bot, and the best action
+ * is handed back to the controller. No behavior trees, blackboards or per-bot ticks, so a headless (-nullrhi)
+ * server can host hundreds of bots in a single process.
+ */
+UCLASS()
+class UUltimateSFBotSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	void RegisterBot(AUltimateSFBotController* Bot);
+	void UnregisterBot(AUltimateSFBotController* Bot);
+
+	int32 GetNumBots() const { return Bots.Num(); }
+
+	/* Spawns Count bot fighters of the game mode's default pawn class around the player starts, server only */
+	int32 SpawnBots(int32 Count);
+
+private:
+	static constexpr int32 NumActions = static_cast<int32>(EUltimateSFBotAction::MAX);
+
+	void GatherFighters();
+	void ScoreActions(int32 NumDeciding);
+
+	TArray<TWeakObjectPtr<AUltimateSFBotController>> Bots;
+
+	/* Batch buffers, reused every tick */
+	TArray<AUltimateSFCharacter*> Fighters;
+	TArray<FVector> FighterLocations;
+	TArray<int32> DecidingBots;
+	TArray<int32> Targets;
+	TArray<float> TargetDistances;
+	TArray<float> Scores;
+};
@@ -0,0 +1,878 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFBroadcast.h"
+#include "UltimateSF.h"
+#include "UltimateSFCharacter.h"
+#include "UltimateSFFighterGridSubsystem.h"
+#include "Engine/World.h"
+#include "GameFramework/GameStateBase.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Compression.h"
+#include "Containers/Ticker.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+#include "IPAddress.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF Broadcast"), STATGROUP_UltimateSFBroadcast, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Broadcast Tick"), STAT_UltimateSFBroadcastTick, STATGROUP_UltimateSFBroadcast);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Broadcast Connections"), STAT_UltimateSFBroadcastConnections, STATGROUP_UltimateSFBroadcast);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Broadcast Frame Bytes"), STAT_UltimateSFBroadcastFrameBytes, STATGROUP_UltimateSFBroadcast);
+
+static TAutoConsoleVariable<int32> CVarBroadcastPort(
+	TEXT("usf.Broadcast.Port"),
+	0,
+	TEXT("Port the match server streams spectator frames on, 0 disables. -UltimateSFBroadcastPort= overrides it."));
+
+static TAutoConsoleVariable<float> CVarBroadcastDelay(
+	TEXT("usf.Broadcast.Delay"),
+	10.f,
+	TEXT("Seconds spectator frames are held back on the match server, so spectators cannot feed the fight to a player."));
+
+static TAutoConsoleVariable<float> CVarBroadcastRate(
+	TEXT("usf.Broadcast.Rate"),
+	20.f,
+	TEXT("Spectator frames per second."));
+
+//Four byte magic at the start of every uncompressed frame
+static constexpr uint32 FrameMagic = 0x46535355;
+//Larger packets mean a corrupt or hostile stream
+static constexpr uint32 MaxPacketSize = 1 << 20;
+
+static ISocketSubsystem* GetSocketSubsystem()
+{
+	return ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+}
+
+TArray<uint8> UltimateSFBroadcast::EncodeFrame(uint32 FrameIndex, float ServerTime, const TArray<FFighterState>& Fighters)
+{
+	TArray<uint8> Uncompressed;
+	FMemoryWriter Writer(Uncompressed);
+
+	uint32 Magic = FrameMagic;
+	int32 NumFighters = Fighters.Num();
+	Writer << Magic << FrameIndex << ServerTime << NumFighters;
+	for (FFighterState Fighter : Fighters)
+	{
+		Writer << Fighter.Id << Fighter.Position << Fighter.Yaw << Fighter.Move << Fighter.Flags << Fighter.Damage;
+	}
+
+	TArray<uint8> Packet;
+	int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, Uncompressed.Num());
+	Packet.SetNumUninitialized(sizeof(uint32) + CompressedSize);
+	if (!FCompression::CompressMemory(NAME_Zlib, Packet.GetData() + sizeof(uint32), CompressedSize, Uncompressed.GetData(), Uncompressed.Num()))
+	{
+		Packet.Reset();
+		return Packet;
+	}
+	Packet.SetNum(sizeof(uint32) + CompressedSize);
+
+	const uint32 UncompressedSize = Uncompressed.Num();
+	FMemory::Memcpy(Packet.GetData(), &UncompressedSize, sizeof(uint32));
+	return Packet;
+}
+
+bool UltimateSFBroadcast::DecodeFrame(const TArray<uint8>& Packet, uint32& OutFrameIndex, float& OutServerTime, TArray<FFighterState>& OutFighters)
+{
+	OutFighters.Reset();
+
+	uint32 UncompressedSize = 0;
+	if (Packet.Num() <= (int32)sizeof(uint32))
+	{
+		return false;
+	}
+	FMemory::Memcpy(&UncompressedSize, Packet.GetData(), sizeof(uint32));
+	if (UncompressedSize == 0 || UncompressedSize > MaxPacketSize)
+	{
+		return false;
+	}
+
+	TArray<uint8> Uncompressed;
+	Uncompressed.SetNumUninitialized(UncompressedSize);
+	if (!FCompression::UncompressMemory(NAME_Zlib, Uncompressed.GetData(), UncompressedSize, Packet.GetData() + sizeof(uint32), Packet.Num() - sizeof(uint32)))
+	{
+		return false;
+	}
+
+	FMemoryReader Reader(Uncompressed);
+	uint32 Magic = 0;
+	int32 NumFighters = 0;
+	Reader << Magic << OutFrameIndex << OutServerTime << NumFighters;
+	//Every fighter is 20 bytes
+	if (Magic != FrameMagic || NumFighters < 0 || NumFighters > (int32)UncompressedSize / 20)
+	{
+		return false;
+	}
+
+	OutFighters.SetNum(NumFighters);
+	for (FFighterState& Fighter : OutFighters)
+	{
+		Reader << Fighter.Id << Fighter.Position << Fighter.Yaw << Fighter.Move << Fighter.Flags << Fighter.Damage;
+	}
+	return !Reader.IsError();
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Stream Connection***
+/// </summary>
+
+FUltimateSFStreamConnection::FUltimateSFStreamConnection(FSocket* InSocket)
+	: Socket(InSocket)
+{
+	Socket->SetNonBlocking(true);
+	Socket->SetNoDelay(true);
+}
+
+FUltimateSFStreamConnection::~FUltimateSFStreamConnection()
+{
+	Socket->Close();
+	GetSocketSubsystem()->DestroySocket(Socket);
+}
+
+TUniquePtr<FUltimateSFStreamConnection> FUltimateSFStreamConnection::Connect(const FString& Address)
+{
+	FString Host;
+	FString PortString;
+	if (!Address.Split(TEXT(":"), &Host, &PortString, ESearchCase::IgnoreCase, ESearchDir::FromEnd))
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Broadcast: '%s' is not ip:port"), *Address);
+		return nullptr;
+	}
+
+	ISocketSubsystem* SocketSubsystem = GetSocketSubsystem();
+	TSharedRef<FInternetAddr> Addr = SocketSubsystem->CreateInternetAddr();
+	bool bIsValid = false;
+	Addr->SetIp(*Host, bIsValid);
+	Addr->SetPort(FCString::Atoi(*PortString));
+	if (!bIsValid)
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Broadcast: '%s' is not a valid ip"), *Host);
+		return nullptr;
+	}
+
+	FSocket* Socket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("UltimateSF Broadcast Client"), Addr->GetProtocolType());
+	if (!Socket)
+	{
+		return nullptr;
+	}
+	//Non-blocking before the connect, so an unreachable peer never stalls the game thread
+	Socket->SetNonBlocking(true);
+	if (!Socket->Connect(*Addr))
+	{
+		const ESocketErrors Error = SocketSubsystem->GetLastErrorCode();
+		if (Error != SE_EINPROGRESS && Error != SE_EWOULDBLOCK)
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("Broadcast: could not connect to %s"), *Address);
+			SocketSubsystem->DestroySocket(Socket);
+			return nullptr;
+		}
+	}
+
+	TUniquePtr<FUltimateSFStreamConnection> Connection = MakeUnique<FUltimateSFStreamConnection>(Socket);
+	Connection->Address = Address;
+	Connection->bConnecting = true;
+	Connection->ConnectDeadline = FPlatformTime::Seconds() + ConnectTimeout;
+	return Connection;
+}
+
+bool FUltimateSFStreamConnection::UpdateConnect()
+{
+	//Zero timeout: a connect in progress is not writable yet, a finished one is, whether it worked or not
+	if (!Socket->Wait(ESocketWaitConditions::WaitForWrite, FTimespan::Zero()))
+	{
+		if (FPlatformTime::Seconds() < ConnectDeadline)
+		{
+			return true;
+		}
+		UE_LOG(LogUltimateSF, Warning, TEXT("Broadcast: connecting to %s timed out"), *Address);
+		return false;
+	}
+
+	if (Socket->GetConnectionState() != SCS_Connected)
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Broadcast: could not connect to %s"), *Address);
+		return false;
+	}
+	bConnecting = false;
+	UE_LOG(LogUltimateSF, Log, TEXT("Broadcast: connected to %s"), *Address);
+	return true;
+}
+
+bool FUltimateSFStreamConnection::QueuePacket(const TArray<uint8>& Packet)
+{
+	if (Outgoing.Num() + Packet.Num() > MaxPendingBytes)
+	{
+		return false;
+	}
+
+	const uint32 Size = Packet.Num();
+	Outgoing.Append(reinterpret_cast<const uint8*>(&Size), sizeof(uint32));
+	Outgoing.Append(Packet);
+	return true;
+}
+
+bool FUltimateSFStreamConnection::Flush()
+{
+	if (bConnecting && !UpdateConnect())
+	{
+		return false;
+	}
+	//Packets stay queued until the connect completes
+	if (bConnecting || Outgoing.Num() == 0)
+	{
+		return true;
+	}
+
+	int32 Sent = 0;
+	if (!Socket->Send(Outgoing.GetData(), Outgoing.Num(), Sent))
+	{
+		return GetSocketSubsystem()->GetLastErrorCode() == SE_EWOULDBLOCK;
+	}
+	BytesSent += Sent;
+	Outgoing.RemoveAt(0, Sent, false);
+	return true;
+}
+
+bool FUltimateSFStreamConnection::Receive(TArray<TArray<uint8>>& OutPackets)
+{
+	if (bConnecting && !UpdateConnect())
+	{
+		return false;
+	}
+	//Nothing to read until the connect completes
+	if (bConnecting)
+	{
+		return true;
+	}
+
+	uint8 Buffer[16 * 1024];
+	for (;;)
+	{
+		int32 Read = 0;
+		//Non-blocking stream sockets report would block as success with nothing read, and a closed peer as failure
+		if (!Socket->Recv(Buffer, sizeof(Buffer), Read))
+		{
+			return false;
+		}
+		if (Read == 0)
+		{
+			break;
+		}
+		Incoming.Append(Buffer, Read);
+	}
+
+	int32 Offset = 0;
+	while (Incoming.Num() - Offset >= (int32)sizeof(uint32))
+	{
+		uint32 Size = 0;
+		FMemory::Memcpy(&Size, Incoming.GetData() + Offset, sizeof(uint32));
+		if (Size > MaxPacketSize)
+		{
+			return false;
+		}
+		if (Incoming.Num() - Offset - (int32)sizeof(uint32) < (int32)Size)
+		{
+			break;
+		}
+		OutPackets.Emplace(Incoming.GetData() + Offset + sizeof(uint32), Size);
+		Offset += sizeof(uint32) + Size;
+	}
+	Incoming.RemoveAt(0, Offset, false);
+	return true;
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Stream Server***
+/// </summary>
+
+FUltimateSFStreamServer::~FUltimateSFStreamServer()
+{
+	Connections.Reset();
+	if (ListenSocket)
+	{
+		ListenSocket->Close();
+		GetSocketSubsystem()->DestroySocket(ListenSocket);
+	}
+}
+
+bool FUltimateSFStreamServer::Listen(int32 Port)
+{
+	ISocketSubsystem* SocketSubsystem = GetSocketSubsystem();
+	TSharedRef<FInternetAddr> Addr = SocketSubsystem->CreateInternetAddr();
+	Addr->SetAnyAddress();
+	Addr->SetPort(Port);
+
+	ListenSocket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("UltimateSF Broadcast Listen"), Addr->GetProtocolType());
+	if (!ListenSocket)
+	{
+		return false;
+	}
+	ListenSocket->SetReuseAddr(true);
+	if (!ListenSocket->Bind(*Addr) || !ListenSocket->Listen(128))
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Broadcast: could not listen on port %d"), Port);
+		SocketSubsystem->DestroySocket(ListenSocket);
+		ListenSocket = nullptr;
+		return false;
+	}
+	ListenSocket->SetNonBlocking(true);
+	return true;
+}
+
+int32 FUltimateSFStreamServer::GetPort() const
+{
+	return ListenSocket ? ListenSocket->GetPortNo() : 0;
+}
+
+void FUltimateSFStreamServer::Broadcast(const TArray<uint8>& Packet)
+{
+	for (const TUniquePtr<FUltimateSFStreamConnection>& Connection : Connections)
+	{
+		if (!Connection->QueuePacket(Packet))
+		{
+			++NumDropped;
+		}
+	}
+}
+
+void FUltimateSFStreamServer::Tick()
+{
+	if (!ListenSocket)
+	{
+		return;
+	}
+
+	bool bPending = false;
+	while (ListenSocket->HasPendingConnection(bPending) && bPending)
+	{
+		FSocket* Accepted = ListenSocket->Accept(TEXT("UltimateSF Broadcast Peer"));
+		if (!Accepted)
+		{
+			break;
+		}
+
+		if (AllowedPeers.Num() > 0)
+		{
+			TSharedRef<FInternetAddr> PeerAddr = GetSocketSubsystem()->CreateInternetAddr();
+			Accepted->GetPeerAddress(*PeerAddr);
+			const FString PeerIp = PeerAddr->ToString(false);
+			if (!AllowedPeers.Contains(PeerIp))
+			{
+				//Once per peer would let a reconnect loop flood the log, the count is in GetNumRejected
+				if (NumRejected++ == 0)
+				{
+					UE_LOG(LogUltimateSF, Warning, TEXT("Broadcast: refused %s on port %d, only relays may connect here"), *PeerIp, GetPort());
+				}
+				Accepted->Close();
+				GetSocketSubsystem()->DestroySocket(Accepted);
+				continue;
+			}
+		}
+		Connections.Add(MakeUnique<FUltimateSFStreamConnection>(Accepted));
+	}
+
+	for (int32 Index = Connections.Num() - 1; Index >= 0; --Index)
+	{
+		if (!Connections[Index]->Flush())
+		{
+			ClosedBytesSent += Connections[Index]->GetBytesSent();
+			Connections.RemoveAtSwap(Index, 1, false);
+		}
+	}
+}
+
+uint64 FUltimateSFStreamServer::GetBytesSent() const
+{
+	uint64 Bytes = ClosedBytesSent;
+	for (const TUniquePtr<FUltimateSFStreamConnection>& Connection : Connections)
+	{
+		Bytes += Connection->GetBytesSent();
+	}
+	return Bytes;
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Broadcast Subsystem***
+/// </summary>
+
+void UUltimateSFBroadcastSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	//A relay is its own headless process, it never hosts a match
+	if (FParse::Value(FCommandLine::Get(), TEXT("UltimateSFRelay="), UpstreamAddress))
+	{
+		int32 RelayPort = 7801;
+		FParse::Value(FCommandLine::Get(), TEXT("UltimateSFRelayPort="), RelayPort);
+
+		Server = MakeUnique<FUltimateSFStreamServer>();
+		if (!Server->Listen(RelayPort))
+		{
+			Server.Reset();
+			return;
+		}
+		Upstream = FUltimateSFStreamConnection::Connect(UpstreamAddress);
+		UE_LOG(LogUltimateSF, Log, TEXT("Broadcast: relaying %s to spectators on port %d"), *UpstreamAddress, Server->GetPort());
+		return;
+	}
+
+	int32 Port = CVarBroadcastPort.GetValueOnGameThread();
+	FParse::Value(FCommandLine::Get(), TEXT("UltimateSFBroadcastPort="), Port);
+	if (Port > 0 && InWorld.GetNetMode() != NM_Client)
+	{
+		//Spectators go through the relays, the match server only serves the relays it is told about
+		FString RelayList;
+		FParse::Value(FCommandLine::Get(), TEXT("UltimateSFBroadcastRelays="), RelayList, false);
+		TArray<FString> Relays;
+		RelayList.ParseIntoArray(Relays, TEXT(","));
+		if (Relays.Num() == 0)
+		{
+			Relays.Add(TEXT("127.0.0.1"));
+		}
+
+		Server = MakeUnique<FUltimateSFStreamServer>();
+		Server->SetAllowedPeers(Relays);
+		if (!Server->Listen(Port))
+		{
+			Server.Reset();
+			return;
+		}
+		UE_LOG(LogUltimateSF, Log, TEXT("Broadcast: streaming to relays %s on port %d, %.1f s delay"),
+			*FString::Join(Relays, TEXT(", ")), Port, CVarBroadcastDelay.GetValueOnGameThread());
+	}
+}
+
+void UUltimateSFBroadcastSubsystem::Deinitialize()
+{
+	Upstream.Reset();
+	Server.Reset();
+	DelayedFrames.Reset();
+	Super::Deinitialize();
+}
+
+TStatId UUltimateSFBroadcastSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UUltimateSFBroadcastSubsystem, STATGROUP_Tickables);
+}
+
+void UUltimateSFBroadcastSubsystem::Tick(float DeltaTime)
+{
+	if (!Server)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFBroadcastTick);
+	if (UpstreamAddress.IsEmpty())
+	{
+		TickSource(DeltaTime);
+	}
+	else
+	{
+		TickRelay(DeltaTime);
+	}
+	Server->Tick();
+	SET_DWORD_STAT(STAT_UltimateSFBroadcastConnections, Server->GetNumConnections());
+}
+
+void UUltimateSFBroadcastSubsystem::TickSource(float DeltaTime)
+{
+	const float Interval = 1.f / FMath::Max(CVarBroadcastRate.GetValueOnGameThread(), 1.f);
+	FrameAccumulator = FMath::Min(FrameAccumulator + DeltaTime, Interval * 4.f);
+	const double Now = GetWorld()->GetTimeSeconds();
+
+	if (FrameAccumulator >= Interval)
+	{
+		FrameAccumulator -= Interval;
+
+		TArray<UltimateSFBroadcast::FFighterState> Fighters;
+		if (const UUltimateSFFighterGridSubsystem* Grid = GetWorld()->GetSubsystem<UUltimateSFFighterGridSubsystem>())
+		{
+			Grid->ForEachFighter([&Fighters](AUltimateSFCharacter* Fighter)
+			{
+				const FVector Location = Fighter->GetActorLocation();
+				UltimateSFBroadcast::FFighterState& State = Fighters.AddDefaulted_GetRef();
+				State.Id = Fighter->GetUniqueID();
+				State.Position = FIntVector(FMath::RoundToInt(Location.X), FMath::RoundToInt(Location.Y), FMath::RoundToInt(Location.Z));
+				State.Yaw = (uint8)(FMath::RoundToInt(FRotator::ClampAxis(Fighter->GetActorRotation().Yaw) * (256.f / 360.f)) & 0xFF);
+				State.Move = (uint8)Fighter->GetActiveMove();
+				State.Flags = (Fighter->bIsCombatMode ? UltimateSFBroadcast::FlagCombatMode : 0)
+					| (Fighter->bIsGuarding ? UltimateSFBroadcast::FlagGuarding : 0)
+					| (Fighter->bIsRagdollMode ? UltimateSFBroadcast::FlagRagdoll : 0)
+					| (Fighter->bIsHitActive ? UltimateSFBroadcast::FlagHitActive : 0);
+				State.Damage = (uint8)FMath::Clamp(FMath::RoundToInt(Fighter->DamageRecieved * 2.f), 0, 255);
+			});
+		}
+
+		const AGameStateBase* GameState = GetWorld()->GetGameState();
+		const float ServerTime = GameState ? GameState->GetServerWorldTimeSeconds() : (float)Now;
+		TArray<uint8> Packet = UltimateSFBroadcast::EncodeFrame(++FrameIndex, ServerTime, Fighters);
+		SET_DWORD_STAT(STAT_UltimateSFBroadcastFrameBytes, Packet.Num());
+		DelayedFrames.Emplace(Now + CVarBroadcastDelay.GetValueOnGameThread(), MoveTemp(Packet));
+	}
+
+	int32 NumReady = 0;
+	while (NumReady < DelayedFrames.Num() && DelayedFrames[NumReady].Key <= Now)
+	{
+		Server->Broadcast(DelayedFrames[NumReady].Value);
+		++NumReady;
+	}
+	DelayedFrames.RemoveAt(0, NumReady, false);
+}
+
+void UUltimateSFBroadcastSubsystem::TickRelay(float DeltaTime)
+{
+	if (!Upstream)
+	{
+		ReconnectTimer -= DeltaTime;
+		if (ReconnectTimer <= 0.f)
+		{
+			//Returns at once, Receive below reports a connect that failed or timed out like a lost stream
+			ReconnectTimer = 2.f;
+			Upstream = FUltimateSFStreamConnection::Connect(UpstreamAddress);
+		}
+		return;
+	}
+
+	//Packets are forwarded as received, the relay never decodes them
+	TArray<TArray<uint8>> Packets;
+	const bool bAlive = Upstream->Receive(Packets);
+	for (const TArray<uint8>& Packet : Packets)
+	{
+		Server->Broadcast(Packet);
+	}
+	if (!bAlive)
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Broadcast: lost %s, reconnecting"), *UpstreamAddress);
+		Upstream.Reset();
+		ReconnectTimer = 2.f;
+	}
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Spectator***
+/// </summary>
+
+/* Prints what a spectator sees, a stand in for the spectator HUD */
+struct FUltimateSFSpectatorClient
+{
+	TUniquePtr<FUltimateSFStreamConnection> Connection;
+	FTSTicker::FDelegateHandle TickerHandle;
+	uint32 NumFrames = 0;
+	double LastLogTime = 0.0;
+
+	~FUltimateSFSpectatorClient()
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+	}
+
+	bool Tick(float DeltaTime)
+	{
+		TArray<TArray<uint8>> Packets;
+		if (!Connection->Receive(Packets))
+		{
+			UE_LOG(LogUltimateSF, Log, TEXT("Spectate: stream closed or never opened after %u frames"), NumFrames);
+			Connection.Reset();
+			return false;
+		}
+
+		for (const TArray<uint8>& Packet : Packets)
+		{
+			uint32 FrameIndex = 0;
+			float ServerTime = 0.f;
+			TArray<UltimateSFBroadcast::FFighterState> Fighters;
+			if (!UltimateSFBroadcast::DecodeFrame(Packet, FrameIndex, ServerTime, Fighters))
+			{
+				continue;
+			}
+			++NumFrames;
+
+			const double Now = FPlatformTime::Seconds();
+			if (Now - LastLogTime > 5.0)
+			{
+				LastLogTime = Now;
+				UE_LOG(LogUltimateSF, Log, TEXT("Spectate: frame %u at %.2f, %d fighters, %d bytes"), FrameIndex, ServerTime, Fighters.Num(), Packet.Num());
+				for (const UltimateSFBroadcast::FFighterState& Fighter : Fighters)
+				{
+					UE_LOG(LogUltimateSF, Log, TEXT("  %u at %s move %d flags 0x%02x damage %.1f"), Fighter.Id, *Fighter.Position.ToString(), Fighter.Move, Fighter.Flags, Fighter.Damage * 0.5f);
+				}
+			}
+		}
+		return true;
+	}
+};
+
+static TUniquePtr<FUltimateSFSpectatorClient> GSpectatorClient;
+
+static FAutoConsoleCommand SpectateCommand(
+	TEXT("usf.Spectate"),
+	TEXT("Connects to a broadcast relay and logs the frames. usf.Spectate ip:port, no argument disconnects"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		GSpectatorClient.Reset();
+		if (Args.Num() == 0)
+		{
+			return;
+		}
+
+		TUniquePtr<FUltimateSFStreamConnection> Connection = FUltimateSFStreamConnection::Connect(Args[0]);
+		if (Connection)
+		{
+			GSpectatorClient = MakeUnique<FUltimateSFSpectatorClient>();
+			GSpectatorClient->Connection = MoveTemp(Connection);
+			GSpectatorClient->TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(GSpectatorClient.Get(), &FUltimateSFSpectatorClient::Tick));
+		}
+	}));
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Loopback Test***
+/// </summary>
+
+/**
+ * Source, relay and spectators in one process over loopback. The source sends synthetic frames to the relay only,
+ * so its bytes sent stay flat however many spectators are attached. Passes when every spectator stayed connected and
+ * received every frame, in order and exactly as the source built it, but the few sent before it was accepted or
+ * still in flight at the end.
+ */
+struct FUltimateSFRelayLoopbackTest
+{
+	static constexpr double FrameRate = 20.0;
+	//Half a second of frames may go out before a connect is accepted, or still be on the way when the test ends
+	static constexpr uint32 MaxFramesInFlight = 10;
+
+	/* Eight fighters circling, same frame size as a real match */
+	static TArray<UltimateSFBroadcast::FFighterState> MakeFighters(uint32 Frame)
+	{
+		TArray<UltimateSFBroadcast::FFighterState> Fighters;
+		Fighters.SetNum(8);
+		for (int32 Index = 0; Index < Fighters.Num(); ++Index)
+		{
+			const float Angle = Frame * 0.05f + Index * (PI / 4.f);
+			Fighters[Index].Id = Index + 1;
+			Fighters[Index].Position = FIntVector(FMath::RoundToInt(FMath::Cos(Angle) * 500.f), FMath::RoundToInt(FMath::Sin(Angle) * 500.f), 90);
+			Fighters[Index].Yaw = (uint8)(Frame + Index * 32);
+			Fighters[Index].Move = (uint8)((Frame / 10 + Index) % (uint32)EUltimateSFMove::MAX);
+		}
+		return Fighters;
+	}
+
+	static bool MatchesSent(uint32 Frame, float ServerTime, const TArray<UltimateSFBroadcast::FFighterState>& Fighters)
+	{
+		const TArray<UltimateSFBroadcast::FFighterState> Sent = MakeFighters(Frame);
+		if (ServerTime != (float)(Frame / FrameRate) || Fighters.Num() != Sent.Num())
+		{
+			return false;
+		}
+		for (int32 Index = 0; Index < Sent.Num(); ++Index)
+		{
+			const UltimateSFBroadcast::FFighterState& A = Fighters[Index];
+			const UltimateSFBroadcast::FFighterState& B = Sent[Index];
+			if (A.Id != B.Id || A.Position != B.Position || A.Yaw != B.Yaw || A.Move != B.Move || A.Flags != B.Flags || A.Damage != B.Damage)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	FUltimateSFStreamServer Source;
+	FUltimateSFStreamServer Relay;
+	TUniquePtr<FUltimateSFStreamConnection> Upstream;
+	TArray<TUniquePtr<FUltimateSFStreamConnection>> Spectators;
+	TArray<uint32> FramesPerSpectator;
+	TArray<uint32> LastFramePerSpectator;
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	double EndTime = 0.0;
+	double FrameAccumulator = 0.0;
+	uint32 FrameIndex = 0;
+	int32 NumSpectatorsLost = 0;
+	int32 NumDecodeErrors = 0;
+	int32 NumWrongFrames = 0;
+
+	bool Start(int32 NumSpectators, float Seconds)
+	{
+		if (!Source.Listen(0) || !Relay.Listen(0))
+		{
+			return false;
+		}
+
+		Upstream = FUltimateSFStreamConnection::Connect(FString::Printf(TEXT("127.0.0.1:%d"), Source.GetPort()));
+		if (!Upstream)
+		{
+			return false;
+		}
+
+		const FString RelayAddress = FString::Printf(TEXT("127.0.0.1:%d"), Relay.GetPort());
+		for (int32 Index = 0; Index < NumSpectators; ++Index)
+		{
+			TUniquePtr<FUltimateSFStreamConnection> Spectator = FUltimateSFStreamConnection::Connect(RelayAddress);
+			if (!Spectator)
+			{
+				UE_LOG(LogUltimateSF, Warning, TEXT("Relay loopback: only %d spectators connected, check the open file limit"), Index);
+				break;
+			}
+			Spectators.Add(MoveTemp(Spectator));
+			//Drain the accept backlog as we go
+			Relay.Tick();
+		}
+		Source.Tick();
+		FramesPerSpectator.SetNumZeroed(Spectators.Num());
+		LastFramePerSpectator.SetNumZeroed(Spectators.Num());
+
+		EndTime = FPlatformTime::Seconds() + Seconds;
+		return true;
+	}
+
+	bool Tick(float DeltaTime)
+	{
+		FrameAccumulator += DeltaTime;
+		while (FrameAccumulator >= 1.0 / FrameRate)
+		{
+			FrameAccumulator -= 1.0 / FrameRate;
+			++FrameIndex;
+			Source.Broadcast(UltimateSFBroadcast::EncodeFrame(FrameIndex, (float)(FrameIndex / FrameRate), MakeFighters(FrameIndex)));
+		}
+		Source.Tick();
+
+		TArray<TArray<uint8>> Packets;
+		Upstream->Receive(Packets);
+		for (const TArray<uint8>& Packet : Packets)
+		{
+			Relay.Broadcast(Packet);
+		}
+		Relay.Tick();
+
+		for (int32 Index = 0; Index < Spectators.Num(); ++Index)
+		{
+			if (!Spectators[Index])
+			{
+				continue;
+			}
+			Packets.Reset();
+			if (!Spectators[Index]->Receive(Packets))
+			{
+				Spectators[Index].Reset();
+				++NumSpectatorsLost;
+				continue;
+			}
+			for (const TArray<uint8>& Packet : Packets)
+			{
+				uint32 DecodedFrame = 0;
+				float ServerTime = 0.f;
+				TArray<UltimateSFBroadcast::FFighterState> Fighters;
+				if (!UltimateSFBroadcast::DecodeFrame(Packet, DecodedFrame, ServerTime, Fighters))
+				{
+					++NumDecodeErrors;
+					continue;
+				}
+				//The relay forwards in order and drops nothing for a spectator that keeps up, so after the first frame
+				//only the next one is right
+				const bool bInOrder = LastFramePerSpectator[Index] == 0 || DecodedFrame == LastFramePerSpectator[Index] + 1;
+				if (!bInOrder || !MatchesSent(DecodedFrame, ServerTime, Fighters))
+				{
+					++NumWrongFrames;
+				}
+				LastFramePerSpectator[Index] = DecodedFrame;
+				++FramesPerSpectator[Index];
+			}
+		}
+
+		if (FPlatformTime::Seconds() < EndTime)
+		{
+			return true;
+		}
+
+		uint32 MinFrames = MAX_uint32;
+		uint32 MaxFrames = 0;
+		uint64 SumFrames = 0;
+		for (uint32 Frames : FramesPerSpectator)
+		{
+			MinFrames = FMath::Min(MinFrames, Frames);
+			MaxFrames = FMath::Max(MaxFrames, Frames);
+			SumFrames += Frames;
+		}
+		MinFrames = FramesPerSpectator.Num() > 0 ? MinFrames : 0;
+		const int32 NumSpectators = FMath::Max(FramesPerSpectator.Num(), 1);
+		UE_LOG(LogUltimateSF, Log, TEXT("Relay loopback: %u frames, %d spectators (%d lost), frames per spectator min %u avg %.1f max %u, %d decode errors, %d wrong or out of order"),
+			FrameIndex, FramesPerSpectator.Num(), NumSpectatorsLost, MinFrames, (double)SumFrames / NumSpectators, MaxFrames, NumDecodeErrors, NumWrongFrames);
+		UE_LOG(LogUltimateSF, Log, TEXT("Relay loopback: source sent %.1f KB to 1 relay, relay sent %.1f KB to spectators, %llu frames dropped for slow spectators"),
+			Source.GetBytesSent() / 1024.0, Relay.GetBytesSent() / 1024.0, Relay.GetNumDropped());
+
+		const bool bPassed = FramesPerSpectator.Num() > 0 && NumSpectatorsLost == 0 && NumDecodeErrors == 0 && NumWrongFrames == 0
+			&& Relay.GetNumDropped() == 0 && MinFrames + MaxFramesInFlight >= FrameIndex;
+		if (bPassed)
+		{
+			UE_LOG(LogUltimateSF, Log, TEXT("Relay loopback: PASSED"));
+		}
+		else
+		{
+			UE_LOG(LogUltimateSF, Error, TEXT("Relay loopback: FAILED, every spectator must receive all but %u frames, intact and in order"), MaxFramesInFlight);
+		}
+
+		//Nothing touches this after the delete, returning false removes the ticker
+		delete this;
+		return false;
+	}
+};
+
+static FAutoConsoleCommand RelayLoopbackTestCommand(
+	TEXT("usf.Relay.LoopbackTest"),
+	TEXT("Runs a source, a relay and N spectators over loopback and reports frame delivery and bytes per hop. usf.Relay.LoopbackTest [Spectators=500] [Seconds=10]. Every spectator costs two sockets, raise ulimit -n for large counts"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const int32 NumSpectators = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 500;
+		const float Seconds = Args.Num() > 1 ? FMath::Max(FCString::Atof(*Args[1]), 1.f) : 10.f;
+
+		FUltimateSFRelayLoopbackTest* Test = new FUltimateSFRelayLoopbackTest();
+		if (!Test->Start(NumSpectators, Seconds))
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("Relay loopback: could not open loopback sockets"));
+			delete Test;
+			return;
+		}
+		UE_LOG(LogUltimateSF, Log, TEXT("Relay loopback: %d spectators for %.0f s"), Test->Spectators.Num(), Seconds);
+		Test->TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(Test, &FUltimateSFRelayLoopbackTest::Tick));
+	}));
@@ -0,0 +1,151 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UltimateSFBroadcast.generated.h"
+
+class FSocket;
+
+/**
+ * Spectator broadcast: the match server streams delayed, compressed snapshots of every fighter over TCP
+ * to a few relay processes, and each relay fans the same packets out to its spectators unchanged.
+ * The match server pays for its relays only, whatever the number of spectators.
+ *
+ *   Match server:  -UltimateSFBroadcastPort=7800 -UltimateSFBroadcastRelays=10.0.0.6,10.0.0.7   (usf.Broadcast.Delay, usf.Broadcast.Rate)
+ *   Relay:         -UltimateSFRelay=10.0.0.5:7800 -UltimateSFRelayPort=7801 -nullrhi
+ *   Spectator:     usf.Spectate 10.0.0.6:7801
+ *
+ * The match server only accepts the relay IPs it is given, loopback when none are, so spectators cannot bypass
+ * the relays and load the match server. Packets are full snapshots, so a spectator that falls behind just loses
+ * frames instead of stalling the relay.
+ */
+namespace UltimateSFBroadcast
+{
+	struct FFighterState
+	{
+		uint32 Id = 0;
+		FIntVector Position = FIntVector::ZeroValue;
+		uint8 Yaw = 0;
+		uint8 Move = 0;
+		uint8 Flags = 0;
+		/* DamageRecieved in half point steps */
+		uint8 Damage = 0;
+	};
+
+	static constexpr uint8 FlagCombatMode = 1 << 0;
+	static constexpr uint8 FlagGuarding = 1 << 1;
+	static constexpr uint8 FlagRagdoll = 1 << 2;
+	static constexpr uint8 FlagHitActive = 1 << 3;
+
+	/* Zlib compressed snapshot, prefixed with its uncompressed size */
+	TArray<uint8> EncodeFrame(uint32 FrameIndex, float ServerTime, const TArray<FFighterState>& Fighters);
+	bool DecodeFrame(const TArray<uint8>& Packet, uint32& OutFrameIndex, float& OutServerTime, TArray<FFighterState>& OutFighters);
+}
+
+/* Non-blocking TCP stream of length prefixed packets */
+class FUltimateSFStreamConnection
+{
+public:
+	explicit FUltimateSFStreamConnection(FSocket* InSocket);
+	~FUltimateSFStreamConnection();
+
+	/**
+	 * "ip:port". Starts a non-blocking connect and returns at once, null only when it could not even start.
+	 * Flush and Receive poll the connect until it completes, and return false once it failed or ConnectTimeout ran out.
+	 */
+	static TUniquePtr<FUltimateSFStreamConnection> Connect(const FString& Address);
+
+	bool IsConnecting() const { return bConnecting; }
+
+	/* Returns false and drops the packet if this peer already has MaxPendingBytes queued */
+	bool QueuePacket(const TArray<uint8>& Packet);
+
+	/* Both return false once the connection is dead */
+	bool Flush();
+	bool Receive(TArray<TArray<uint8>>& OutPackets);
+
+	uint64 GetBytesSent() const { return BytesSent; }
+
+	static constexpr int32 MaxPendingBytes = 256 * 1024;
+	static constexpr double ConnectTimeout = 5.0;
+
+private:
+	/* Returns false once the connect failed or timed out, clears bConnecting once it succeeded */
+	bool UpdateConnect();
+
+	FSocket* Socket = nullptr;
+	/* Connect only: the peer, for the log */
+	FString Address;
+	bool bConnecting = false;
+	double ConnectDeadline = 0.0;
+	TArray<uint8> Outgoing;
+	TArray<uint8> Incoming;
+	uint64 BytesSent = 0;
+};
+
+/* Listen socket plus every accepted connection, each gets a copy of every broadcast packet */
+class FUltimateSFStreamServer
+{
+public:
+	~FUltimateSFStreamServer();
+
+	/* Port 0 picks a free one, see GetPort */
+	bool Listen(int32 Port);
+	int32 GetPort() const;
+
+	/* Peers from any other IP are closed as soon as they are accepted. Empty, the default, accepts everyone */
+	void SetAllowedPeers(const TArray<FString>& InAllowedPeers) { AllowedPeers = InAllowedPeers; }
+
+	void Broadcast(const TArray<uint8>& Packet);
+
+	/* Accepts new peers, flushes and drops dead ones */
+	void Tick();
+
+	int32 GetNumConnections() const { return Connections.Num(); }
+	uint64 GetBytesSent() const;
+	uint64 GetNumDropped() const { return NumDropped; }
+	uint64 GetNumRejected() const { return NumRejected; }
+
+private:
+	FSocket* ListenSocket = nullptr;
+	TArray<FString> AllowedPeers;
+	TArray<TUniquePtr<FUltimateSFStreamConnection>> Connections;
+	uint64 ClosedBytesSent = 0;
+	uint64 NumDropped = 0;
+	uint64 NumRejected = 0;
+};
+
+/**
+ * Runs the broadcast role of this process: the source on a match server, or the relay on a relay process.
+ * Neither is active unless its command line switch is given.
+ */
+UCLASS()
+class UUltimateSFBroadcastSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	void TickSource(float DeltaTime);
+	void TickRelay(float DeltaTime);
+
+	/* Source: relays connect here. Relay: spectators connect here */
+	TUniquePtr<FUltimateSFStreamServer> Server;
+
+	/* Relay only: the match server */
+	TUniquePtr<FUltimateSFStreamConnection> Upstream;
+	FString UpstreamAddress;
+	float ReconnectTimer = 0.f;
+
+	/* Source only: encoded frames waiting out the broadcast delay */
+	TArray<TPair<double, TArray<uint8>>> DelayedFrames;
+	float FrameAccumulator = 0.f;
+	uint32 FrameIndex = 0;
+};
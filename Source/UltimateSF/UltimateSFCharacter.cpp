@@ -1,10 +1,19 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "UltimateSFCharacter.h"
+#include "UltimateSFRagdollSubsystem.h"
+#include "UltimateSFFighterGridSubsystem.h"
+#include "UltimateSFCombatAudioSubsystem.h"
+#include "UltimateSFHitWindowNotifyState.h"
+#include "UltimateSFFighterArchetype.h"
+#include "UltimateSFGameMode.h"
+#include "UltimateSFGameState.h"
 #include "HeadMountedDisplayFunctionLibrary.h"
+#include "Animation/AnimInstance.h"
 #include "Camera/CameraComponent.h"
 #include "Components/CapsuleComponent.h"
 #include "Components/InputComponent.h"
+#include "Components/SkeletalMeshComponent.h"
 #include "Math/UnrealMathUtility.h"
 #include "Math/Vector.h"
 #include "Kismet/KismetMathLibrary.h"
@@ -13,6 +22,68 @@
 #include "GameFramework/Controller.h"
 #include "GameFramework/SpringArmComponent.h"
 #include "Net/UnrealNetwork.h"
+#include "HAL/IConsoleManager.h"
+#include "GameFramework/GameStateBase.h"
+#include "UltimateSFLatencyTracker.h"
+#include "UltimateSFNetProfiler.h"
+#include "UltimateSFMetrics.h"
+#include "UltimateSF.h"
+
+DECLARE_CYCLE_STAT(TEXT("Combat Checksum"), STAT_UltimateSFCombatChecksum, STATGROUP_Game);
+
+static TAutoConsoleVariable<int32> CVarDesyncInterval(
+	TEXT("usf.Desync.Interval"),
+	8,
+	TEXT("Combat frames between the server's checksum batches to clients. 0 disables desync detection."));
+
+DECLARE_CYCLE_STAT(TEXT("HUD Notify"), STAT_UltimateSFHUDNotify, STATGROUP_Game);
+
+static TAutoConsoleVariable<bool> CVarCompactCombatState(
+	TEXT("usf.Net.CompactCombatState"),
+	true,
+	TEXT("Replicate the combat flags and floats as one quantized FUltimateSFNetCombatState instead of one property each. Switchable at runtime."));
+
+static TAutoConsoleVariable<bool> CVarArenaMovement(
+	TEXT("usf.ArenaMovement.Enabled"),
+	true,
+	TEXT("Replicate fighter movement to simulated proxies as arena relative FUltimateSFArenaMovement instead of FRepMovement."));
+
+//Combat flags shared by every peer, in FUltimateSFNetCombatState bit order. W/A/S/D stay on the owning client
+#define USF_NET_COMBAT_FLAGS(Op) \
+	Op(bIsCombatMode) Op(bIsSprinting) Op(bIsPunching) Op(bIsLeftAttack) Op(bIsKicking) Op(bIsUpper) \
+	Op(bIsGuarding) Op(bHasDodged) Op(bIsDodging) Op(bIsRagdollMode) \
+	Op(bIsJabbing) Op(bIsLeftHooking) Op(bIsRightHooking) Op(bIsStraightPunching) Op(bIsUpperCutting) \
+	Op(bIsLowKicking) Op(bIsLeftMiddleKicking) Op(bIsRightMiddleKicking) Op(bIsHighKicking)
+
+//Flags the owning client sets itself when it attacks or dodges, the server's late copy would only undo its prediction
+#define USF_OWNER_PREDICTED_FLAGS(Op) \
+	Op(bIsPunching) Op(bIsKicking) Op(bHasDodged) Op(bIsDodging)
+
+//Flags the HUD shows in the combo panel rather than the state panel
+#define USF_HUD_COMBO_FLAGS(Op) \
+	Op(bHasDodged)
+
+#define USF_COUNT_FLAG(Flag) + 1
+static_assert(0 USF_NET_COMBAT_FLAGS(USF_COUNT_FLAG) == FUltimateSFNetCombatState::NumFlags, "FUltimateSFNetCombatState::NumFlags must match the combat flag list");
+#undef USF_COUNT_FLAG
+
+//Bit index of each flag in FUltimateSFNetCombatState::Flags, so masks follow the flag list
+enum EUltimateSFNetCombatBit : uint32
+{
+#define USF_FLAG_BIT(Flag) NetCombatBit_##Flag,
+	USF_NET_COMBAT_FLAGS(USF_FLAG_BIT)
+#undef USF_FLAG_BIT
+};
+
+#define USF_FLAG_MASK(Flag) | (1u << NetCombatBit_##Flag)
+static constexpr uint32 OwnerPredictedFlagsMask = 0 USF_OWNER_PREDICTED_FLAGS(USF_FLAG_MASK);
+static constexpr uint32 HUDComboFlagsMask = 0 USF_HUD_COMBO_FLAGS(USF_FLAG_MASK);
+#undef USF_FLAG_MASK
+
+static TAutoConsoleVariable<bool> CVarPredictAttacks(
+	TEXT("usf.Attack.Predict"),
+	true,
+	TEXT("Owning clients start attack montages immediately and roll them back if the server rejects the attack."));
 
 //////////////////////////////////////////////////////////////////////////
 // AUltimateSFCharacter
@@ -70,6 +141,62 @@ AUltimateSFCharacter::AUltimateSFCharacter()
 
 }
 
+void AUltimateSFCharacter::BeginPlay()
+{
+	Super::BeginPlay();
+
+	ApplyArchetype();
+
+	if (HasAuthority())
+	{
+		if (const AUltimateSFGameMode* GameMode = GetWorld()->GetAuthGameMode<AUltimateSFGameMode>())
+		{
+			ArenaBounds = GameMode->GetArenaBounds();
+		}
+	}
+
+	//Remember where the mesh sits under the capsule so it can go back there after a ragdoll
+	MeshRelativeTransform = GetMesh()->GetRelativeTransform();
+	MeshCollisionProfile = GetMesh()->GetCollisionProfileName();
+
+	if (!bIsPooled)
+	{
+		if (UUltimateSFFighterGridSubsystem* Grid = GetWorld()->GetSubsystem<UUltimateSFFighterGridSubsystem>())
+		{
+			Grid->AddFighter(this);
+		}
+	}
+}
+
+void AUltimateSFCharacter::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (bIsRagdollMode)
+	{
+		if (UUltimateSFRagdollSubsystem* Ragdolls = GetWorld()->GetSubsystem<UUltimateSFRagdollSubsystem>())
+		{
+			Ragdolls->ReleaseRagdoll(this);
+		}
+	}
+	GetWorld()->GetTimerManager().ClearTimer(HitReactionTimerHandle);
+
+	if (UUltimateSFFighterGridSubsystem* Grid = GetWorld()->GetSubsystem<UUltimateSFFighterGridSubsystem>())
+	{
+		Grid->RemoveFighter(this);
+	}
+	if (UUltimateSFKillcamSubsystem* Killcam = GetWorld()->GetSubsystem<UUltimateSFKillcamSubsystem>())
+	{
+		Killcam->RemoveFighter(this);
+	}
+	FUltimateSFNetProfiler::Get().RemoveActor(this);
+
+	if (Archetype)
+	{
+		Archetype->OnArchetypeChanged.Remove(ArchetypeChangedHandle);
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
 //////////////////////////////////////////////////////////////////////////
 // Input
 
@@ -109,6 +236,8 @@ void AUltimateSFCharacter::SetupPlayerInputComponent(class UInputComponent* Play
 	PlayerInputComponent->BindAction("LeftMouseAttack", IE_Pressed, this, &AUltimateSFCharacter::LeftMouseAttack);
 	PlayerInputComponent->BindAction("RightMouseAttack", IE_Pressed, this, &AUltimateSFCharacter::RightMouseAttack);
 
+	PlayerInputComponent->BindAction("LockOn", IE_Pressed, this, &AUltimateSFCharacter::ToggleLockOn);
+
 	PlayerInputComponent->BindAxis("Move Forward / Backward", this, &AUltimateSFCharacter::MoveForward);
 	PlayerInputComponent->BindAxis("Move Right / Left", this, &AUltimateSFCharacter::MoveRight);
 
@@ -136,15 +265,104 @@ void AUltimateSFCharacter::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>&
 {
 	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
 
-	DOREPLIFETIME(AUltimateSFCharacter, WalkSpeed)
-		DOREPLIFETIME(AUltimateSFCharacter, RunSpeed)
-		DOREPLIFETIME(AUltimateSFCharacter, SprintSpeed)
+	DOREPLIFETIME(AUltimateSFCharacter, ArchetypeId)
 
-		DOREPLIFETIME(AUltimateSFCharacter, bIsCombatMode)
-		DOREPLIFETIME(AUltimateSFCharacter, bIsSprinting)
 		DOREPLIFETIME(AUltimateSFCharacter, bIsToggleRun)
+		DOREPLIFETIME(AUltimateSFCharacter, LockOnTarget)
+
+	//Combat state goes either through the per property path or through NetCombatState, PreReplication picks one
+#define USF_REGISTER_FLAG(Flag) DOREPLIFETIME_CONDITION(AUltimateSFCharacter, Flag, COND_Custom);
+	USF_NET_COMBAT_FLAGS(USF_REGISTER_FLAG)
+#undef USF_REGISTER_FLAG
+#define USF_SKIP_OWNER_FLAG(Flag) RESET_REPLIFETIME_CONDITION(AUltimateSFCharacter, Flag, COND_SkipOwner);
+	USF_OWNER_PREDICTED_FLAGS(USF_SKIP_OWNER_FLAG)
+#undef USF_SKIP_OWNER_FLAG
+	DOREPLIFETIME_CONDITION(AUltimateSFCharacter, DamageDealt, COND_Custom);
+	DOREPLIFETIME_CONDITION(AUltimateSFCharacter, DamageRecieved, COND_Custom);
+	//The owner predicts the dodge bonus along with the dodge flags
+	DOREPLIFETIME_CONDITION(AUltimateSFCharacter, DamageMultiplier, COND_SkipOwner);
+	DOREPLIFETIME_CONDITION(AUltimateSFCharacter, DamageReducingValue, COND_Custom);
+	DOREPLIFETIME_CONDITION(AUltimateSFCharacter, NetCombatState, COND_Custom);
+
+	DOREPLIFETIME(AUltimateSFCharacter, ArenaBounds);
+	DOREPLIFETIME_CONDITION(AUltimateSFCharacter, ArenaMovement, COND_SimulatedOnly);
+}
+
+void AUltimateSFCharacter::PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker)
+{
+	Super::PreReplication(ChangedPropertyTracker);
+
+	const bool bCompact = CVarCompactCombatState.GetValueOnGameThread();
+	if (bCompact)
+	{
+		NetCombatState = MakeNetCombatState();
+	}
+#define USF_OVERRIDE_FLAG(Flag) DOREPLIFETIME_ACTIVE_OVERRIDE(AUltimateSFCharacter, Flag, !bCompact);
+	USF_NET_COMBAT_FLAGS(USF_OVERRIDE_FLAG)
+#undef USF_OVERRIDE_FLAG
+	DOREPLIFETIME_ACTIVE_OVERRIDE(AUltimateSFCharacter, DamageDealt, !bCompact);
+	DOREPLIFETIME_ACTIVE_OVERRIDE(AUltimateSFCharacter, DamageRecieved, !bCompact);
+	DOREPLIFETIME_ACTIVE_OVERRIDE(AUltimateSFCharacter, DamageMultiplier, !bCompact);
+	DOREPLIFETIME_ACTIVE_OVERRIDE(AUltimateSFCharacter, DamageReducingValue, !bCompact);
+	DOREPLIFETIME_ACTIVE_OVERRIDE(AUltimateSFCharacter, NetCombatState, bCompact);
+
+	//Super gathered ReplicatedMovement, it is sent in the arena profile instead
+	const bool bArenaMovement = IsReplicatingMovement() && CVarArenaMovement.GetValueOnGameThread();
+	if (bArenaMovement)
+	{
+		ArenaMovement = FUltimateSFArenaMovement::Make(ArenaBounds, GetReplicatedMovement());
+		if (FUltimateSFArenaMovementStats::IsMeasuring())
+		{
+			FUltimateSFArenaMovementStats::Get().Measure(ArenaBounds, ArenaMovement, GetReplicatedMovement());
+		}
+	}
+	DOREPLIFETIME_ACTIVE_OVERRIDE_PRIVATE_PROPERTY(AActor, ReplicatedMovement, IsReplicatingMovement() && !bArenaMovement);
+	DOREPLIFETIME_ACTIVE_OVERRIDE(AUltimateSFCharacter, ArenaMovement, bArenaMovement);
+
+	if (FUltimateSFNetProfiler::IsEnabled())
+	{
+		FUltimateSFNetProfiler::Get().TrackProperties(this, ChangedPropertyTracker);
+	}
+}
+
+bool AUltimateSFCharacter::CallRemoteFunction(UFunction* Function, void* Parameters, FOutParmRec* OutParms, FFrame* Stack)
+{
+	if (FUltimateSFNetProfiler::IsEnabled())
+	{
+		FUltimateSFNetProfiler::Get().TrackRPC(this, Function, Parameters);
+	}
+
+	FUltimateSFMetrics& Metrics = FUltimateSFMetrics::Get();
+	if (Metrics.IsRunning())
+	{
+		Metrics.AddRPC(Function->GetFName());
+		//Every refused attack answers its owner with exactly one rejection
+		if (Function->GetFName() == GET_FUNCTION_NAME_CHECKED(AUltimateSFCharacter, C_RejectAttack))
+		{
+			Metrics.Add(FUltimateSFMetrics::RejectedRPCs);
+		}
+	}
+
+	return Super::CallRemoteFunction(Function, Parameters, OutParms, Stack);
+}
 
+void AUltimateSFCharacter::ProcessEvent(UFunction* Function, void* Parameters)
+{
+	//Received RPCs run here without passing CallRemoteFunction: server RPCs of a remote owner, client and multicast RPCs on a client
+	if (Function->HasAnyFunctionFlags(FUNC_Net))
+	{
+		FUltimateSFMetrics& Metrics = FUltimateSFMetrics::Get();
+		if (Metrics.IsRunning())
+		{
+			const bool bReceived = Function->HasAnyFunctionFlags(FUNC_NetServer) ? HasAuthority() && !IsLocallyControlled() : !HasAuthority();
+			if (bReceived && (GetFunctionCallspace(Function, nullptr) & FunctionCallspace::Local))
+			{
+				Metrics.AddRPC(Function->GetFName(), true);
+			}
+		}
+	}
 
+	Super::ProcessEvent(Function, Parameters);
 }
 
 
@@ -269,6 +487,7 @@ void AUltimateSFCharacter::SprintStarted()
 		C_MaxWalkSpeed(DefaultCombatDashSpeed);
 
 		GetWorld()->GetTimerManager().SetTimer(TimerHandle, this, &AUltimateSFCharacter::SprintFalseTimer, 0.5f, false);
+		CombatTimer = EUltimateSFCombatTimer::SprintFalse;
 
 	}
 	else if (bIsCombatMode == false)
@@ -339,6 +558,7 @@ void AUltimateSFCharacter::C_MaxWalkSpeed_Implementation(float Speed)
 void AUltimateSFCharacter::C_SetCombatMode_Implementation(bool CombatModeBool)
 {
 	bIsCombatMode = CombatModeBool;
+	MarkHUDDirty((int32)EUltimateSFHUDChange::State);
 	S_SetCombatMode(CombatModeBool);
 }
 
@@ -350,6 +570,10 @@ void AUltimateSFCharacter::S_SetToggleRun_Implementation(bool RunToggle)
 void AUltimateSFCharacter::S_SetCombatMode_Implementation(bool CombatModeBool)
 {
 	bIsCombatMode = CombatModeBool;
+	if (bIsCombatMode)
+	{
+		NotifyCombatActivity();
+	}
 }
 void AUltimateSFCharacter::S_MaxWalkSpeed_Implementation(float Speed)
 {
@@ -431,293 +655,636 @@ void AUltimateSFCharacter::IsAReleased()
 
 
 
-/// 
-/// LeftMouse Click Or LeftMouse Click + W -> Jab
-/// LeftMouse Click + A Or LeftMouse Click + W + A Or LeftMouse Click + S + A  -> LeftHook
-/// LeftMouse Click + D Or LeftMouse Click + W + D Or LeftMouse Click + S + D  -> RightHook
-/// LeftMouse Click + Mouse Forward -> Straight
-/// LeftMouse Click + S -> UpperCut
-/// 
-
-void AUltimateSFCharacter::LeftMouseAttack()
+UltimateSFCombatRules::FInput AUltimateSFCharacter::GetRulesInput() const
 {
+	UltimateSFCombatRules::FInput Input;
+	Input.bW = bIsW;
+	Input.bA = bIsA;
+	Input.bS = bIsS;
+	Input.bD = bIsD;
+	Input.MouseY = MouseYVal;
+	return Input;
+}
 
-	bIsUpper = false;
+UltimateSFCombatRules::FFighter AUltimateSFCharacter::GetRulesFighter() const
+{
+	UltimateSFCombatRules::FFighter Fighter;
+	Fighter.bCombatMode = bIsCombatMode;
+	Fighter.bPunching = bIsPunching;
+	Fighter.bKicking = bIsKicking;
+	Fighter.bDodging = bIsDodging;
+	return Fighter;
+}
 
-	if (((bIsA == true && bIsW == true) || (bIsA == true && bIsS == true) || bIsA == true) && (bIsCombatMode == true) && (bIsPunching == false) && (bIsDodging == false))
+UAnimMontage* AUltimateSFCharacter::GetMoveMontage(EUltimateSFMove Move) const
+{
+	switch (Move)
 	{
-		bIsPunching = true;
-		bIsLeftAttack = true;
-		DamageDealt = 8.0;
-		S_LeftMouseAttack(bIsUpper, bIsPunching, bIsLeftAttack, DamageDealt, LeftMouseLeftHook);
+	case EUltimateSFMove::Jab:				return LeftMouseJab;
+	case EUltimateSFMove::LeftHook:			return LeftMouseLeftHook;
+	case EUltimateSFMove::RightHook:		return LeftMouseRightHook;
+	case EUltimateSFMove::Straight:			return LeftMouseStraight;
+	case EUltimateSFMove::UpperCut:			return LeftMouseUpperCut;
+	case EUltimateSFMove::LowKick:			return RightMouseLowKick;
+	case EUltimateSFMove::LeftMiddleKick:	return RightMouseLeftMiddleKick;
+	case EUltimateSFMove::RightMiddleKick:	return RightMouseRightMiddleKick;
+	case EUltimateSFMove::HighKick:			return RightMouseHighKick;
+	default:								return nullptr;
 	}
-	else if (((bIsD == true && bIsW == true) || (bIsD == true && bIsS == true) || bIsD == true) && (bIsCombatMode == true) && (bIsPunching == false) && (bIsDodging == false))
+}
+
+
+double AUltimateSFCharacter::GetSyncedServerTime() const
+{
+	const AGameStateBase* GameState = GetWorld()->GetGameState();
+	return GameState ? GameState->GetServerWorldTimeSeconds() : GetWorld()->GetTimeSeconds();
+}
+
+FUltimateSFInputStamp AUltimateSFCharacter::MakeInputStamp()
+{
+	FUltimateSFInputStamp Stamp;
+	//0 marks a consumed slot, skip it on wrap
+	InputSequence = InputSequence == MAX_uint16 ? 1 : InputSequence + 1;
+	Stamp.Sequence = InputSequence;
+	Stamp.InputTime = GetSyncedServerTime();
+
+	//The end to end hop is measured on the local clock, the synced clock drifts with the ping estimate
+	const int32 Slot = Stamp.Sequence % PendingInputCount;
+	PendingInputSequences[Slot] = Stamp.Sequence;
+	PendingInputTimes[Slot] = FPlatformTime::Seconds();
+	return Stamp;
+}
+
+void AUltimateSFCharacter::StampServerReceived(FUltimateSFInputStamp& Stamp) const
+{
+	Stamp.ServerTime = GetSyncedServerTime();
+	//Only accepted attacks are multicast and consume the frame
+	Stamp.CombatFrame = CombatChecksum.GetFrame() + 1;
+
+	//Bots and the listen server host call the S_ functions locally, there is no hop to measure
+	if (!IsLocallyControlled())
 	{
-		bIsPunching = true;
-		bIsLeftAttack = false;
-		DamageDealt = 8.0f;
-		S_LeftMouseAttack(bIsUpper, bIsPunching, bIsLeftAttack, DamageDealt,LeftMouseRightHook);
+		FUltimateSFLatencyTracker::Get().Record(FUltimateSFLatencyTracker::EHop::ClientToServer, (float)(Stamp.ServerTime - Stamp.InputTime));
 	}
-	else if ((MouseYVal < -0.15) && (bIsCombatMode == true) && (bIsPunching == false) && (bIsDodging == false))
-	{
-		bIsPunching = true;
-		bIsLeftAttack = false;
-		DamageDealt = 10.0f;
-		S_LeftMouseAttack(bIsUpper, bIsPunching, bIsLeftAttack, DamageDealt, LeftMouseStraight);
+}
 
-	}
-	else if ((MouseYVal > 0.05) && (bIsCombatMode == true) && (bIsPunching == false) && (bIsDodging == false))
+void AUltimateSFCharacter::NotifyCombatActivity() const
+{
+	if (AUltimateSFGameMode* GameMode = GetWorld()->GetAuthGameMode<AUltimateSFGameMode>())
 	{
-		bIsPunching = true;
-		bIsLeftAttack = true;
-		DamageDealt = 15.0f;
-		S_LeftMouseAttack(bIsUpper, bIsPunching, bIsLeftAttack, DamageDealt,LeftMouseUpperCut);
+		GameMode->NotifyCombatActivity();
 	}
-	else if ((bIsCombatMode == true) && (bIsPunching == false) && (bIsDodging == false))
+}
+
+void AUltimateSFCharacter::RecordMontageLatency(const FUltimateSFInputStamp& Stamp)
+{
+	if (IsLocallyControlled() && IsPlayerControlled())
 	{
-		bIsPunching = true;
-		bIsLeftAttack = true;
-		DamageDealt = 5.0f;
-		S_LeftMouseAttack_Jab(bIsUpper, bIsPunching, bIsLeftAttack, DamageDealt, LeftMouseJab);
-	
+		const int32 Slot = Stamp.Sequence % PendingInputCount;
+		if (PendingInputSequences[Slot] == Stamp.Sequence)
+		{
+			FUltimateSFLatencyTracker::Get().Record(FUltimateSFLatencyTracker::EHop::InputToMontage, FPlatformTime::Seconds() - PendingInputTimes[Slot]);
+			PendingInputSequences[Slot] = 0;
+		}
 	}
-	if ((bIsDodging == false) && (bHasDodged == false))
+	else if (GetNetMode() == NM_Client)
 	{
-		GetWorld()->GetTimerManager().SetTimer(TimerHandle, [&]()
-			{
-				bIsUpper = false; bIsPunching = false; bIsLeftAttack = false;
-			}, 0.5f, false);
+		FUltimateSFLatencyTracker::Get().Record(FUltimateSFLatencyTracker::EHop::ServerToMontage, (float)(GetSyncedServerTime() - Stamp.ServerTime));
 	}
 }
 
 
+void AUltimateSFCharacter::StartAttackWindow(UAnimMontage* Montage, float PlayRate)
+{
+	//Marked montages end the attack from the recovery notify, the rest fall back to the montage length at this rate
+	const FUltimateSFAttackFrameData FrameData = UUltimateSFHitWindowNotifyState::GetFrameData(Montage, PlayRate);
+	const bool bDodgeOwnsTimer = bIsDodging || bHasDodged;
+	if (FrameData.bFromNotifies)
+	{
+		if (!bDodgeOwnsTimer)
+		{
+			GetWorld()->GetTimerManager().ClearTimer(TimerHandle);
+		}
+		return;
+	}
 
+	const float Window = FrameData.RecoveryEnd > 0.f ? FrameData.RecoveryEnd : UltimateSFCombatRules::PunchWindow;
+	//A dodge owns the timer until its bonus runs out, its callbacks close the attack once this window is over
+	if (bDodgeOwnsTimer)
+	{
+		DodgeAttackWindowEnd = GetWorld()->GetTimeSeconds() + Window;
+		return;
+	}
 
-/** Left Mouse Attack  Server Side Functions */
-
-
-
+	GetWorld()->GetTimerManager().SetTimer(TimerHandle, this, &AUltimateSFCharacter::EndAttackWindow, Window, false);
+	CombatTimer = EUltimateSFCombatTimer::AttackWindow;
+}
 
-void AUltimateSFCharacter::S_LeftMouseAttack_Jab_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim)
+void AUltimateSFCharacter::EndAttackWindow()
 {
-	bIsUpper = Upper;
-
-	bIsPunching = Punching;
-	bIsLeftAttack = LeftAttack;
-	DamageDealt = Dam;
-	M_LeftMouseAttack_Jab(bIsUpper, bIsPunching, bIsLeftAttack, DamageDealt, Anim);
+	bIsUpper = false; bIsPunching = false; bIsKicking = false; bIsLeftAttack = false;
+	bIsHitActive = false;
+	DodgeAttackWindowEnd = 0.0;
 }
 
-void AUltimateSFCharacter::S_LeftMouseAttack_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim)
+void AUltimateSFCharacter::UpdateDodgeAttackWindow(bool bDodgeOver)
 {
-	bIsUpper = Upper;
+	if (DodgeAttackWindowEnd == 0.0)
+	{
+		return;
+	}
 
-	bIsPunching = Punching;
-	bIsLeftAttack = LeftAttack;
-	DamageDealt = Dam;
-	M_LeftMouseAttack(bIsUpper, bIsPunching, bIsLeftAttack, DamageDealt, Anim);
+	const double Remaining = DodgeAttackWindowEnd - GetWorld()->GetTimeSeconds();
+	if (Remaining <= 0.0)
+	{
+		EndAttackWindow();
+	}
+	else if (bDodgeOver)
+	{
+		//The dodge is done with the timer, the attack's window takes it over for what it has left
+		DodgeAttackWindowEnd = 0.0;
+		GetWorld()->GetTimerManager().SetTimer(TimerHandle, this, &AUltimateSFCharacter::EndAttackWindow, (float)Remaining, false);
+		CombatTimer = EUltimateSFCombatTimer::AttackWindow;
+	}
 }
 
+EUltimateSFMove AUltimateSFCharacter::GetActiveMove() const
+{
+	return GetMontageMove(GetCurrentMontage());
+}
 
-/**  Left Mouse Attack Net Multicast functions **/
+EUltimateSFMove AUltimateSFCharacter::GetMontageMove(const UAnimMontage* Montage) const
+{
+	if (Montage == nullptr)
+	{
+		return EUltimateSFMove::None;
+	}
 
+	for (uint8 Move = (uint8)EUltimateSFMove::Jab; Move < (uint8)EUltimateSFMove::MAX; ++Move)
+	{
+		if (GetMoveMontage((EUltimateSFMove)Move) == Montage)
+		{
+			return (EUltimateSFMove)Move;
+		}
+	}
+	return EUltimateSFMove::None;
+}
 
-void AUltimateSFCharacter::M_LeftMouseAttack_Jab_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim)
+void AUltimateSFCharacter::PredictAttack(UAnimMontage* Montage, float PlayRate, FUltimateSFInputStamp& Stamp)
 {
-	bIsUpper = Upper;
-
-	bIsPunching = Punching;
-	bIsLeftAttack = LeftAttack;
-	DamageDealt = Dam;
-	if (Anim)
+	if (!CVarPredictAttacks.GetValueOnGameThread() || HasAuthority() || !IsLocallyControlled() || Montage == nullptr)
 	{
-		PlayAnimMontage(Anim, 1.5f, NAME_None);
+		return;
 	}
-	
+
+	//Only the newest prediction can still be rolled back, an older one has already been replaced by this montage
+	Stamp.bPredicted = true;
+	PredictedSequence = Stamp.Sequence;
+	PredictedMontage = Montage;
+	PredictedInputTime = PendingInputTimes[Stamp.Sequence % PendingInputCount];
+
+	PlayAnimMontage(Montage, PlayRate, NAME_None);
+	RecordMontageLatency(Stamp);
 }
 
-void AUltimateSFCharacter::M_LeftMouseAttack_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim)
+bool AUltimateSFCharacter::ConfirmPredictedAttack(const FUltimateSFInputStamp& Stamp)
 {
-	bIsUpper = Upper;
+	if (!Stamp.bPredicted || !IsLocallyControlled() || HasAuthority())
+	{
+		return false;
+	}
 
-	bIsPunching = Punching;
-	bIsLeftAttack = LeftAttack;
-	DamageDealt = Dam;
-	if (Anim)
+	if (Stamp.Sequence == PredictedSequence)
 	{
-		PlayAnimMontage(Anim, 1.3f, NAME_None);
+		FUltimateSFLatencyTracker::Get().Record(FUltimateSFLatencyTracker::EHop::PredictionConfirm, FPlatformTime::Seconds() - PredictedInputTime);
+		PredictedSequence = 0;
+		PredictedMontage = nullptr;
 	}
+	return true;
 }
 
+bool AUltimateSFCharacter::CanAcceptAttack(UAnimMontage* Anim, bool bKick) const
+{
+	//The same rules that let the client throw the move, against the server's own flags
+	const UltimateSFCombatRules::EMove Move = ToRulesMove(GetMontageMove(Anim));
+	return !bIsRagdollMode && !bIsPooled && (bKick ? UltimateSFCombatRules::IsKick(Move) : UltimateSFCombatRules::IsPunch(Move))
+		&& UltimateSFCombatRules::CanStartAttack(Move, GetRulesFighter());
+}
 
+float AUltimateSFCharacter::ClampAttackDamage(UAnimMontage* Anim, float Dam) const
+{
+	//The client only says which move it played, never more than the rules give that move
+	return FMath::Clamp(Dam, 0.f, UltimateSFCombatRules::GetMoveDamage(ToRulesMove(GetMontageMove(Anim))));
+}
 
+void AUltimateSFCharacter::C_RejectAttack_Implementation(uint16 Sequence)
+{
+	if (Sequence != PredictedSequence || PredictedSequence == 0)
+	{
+		return;
+	}
 
+	UE_LOG(LogUltimateSF, Verbose, TEXT("%s: server rejected predicted attack %u"), *GetName(), Sequence);
 
+	if (PredictedMontage && GetCurrentMontage() == PredictedMontage)
+	{
+		StopAnimMontage(PredictedMontage);
+	}
+	//A dodge keeps its timer, it is only the attack that did not happen
+	if (CombatTimer == EUltimateSFCombatTimer::AttackWindow)
+	{
+		GetWorld()->GetTimerManager().ClearTimer(TimerHandle);
+	}
+	EndAttackWindow();
 
+	PredictedSequence = 0;
+	PredictedMontage = nullptr;
+}
 
+void AUltimateSFCharacter::OnHitWindow(EUltimateSFHitWindow Window, bool bBegin)
+{
+	if (Window == EUltimateSFHitWindow::Active)
+	{
+		bIsHitActive = bBegin;
+	}
+	else if (!bBegin)
+	{
+		EndAttackWindow();
+	}
+}
 
 
 /// 
-/// RightMouse Click Or LeftMouse Click + W -> LowKick
-/// RightMouse Click + A Or LeftMouse Click + W + A Or LeftMouse Click + S + A  -> LeftMiddleKick
-/// RightMouse Click + D Or LeftMouse Click + W + D Or LeftMouse Click + S + D  -> RightMiddleKick
-/// RightMouse Click + Mouse Forward -> HighKick
+/// LeftMouse Click Or LeftMouse Click + W -> Jab
+/// LeftMouse Click + A Or LeftMouse Click + W + A Or LeftMouse Click + S + A  -> LeftHook
+/// LeftMouse Click + D Or LeftMouse Click + W + D Or LeftMouse Click + S + D  -> RightHook
+/// LeftMouse Click + Mouse Forward -> Straight
+/// LeftMouse Click + Mouse Back -> UpperCut
+/// Selection and damage live in UltimateSFCombatRules::SelectPunch
 /// 
 
-
-void AUltimateSFCharacter::RightMouseAttack()
+void AUltimateSFCharacter::LeftMouseAttack()
 {
-	bIsUpper = false;
 
-	if (((bIsA == true && bIsW == true) || bIsA == true) && (bIsCombatMode == true) && (bIsKicking == false) && (bIsDodging == false))
-	{
-		bIsKicking = true;
-		bIsLeftAttack = true;
-		DamageDealt = 10.0f;
-		S_RightMouseAttack(bIsUpper, bIsKicking, bIsLeftAttack, DamageDealt, RightMouseLeftMiddleKick);
-	}
-	else if (((bIsD == true && bIsW == true) || bIsD == true) && (bIsCombatMode == true) && (bIsKicking == false) && (bIsDodging == false))
-	{
-		bIsKicking = true;
-		bIsLeftAttack = false;
-		DamageDealt = 10.0f;
-		S_RightMouseAttack(bIsUpper, bIsKicking, bIsLeftAttack, DamageDealt, RightMouseRightMiddleKick);
-	}
-	else if ((MouseYVal < -0.05) && (bIsCombatMode == true) && (bIsKicking == false) && (bIsDodging == false))
-	{
+	bIsUpper = false;
 
-		bIsKicking = true;
-		bIsLeftAttack = false;
-		DamageDealt = 20.0f;
-		S_RightMouseAttack(bIsUpper, bIsKicking, bIsLeftAttack, DamageDealt, RightMouseHighKick);
-	}
-	else if (((bIsCombatMode == true) && (bIsKicking == false)) || (((bIsCombatMode == true) && (bIsKicking == false)) && bIsW == true) && (bIsDodging == false))
+	const UltimateSFCombatRules::FAttack Attack = UltimateSFCombatRules::SelectPunch(GetRulesInput(), GetRulesFighter());
+	if (Attack.Move != UltimateSFCombatRules::EMove::None)
 	{
-		bIsKicking = true;
-		bIsLeftAttack = false;
-		DamageDealt = 5.0f;
-		S_RightMouseAttack_LowKick(bIsUpper, bIsKicking, bIsLeftAttack, DamageDealt, RightMouseLowKick);
-	}
+		UAnimMontage* Montage = GetMoveMontage(ToUltimateSFMove(Attack.Move));
+		FUltimateSFInputStamp Stamp = MakeInputStamp();
+		PredictAttack(Montage, UltimateSFCombatRules::GetPlayRate(Attack.Move), Stamp);
+		if (Attack.Move == UltimateSFCombatRules::EMove::Jab)
+		{
+			S_LeftMouseAttack_Jab(bIsUpper, true, Attack.bLeftAttack, Attack.Damage, Montage, Stamp);
+		}
+		else
+		{
+			S_LeftMouseAttack(bIsUpper, true, Attack.bLeftAttack, Attack.Damage, Montage, Stamp);
+		}
 
-	if (bIsDodging == false && bHasDodged == false)
-	{
-		GetWorld()->GetTimerManager().SetTimer(TimerHandle,
-			[&]()
-			{
-				bIsUpper = false; bIsKicking = false; bIsLeftAttack = false;
-			},
-			1.1f,
-				false);
+		//Set after the RPC: on the server it runs right here and checks the flags from before the attack
+		bIsPunching = true;
+		bIsLeftAttack = Attack.bLeftAttack;
+		DamageDealt = Attack.Damage;
+		StartAttackWindow(Montage, UltimateSFCombatRules::GetPlayRate(Attack.Move));
 	}
 }
 
 
 
-/** Right Mouse Attack Server functions **/
 
-void AUltimateSFCharacter::S_RightMouseAttack_LowKick_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim)
+/** Left Mouse Attack  Server Side Functions */
+
+
+
+
+void AUltimateSFCharacter::S_LeftMouseAttack_Jab_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp)
 {
-	bIsUpper = Upper;
+	StampServerReceived(Stamp);
+	NotifyCombatActivity();
+	if (!CanAcceptAttack(Anim, false))
+	{
+		C_RejectAttack(Stamp.Sequence);
+		return;
+	}
 
-	bIsKicking = Kicking;
-	bIsLeftAttack = LeftAttack;
-	DamageDealt = Dam;
-	M_LeftMouseAttack_Jab(bIsUpper, bIsPunching, bIsLeftAttack, DamageDealt, Anim);
+	//Only the move is taken from the client, the flags are the server's
+	bIsUpper = false;
+
+	bIsPunching = true;
+	bIsLeftAttack = UltimateSFCombatRules::IsLeftAttack(ToRulesMove(GetMontageMove(Anim)));
+	DamageDealt = ClampAttackDamage(Anim, Dam);
+	M_LeftMouseAttack_Jab(bIsUpper, bIsPunching, bIsLeftAttack, DamageDealt, Anim, Stamp);
+
+	//A remote owner's window only closes on its machine, the server closes its own copy like S_DodgingFire does
+	if (!IsLocallyControlled())
+	{
+		StartAttackWindow(Anim, UltimateSFCombatRules::JabPlayRate);
+	}
 }
 
-void AUltimateSFCharacter::S_RightMouseAttack_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim)
+void AUltimateSFCharacter::S_LeftMouseAttack_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp)
 {
-	bIsUpper = Upper;
+	StampServerReceived(Stamp);
+	NotifyCombatActivity();
+	if (!CanAcceptAttack(Anim, false))
+	{
+		C_RejectAttack(Stamp.Sequence);
+		return;
+	}
 
-	bIsKicking = Kicking;
-	bIsLeftAttack = LeftAttack;
-	DamageDealt = Dam;
-	M_LeftMouseAttack(bIsUpper, bIsKicking, bIsLeftAttack, DamageDealt, Anim);
-}
+	//Only the move is taken from the client, the flags are the server's
+	bIsUpper = false;
 
+	bIsPunching = true;
+	bIsLeftAttack = UltimateSFCombatRules::IsLeftAttack(ToRulesMove(GetMontageMove(Anim)));
+	DamageDealt = ClampAttackDamage(Anim, Dam);
+	M_LeftMouseAttack(bIsUpper, bIsPunching, bIsLeftAttack, DamageDealt, Anim, Stamp);
 
+	//A remote owner's window only closes on its machine, the server closes its own copy like S_DodgingFire does
+	if (!IsLocallyControlled())
+	{
+		StartAttackWindow(Anim, UltimateSFCombatRules::AttackPlayRate);
+	}
+}
 
 
-/** Right Mouse Attack Net Multicast functions **/
+/**  Left Mouse Attack Net Multicast functions **/
 
 
-void AUltimateSFCharacter::M_RightMouseAttack_LowKick_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim)
+void AUltimateSFCharacter::M_LeftMouseAttack_Jab_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp)
 {
+	//The owner already plays its predicted montage, this multicast only confirms it
+	if (ConfirmPredictedAttack(Stamp))
+	{
+		DamageDealt = Dam;
+		UpdateCombatChecksum(Stamp.CombatFrame);
+		return;
+	}
+
 	bIsUpper = Upper;
 
-	bIsKicking = Kicking;
+	bIsPunching = Punching;
 	bIsLeftAttack = LeftAttack;
 	DamageDealt = Dam;
+	MarkHUDDirty((int32)EUltimateSFHUDChange::Combo);
 	if (Anim)
 	{
-		PlayAnimMontage(Anim, 1.5f, NAME_None);
+		PlayAnimMontage(Anim, UltimateSFCombatRules::JabPlayRate, NAME_None);
 	}
 
+	RecordMontageLatency(Stamp);
+	UpdateCombatChecksum(Stamp.CombatFrame);
+	
 }
 
-void AUltimateSFCharacter::M_RightMouseAttack_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim)
+void AUltimateSFCharacter::M_LeftMouseAttack_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp)
 {
+	//The owner already plays its predicted montage, this multicast only confirms it
+	if (ConfirmPredictedAttack(Stamp))
+	{
+		DamageDealt = Dam;
+		UpdateCombatChecksum(Stamp.CombatFrame);
+		return;
+	}
+
 	bIsUpper = Upper;
 
-	bIsKicking = Kicking;
+	bIsPunching = Punching;
 	bIsLeftAttack = LeftAttack;
 	DamageDealt = Dam;
+	MarkHUDDirty((int32)EUltimateSFHUDChange::Combo);
 	if (Anim)
 	{
-		PlayAnimMontage(Anim, 1.3f, NAME_None);
+		PlayAnimMontage(Anim, UltimateSFCombatRules::AttackPlayRate, NAME_None);
 	}
+
+	RecordMontageLatency(Stamp);
+	UpdateCombatChecksum(Stamp.CombatFrame);
 }
 
 
 
 
 
-void AUltimateSFCharacter::DodgingFire()
-{
-	if ((bIsCombatMode == true && bIsKicking == false && bIsPunching == false)
-		&& ((bIsD == true) || (bIsD == true) && (bIsW == true) || (bIsD == true) && (bIsS == true) || bIsW == true))
-	{
-		bIsUpper = false;
-		bIsDodging = true;
-		bHasDodged = true;
-		DamageMultiplier = 2.f;
-		S_DodgingFire(bIsUpper, bIsDodging, bHasDodged, DamageMultiplier, DodgingRight);
+
+
+
+
+/// 
+/// RightMouse Click Or LeftMouse Click + W -> LowKick
+/// RightMouse Click + A Or LeftMouse Click + W + A Or LeftMouse Click + S + A  -> LeftMiddleKick
+/// RightMouse Click + D Or LeftMouse Click + W + D Or LeftMouse Click + S + D  -> RightMiddleKick
+/// RightMouse Click + Mouse Forward -> HighKick
+/// Selection and damage live in UltimateSFCombatRules::SelectKick
+/// 
+
+
+void AUltimateSFCharacter::RightMouseAttack()
+{
+	bIsUpper = false;
+
+	const UltimateSFCombatRules::FAttack Attack = UltimateSFCombatRules::SelectKick(GetRulesInput(), GetRulesFighter());
+	if (Attack.Move != UltimateSFCombatRules::EMove::None)
+	{
+		UAnimMontage* Montage = GetMoveMontage(ToUltimateSFMove(Attack.Move));
+		FUltimateSFInputStamp Stamp = MakeInputStamp();
+		PredictAttack(Montage, UltimateSFCombatRules::GetPlayRate(Attack.Move), Stamp);
+		if (Attack.Move == UltimateSFCombatRules::EMove::LowKick)
+		{
+			S_RightMouseAttack_LowKick(bIsUpper, true, Attack.bLeftAttack, Attack.Damage, Montage, Stamp);
+		}
+		else
+		{
+			S_RightMouseAttack(bIsUpper, true, Attack.bLeftAttack, Attack.Damage, Montage, Stamp);
+		}
+
+		//Set after the RPC: on the server it runs right here and checks the flags from before the attack
+		bIsKicking = true;
+		bIsLeftAttack = Attack.bLeftAttack;
+		DamageDealt = Attack.Damage;
+		StartAttackWindow(Montage, UltimateSFCombatRules::GetPlayRate(Attack.Move));
+	}
+}
+
+
+
+/** Right Mouse Attack Server functions **/
+
+void AUltimateSFCharacter::S_RightMouseAttack_LowKick_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp)
+{
+	StampServerReceived(Stamp);
+	NotifyCombatActivity();
+	if (!CanAcceptAttack(Anim, true))
+	{
+		C_RejectAttack(Stamp.Sequence);
+		return;
+	}
+
+	//Only the move is taken from the client, the flags are the server's
+	bIsUpper = false;
+
+	bIsKicking = true;
+	bIsLeftAttack = UltimateSFCombatRules::IsLeftAttack(ToRulesMove(GetMontageMove(Anim)));
+	DamageDealt = ClampAttackDamage(Anim, Dam);
+	M_RightMouseAttack_LowKick(bIsUpper, bIsKicking, bIsLeftAttack, DamageDealt, Anim, Stamp);
+
+	//A remote owner's window only closes on its machine, the server closes its own copy like S_DodgingFire does
+	if (!IsLocallyControlled())
+	{
+		StartAttackWindow(Anim, UltimateSFCombatRules::LowKickPlayRate);
+	}
+}
+
+void AUltimateSFCharacter::S_RightMouseAttack_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp)
+{
+	StampServerReceived(Stamp);
+	NotifyCombatActivity();
+	if (!CanAcceptAttack(Anim, true))
+	{
+		C_RejectAttack(Stamp.Sequence);
+		return;
+	}
+
+	//Only the move is taken from the client, the flags are the server's
+	bIsUpper = false;
+
+	bIsKicking = true;
+	bIsLeftAttack = UltimateSFCombatRules::IsLeftAttack(ToRulesMove(GetMontageMove(Anim)));
+	DamageDealt = ClampAttackDamage(Anim, Dam);
+	M_RightMouseAttack(bIsUpper, bIsKicking, bIsLeftAttack, DamageDealt, Anim, Stamp);
+
+	//A remote owner's window only closes on its machine, the server closes its own copy like S_DodgingFire does
+	if (!IsLocallyControlled())
+	{
+		StartAttackWindow(Anim, UltimateSFCombatRules::AttackPlayRate);
+	}
+}
+
+
+
+
+/** Right Mouse Attack Net Multicast functions **/
+
+
+void AUltimateSFCharacter::M_RightMouseAttack_LowKick_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp)
+{
+	//The owner already plays its predicted montage, this multicast only confirms it
+	if (ConfirmPredictedAttack(Stamp))
+	{
+		DamageDealt = Dam;
+		UpdateCombatChecksum(Stamp.CombatFrame);
+		return;
+	}
+
+	bIsUpper = Upper;
+
+	bIsKicking = Kicking;
+	bIsLeftAttack = LeftAttack;
+	DamageDealt = Dam;
+	MarkHUDDirty((int32)EUltimateSFHUDChange::Combo);
+	if (Anim)
+	{
+		PlayAnimMontage(Anim, UltimateSFCombatRules::LowKickPlayRate, NAME_None);
+	}
+
+	RecordMontageLatency(Stamp);
+	UpdateCombatChecksum(Stamp.CombatFrame);
+
+}
+
+void AUltimateSFCharacter::M_RightMouseAttack_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp)
+{
+	//The owner already plays its predicted montage, this multicast only confirms it
+	if (ConfirmPredictedAttack(Stamp))
+	{
+		DamageDealt = Dam;
+		UpdateCombatChecksum(Stamp.CombatFrame);
+		return;
+	}
+
+	bIsUpper = Upper;
+
+	bIsKicking = Kicking;
+	bIsLeftAttack = LeftAttack;
+	DamageDealt = Dam;
+	MarkHUDDirty((int32)EUltimateSFHUDChange::Combo);
+	if (Anim)
+	{
+		PlayAnimMontage(Anim, UltimateSFCombatRules::AttackPlayRate, NAME_None);
 	}
-	else if (bIsCombatMode == true && bIsKicking == false && bIsPunching == false)
+
+	RecordMontageLatency(Stamp);
+	UpdateCombatChecksum(Stamp.CombatFrame);
+}
+
+
+
+
+
+void AUltimateSFCharacter::DodgingFire()
+{
+	//The rules allow a dodge out of a dodge, the character does not until the first one is over
+	const UltimateSFCombatRules::EDodge Dodge = UltimateSFCombatRules::SelectDodge(GetRulesInput(), GetRulesFighter());
+	if (Dodge != UltimateSFCombatRules::EDodge::None && !bIsDodging)
 	{
+		//Sent before the flags are set: on the server it runs right here and checks the fighter from before the dodge
 		bIsUpper = false;
+		S_DodgingFire(bIsUpper, true, true, UltimateSFCombatRules::DodgeDamageMultiplier, Dodge == UltimateSFCombatRules::EDodge::Right ? DodgingRight : DodgingLeft);
 		bIsDodging = true;
 		bHasDodged = true;
-		DamageMultiplier = 2.f;
-		S_DodgingFire(bIsUpper, bIsDodging, bHasDodged, DamageMultiplier, DodgingLeft);
+		DamageMultiplier = UltimateSFCombatRules::DodgeDamageMultiplier;
+
+		//Turns bIsDodging off as soon as the animation is over 
+		//and then Turns off bHasDodged off and sets DamageMultiplier back to 1
+		//a second after the animation is over for the character's next attack to increase its damage
+		//A refused dodge leaves the timer alone, it may be closing an attack
+		GetWorld()->GetTimerManager().SetTimer(TimerHandle, this, &AUltimateSFCharacter::EndDodge, UltimateSFCombatRules::DodgeTime, false);
+		CombatTimer = EUltimateSFCombatTimer::Dodge;
 	}
+}
 
-	//Turns bIsDodging off as soon as the animation is over 
-	//and then Turns off bHasDodged off and sets DamageMultiplier back to 1
-	//a second after the animation is over for the character's next attack to increase its damage
-
-	GetWorld()->GetTimerManager().SetTimer(TimerHandle,
-		[&]()
-		{
-			bIsDodging = false; GetWorld()->GetTimerManager().SetTimer(TimerHandle,
-				[&]()
-				{
-					bHasDodged = false;  DamageMultiplier = 1.f;
-				},
-				1.f,
-					false);
-		},
-		1.5f,
-			false);
-
+bool AUltimateSFCharacter::CanAcceptDodge(UAnimMontage* Anim) const
+{
+	return !bIsRagdollMode && !bIsPooled && !bIsDodging && Anim && (Anim == DodgingRight || Anim == DodgingLeft)
+		&& UltimateSFCombatRules::SelectDodge(GetRulesInput(), GetRulesFighter()) != UltimateSFCombatRules::EDodge::None;
+}
 
+void AUltimateSFCharacter::EndDodge()
+{
+	bIsDodging = false;
+	GetWorld()->GetTimerManager().SetTimer(TimerHandle, this, &AUltimateSFCharacter::EndDodgeBonus, UltimateSFCombatRules::DodgeBonusTime, false);
+	CombatTimer = EUltimateSFCombatTimer::DodgeBonus;
+	UpdateDodgeAttackWindow(false);
+}
 
+void AUltimateSFCharacter::EndDodgeBonus()
+{
+	bHasDodged = false;  DamageMultiplier = 1.f;
+	MarkHUDDirty((int32)EUltimateSFHUDChange::Combo);
+	UpdateDodgeAttackWindow(true);
 }
 
 
 void AUltimateSFCharacter::S_DodgingFire_Implementation(bool Upper, bool isDodging, bool hasDodged, float DamageMult, UAnimMontage* Anim)
 {
-	M_DodgingFire(Upper, isDodging, hasDodged, DamageMult, Anim);
+	NotifyCombatActivity();
+	//A refused dodge grants no multiplier, the owner's own timers put its predicted flags back
+	if (!CanAcceptDodge(Anim))
+	{
+		return;
+	}
+	++MatchStats.Dodges;
+
+	//The multiplier boosts damage in ReceiveHit, so the server sets it and ends it on its own clock.
+	//A remote owner's timers only run on its machine, bots and the listen host already armed them in DodgingFire
+	if (!IsLocallyControlled())
+	{
+		GetWorld()->GetTimerManager().SetTimer(TimerHandle, this, &AUltimateSFCharacter::EndDodge, UltimateSFCombatRules::DodgeTime, false);
+		CombatTimer = EUltimateSFCombatTimer::Dodge;
+	}
+	M_DodgingFire(Upper, true, true, UltimateSFCombatRules::DodgeDamageMultiplier, Anim);
 }
 
 void AUltimateSFCharacter::M_DodgingFire_Implementation(bool Upper, bool isDodging, bool hasDodged, float DamageMult, UAnimMontage* Anim)
@@ -726,10 +1293,1066 @@ void AUltimateSFCharacter::M_DodgingFire_Implementation(bool Upper, bool isDodgi
 	bIsDodging = isDodging;
 	bHasDodged = hasDodged;
 	DamageMultiplier = DamageMult;
+	MarkHUDDirty((int32)EUltimateSFHUDChange::Combo);
 	if (Anim)
 	{
-		PlayAnimMontage(Anim, 1.0f, NAME_None);
+		PlayAnimMontage(Anim, UltimateSFCombatRules::DodgePlayRate, NAME_None);
+	}
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// 
+/// 
+/// *********************************************************Hit Reactions And Ragdoll*********************************************************
+/// 
+/// 
+/// </summary>
+
+
+void AUltimateSFCharacter::ReceiveHit(AUltimateSFCharacter* Attacker, EUltimateSFMove Move, float Damage, bool bKnockdown)
+{
+	if (!HasAuthority())
+	{
+		return;
+	}
+
+	//Guard divides the damage and never lets the hit knock us down
+	const bool bGuarded = bIsGuarding;
+	const float FinalDamage = UltimateSFCombatRules::ApplyDamage(Damage, Attacker ? Attacker->DamageMultiplier : 1.f, DamageReducingValue);
+	const bool bKnockedDown = !bGuarded && (bKnockdown || FinalDamage >= KnockdownDamage);
+
+	float RelativeYaw = 0.f;
+	if (Attacker)
+	{
+		const FVector ToAttacker = Attacker->GetActorLocation() - GetActorLocation();
+		RelativeYaw = ToAttacker.Rotation().Yaw - GetActorRotation().Yaw;
+	}
+
+	const FUltimateSFHitEvent HitEvent = FUltimateSFHitEvent::Make(Move, RelativeYaw, FinalDamage, bKnockedDown, bGuarded);
+	MatchStats.DamageRecieved += HitEvent.GetDamage();
+	if (Attacker)
+	{
+		Attacker->MatchStats.DamageDealtByMove[(int32)Move] += HitEvent.GetDamage();
+		++Attacker->MatchStats.Hits;
+	}
+	if (UUltimateSFKillcamSubsystem* Killcam = GetWorld()->GetSubsystem<UUltimateSFKillcamSubsystem>())
+	{
+		Killcam->RecordHit(this, HitEvent);
+	}
+	//Round health takes the same quantized damage the clients are sent
+	if (AUltimateSFGameState* GameState = GetWorld()->GetGameState<AUltimateSFGameState>())
+	{
+		GameState->QueueDamage(this, HitEvent.GetDamage());
+	}
+	M_ReceiveHit(HitEvent, CombatChecksum.GetFrame() + 1);
+}
+
+float AUltimateSFCharacter::GetHealth() const
+{
+	const AUltimateSFGameState* GameState = GetWorld() ? GetWorld()->GetGameState<AUltimateSFGameState>() : nullptr;
+	return GameState ? GameState->GetHealth(this) : GetDefault<AUltimateSFGameState>()->MaxHealth;
+}
+
+
+void AUltimateSFCharacter::M_ReceiveHit_Implementation(FUltimateSFHitEvent HitEvent, uint32 CombatFrame)
+{
+	//Every peer applies the same quantized damage
+	DamageRecieved = HitEvent.GetDamage();
+	LastHitEvent = HitEvent;
+	MarkHUDDirty((int32)EUltimateSFHUDChange::Health);
+	LastHitDirection = HitEvent.GetHitDirection();
+	SetHitReactionFlags(HitEvent.GetMove());
+
+	GetWorld()->GetTimerManager().SetTimer(HitReactionTimerHandle, this, &AUltimateSFCharacter::ClearHitReactionFlags, HitReactionTime, false);
+	UpdateCombatChecksum(CombatFrame);
+
+	if (UUltimateSFCombatAudioSubsystem* CombatAudio = GetWorld()->GetSubsystem<UUltimateSFCombatAudioSubsystem>())
+	{
+		CombatAudio->PlayImpact(HitEvent.GetMove(), GetActorLocation(), HitEvent.IsKnockdown() || UUltimateSFCombatAudioSubsystem::GetImpactStrength(HitEvent.GetMove()) == EUltimateSFImpactStrength::Heavy);
+	}
+
+	if (HitEvent.IsKnockdown())
+	{
+		//Push the body away from the attacker, a few m/s whatever the bodies weigh
+		const FRotator ImpulseRotation(0.f, GetActorRotation().Yaw + HitEvent.GetDirectionYaw() + 180.f, 0.f);
+		const float Strength = FMath::Clamp(HitEvent.GetDamage() / FMath::Max(KnockdownDamage, 1.f), 1.f, 1.5f);
+		EnterRagdoll(ImpulseRotation.Vector() * KnockdownSpeed * Strength);
+		return;
+	}
+
+	if (HitEvent.IsGuarded() || bIsRagdollMode)
+	{
+		return;
+	}
+
+	UAnimMontage* Reaction = nullptr;
+	switch (HitEvent.GetHitDirection())
+	{
+	case EUltimateSFHitDirection::Front:	Reaction = HitReactFront;	break;
+	case EUltimateSFHitDirection::Right:	Reaction = HitReactRight;	break;
+	case EUltimateSFHitDirection::Back:		Reaction = HitReactBack;	break;
+	case EUltimateSFHitDirection::Left:		Reaction = HitReactLeft;	break;
+	}
+	if (Reaction)
+	{
+		PlayAnimMontage(Reaction, 1.0f, NAME_None);
+	}
+}
+
+
+void AUltimateSFCharacter::SetHitReactionFlags(EUltimateSFMove Move)
+{
+	bIsJabbing = Move == EUltimateSFMove::Jab;
+	bIsLeftHooking = Move == EUltimateSFMove::LeftHook;
+	bIsRightHooking = Move == EUltimateSFMove::RightHook;
+	bIsStraightPunching = Move == EUltimateSFMove::Straight;
+	bIsUpperCutting = Move == EUltimateSFMove::UpperCut;
+
+	bIsLowKicking = Move == EUltimateSFMove::LowKick;
+	bIsLeftMiddleKicking = Move == EUltimateSFMove::LeftMiddleKick;
+	bIsRightMiddleKicking = Move == EUltimateSFMove::RightMiddleKick;
+	bIsHighKicking = Move == EUltimateSFMove::HighKick;
+}
+
+void AUltimateSFCharacter::ClearHitReactionFlags()
+{
+	SetHitReactionFlags(EUltimateSFMove::None);
+}
+
+
+void AUltimateSFCharacter::EnterRagdoll(const FVector& Velocity)
+{
+	if (bIsRagdollMode)
+	{
+		return;
+	}
+
+	UUltimateSFRagdollSubsystem* Ragdolls = GetWorld()->GetSubsystem<UUltimateSFRagdollSubsystem>();
+	if (Ragdolls == nullptr || !Ragdolls->RequestRagdoll(this))
+	{
+		if (Knockdown)
+		{
+			PlayAnimMontage(Knockdown, 1.0f, NAME_None);
+		}
+		return;
+	}
+
+	bIsRagdollMode = true;
+	bRagdollSimulating = true;
+	RagdollBlendWeight = 0.f;
+
+	StopAnimMontage();
+	GetCharacterMovement()->DisableMovement();
+	GetCapsuleComponent()->SetCollisionEnabled(ECollisionEnabled::QueryOnly);
+
+	GetMesh()->SetCollisionProfileName(TEXT("Ragdoll"));
+	GetMesh()->SetAllBodiesSimulatePhysics(true);
+	GetMesh()->SetAllBodiesPhysicsBlendWeight(1.f);
+	GetMesh()->WakeAllRigidBodies();
+	GetMesh()->AddImpulseToAllBodiesBelow(Velocity, GetMesh()->GetBoneName(0), true, true);
+}
+
+
+void AUltimateSFCharacter::BeginRagdollRecovery()
+{
+	//The anim blueprint blends from this snapshot back to its own pose using RagdollBlendWeight
+	if (UAnimInstance* AnimInstance = GetMesh()->GetAnimInstance())
+	{
+		AnimInstance->SavePoseSnapshot(TEXT("Ragdoll"));
 	}
+	RagdollBlendWeight = 1.f;
+
+	RestoreMeshFromRagdoll();
+}
+
+void AUltimateSFCharacter::SetRagdollBlendWeight(float Weight)
+{
+	RagdollBlendWeight = Weight;
+}
+
+void AUltimateSFCharacter::ExitRagdoll()
+{
+	if (!bIsRagdollMode)
+	{
+		return;
+	}
+
+	//Forced out of a ragdoll before it settled, e.g. when the budget needs the slot
+	if (bRagdollSimulating)
+	{
+		RestoreMeshFromRagdoll();
+	}
+
+	bIsRagdollMode = false;
+	RagdollBlendWeight = 0.f;
+	GetCharacterMovement()->SetMovementMode(MOVE_Walking);
+}
+
+void AUltimateSFCharacter::RestoreMeshFromRagdoll()
+{
+	bRagdollSimulating = false;
+
+	//Stand the capsule up where the pelvis ended
+	const FVector PelvisLocation = GetMesh()->GetBoneLocation(TEXT("pelvis"));
+	const float HalfHeight = GetCapsuleComponent()->GetScaledCapsuleHalfHeight();
+
+	GetMesh()->SetAllBodiesSimulatePhysics(false);
+	GetMesh()->SetAllBodiesPhysicsBlendWeight(0.f);
+	GetMesh()->SetCollisionProfileName(MeshCollisionProfile);
+
+	GetCapsuleComponent()->SetCollisionEnabled(ECollisionEnabled::QueryAndPhysics);
+	SetActorLocation(PelvisLocation + FVector(0.f, 0.f, HalfHeight), false, nullptr, ETeleportType::TeleportPhysics);
+
+	GetMesh()->AttachToComponent(GetCapsuleComponent(), FAttachmentTransformRules::SnapToTargetNotIncludingScale);
+	GetMesh()->SetRelativeTransform(MeshRelativeTransform);
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// 
+/// 
+/// *********************************************************Fighter Archetype*********************************************************
+/// 
+/// 
+/// </summary>
+
+
+void AUltimateSFCharacter::SetArchetypeId(uint8 NewArchetypeId)
+{
+	if (HasAuthority() && NewArchetypeId != ArchetypeId)
+	{
+		ArchetypeId = NewArchetypeId;
+		ApplyArchetype();
+	}
+}
+
+void AUltimateSFCharacter::OnRep_ArchetypeId()
+{
+	ApplyArchetype();
+}
+
+void AUltimateSFCharacter::ApplyArchetype()
+{
+	UUltimateSFFighterArchetype* NewArchetype = UUltimateSFFighterArchetype::FindById(ArchetypeId);
+	if (NewArchetype != Archetype)
+	{
+		if (Archetype)
+		{
+			Archetype->OnArchetypeChanged.Remove(ArchetypeChangedHandle);
+		}
+		Archetype = NewArchetype;
+		if (Archetype)
+		{
+			ArchetypeChangedHandle = Archetype->OnArchetypeChanged.AddUObject(this, &AUltimateSFCharacter::ApplyArchetype);
+		}
+	}
+
+	//No archetypes set up, keep the constructor defaults
+	if (Archetype == nullptr)
+	{
+		return;
+	}
+
+	WalkSpeed = Archetype->WalkSpeed;
+	RunSpeed = Archetype->RunSpeed;
+	SprintSpeed = Archetype->SprintSpeed;
+	DefaultCombatSpeed = Archetype->DefaultCombatSpeed;
+	DefaultCombatDashSpeed = Archetype->DefaultCombatDashSpeed;
+
+	TurnRateGamepad = Archetype->TurnRateGamepad;
+	BaseTurnRate = Archetype->BaseTurnRate;
+	BaseLookUpRate = Archetype->BaseLookUpRate;
+
+	GetCapsuleComponent()->SetCapsuleSize(Archetype->CapsuleRadius, Archetype->CapsuleHalfHeight);
+	GetCharacterMovement()->RotationRate = FRotator(0.0f, Archetype->RotationRateYaw, 0.0f);
+
+	CameraBoom->TargetArmLength = Archetype->TargetArmLength;
+	CameraBoom->bEnableCameraLag = Archetype->bEnableCameraLag;
+	CameraBoom->CameraLagSpeed = Archetype->CameraLagSpeed;
+	CameraBoom->CameraLagMaxDistance = Archetype->CameraLagMaxDistance;
+
+	//Pick up the new speed for whatever the fighter is doing right now
+	if (bIsSprinting)
+	{
+		GetCharacterMovement()->MaxWalkSpeed = bIsCombatMode ? DefaultCombatDashSpeed : SprintSpeed;
+	}
+	else if (bIsCombatMode)
+	{
+		GetCharacterMovement()->MaxWalkSpeed = DefaultCombatSpeed;
+	}
+	else
+	{
+		GetCharacterMovement()->MaxWalkSpeed = bIsToggleRun ? RunSpeed : WalkSpeed;
+	}
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// 
+/// 
+/// *********************************************************Fighter Pooling*********************************************************
+/// 
+/// 
+/// </summary>
+
+
+void AUltimateSFCharacter::ResetCombatState()
+{
+	GetWorldTimerManager().ClearAllTimersForObject(this);
+	TimerHandle.Invalidate();
+	HitReactionTimerHandle.Invalidate();
+	CombatTimer = EUltimateSFCombatTimer::None;
+	DodgeAttackWindowEnd = 0.0;
+	StopAnimMontage();
+
+	//A rejection or confirmation still in flight belongs to the previous life
+	PredictedSequence = 0;
+	PredictedMontage = nullptr;
+
+	if (bIsRagdollMode)
+	{
+		if (UUltimateSFRagdollSubsystem* Ragdolls = GetWorld()->GetSubsystem<UUltimateSFRagdollSubsystem>())
+		{
+			Ragdolls->ReleaseRagdoll(this);
+		}
+		ExitRagdoll();
+	}
+
+	LockOnTarget = nullptr;
+	ApplyLockOnMovement();
+	MarkHUDDirty((int32)(EUltimateSFHUDChange::Health | EUltimateSFHUDChange::Combo | EUltimateSFHUDChange::State));
+
+	bIsSprinting = false;
+	bIsCombatMode = false;
+	bIsPunching = false;
+	bIsHitActive = false;
+	bIsToggleRun = false;
+	bIsLeftAttack = false;
+	bIsKicking = false;
+	bIsUpper = true;
+	bIsW = false;
+	bIsA = false;
+	bIsS = false;
+	bIsD = false;
+	bIsGuarding = false;
+	bHasDodged = false;
+	bIsDodging = false;
+	ClearHitReactionFlags();
+
+	DamageDealt = 0.f;
+	DamageRecieved = 0.f;
+	DamageReducingValue = 1.f;
+	DamageMultiplier = 1.f;
+	MouseXVal = 0.f;
+	MouseYVal = 0.f;
+	LastHitDirection = EUltimateSFHitDirection::Front;
+	LastHitEvent = FUltimateSFHitEvent();
+
+	GetCharacterMovement()->MaxWalkSpeed = WalkSpeed;
+	CombatChecksum = FUltimateSFCombatChecksum();
+}
+
+
+void AUltimateSFCharacter::SetPooled(bool bPooled)
+{
+	bIsPooled = bPooled;
+	ResetCombatState();
+
+	SetActorHiddenInGame(bPooled);
+	SetActorEnableCollision(!bPooled);
+	SetActorTickEnabled(!bPooled);
+	GetCharacterMovement()->SetComponentTickEnabled(!bPooled);
+	GetMesh()->SetComponentTickEnabled(!bPooled);
+
+	if (UUltimateSFFighterGridSubsystem* Grid = GetWorld()->GetSubsystem<UUltimateSFFighterGridSubsystem>())
+	{
+		if (bPooled)
+		{
+			Grid->RemoveFighter(this);
+		}
+		else
+		{
+			Grid->AddFighter(this);
+		}
+	}
+
+	if (bPooled)
+	{
+		GetCharacterMovement()->StopMovementImmediately();
+		GetCharacterMovement()->DisableMovement();
+
+		//Clients drop the pooled fighter's channel traffic until it is reused
+		FlushNetDormancy();
+		SetNetDormancy(DORM_DormantAll);
+	}
+	else
+	{
+		GetCharacterMovement()->SetMovementMode(MOVE_Walking);
+
+		SetNetDormancy(DORM_Awake);
+		ForceNetUpdate();
+	}
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// 
+/// 
+/// *********************************************************Killcam*********************************************************
+/// 
+/// 
+/// </summary>
+
+void AUltimateSFCharacter::RequestKillcam()
+{
+	if (IsLocallyControlled())
+	{
+		S_RequestKillcam();
+	}
+}
+
+void AUltimateSFCharacter::S_RequestKillcam_Implementation()
+{
+	//One blob every couple of seconds per player is plenty for a replay, and keeps the RPC from being spammed
+	const float Now = GetWorld()->GetTimeSeconds();
+	if (Now - LastKillcamRequestTime < 2.f)
+	{
+		return;
+	}
+	LastKillcamRequestTime = Now;
+
+	if (UUltimateSFKillcamSubsystem* Killcam = GetWorld()->GetSubsystem<UUltimateSFKillcamSubsystem>())
+	{
+		//The requester and whoever it fought: the round opponent, or the fighter it is locked on to outside of a match
+		TArray<AUltimateSFCharacter*> Requested = { this };
+		const AUltimateSFGameState* GameState = GetWorld()->GetGameState<AUltimateSFGameState>();
+		const int32 ContenderIndex = GameState ? GameState->GetContenderIndex(this) : INDEX_NONE;
+		Requested.Add(ContenderIndex != INDEX_NONE ? GameState->GetContender(1 - ContenderIndex) : LockOnTarget);
+
+		TArray<AUltimateSFCharacter*> Fighters;
+		TArray<uint8> Blob;
+		int32 UncompressedSize = 0;
+		if (Killcam->BuildBlob(Requested, Fighters, Blob, UncompressedSize))
+		{
+			UE_LOG(LogUltimateSF, Verbose, TEXT("Killcam blob for %s: %d fighters, %d -> %d bytes"), *GetName(), Fighters.Num(), UncompressedSize, Blob.Num());
+			C_ReceiveKillcam(Fighters, Blob, UncompressedSize);
+		}
+	}
+}
+
+void AUltimateSFCharacter::C_ReceiveKillcam_Implementation(const TArray<AUltimateSFCharacter*>& Fighters, const TArray<uint8>& Blob, int32 UncompressedSize)
+{
+	if (!UUltimateSFKillcamSubsystem::DecodeBlob(Blob, UncompressedSize, Fighters.Num(), KillcamSamples))
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Killcam blob could not be decoded"));
+		return;
+	}
+
+	KillcamFighters = Fighters;
+	OnKillcamReceived.Broadcast(this);
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// 
+/// 
+/// *********************************************************HUD Notifications*********************************************************
+/// 
+/// 
+/// </summary>
+
+void AUltimateSFCharacter::OnRep_Health()
+{
+	MarkHUDDirty((int32)EUltimateSFHUDChange::Health);
+}
+
+void AUltimateSFCharacter::OnRep_Combo()
+{
+	MarkHUDDirty((int32)EUltimateSFHUDChange::Combo);
+}
+
+void AUltimateSFCharacter::OnRep_CombatState()
+{
+	MarkHUDDirty((int32)EUltimateSFHUDChange::State);
+}
+
+void AUltimateSFCharacter::MarkHUDDirty(int32 ChangeMask)
+{
+	//Several properties of one bunch, or a multicast plus its OnRep_, land in the same frame and flush once
+	PendingHUDChanges |= (uint8)ChangeMask;
+}
+
+void AUltimateSFCharacter::FlushHUDChanges()
+{
+	if (PendingHUDChanges == 0)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFHUDNotify);
+
+	const EUltimateSFHUDChange Changes = (EUltimateSFHUDChange)PendingHUDChanges;
+	PendingHUDChanges = 0;
+
+	if (EnumHasAnyFlags(Changes, EUltimateSFHUDChange::Health))
+	{
+		OnHealthChanged.Broadcast(this);
+	}
+	if (EnumHasAnyFlags(Changes, EUltimateSFHUDChange::Combo))
+	{
+		OnComboChanged.Broadcast(this);
+	}
+	if (EnumHasAnyFlags(Changes, EUltimateSFHUDChange::State))
+	{
+		OnCombatStateChanged.Broadcast(this);
+	}
+	OnHUDChanged.Broadcast(this, (int32)Changes);
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// 
+/// 
+/// *********************************************************Lock-On*********************************************************
+/// 
+/// 
+/// </summary>
+
+void AUltimateSFCharacter::ToggleLockOn()
+{
+	if (LockOnTarget)
+	{
+		SetLockOnTarget(nullptr);
+	}
+	else if (bIsCombatMode)
+	{
+		SetLockOnTarget(FindLockOnTarget());
+	}
+}
+
+AUltimateSFCharacter* AUltimateSFCharacter::FindLockOnTarget() const
+{
+	const UUltimateSFFighterGridSubsystem* Grid = GetWorld()->GetSubsystem<UUltimateSFFighterGridSubsystem>();
+	if (Grid == nullptr)
+	{
+		return nullptr;
+	}
+
+	TArray<AUltimateSFCharacter*> Candidates;
+	Grid->QueryRadius(GetActorLocation(), LockOnRange, Candidates, this);
+
+	//The view is what the player aims with, the body may still be turned towards the last movement input
+	const FVector ViewDirection = (Controller ? Controller->GetControlRotation() : GetActorRotation()).Vector().GetSafeNormal2D();
+	const float MinDot = FMath::Cos(FMath::DegreesToRadians(LockOnConeAngle));
+
+	AUltimateSFCharacter* BestTarget = nullptr;
+	float BestScore = TNumericLimits<float>::Max();
+	for (AUltimateSFCharacter* Candidate : Candidates)
+	{
+		if (!CanBeLockedOn(Candidate))
+		{
+			continue;
+		}
+
+		const FVector ToCandidate = Candidate->GetActorLocation() - GetActorLocation();
+		const float Distance = ToCandidate.Size2D();
+		const float Dot = Distance > KINDA_SMALL_NUMBER ? FVector::DotProduct(ToCandidate.GetSafeNormal2D(), ViewDirection) : 1.f;
+		if (Dot < MinDot)
+		{
+			continue;
+		}
+
+		//Centre of the cone first, distance breaks near ties
+		const float Score = (1.f - Dot) / FMath::Max(1.f - MinDot, KINDA_SMALL_NUMBER) + Distance / LockOnRange * 0.5f;
+		if (Score < BestScore)
+		{
+			BestScore = Score;
+			BestTarget = Candidate;
+		}
+	}
+	return BestTarget;
+}
+
+void AUltimateSFCharacter::SetLockOnTarget(AUltimateSFCharacter* Target)
+{
+	if (Target == LockOnTarget)
+	{
+		return;
+	}
+
+	LockOnTarget = Target;
+	ApplyLockOnMovement();
+
+	if (!HasAuthority())
+	{
+		S_SetLockOnTarget(Target);
+	}
+}
+
+void AUltimateSFCharacter::S_SetLockOnTarget_Implementation(AUltimateSFCharacter* Target)
+{
+	LockOnTarget = (Target != this && CanBeLockedOn(Target)) ? Target : nullptr;
+	ApplyLockOnMovement();
+}
+
+void AUltimateSFCharacter::OnRep_LockOnTarget()
+{
+	ApplyLockOnMovement();
+}
+
+void AUltimateSFCharacter::ApplyLockOnMovement()
+{
+	GetCharacterMovement()->bOrientRotationToMovement = LockOnTarget == nullptr;
+	GetCharacterMovement()->bUseControllerDesiredRotation = LockOnTarget != nullptr;
+}
+
+bool AUltimateSFCharacter::IsLockOnTargetValid() const
+{
+	const float BreakRange = LockOnRange * 1.5f;
+	return bIsCombatMode && CanBeLockedOn(LockOnTarget)
+		&& FVector::DistSquared2D(LockOnTarget->GetActorLocation(), GetActorLocation()) <= BreakRange * BreakRange;
+}
+
+bool AUltimateSFCharacter::CanBeLockedOn(const AUltimateSFCharacter* Target)
+{
+	return IsValid(Target) && !Target->IsPooled() && !Target->IsHidden() && !Target->bIsRagdollMode;
+}
+
+void AUltimateSFCharacter::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+
+	FlushHUDChanges();
+
+	if (LockOnTarget == nullptr || !IsLocallyControlled() || Controller == nullptr)
+	{
+		return;
+	}
+
+	if (!IsLockOnTargetValid())
+	{
+		SetLockOnTarget(nullptr);
+		return;
+	}
+
+	//Only the yaw is driven, the player keeps the camera pitch. The boom follows the control rotation
+	//and the movement component turns the capsule towards it on both the owner and the server
+	const FRotator ControlRotation = Controller->GetControlRotation();
+	const FRotator ToTarget = (LockOnTarget->GetActorLocation() - GetActorLocation()).Rotation();
+	const FRotator Desired(ControlRotation.Pitch, ToTarget.Yaw, ControlRotation.Roll);
+	Controller->SetControlRotation(FMath::RInterpTo(ControlRotation, Desired, DeltaSeconds, LockOnTurnSpeed));
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// 
+/// 
+/// *********************************************************Combat State Replication*********************************************************
+/// 
+/// 
+/// </summary>
+
+FUltimateSFNetCombatState AUltimateSFCharacter::MakeNetCombatState() const
+{
+	FUltimateSFNetCombatState State;
+	uint32 Bit = 0;
+#define USF_PACK_FLAG(Flag) State.Flags |= (uint32)Flag << Bit++;
+	USF_NET_COMBAT_FLAGS(USF_PACK_FLAG)
+#undef USF_PACK_FLAG
+	State.DamageDealt = FUltimateSFNetCombatState::QuantizeDamage(DamageDealt);
+	State.DamageRecieved = FUltimateSFNetCombatState::QuantizeDamage(DamageRecieved);
+	State.DamageMultiplier = FUltimateSFNetCombatState::QuantizeModifier(DamageMultiplier);
+	State.DamageReducingValue = FUltimateSFNetCombatState::QuantizeModifier(DamageReducingValue);
+	return State;
+}
+
+int32 AUltimateSFCharacter::ApplyNetCombatState(const FUltimateSFNetCombatState& InState)
+{
+	const FUltimateSFNetCombatState Local = MakeNetCombatState();
+
+	//The owner keeps its predicted fields, like COND_SkipOwner does on the per property path
+	FUltimateSFNetCombatState State = InState;
+	if (IsLocallyControlled())
+	{
+		State.Flags = (State.Flags & ~OwnerPredictedFlagsMask) | (Local.Flags & OwnerPredictedFlagsMask);
+		State.DamageMultiplier = Local.DamageMultiplier;
+	}
+
+	uint32 Bit = 0;
+#define USF_UNPACK_FLAG(Flag) Flag = (State.Flags >> Bit++ & 1) != 0;
+	USF_NET_COMBAT_FLAGS(USF_UNPACK_FLAG)
+#undef USF_UNPACK_FLAG
+
+	//Floats this peer already holds at the replicated precision keep their exact value, or the combat checksum would drift
+	if (Local.DamageDealt != State.DamageDealt)
+	{
+		DamageDealt = FUltimateSFNetCombatState::DequantizeDamage(State.DamageDealt);
+	}
+	if (Local.DamageRecieved != State.DamageRecieved)
+	{
+		DamageRecieved = FUltimateSFNetCombatState::DequantizeDamage(State.DamageRecieved);
+	}
+	if (Local.DamageMultiplier != State.DamageMultiplier)
+	{
+		DamageMultiplier = FUltimateSFNetCombatState::DequantizeModifier(State.DamageMultiplier);
+	}
+	if (Local.DamageReducingValue != State.DamageReducingValue)
+	{
+		DamageReducingValue = FUltimateSFNetCombatState::DequantizeModifier(State.DamageReducingValue);
+	}
+
+	int32 Changes = 0;
+	if (Local.DamageRecieved != State.DamageRecieved)
+	{
+		Changes |= (int32)EUltimateSFHUDChange::Health;
+	}
+	if (Local.DamageDealt != State.DamageDealt || Local.DamageMultiplier != State.DamageMultiplier || ((Local.Flags ^ State.Flags) & HUDComboFlagsMask))
+	{
+		Changes |= (int32)EUltimateSFHUDChange::Combo;
+	}
+	if ((Local.Flags ^ State.Flags) & ~HUDComboFlagsMask)
+	{
+		Changes |= (int32)EUltimateSFHUDChange::State;
+	}
+	return Changes;
+}
+
+void AUltimateSFCharacter::OnRep_NetCombatState()
+{
+	MarkHUDDirty(ApplyNetCombatState(NetCombatState));
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// 
+/// 
+/// *********************************************************Arena Movement*********************************************************
+/// 
+/// 
+/// </summary>
+
+void AUltimateSFCharacter::OnRep_ArenaMovement()
+{
+	//Fed through the regular path so the movement component's simulated proxy smoothing still applies
+	FRepMovement& Movement = GetReplicatedMovement_Mutable();
+	Movement.Location = ArenaMovement.GetLocation(ArenaBounds);
+	Movement.Rotation = FRotator(0.f, ArenaMovement.GetYaw(), 0.f);
+	Movement.LinearVelocity = ArenaMovement.GetVelocity();
+	Movement.AngularVelocity = FVector::ZeroVector;
+	Movement.bRepPhysics = false;
+	Movement.bSimulatedPhysicSleep = false;
+	OnRep_ReplicatedMovement();
+}
+
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// 
+/// 
+/// *********************************************************Checkpoint*********************************************************
+/// 
+/// 
+/// </summary>
+
+void AUltimateSFCharacter::SaveCheckpoint(FUltimateSFFighterCheckpoint& OutCheckpoint) const
+{
+	const UCharacterMovementComponent* Movement = GetCharacterMovement();
+
+	OutCheckpoint = FUltimateSFFighterCheckpoint();
+	OutCheckpoint.Location = FVector3f(GetActorLocation());
+	OutCheckpoint.Velocity = FVector3f(Movement->Velocity);
+	OutCheckpoint.Yaw = GetActorRotation().Yaw;
+
+	uint32 Bit = 0;
+#define USF_PACK_FLAG(Flag) OutCheckpoint.Flags |= (uint32)Flag << Bit++;
+	USF_NET_COMBAT_FLAGS(USF_PACK_FLAG)
+#undef USF_PACK_FLAG
+
+	OutCheckpoint.DamageDealt = DamageDealt;
+	OutCheckpoint.DamageRecieved = DamageRecieved;
+	OutCheckpoint.DamageMultiplier = DamageMultiplier;
+	OutCheckpoint.DamageReducingValue = DamageReducingValue;
+
+	OutCheckpoint.WalkSpeed = WalkSpeed;
+	OutCheckpoint.RunSpeed = RunSpeed;
+	OutCheckpoint.SprintSpeed = SprintSpeed;
+	OutCheckpoint.CombatSpeed = DefaultCombatSpeed;
+	OutCheckpoint.CombatDashSpeed = DefaultCombatDashSpeed;
+	OutCheckpoint.MaxWalkSpeed = Movement->MaxWalkSpeed;
+
+	const FTimerManager& Timers = GetWorldTimerManager();
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (Timers.IsTimerActive(TimerHandle))
+	{
+		OutCheckpoint.CombatTimer = (uint8)CombatTimer;
+		OutCheckpoint.CombatTimerEnd = FUltimateSFFighterCheckpoint::ToMilliseconds(Now + Timers.GetTimerRemaining(TimerHandle));
+	}
+	if (Timers.IsTimerActive(HitReactionTimerHandle))
+	{
+		OutCheckpoint.HitReactionEnd = FUltimateSFFighterCheckpoint::ToMilliseconds(Now + Timers.GetTimerRemaining(HitReactionTimerHandle));
+	}
+
+	OutCheckpoint.ArchetypeId = ArchetypeId;
+	OutCheckpoint.MovementMode = Movement->MovementMode;
+	OutCheckpoint.ControlFlags = (IsBotControlled() ? FUltimateSFFighterCheckpoint::Control_Bot : 0)
+		| (bIsToggleRun ? FUltimateSFFighterCheckpoint::Control_ToggleRun : 0);
+	OutCheckpoint.HitDirection = (uint8)LastHitDirection;
+}
+
+void AUltimateSFCharacter::RestoreCheckpoint(const FUltimateSFFighterCheckpoint& Checkpoint, double CheckpointTime)
+{
+	//First, the archetype resets the speeds
+	SetArchetypeId(Checkpoint.ArchetypeId);
+	TeleportTo(FVector(Checkpoint.Location), FRotator(0.f, Checkpoint.Yaw, 0.f), false, true);
+
+	UCharacterMovementComponent* Movement = GetCharacterMovement();
+	if (Checkpoint.MovementMode != MOVE_None)
+	{
+		Movement->SetMovementMode((EMovementMode)Checkpoint.MovementMode);
+	}
+	Movement->Velocity = FVector(Checkpoint.Velocity);
+
+	uint32 Bit = 0;
+#define USF_UNPACK_FLAG(Flag) Flag = (Checkpoint.Flags >> Bit++ & 1) != 0;
+	USF_NET_COMBAT_FLAGS(USF_UNPACK_FLAG)
+#undef USF_UNPACK_FLAG
+	bIsToggleRun = (Checkpoint.ControlFlags & FUltimateSFFighterCheckpoint::Control_ToggleRun) != 0;
+
+	DamageDealt = Checkpoint.DamageDealt;
+	DamageRecieved = Checkpoint.DamageRecieved;
+	DamageMultiplier = Checkpoint.DamageMultiplier;
+	DamageReducingValue = Checkpoint.DamageReducingValue;
+
+	WalkSpeed = Checkpoint.WalkSpeed;
+	RunSpeed = Checkpoint.RunSpeed;
+	SprintSpeed = Checkpoint.SprintSpeed;
+	DefaultCombatSpeed = Checkpoint.CombatSpeed;
+	DefaultCombatDashSpeed = Checkpoint.CombatDashSpeed;
+	Movement->MaxWalkSpeed = Checkpoint.MaxWalkSpeed;
+
+	LastHitDirection = (EUltimateSFHitDirection)Checkpoint.HitDirection;
+
+	//Pending timers resume with what they had left, one that was already due fires on the next tick
+	FTimerManager& Timers = GetWorldTimerManager();
+	if (Checkpoint.CombatTimerEnd != 0)
+	{
+		const float Remaining = FMath::Max(Checkpoint.CombatTimerEnd / 1000.0 - CheckpointTime, 0.001);
+		CombatTimer = (EUltimateSFCombatTimer)Checkpoint.CombatTimer;
+		switch (CombatTimer)
+		{
+		case EUltimateSFCombatTimer::SprintFalse:	Timers.SetTimer(TimerHandle, this, &AUltimateSFCharacter::SprintFalseTimer, Remaining, false); break;
+		case EUltimateSFCombatTimer::AttackWindow:	Timers.SetTimer(TimerHandle, this, &AUltimateSFCharacter::EndAttackWindow, Remaining, false); break;
+		case EUltimateSFCombatTimer::Dodge:			Timers.SetTimer(TimerHandle, this, &AUltimateSFCharacter::EndDodge, Remaining, false); break;
+		case EUltimateSFCombatTimer::DodgeBonus:	Timers.SetTimer(TimerHandle, this, &AUltimateSFCharacter::EndDodgeBonus, Remaining, false); break;
+		default: break;
+		}
+	}
+	if (Checkpoint.HitReactionEnd != 0)
+	{
+		Timers.SetTimer(HitReactionTimerHandle, this, &AUltimateSFCharacter::ClearHitReactionFlags, FMath::Max(Checkpoint.HitReactionEnd / 1000.0 - CheckpointTime, 0.001), false);
+	}
+
+	//Only the timer restored above ends the attack and dodge flags on this server: montage notifies are not
+	//checkpointed, and a remote player's own timers went away with its old connection. Whatever it will not end is over
+	const bool bTimerRestored = Checkpoint.CombatTimerEnd != 0;
+	if (!bTimerRestored || CombatTimer != EUltimateSFCombatTimer::AttackWindow)
+	{
+		EndAttackWindow();
+	}
+	if (!bTimerRestored || (CombatTimer != EUltimateSFCombatTimer::Dodge && CombatTimer != EUltimateSFCombatTimer::DodgeBonus))
+	{
+		bIsDodging = false;
+		EndDodgeBonus();
+	}
+
+	//The physics of a fall are not checkpointed, a fighter that was down falls again where it lay
+	if (bIsRagdollMode)
+	{
+		bIsRagdollMode = false;
+		EnterRagdoll(FVector::ZeroVector);
+	}
+
+	MarkHUDDirty((int32)(EUltimateSFHUDChange::Health | EUltimateSFHUDChange::Combo | EUltimateSFHUDChange::State));
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// 
+/// 
+/// *********************************************************Desync Detection*********************************************************
+/// 
+/// 
+/// </summary>
+
+
+FUltimateSFCombatSnapshot AUltimateSFCharacter::MakeCombatSnapshot() const
+{
+	//Guard and the timer driven dodge flags differ between peers for a moment and are left out
+	FUltimateSFCombatSnapshot Snapshot;
+	Snapshot.LastHit = (uint32)LastHitEvent.Move | (uint32)LastHitEvent.Direction << 8
+		| (uint32)LastHitEvent.Damage << 16 | (uint32)LastHitEvent.Flags << 24;
+	Snapshot.AttackFlags = (uint32)bIsPunching | (uint32)bIsKicking << 1;
+	Snapshot.DamageDealt = DamageDealt;
+	Snapshot.DamageRecieved = DamageRecieved;
+	Snapshot.DamageMultiplier = DamageMultiplier;
+	return Snapshot;
+}
+
+
+void AUltimateSFCharacter::UpdateCombatChecksum(uint32 CombatFrame)
+{
+	const int32 Interval = CVarDesyncInterval.GetValueOnGameThread();
+	if (Interval <= 0)
+	{
+		return;
+	}
+
+	uint32 Frame;
+	{
+		SCOPE_CYCLE_COUNTER(STAT_UltimateSFCombatChecksum);
+		Frame = CombatChecksum.Advance(MakeCombatSnapshot(), CombatFrame);
+	}
+
+	if (HasAuthority())
+	{
+		if (Frame % Interval == 0 && GetNetMode() != NM_Standalone)
+		{
+			const uint32 Count = FMath::Min<uint32>(Interval, FUltimateSFCombatChecksum::HistorySize);
+			TArray<uint32> Hashes;
+			Hashes.Reserve(Count);
+			for (uint32 Back = Count; Back > 0; --Back)
+			{
+				Hashes.Add(CombatChecksum.GetHashAt(Frame - Back + 1));
+			}
+			M_CombatChecksums(Frame, Hashes);
+		}
+	}
+	else if (!CombatChecksum.bDesynced)
+	{
+		//The server's batch may have arrived before we applied these frames
+		if (const uint32 BadFrame = CombatChecksum.CheckRemote())
+		{
+			ReportDesync(BadFrame);
+		}
+	}
+}
+
+
+void AUltimateSFCharacter::M_CombatChecksums_Implementation(uint32 LastFrame, const TArray<uint32>& Hashes)
+{
+	if (HasAuthority() || CombatChecksum.bDesynced || (uint32)Hashes.Num() > LastFrame)
+	{
+		return;
+	}
+
+	const uint32 FirstFrame = LastFrame - Hashes.Num() + 1;
+	for (int32 Index = 0; Index < Hashes.Num(); ++Index)
+	{
+		CombatChecksum.AddRemote(FirstFrame + Index, Hashes[Index]);
+	}
+
+	if (const uint32 BadFrame = CombatChecksum.CheckRemote())
+	{
+		ReportDesync(BadFrame);
+	}
+}
+
+
+void AUltimateSFCharacter::ReportDesync(uint32 Frame)
+{
+	const uint32 LocalHash = CombatChecksum.GetHashAt(Frame);
+	UE_LOG(LogUltimateSF, Warning, TEXT("Combat desync on %s at combat frame %u (local frame %u), local hash 0x%08x. Client state: %s"),
+		*GetName(), Frame, CombatChecksum.GetFrame(), LocalHash, *CombatChecksum.GetSnapshotAt(Frame).ToString());
+
+	if (IsLocallyControlled())
+	{
+		S_ReportDesync(Frame, LocalHash);
+	}
+}
+
+
+void AUltimateSFCharacter::S_ReportDesync_Implementation(uint32 Frame, uint32 ClientHash)
+{
+	if (!CombatChecksum.HasFrame(Frame))
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Combat desync on %s at combat frame %u reported by client (hash 0x%08x), frame no longer in server history"),
+			*GetName(), Frame, ClientHash);
+		return;
+	}
+
+	UE_LOG(LogUltimateSF, Warning, TEXT("Combat desync on %s at combat frame %u, server hash 0x%08x, client hash 0x%08x. Server state: %s"),
+		*GetName(), Frame, CombatChecksum.GetHashAt(Frame), ClientHash, *CombatChecksum.GetSnapshotAt(Frame).ToString());
 }
 
 
@@ -10,13 +10,33 @@
 #include "Math/Vector.h"
 #include "Net/UnrealNetwork.h"
 #include "Kismet/KismetMathLibrary.h"
+#include "UltimateSFCombatTypes.h"
+#include "UltimateSFCombatChecksum.h"
+#include "UltimateSFKillcam.h"
+#include "UltimateSFArenaMovement.h"
+#include "UltimateSFMatchResults.h"
+#include "UltimateSFCheckpoint.h"
 #include "UltimateSFCharacter.generated.h"
 
+class AUltimateSFCharacter;
+
+DECLARE_MULTICAST_DELEGATE_OneParam(FUltimateSFCharacterChanged, AUltimateSFCharacter*);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FUltimateSFHUDChangedSignature, AUltimateSFCharacter*, Character, int32, ChangeMask);
+
 UCLASS(config=Game)
 class AUltimateSFCharacter : public ACharacter
 {
 	GENERATED_BODY()
 
+	/* Bots drive the same input handlers as the PlayerInputComponent */
+	friend class AUltimateSFBotController;
+	/* usf.Latency.Validate fires the local player's attacks the same way */
+	friend struct FUltimateSFLatencyValidation;
+	/* A promoted ambient fighter enters combat mode on the server */
+	friend class UUltimateSFCrowdSubsystem;
+	/* Contenders enter combat mode on the server when the fight begins */
+	friend class AUltimateSFGameState;
+
 	/** Camera boom positioning the camera behind the character */
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Camera, meta = (AllowPrivateAccess = "true"))
 	class USpringArmComponent* CameraBoom;
@@ -39,32 +59,44 @@ public:
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Camera)
 		float BaseLookUpRate;
 
-	/*WalkSpeed*/
-	UPROPERTY(replicated, EditAnywhere, BlueprintReadWrite, Category = Default)
+	/*Index into Project Settings > Fighter Archetypes. The only tuning value that replicates*/
+	UPROPERTY(ReplicatedUsing = OnRep_ArchetypeId, EditAnywhere, BlueprintReadOnly, Category = Default)
+		uint8 ArchetypeId = 0;
+
+	/*Shared tuning for this fighter, resolved from ArchetypeId*/
+	UPROPERTY(Transient, VisibleAnywhere, BlueprintReadOnly, Category = Default)
+		class UUltimateSFFighterArchetype* Archetype;
+
+	/*WalkSpeed, copied from the archetype*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Default)
 		float WalkSpeed;
 
-	/*RunSpeed*/
-	UPROPERTY(replicated, EditAnywhere, BlueprintReadWrite, Category = Default)
+	/*RunSpeed, copied from the archetype*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Default)
 		float RunSpeed;
 
-	/*SprintSpeed*/
-	UPROPERTY(replicated, EditAnywhere, BlueprintReadWrite, Category = Default)
+	/*SprintSpeed, copied from the archetype*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Default)
 		float SprintSpeed;
 
-	/*CombatSpeed*/
-	UPROPERTY(replicated, EditAnywhere, BlueprintReadWrite, Category = Default)
+	/*CombatSpeed, copied from the archetype*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Default)
 		float DefaultCombatSpeed;
 
-	/*SprintSpeed*/
-	UPROPERTY(replicated, EditAnywhere, BlueprintReadWrite, Category = Default)
+	/*CombatDashSpeed, copied from the archetype*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Default)
 		float DefaultCombatDashSpeed;
 
+	/* Server only. Switches the fighter to another archetype, clients follow through OnRep_ArchetypeId */
+	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = Default)
+	void SetArchetypeId(uint8 NewArchetypeId);
+
 	/*Is Sprinting Bool*/
-	UPROPERTY(replicated, EditAnywhere, BlueprintReadWrite, Category = Default)
+	UPROPERTY(ReplicatedUsing = OnRep_CombatState, EditAnywhere, BlueprintReadWrite, Category = Default)
 		bool bIsSprinting = false;
 
 	/*Is Combat Bool*/
-	UPROPERTY(replicated, EditAnywhere, BlueprintReadWrite, Category = Default)
+	UPROPERTY(ReplicatedUsing = OnRep_CombatState, EditAnywhere, BlueprintReadWrite, Category = Default)
 		bool bIsCombatMode = false;
 
 	/*Is Punching Bool*/
@@ -130,19 +162,39 @@ public:
 	UPROPERTY(Replicated, EditAnywhere, BlueprintReadWrite, Category = Combat)
 		bool bIsRagdollMode = false;
 
+	/*Side the last hit came from, used by the anim blueprint to pick a directional reaction*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Combat)
+		EUltimateSFHitDirection LastHitDirection = EUltimateSFHitDirection::Front;
+
+	/*1 right after a ragdoll starts recovering, 0 once fully back on animation. Blends from the "Ragdoll" pose snapshot*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Combat)
+		float RagdollBlendWeight = 0.f;
+
+	/*Hits dealing at least this much damage knock the character down*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Combat)
+		float KnockdownDamage = 20.f;
+
+	/*Velocity change in cm/s a knockdown at KnockdownDamage gives the ragdoll, harder hits push up to 1.5 times as fast*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Combat)
+		float KnockdownSpeed = 400.f;
+
+	/*How long a hit reaction flag stays on*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Combat)
+		float HitReactionTime = 0.5f;
+
 	/*Damage dealt value*/
-	UPROPERTY(Replicated, EditAnywhere, BlueprintReadWrite, Category = Combat)
+	UPROPERTY(ReplicatedUsing = OnRep_Combo, EditAnywhere, BlueprintReadWrite, Category = Combat)
 		float DamageDealt;
 
 	/*Damage Recieved value*/
-	UPROPERTY(Replicated, EditAnywhere, BlueprintReadWrite, Category = Combat)
+	UPROPERTY(ReplicatedUsing = OnRep_Health, EditAnywhere, BlueprintReadWrite, Category = Combat)
 		float DamageRecieved;
 
 	//Variable for reducing damage
 	UPROPERTY(Replicated, EditAnywhere, BlueprintReadWrite, Category = Combat)
 	float DamageReducingValue = 1.f;
 
-	UPROPERTY(Replicated, EditAnywhere, BlueprintReadWrite, Category = Combat)
+	UPROPERTY(ReplicatedUsing = OnRep_Combo, EditAnywhere, BlueprintReadWrite, Category = Combat)
 	//Variable for damage increasing after dodging
 	float DamageMultiplier = 1.f;
 
@@ -172,11 +224,11 @@ public:
 		bool bIsD = false;
 
 	/* Checks if the character is guarding*/
-	UPROPERTY(Replicated, EditAnywhere, BlueprintReadWrite, Category = Combat)
+	UPROPERTY(ReplicatedUsing = OnRep_CombatState, EditAnywhere, BlueprintReadWrite, Category = Combat)
 		bool bIsGuarding = false;
 
 	/* Checks if the character is dodging or has dodged*/
-	UPROPERTY(Replicated, EditAnywhere, BlueprintReadWrite, Category = Combat)
+	UPROPERTY(ReplicatedUsing = OnRep_Combo, EditAnywhere, BlueprintReadWrite, Category = Combat)
 		bool bHasDodged = false;
 
 	UPROPERTY(Replicated, EditAnywhere, BlueprintReadWrite, Category = Combat)
@@ -236,6 +288,23 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CombatAnimations)
 		UAnimMontage* DodgingLeft;
 
+	//Hit reaction animations, picked by the side the hit came from
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CombatAnimations)
+		UAnimMontage* HitReactFront;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CombatAnimations)
+		UAnimMontage* HitReactRight;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CombatAnimations)
+		UAnimMontage* HitReactBack;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CombatAnimations)
+		UAnimMontage* HitReactLeft;
+
+	//Played instead of a ragdoll when the ragdoll budget is used up
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CombatAnimations)
+		UAnimMontage* Knockdown;
+
 
 
 
@@ -251,6 +320,151 @@ public:
 	bool TraceComplex = false;
 
 
+	/*  Hit reactions and ragdoll*/
+
+	/* Server only. Applies a landed attack to this character and sends the hit to every client */
+	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = Combat)
+	void ReceiveHit(AUltimateSFCharacter* Attacker, EUltimateSFMove Move, float Damage, bool bKnockdown);
+
+	/* Round health kept by AUltimateSFGameState, full outside of a round */
+	UFUNCTION(BlueprintPure, Category = Combat)
+	float GetHealth() const;
+
+	/* Switches the mesh to physics if the world's ragdoll budget allows it, otherwise plays the knockdown montage.
+	 * Velocity is a mass independent velocity change in cm/s applied to every body */
+	void EnterRagdoll(const FVector& Velocity);
+
+	/* Called by the ragdoll subsystem once the bodies have settled: snapshots the pose and puts the capsule back under the mesh */
+	void BeginRagdollRecovery();
+
+	void SetRagdollBlendWeight(float Weight);
+
+	/* Back on animation, the ragdoll slot has been returned */
+	void ExitRagdoll();
+
+
+	/*  Fighter pooling*/
+
+	/* Puts every combat flag, modifier, timer and speed back to a fresh character's values */
+	UFUNCTION(BlueprintCallable, Category = Combat)
+	void ResetCombatState();
+
+	/* Parks the fighter in the game mode's pool (hidden, no collision, no tick, dormant) or brings it back */
+	void SetPooled(bool bPooled);
+	bool IsPooled() const { return bIsPooled; }
+
+
+	/*  Hit windows*/
+
+	/* Inside the hit-active window of the current attack montage */
+	UPROPERTY(BlueprintReadOnly, Category = Combat)
+		bool bIsHitActive = false;
+
+	/* Called by UUltimateSFHitWindowNotifyState as the montage enters and leaves a window */
+	void OnHitWindow(EUltimateSFHitWindow Window, bool bBegin);
+
+	/* Move of the attack montage currently playing, None otherwise */
+	EUltimateSFMove GetActiveMove() const;
+	EUltimateSFMove GetMontageMove(const UAnimMontage* Montage) const;
+	UAnimMontage* GetMoveMontage(EUltimateSFMove Move) const;
+
+
+	/*  Killcam*/
+
+	/* Asks the server for this fighter's and its opponent's recent history, OnKillcamReceived fires when it arrives */
+	UFUNCTION(BlueprintCallable, Category = Killcam)
+	void RequestKillcam();
+
+	/* Last received killcam: fighters and their samples, oldest first, in the same order */
+	UPROPERTY(Transient, BlueprintReadOnly, Category = Killcam)
+		TArray<AUltimateSFCharacter*> KillcamFighters;
+	TArray<TArray<FUltimateSFKillcamSample>> KillcamSamples;
+
+	FUltimateSFCharacterChanged OnKillcamReceived;
+
+
+	/*  Lock-on*/
+
+	/* Opponent the character and camera boom stay turned towards, null when not locked */
+	UPROPERTY(ReplicatedUsing = OnRep_LockOnTarget, BlueprintReadOnly, Category = LockOn)
+		AUltimateSFCharacter* LockOnTarget = nullptr;
+
+	/* Candidates further than this are ignored, locks break at 1.5 times this distance */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = LockOn)
+		float LockOnRange = 1500.f;
+
+	/* Half angle of the view cone candidates must be in, in degrees */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = LockOn)
+		float LockOnConeAngle = 45.f;
+
+	/* Interp speed of the control rotation towards the target */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = LockOn)
+		float LockOnTurnSpeed = 10.f;
+
+	/* Locks on to the best opponent in view, or releases the current lock */
+	UFUNCTION(BlueprintCallable, Category = LockOn)
+	void ToggleLockOn();
+
+	/* Nearest opponent to the view direction within LockOnRange and LockOnConeAngle, found through the fighter grid */
+	AUltimateSFCharacter* FindLockOnTarget() const;
+
+	void SetLockOnTarget(AUltimateSFCharacter* Target);
+
+
+	/*  HUD notifications*/
+
+	/* Fired at most once per frame each, from the OnRep_ handlers and the local combat paths */
+	FUltimateSFCharacterChanged OnHealthChanged;
+	FUltimateSFCharacterChanged OnComboChanged;
+	FUltimateSFCharacterChanged OnCombatStateChanged;
+
+	/* Same notification for widgets; ChangeMask is a set of EUltimateSFHUDChange */
+	UPROPERTY(BlueprintAssignable, Category = HUD)
+		FUltimateSFHUDChangedSignature OnHUDChanged;
+
+	/* Queues a HUD notification for the end of this frame's tick. Blueprints that write the HUD values directly call this */
+	UFUNCTION(BlueprintCallable, Category = HUD)
+	void MarkHUDDirty(UPARAM(meta = (Bitmask, BitmaskEnum = EUltimateSFHUDChange)) int32 ChangeMask);
+
+
+	/*  Combat state replication*/
+
+	/* Every combat flag and float in one quantized property, replicated instead of the individual ones while usf.Net.CompactCombatState is on */
+	UPROPERTY(ReplicatedUsing = OnRep_NetCombatState)
+		FUltimateSFNetCombatState NetCombatState;
+
+	FUltimateSFNetCombatState MakeNetCombatState() const;
+
+	/* Returns the EUltimateSFHUDChange groups that changed. The owner keeps the attack and dodge state it predicts */
+	int32 ApplyNetCombatState(const FUltimateSFNetCombatState& InState);
+
+
+	/*  Match results*/
+
+	/* Server only, collected from ReceiveHit and the dodge RPC and reset whenever the game mode records a result */
+	FUltimateSFFighterMatchStats MatchStats;
+
+
+	/*  Checkpoint*/
+
+	/* Server only. Everything AUltimateSFGameMode needs to put this fighter back after a server restart, timers as world times */
+	void SaveCheckpoint(FUltimateSFFighterCheckpoint& OutCheckpoint) const;
+
+	/* Server only. CheckpointTime is the world time the checkpoint was written at, pending timers resume with what was left */
+	void RestoreCheckpoint(const FUltimateSFFighterCheckpoint& Checkpoint, double CheckpointTime);
+
+
+	/*  Arena movement*/
+
+	/* Set by the server from the game mode's arena */
+	UPROPERTY(Replicated)
+		FUltimateSFArenaBounds ArenaBounds;
+
+	/* Replaces ReplicatedMovement for simulated proxies while usf.ArenaMovement.Enabled is on */
+	UPROPERTY(ReplicatedUsing = OnRep_ArenaMovement)
+		FUltimateSFArenaMovement ArenaMovement;
+
+
 
 protected:
 
@@ -358,20 +572,145 @@ protected:
 
 
 
+	//Multicast Function for hit reactions
+	UFUNCTION(NetMulticast, Reliable)
+	void M_ReceiveHit(FUltimateSFHitEvent HitEvent, uint32 CombatFrame);
+	void M_ReceiveHit_Implementation(FUltimateSFHitEvent HitEvent, uint32 CombatFrame);
+
+	//Fighter archetype
+	UFUNCTION()
+	void OnRep_ArchetypeId();
+
+	//Killcam
+	UFUNCTION(Server, Reliable)
+	void S_RequestKillcam();
+	void S_RequestKillcam_Implementation();
+
+	UFUNCTION(Client, Reliable)
+	void C_ReceiveKillcam(const TArray<AUltimateSFCharacter*>& Fighters, const TArray<uint8>& Blob, int32 UncompressedSize);
+	void C_ReceiveKillcam_Implementation(const TArray<AUltimateSFCharacter*>& Fighters, const TArray<uint8>& Blob, int32 UncompressedSize);
+
+	//Lock-on
+	UFUNCTION(Server, Reliable)
+	void S_SetLockOnTarget(AUltimateSFCharacter* Target);
+	void S_SetLockOnTarget_Implementation(AUltimateSFCharacter* Target);
+
+	UFUNCTION()
+	void OnRep_LockOnTarget();
+
+	//HUD notifications
+	UFUNCTION()
+	void OnRep_Health();
+
+	UFUNCTION()
+	void OnRep_Combo();
+
+	UFUNCTION()
+	void OnRep_CombatState();
+
+	//Combat state replication
+	UFUNCTION()
+	void OnRep_NetCombatState();
+
+	//Arena movement
+	UFUNCTION()
+	void OnRep_ArenaMovement();
+
+	void FlushHUDChanges();
+
+	/* Locked fighters face the target through the control rotation, which the movement component already sends to the server */
+	void ApplyLockOnMovement();
+	bool IsLockOnTargetValid() const;
+
+	/* Pooling is only known to the server, clients see a pooled fighter as hidden while the grid may still hold it */
+	static bool CanBeLockedOn(const AUltimateSFCharacter* Target);
+
+	/* Copies the archetype's tuning onto this fighter and its components */
+	void ApplyArchetype();
+
+	//Desync detection
+	/* Records the server's combat frame in the checksum, called at the end of every attack and hit multicast */
+	void UpdateCombatChecksum(uint32 CombatFrame);
+	FUltimateSFCombatSnapshot MakeCombatSnapshot() const;
+
+	//Server sends the hashes of the last few combat frames to every client
+	UFUNCTION(NetMulticast, Unreliable)
+	void M_CombatChecksums(uint32 LastFrame, const TArray<uint32>& Hashes);
+	void M_CombatChecksums_Implementation(uint32 LastFrame, const TArray<uint32>& Hashes);
+
+	//Owning client asks the server to dump its side of a divergent frame
+	UFUNCTION(Server, Unreliable)
+	void S_ReportDesync(uint32 Frame, uint32 ClientHash);
+	void S_ReportDesync_Implementation(uint32 Frame, uint32 ClientHash);
+
+	void ReportDesync(uint32 Frame);
+
+	/* Turns on the bIs* flag matching the move that hit us and clears the others */
+	void SetHitReactionFlags(EUltimateSFMove Move);
+	void ClearHitReactionFlags();
+
+	/* Detaches the mesh from physics and puts it back on the capsule */
+	void RestoreMeshFromRagdoll();
+
+
+
+	/*  Inputs and flags handed to UltimateSFCombatRules*/
+	UltimateSFCombatRules::FInput GetRulesInput() const;
+	UltimateSFCombatRules::FFighter GetRulesFighter() const;
+
 	/*  Handler for attacks*/
 	void LeftMouseAttack();
 	void RightMouseAttack();
 
+	/* Owning client: plays the montage now under the stamp's sequence as prediction key */
+	void PredictAttack(UAnimMontage* Montage, float PlayRate, FUltimateSFInputStamp& Stamp);
+
+	/* True on the owner for its own predicted attack, the multicast then only confirms it */
+	bool ConfirmPredictedAttack(const FUltimateSFInputStamp& Stamp);
+
+	/* Server side check of an attack RPC: a punch or kick montage of this fighter that UltimateSFCombatRules lets it start now */
+	bool CanAcceptAttack(UAnimMontage* Anim, bool bKick) const;
+
+	/* Server side cap of the damage an attack RPC claims to the move's damage in UltimateSFCombatRules */
+	float ClampAttackDamage(UAnimMontage* Anim, float Dam) const;
+
+	/* Server side check of a dodge RPC: one of the dodge montages, out of a dodge and allowed by UltimateSFCombatRules::SelectDodge */
+	bool CanAcceptDodge(UAnimMontage* Anim) const;
+
+	UFUNCTION(Client, Reliable)
+	void C_RejectAttack(uint16 Sequence);
+	void C_RejectAttack_Implementation(uint16 Sequence);
+
+	/* Arms the end of the attack: the recovery notify if the montage has one, else a timer for the montage length at PlayRate */
+	void StartAttackWindow(UAnimMontage* Montage, float PlayRate);
+	void EndAttackWindow();
+
+	/* Dodge timer callbacks, the dodge ends first and its damage bonus a second later */
+	void EndDodge();
+	void EndDodgeBonus();
+
+	/* Closes an attack thrown mid dodge once its window is over, or arms its timer for the rest once the dodge is done */
+	void UpdateDodgeAttackWindow(bool bDodgeOver);
+
+	/*  Latency stamps carried through the attack RPCs, see FUltimateSFLatencyTracker*/
+	FUltimateSFInputStamp MakeInputStamp();
+	void StampServerReceived(FUltimateSFInputStamp& Stamp) const;
+	void RecordMontageLatency(const FUltimateSFInputStamp& Stamp);
+	double GetSyncedServerTime() const;
+
+	/* Wakes an idle throttled dedicated server, see AUltimateSFGameMode::NotifyCombatActivity */
+	void NotifyCombatActivity() const;
+
 
 	//Multicast Functions for Left mouse attacks
 
 	UFUNCTION(NetMulticast, Reliable)
-	void M_LeftMouseAttack_Jab(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim);
-	void M_LeftMouseAttack_Jab_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim);
+	void M_LeftMouseAttack_Jab(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
+	void M_LeftMouseAttack_Jab_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
 
 	UFUNCTION(NetMulticast, Reliable)
-	void M_LeftMouseAttack(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim);
-	void M_LeftMouseAttack_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim);
+	void M_LeftMouseAttack(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
+	void M_LeftMouseAttack_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
 
 
 
@@ -379,36 +718,36 @@ protected:
 
 
 	UFUNCTION(Server, Reliable)
-		void S_LeftMouseAttack_Jab(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim);
-	void S_LeftMouseAttack_Jab_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim);
+		void S_LeftMouseAttack_Jab(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
+	void S_LeftMouseAttack_Jab_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
 
 	UFUNCTION(Server, Reliable)
-		void S_LeftMouseAttack(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim);
-	void S_LeftMouseAttack_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim);
+		void S_LeftMouseAttack(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
+	void S_LeftMouseAttack_Implementation(bool Upper, bool Punching, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
 
 
 
 	//Multicast Functions for Left mouse attacks
 
 	UFUNCTION(NetMulticast, Reliable)
-	void M_RightMouseAttack_LowKick(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim);
-	void M_RightMouseAttack_LowKick_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim);
+	void M_RightMouseAttack_LowKick(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
+	void M_RightMouseAttack_LowKick_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
 
 	UFUNCTION(NetMulticast, Reliable)
-	void M_RightMouseAttack(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim);
-	void M_RightMouseAttack_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim);
+	void M_RightMouseAttack(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
+	void M_RightMouseAttack_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
 
 
 
 	//Server Functions for Right mouse attacks
 
 	UFUNCTION(Server, Reliable)
-		void S_RightMouseAttack_LowKick(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim);
-	void S_RightMouseAttack_LowKick_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim);
+		void S_RightMouseAttack_LowKick(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
+	void S_RightMouseAttack_LowKick_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
 
 	UFUNCTION(Server, Reliable)
-		void S_RightMouseAttack(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim);
-	void S_RightMouseAttack_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim);
+		void S_RightMouseAttack(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
+	void S_RightMouseAttack_Implementation(bool Upper, bool Kicking, bool LeftAttack, float Dam, UAnimMontage* Anim, FUltimateSFInputStamp Stamp);
 
 
 
@@ -443,10 +782,56 @@ protected:
 	virtual void SetupPlayerInputComponent(class UInputComponent* PlayerInputComponent) override;
 	// End of APawn interface
 
+	// AActor interface
+	virtual void BeginPlay() override;
+	virtual void Tick(float DeltaSeconds) override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	// End of AActor interface
+
 private:
 	FTimerHandle TimerHandle;
 	FTimerManager TimerManager;
 
+	/* Callback TimerHandle was last set for, so a checkpoint can restore it */
+	EUltimateSFCombatTimer CombatTimer = EUltimateSFCombatTimer::None;
+
+	/* World time an attack thrown while a dodge held TimerHandle is over, 0 when there is none */
+	double DodgeAttackWindowEnd = 0.0;
+
+	FTimerHandle HitReactionTimerHandle;
+
+	/* Mesh placement under the capsule, restored after a ragdoll */
+	FTransform MeshRelativeTransform;
+	FName MeshCollisionProfile;
+	bool bRagdollSimulating = false;
+
+	FUltimateSFCombatChecksum CombatChecksum;
+	FUltimateSFHitEvent LastHitEvent;
+
+	bool bIsPooled = false;
+
+	FDelegateHandle ArchetypeChangedHandle;
+
+	/* Newest predicted attack not yet confirmed or rejected, 0 when none */
+	uint16 PredictedSequence = 0;
+	/* Local platform time of its input, for the PredictionConfirm latency hop */
+	double PredictedInputTime = 0.0;
+
+	UPROPERTY(Transient)
+		UAnimMontage* PredictedMontage = nullptr;
+
+	/* Server side throttle for S_RequestKillcam */
+	float LastKillcamRequestTime = -1000.f;
+
+	/* EUltimateSFHUDChange bits waiting for FlushHUDChanges */
+	uint8 PendingHUDChanges = 0;
+
+	/* Local platform time of the owner's last few attack inputs, keyed by stamp sequence */
+	static constexpr int32 PendingInputCount = 16;
+	uint16 InputSequence = 0;
+	uint16 PendingInputSequences[PendingInputCount] = {};
+	double PendingInputTimes[PendingInputCount] = {};
+
 public:
 	/** Returns CameraBoom subobject **/
 	FORCEINLINE class USpringArmComponent* GetCameraBoom() const { return CameraBoom; }
@@ -455,6 +840,9 @@ public:
 
 
 	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+	virtual void PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker) override;
+	virtual bool CallRemoteFunction(UFunction* Function, void* Parameters, struct FOutParmRec* OutParms, FFrame* Stack) override;
+	virtual void ProcessEvent(UFunction* Function, void* Parameters) override;
 };
 
 
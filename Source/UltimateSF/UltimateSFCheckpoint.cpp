@@ -0,0 +1,279 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFCheckpoint.h"
+#include "UltimateSF.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/Paths.h"
+
+#if PLATFORM_WINDOWS
+#include "Windows/AllowWindowsPlatformTypes.h"
+#include <windows.h>
+#include "Windows/HideWindowsPlatformTypes.h"
+#elif PLATFORM_UNIX || PLATFORM_MAC
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FUltimateSFCheckpointFile::~FUltimateSFCheckpointFile()
+{
+	Close();
+}
+
+bool FUltimateSFCheckpointFile::Open(const FString& InFilename, int32 InNumSlots)
+{
+	Close();
+
+	Filename = FPaths::ConvertRelativePathToFull(InFilename);
+	NumSlots = FMath::Max(InNumSlots, 1);
+	FPlatformFileManager::Get().GetPlatformFile().CreateDirectoryTree(*FPaths::GetPath(Filename));
+
+	bool bExisted = false;
+	if (!Map(sizeof(FHeader) + (int64)NumSlots * sizeof(FSlot), bExisted))
+	{
+		UE_LOG(LogUltimateSF, Error, TEXT("Checkpoint: could not map %s, the arena is not checkpointed"), *Filename);
+		return false;
+	}
+
+	const FHeader& Header = GetHeader();
+	const bool bSameLayout = bExisted && Header.Magic == FileMagic && Header.Version == FileVersion
+		&& Header.NumSlots == (uint32)NumSlots && Header.SlotSize == sizeof(FSlot);
+	bHadCheckpoint = bSameLayout && Header.bValid != 0;
+	if (!bSameLayout)
+	{
+		FMemory::Memzero(Data, Size);
+		FHeader& NewHeader = GetHeader();
+		NewHeader.Magic = FileMagic;
+		NewHeader.Version = FileVersion;
+		NewHeader.NumSlots = NumSlots;
+		NewHeader.SlotSize = sizeof(FSlot);
+	}
+	return true;
+}
+
+void FUltimateSFCheckpointFile::Close()
+{
+	if (Data)
+	{
+		Flush();
+		Unmap();
+	}
+	Data = nullptr;
+	Size = 0;
+	bHadCheckpoint = false;
+}
+
+bool FUltimateSFCheckpointFile::ReadFighter(int32 Slot, FUltimateSFFighterCheckpoint& OutFighter) const
+{
+	const FSlot& Stored = GetSlot(Slot);
+	if (!Stored.bUsed || Stored.Crc != GetSlotCrc(Stored))
+	{
+		return false;
+	}
+	OutFighter = Stored.Fighter;
+	return true;
+}
+
+bool FUltimateSFCheckpointFile::ReadArena(FUltimateSFArenaCheckpoint& OutArena, double& OutWorldTime) const
+{
+	const FHeader& Header = GetHeader();
+	if (!Header.bValid || Header.ArenaCrc != FCrc::MemCrc32(&Header.Arena, sizeof(Header.Arena)))
+	{
+		return false;
+	}
+	OutArena = Header.Arena;
+	OutWorldTime = Header.WorldTime;
+	return true;
+}
+
+bool FUltimateSFCheckpointFile::WriteFighter(int32 Slot, const FUltimateSFFighterCheckpoint& Fighter)
+{
+	FSlot& Stored = GetSlot(Slot);
+	if (Stored.bUsed && FMemory::Memcmp(&Stored.Fighter, &Fighter, sizeof(Fighter)) == 0)
+	{
+		return false;
+	}
+
+	FSlot Updated;
+	Updated.bUsed = 1;
+	Updated.Fighter = Fighter;
+	Updated.Crc = GetSlotCrc(Updated);
+	FMemory::Memcpy(&Stored, &Updated, sizeof(FSlot));
+	BytesWritten += sizeof(FSlot);
+	return true;
+}
+
+void FUltimateSFCheckpointFile::ClearFighter(int32 Slot)
+{
+	GetSlot(Slot).bUsed = 0;
+	BytesWritten += sizeof(uint32);
+}
+
+void FUltimateSFCheckpointFile::WriteArena(const FUltimateSFArenaCheckpoint& Arena, double WorldTime)
+{
+	FHeader& Header = GetHeader();
+	if (!Header.bValid || FMemory::Memcmp(&Header.Arena, &Arena, sizeof(Arena)) != 0)
+	{
+		Header.Arena = Arena;
+		Header.ArenaCrc = FCrc::MemCrc32(&Arena, sizeof(Arena));
+		BytesWritten += sizeof(Arena) + sizeof(uint32);
+	}
+	//The timers in the slots are relative to this
+	Header.WorldTime = WorldTime;
+	++Header.Sequence;
+	Header.bValid = 1;
+	BytesWritten += sizeof(double) + sizeof(uint64);
+}
+
+void FUltimateSFCheckpointFile::Reset()
+{
+	GetHeader().bValid = 0;
+	for (int32 Slot = 0; Slot < NumSlots; ++Slot)
+	{
+		GetSlot(Slot).bUsed = 0;
+	}
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Mapping***
+/// </summary>
+
+#if PLATFORM_WINDOWS
+
+bool FUltimateSFCheckpointFile::Map(int64 InSize, bool& bOutExisted)
+{
+	FileHandle = CreateFileW(*Filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (FileHandle == INVALID_HANDLE_VALUE)
+	{
+		FileHandle = nullptr;
+		return false;
+	}
+
+	LARGE_INTEGER ExistingSize;
+	bOutExisted = GetFileSizeEx(FileHandle, &ExistingSize) && ExistingSize.QuadPart == InSize;
+
+	//Grows or shrinks the file to the mapping size
+	LARGE_INTEGER NewSize;
+	NewSize.QuadPart = InSize;
+	if (!SetFilePointerEx(FileHandle, NewSize, nullptr, FILE_BEGIN) || !SetEndOfFile(FileHandle))
+	{
+		Unmap();
+		return false;
+	}
+
+	MappingHandle = CreateFileMappingW(FileHandle, nullptr, PAGE_READWRITE, (DWORD)(InSize >> 32), (DWORD)(InSize & 0xFFFFFFFF), nullptr);
+	Data = MappingHandle ? static_cast<uint8*>(MapViewOfFile(MappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, InSize)) : nullptr;
+	if (Data == nullptr)
+	{
+		Unmap();
+		return false;
+	}
+	Size = InSize;
+	return true;
+}
+
+void FUltimateSFCheckpointFile::Unmap()
+{
+	if (Data)
+	{
+		UnmapViewOfFile(Data);
+	}
+	if (MappingHandle)
+	{
+		CloseHandle(MappingHandle);
+	}
+	if (FileHandle)
+	{
+		CloseHandle(FileHandle);
+	}
+	Data = nullptr;
+	MappingHandle = nullptr;
+	FileHandle = nullptr;
+}
+
+void FUltimateSFCheckpointFile::Flush()
+{
+	if (Data)
+	{
+		FlushViewOfFile(Data, 0);
+	}
+}
+
+#elif PLATFORM_UNIX || PLATFORM_MAC
+
+bool FUltimateSFCheckpointFile::Map(int64 InSize, bool& bOutExisted)
+{
+	const int File = open(TCHAR_TO_UTF8(*Filename), O_RDWR | O_CREAT, 0644);
+	if (File < 0)
+	{
+		return false;
+	}
+
+	struct stat Stat;
+	bOutExisted = fstat(File, &Stat) == 0 && Stat.st_size == InSize;
+	if (ftruncate(File, InSize) != 0)
+	{
+		close(File);
+		return false;
+	}
+
+	void* Mapped = mmap(nullptr, InSize, PROT_READ | PROT_WRITE, MAP_SHARED, File, 0);
+	//The mapping keeps the file open
+	close(File);
+	if (Mapped == MAP_FAILED)
+	{
+		return false;
+	}
+	Data = static_cast<uint8*>(Mapped);
+	Size = InSize;
+	return true;
+}
+
+void FUltimateSFCheckpointFile::Unmap()
+{
+	if (Data)
+	{
+		munmap(Data, Size);
+	}
+	Data = nullptr;
+}
+
+void FUltimateSFCheckpointFile::Flush()
+{
+	if (Data)
+	{
+		msync(Data, Size, MS_ASYNC);
+	}
+}
+
+#else
+
+//No mapping on this platform, the checkpoint lives in memory and does not survive the process
+bool FUltimateSFCheckpointFile::Map(int64 InSize, bool& bOutExisted)
+{
+	Data = static_cast<uint8*>(FMemory::MallocZeroed(InSize));
+	Size = InSize;
+	bOutExisted = false;
+	return true;
+}
+
+void FUltimateSFCheckpointFile::Unmap()
+{
+	FMemory::Free(Data);
+	Data = nullptr;
+}
+
+void FUltimateSFCheckpointFile::Flush()
+{
+}
+
+#endif
@@ -0,0 +1,191 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Hash/CityHash.h"
+#include "Misc/Crc.h"
+
+/* Which of AUltimateSFCharacter's TimerHandle callbacks is pending */
+enum class EUltimateSFCombatTimer : uint8
+{
+	None,
+	SprintFalse,
+	AttackWindow,
+	Dodge,
+	DodgeBonus
+};
+
+/**
+ * One fighter in an arena checkpoint. Fixed size and free of padding so a slot can be compared and rewritten in place.
+ * Timer ends are absolute world times in milliseconds, so a pending timer does not dirty the slot every frame.
+ */
+struct FUltimateSFFighterCheckpoint
+{
+	/* CityHash64 of the owning player's unique net id, 0 for fighters no player owns */
+	uint64 FighterId;
+
+	FVector3f Location;
+	FVector3f Velocity;
+	float Yaw;
+
+	/* Combat flags in FUltimateSFNetCombatState bit order */
+	uint32 Flags;
+
+	float DamageDealt;
+	float DamageRecieved;
+	float DamageMultiplier;
+	float DamageReducingValue;
+
+	float WalkSpeed;
+	float RunSpeed;
+	float SprintSpeed;
+	float CombatSpeed;
+	float CombatDashSpeed;
+	float MaxWalkSpeed;
+
+	/* World time in ms the timers fire at, 0 when not pending */
+	uint32 CombatTimerEnd;
+	uint32 HitReactionEnd;
+
+	/* EUltimateSFCombatTimer */
+	uint8 CombatTimer;
+	uint8 ArchetypeId;
+	uint8 MovementMode;
+	uint8 ControlFlags;
+	/* EUltimateSFHitDirection */
+	uint8 HitDirection;
+	/* 1 or 2 for contender A or B of AUltimateSFGameState's match, 0 otherwise */
+	uint8 Contender;
+	/* Round health in AUltimateSFGameState's quarter points */
+	uint16 Health;
+
+	static constexpr uint8 Control_Bot = 1 << 0;
+	static constexpr uint8 Control_ToggleRun = 1 << 1;
+
+	FUltimateSFFighterCheckpoint()
+	{
+		FMemory::Memzero(*this);
+	}
+
+	/* Fighter ids are stable across server processes, unlike anything the net driver hands out */
+	static uint64 MakeFighterId(const FString& UniqueNetId)
+	{
+		return UniqueNetId.IsEmpty() ? 0 : CityHash64(reinterpret_cast<const char*>(*UniqueNetId), UniqueNetId.Len() * sizeof(TCHAR));
+	}
+
+	static uint32 ToMilliseconds(double WorldTime) { return (uint32)FMath::Max<int64>(FMath::RoundToInt64(WorldTime * 1000.0), 1); }
+};
+static_assert(sizeof(FUltimateSFFighterCheckpoint) == 96, "FUltimateSFFighterCheckpoint must not pick up padding, slots are compared bytewise");
+
+/* Match and round state of the arena */
+struct FUltimateSFArenaCheckpoint
+{
+	uint64 NextMatchId;
+	uint64 PlayerA;
+	uint64 PlayerB;
+	int32 SkillA;
+	int32 SkillB;
+	uint32 bHasMatch;
+
+	/* EUltimateSFMatchPhase, WaitingForFighters when no round is on */
+	uint8 MatchPhase;
+	uint8 RoundNumber;
+	uint8 RoundWinsA;
+	uint8 RoundWinsB;
+	/* World time in ms the phase ends at, 0 when it has no limit */
+	uint32 PhaseEnd;
+	uint32 Padding;
+
+	FUltimateSFArenaCheckpoint()
+	{
+		FMemory::Memzero(*this);
+	}
+};
+
+/**
+ * Arena checkpoint in a memory mapped file: a header with the arena state followed by one slot per fighter.
+ * Writes go straight into the mapping and only slots whose bytes changed are touched, so a checkpoint costs a
+ * compare per fighter on the game thread. The pages belong to the OS once written, so they survive the server
+ * process exiting or crashing; Flush only matters for surviving the machine. Every slot carries a CRC so a slot
+ * torn by a crash mid copy is dropped on resume instead of restoring garbage.
+ */
+class FUltimateSFCheckpointFile
+{
+public:
+	FUltimateSFCheckpointFile() = default;
+	~FUltimateSFCheckpointFile();
+
+	FUltimateSFCheckpointFile(const FUltimateSFCheckpointFile&) = delete;
+	FUltimateSFCheckpointFile& operator=(const FUltimateSFCheckpointFile&) = delete;
+
+	/* Maps Filename sized for NumSlots fighters. Contents a previous process left with the same layout are kept */
+	bool Open(const FString& Filename, int32 NumSlots);
+	void Close();
+
+	/* The file held a checkpoint when it was opened */
+	bool HasCheckpoint() const { return bHadCheckpoint; }
+
+	int32 GetNumSlots() const { return NumSlots; }
+	const FString& GetFilename() const { return Filename; }
+
+	/* False for empty or torn slots */
+	bool ReadFighter(int32 Slot, FUltimateSFFighterCheckpoint& OutFighter) const;
+	bool ReadArena(FUltimateSFArenaCheckpoint& OutArena, double& OutWorldTime) const;
+
+	/* Returns whether the slot changed */
+	bool WriteFighter(int32 Slot, const FUltimateSFFighterCheckpoint& Fighter);
+	void ClearFighter(int32 Slot);
+	void WriteArena(const FUltimateSFArenaCheckpoint& Arena, double WorldTime);
+
+	/* Empties every slot and the arena, the file no longer holds a checkpoint */
+	void Reset();
+
+	/* Schedules the dirty pages for writing to disk, does not wait */
+	void Flush();
+
+	uint64 GetBytesWritten() const { return BytesWritten; }
+
+private:
+	struct FHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 NumSlots;
+		uint32 SlotSize;
+		uint64 Sequence;
+		double WorldTime;
+		FUltimateSFArenaCheckpoint Arena;
+		uint32 ArenaCrc;
+		uint32 bValid;
+	};
+
+	struct FSlot
+	{
+		uint32 Crc;
+		uint32 bUsed;
+		FUltimateSFFighterCheckpoint Fighter;
+	};
+
+	static constexpr uint32 FileMagic = 0x50435355;
+	static constexpr uint32 FileVersion = 2;
+
+	FHeader& GetHeader() const { return *reinterpret_cast<FHeader*>(Data); }
+	FSlot& GetSlot(int32 Slot) const { return reinterpret_cast<FSlot*>(Data + sizeof(FHeader))[Slot]; }
+	static uint32 GetSlotCrc(const FSlot& Slot) { return FCrc::MemCrc32(&Slot.bUsed, sizeof(FSlot) - sizeof(uint32)); }
+
+	bool Map(int64 InSize, bool& bOutExisted);
+	void Unmap();
+
+	FString Filename;
+	uint8* Data = nullptr;
+	int64 Size = 0;
+	int32 NumSlots = 0;
+	bool bHadCheckpoint = false;
+	uint64 BytesWritten = 0;
+
+#if PLATFORM_WINDOWS
+	void* FileHandle = nullptr;
+	void* MappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,282 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFCombatAudioSubsystem.h"
+#include "UltimateSF.h"
+#include "Components/AudioComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "GameFramework/WorldSettings.h"
+#include "HAL/IConsoleManager.h"
+#include "Sound/SoundBase.h"
+#include "Sound/SoundConcurrency.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF Combat Audio"), STATGROUP_UltimateSFCombatAudio, STATCAT_Advanced);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Active Voices"), STAT_UltimateSFActiveVoices, STATGROUP_UltimateSFCombatAudio);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Culled Impacts"), STAT_UltimateSFCulledImpacts, STATGROUP_UltimateSFCombatAudio);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Voice Allocations"), STAT_UltimateSFVoiceAllocations, STATGROUP_UltimateSFCombatAudio);
+
+static TAutoConsoleVariable<bool> CVarCombatAudioEnabled(
+	TEXT("usf.Audio.Enabled"),
+	true,
+	TEXT("Play combat impact cues through the pooled combat audio service."));
+
+//Cues are short one shots, a voice is considered busy for at most this long
+static constexpr float MaxVoiceDuration = 5.f;
+
+void UUltimateSFCombatAudioSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	if (InWorld.GetNetMode() == NM_DedicatedServer)
+	{
+		return;
+	}
+
+	const UUltimateSFCombatAudioSettings* Settings = GetDefault<UUltimateSFCombatAudioSettings>();
+
+	StrengthSounds.SetNumZeroed((int32)EUltimateSFImpactStrength::MAX);
+	StrengthSounds[(int32)EUltimateSFImpactStrength::Light] = Settings->LightAttack.LoadSynchronous();
+	StrengthSounds[(int32)EUltimateSFImpactStrength::Middle] = Settings->MiddleAttack.LoadSynchronous();
+	StrengthSounds[(int32)EUltimateSFImpactStrength::Heavy] = Settings->HeavyAttack.LoadSynchronous();
+	GruntSound = Settings->Grunt.LoadSynchronous();
+
+	for (int32 Strength = 0; Strength < (int32)EUltimateSFImpactStrength::MAX; ++Strength)
+	{
+		USoundConcurrency* Group = NewObject<USoundConcurrency>(this);
+		Group->Concurrency.MaxCount = FMath::Max(1, Settings->MaxVoicesPerStrength[Strength]);
+		Group->Concurrency.ResolutionRule = EMaxConcurrentResolutionRule::StopLowestPriority;
+		Concurrency.Add(Group);
+	}
+
+	CreateVoices();
+}
+
+void UUltimateSFCombatAudioSubsystem::CreateVoices()
+{
+	const int32 PoolSize = FMath::Max(1, GetDefault<UUltimateSFCombatAudioSettings>()->VoicePoolSize);
+	AWorldSettings* WorldSettings = GetWorld()->GetWorldSettings();
+
+	Voices.Reserve(PoolSize);
+	VoicePriorities.Init(0.f, PoolSize);
+	VoiceEndTimes.Init(0.f, PoolSize);
+
+	for (int32 Index = 0; Index < PoolSize; ++Index)
+	{
+		UAudioComponent* Voice = NewObject<UAudioComponent>(WorldSettings);
+		Voice->bAutoActivate = false;
+		Voice->bAutoDestroy = false;
+		Voice->bAllowSpatialization = true;
+		Voice->bOverridePriority = true;
+		Voice->RegisterComponentWithWorld(GetWorld());
+		Voices.Add(Voice);
+
+		++NumAllocations;
+		INC_DWORD_STAT(STAT_UltimateSFVoiceAllocations);
+	}
+}
+
+void UUltimateSFCombatAudioSubsystem::Deinitialize()
+{
+	for (UAudioComponent* Voice : Voices)
+	{
+		if (IsValid(Voice))
+		{
+			Voice->Stop();
+			Voice->DestroyComponent();
+		}
+	}
+	Voices.Reset();
+	VoicePriorities.Reset();
+	VoiceEndTimes.Reset();
+
+	Super::Deinitialize();
+}
+
+TStatId UUltimateSFCombatAudioSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UUltimateSFCombatAudioSubsystem, STATGROUP_Tickables);
+}
+
+EUltimateSFImpactStrength UUltimateSFCombatAudioSubsystem::GetImpactStrength(EUltimateSFMove Move)
+{
+	switch (Move)
+	{
+	case EUltimateSFMove::UpperCut:
+	case EUltimateSFMove::HighKick:
+		return EUltimateSFImpactStrength::Heavy;
+	case EUltimateSFMove::LeftHook:
+	case EUltimateSFMove::RightHook:
+	case EUltimateSFMove::Straight:
+	case EUltimateSFMove::LeftMiddleKick:
+	case EUltimateSFMove::RightMiddleKick:
+		return EUltimateSFImpactStrength::Middle;
+	default:
+		return EUltimateSFImpactStrength::Light;
+	}
+}
+
+bool UUltimateSFCombatAudioSubsystem::GetListenerLocation(FVector& OutLocation) const
+{
+	APlayerController* PlayerController = GetWorld()->GetFirstPlayerController();
+	if (PlayerController == nullptr || !PlayerController->IsLocalController())
+	{
+		return false;
+	}
+
+	FVector FrontDir;
+	FVector RightDir;
+	PlayerController->GetAudioListenerPosition(OutLocation, FrontDir, RightDir);
+	return true;
+}
+
+int32 UUltimateSFCombatAudioSubsystem::GetNumActiveVoices() const
+{
+	const float Now = GetWorld()->GetTimeSeconds();
+	int32 NumActive = 0;
+	for (const float EndTime : VoiceEndTimes)
+	{
+		NumActive += EndTime > Now ? 1 : 0;
+	}
+	return NumActive;
+}
+
+bool UUltimateSFCombatAudioSubsystem::PlayImpact(EUltimateSFMove Move, const FVector& Location, bool bGrunt)
+{
+	if (Voices.Num() == 0 || !CVarCombatAudioEnabled.GetValueOnGameThread())
+	{
+		return false;
+	}
+
+	const EUltimateSFImpactStrength Strength = GetImpactStrength(Move);
+	const bool bPlayed = PlayVoice(StrengthSounds[(int32)Strength], Strength, Location);
+	if (bPlayed && bGrunt)
+	{
+		//The grunt goes in the middle group so it never pushes a heavy impact out
+		PlayVoice(GruntSound, EUltimateSFImpactStrength::Middle, Location);
+	}
+	return bPlayed;
+}
+
+bool UUltimateSFCombatAudioSubsystem::PlayVoice(USoundBase* Sound, EUltimateSFImpactStrength Strength, const FVector& Location)
+{
+	const UUltimateSFCombatAudioSettings* Settings = GetDefault<UUltimateSFCombatAudioSettings>();
+
+	//Cull before touching a voice: out of range of the listener or of the cue's own attenuation
+	const float MaxDistance = FMath::Max(1.f, Sound ? FMath::Min(Settings->InaudibleDistance, Sound->GetMaxDistance()) : Settings->InaudibleDistance);
+
+	FVector ListenerLocation;
+	const float Distance = GetListenerLocation(ListenerLocation) ? FVector::Dist(ListenerLocation, Location) : 0.f;
+	if (Distance > MaxDistance)
+	{
+		++NumCulled;
+		INC_DWORD_STAT(STAT_UltimateSFCulledImpacts);
+		return false;
+	}
+
+	const float Priority = Settings->PriorityPerStrength[(int32)Strength] * (1.f - Distance / MaxDistance * 0.5f);
+
+	//A free voice, or else the lowest priority one if we outrank it
+	const float Now = GetWorld()->GetTimeSeconds();
+	int32 VoiceIndex = INDEX_NONE;
+	float LowestPriority = TNumericLimits<float>::Max();
+	for (int32 Index = 0; Index < Voices.Num(); ++Index)
+	{
+		if (VoiceEndTimes[Index] <= Now)
+		{
+			VoiceIndex = Index;
+			break;
+		}
+		if (VoicePriorities[Index] < LowestPriority)
+		{
+			LowestPriority = VoicePriorities[Index];
+			VoiceIndex = Index;
+		}
+	}
+
+	if (VoiceIndex == INDEX_NONE || (VoiceEndTimes[VoiceIndex] > Now && LowestPriority >= Priority))
+	{
+		++NumCulled;
+		INC_DWORD_STAT(STAT_UltimateSFCulledImpacts);
+		return false;
+	}
+
+	UAudioComponent* Voice = Voices[VoiceIndex];
+	VoicePriorities[VoiceIndex] = Priority;
+	VoiceEndTimes[VoiceIndex] = Now + (Sound ? FMath::Min(Sound->GetDuration(), MaxVoiceDuration) : 0.f);
+
+	if (Sound)
+	{
+		Voice->Stop();
+		Voice->SetSound(Sound);
+		Voice->SetWorldLocation(Location);
+		Voice->Priority = Priority;
+		Voice->ConcurrencySet.Reset();
+		Voice->ConcurrencySet.Add(Concurrency[(int32)Strength]);
+		Voice->Play();
+	}
+	return true;
+}
+
+void UUltimateSFCombatAudioSubsystem::Tick(float DeltaTime)
+{
+	SET_DWORD_STAT(STAT_UltimateSFActiveVoices, GetNumActiveVoices());
+
+	if (StressTimeLeft > 0.f)
+	{
+		TickStress(DeltaTime);
+	}
+}
+
+void UUltimateSFCombatAudioSubsystem::StartStress(float HitsPerSecond, float Seconds)
+{
+	StressHitsPerSecond = HitsPerSecond;
+	StressTimeLeft = Seconds;
+	StressAccumulator = 0.f;
+	StressHits = 0;
+	StressPeakVoices = 0;
+	StressStartAllocations = NumAllocations;
+	StressStartCulled = NumCulled;
+}
+
+void UUltimateSFCombatAudioSubsystem::TickStress(float DeltaTime)
+{
+	FVector Center = FVector::ZeroVector;
+	GetListenerLocation(Center);
+
+	StressAccumulator += DeltaTime * StressHitsPerSecond;
+	while (StressAccumulator >= 1.f)
+	{
+		StressAccumulator -= 1.f;
+		++StressHits;
+
+		//A lobby brawl: most hits near the listener, some well out of earshot
+		const EUltimateSFMove Move = (EUltimateSFMove)FMath::RandRange(1, (int32)EUltimateSFMove::MAX - 1);
+		const FVector Location = Center + FMath::VRand() * FMath::FRandRange(0.f, GetDefault<UUltimateSFCombatAudioSettings>()->InaudibleDistance * 1.5f);
+		PlayImpact(Move, Location, GetImpactStrength(Move) == EUltimateSFImpactStrength::Heavy);
+	}
+	StressPeakVoices = FMath::Max(StressPeakVoices, GetNumActiveVoices());
+
+	StressTimeLeft -= DeltaTime;
+	if (StressTimeLeft <= 0.f)
+	{
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.Audio.Stress: %d hits, %d voice allocations, peak %d/%d active voices, %d culled"),
+			StressHits, NumAllocations - StressStartAllocations, StressPeakVoices, Voices.Num(), NumCulled - StressStartCulled);
+	}
+}
+
+//Headless check, e.g. "usf.Audio.Stress 100 10": allocations must stay 0 and active voices at or under the pool size
+static FAutoConsoleCommandWithWorldAndArgs CombatAudioStressCommand(
+	TEXT("usf.Audio.Stress"),
+	TEXT("Fires HitsPerSecond synthetic impacts for Seconds and logs voice allocations, peak active voices and culled impacts."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UUltimateSFCombatAudioSubsystem* Audio = World ? World->GetSubsystem<UUltimateSFCombatAudioSubsystem>() : nullptr;
+		if (Audio == nullptr)
+		{
+			return;
+		}
+
+		const float HitsPerSecond = Args.Num() > 0 ? FCString::Atof(*Args[0]) : 100.f;
+		const float Seconds = Args.Num() > 1 ? FCString::Atof(*Args[1]) : 10.f;
+		Audio->StartStress(HitsPerSecond, Seconds);
+	}));
@@ -0,0 +1,123 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DeveloperSettings.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UltimateSFCombatTypes.h"
+#include "UltimateSFCombatAudioSubsystem.generated.h"
+
+class UAudioComponent;
+class USoundBase;
+class USoundConcurrency;
+
+/* How hard a move lands, picks the impact cue, its priority and its concurrency group */
+UENUM(BlueprintType)
+enum class EUltimateSFImpactStrength : uint8
+{
+	Light,
+	Middle,
+	Heavy,
+
+	MAX UMETA(Hidden)
+};
+
+/* Project Settings > Game > Combat Audio */
+UCLASS(Config = Game, DefaultConfig, meta = (DisplayName = "Combat Audio"))
+class UUltimateSFCombatAudioSettings : public UDeveloperSettings
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(Config, EditAnywhere, Category = Cues)
+		TSoftObjectPtr<USoundBase> LightAttack = TSoftObjectPtr<USoundBase>(FSoftObjectPath(TEXT("/Game/Audio/LightAttack.LightAttack")));
+
+	UPROPERTY(Config, EditAnywhere, Category = Cues)
+		TSoftObjectPtr<USoundBase> MiddleAttack = TSoftObjectPtr<USoundBase>(FSoftObjectPath(TEXT("/Game/Audio/MiddelAttack.MiddelAttack")));
+
+	UPROPERTY(Config, EditAnywhere, Category = Cues)
+		TSoftObjectPtr<USoundBase> HeavyAttack = TSoftObjectPtr<USoundBase>(FSoftObjectPath(TEXT("/Game/Audio/HeavyAttack.HeavyAttack")));
+
+	UPROPERTY(Config, EditAnywhere, Category = Cues)
+		TSoftObjectPtr<USoundBase> Grunt = TSoftObjectPtr<USoundBase>(FSoftObjectPath(TEXT("/Game/Audio/Grunt.Grunt")));
+
+	/* Audio components created when the world starts, nothing is allocated per hit */
+	UPROPERTY(Config, EditAnywhere, Category = Voices, meta = (ClampMin = "1"))
+		int32 VoicePoolSize = 24;
+
+	/* Concurrent voices per strength, Light / Middle / Heavy. The lowest priority voice of the group is stopped first */
+	UPROPERTY(Config, EditAnywhere, Category = Voices)
+		int32 MaxVoicesPerStrength[(int32)EUltimateSFImpactStrength::MAX] = { 6, 8, 10 };
+
+	/* Base priority per strength before distance falloff */
+	UPROPERTY(Config, EditAnywhere, Category = Voices)
+		float PriorityPerStrength[(int32)EUltimateSFImpactStrength::MAX] = { 1.f, 2.f, 4.f };
+
+	/* Impacts further than this from the listener are never started, in cm */
+	UPROPERTY(Config, EditAnywhere, Category = Voices)
+		float InaudibleDistance = 4000.f;
+};
+
+/**
+ * Plays combat impact cues from a fixed pool of audio components.
+ * Impacts come from M_ReceiveHit on every peer. Each one is culled against the listener before anything
+ * is started, then takes a free pooled component or steals the lowest priority one. Priority scales with
+ * move strength and falls off with distance, and each strength has its own concurrency group.
+ */
+UCLASS()
+class UUltimateSFCombatAudioSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	static EUltimateSFImpactStrength GetImpactStrength(EUltimateSFMove Move);
+
+	/* Impact cue of the move at Location, plus a grunt from the victim on heavy hits. Returns false if culled */
+	bool PlayImpact(EUltimateSFMove Move, const FVector& Location, bool bGrunt);
+
+	int32 GetNumActiveVoices() const;
+	int32 GetNumAllocations() const { return NumAllocations; }
+	int32 GetNumCulled() const { return NumCulled; }
+
+	/* Fires synthetic impacts around the listener for Seconds, see usf.Audio.Stress */
+	void StartStress(float HitsPerSecond, float Seconds);
+
+private:
+	bool PlayVoice(USoundBase* Sound, EUltimateSFImpactStrength Strength, const FVector& Location);
+	bool GetListenerLocation(FVector& OutLocation) const;
+	void CreateVoices();
+	void TickStress(float DeltaTime);
+
+	UPROPERTY(Transient)
+		TArray<UAudioComponent*> Voices;
+
+	/* Per voice: priority it was started with and when it is free again */
+	TArray<float> VoicePriorities;
+	TArray<float> VoiceEndTimes;
+
+	UPROPERTY(Transient)
+		TArray<USoundConcurrency*> Concurrency;
+
+	UPROPERTY(Transient)
+		TArray<USoundBase*> StrengthSounds;
+
+	UPROPERTY(Transient)
+		USoundBase* GruntSound = nullptr;
+
+	int32 NumAllocations = 0;
+	int32 NumCulled = 0;
+
+	float StressHitsPerSecond = 0.f;
+	float StressTimeLeft = 0.f;
+	float StressAccumulator = 0.f;
+	int32 StressHits = 0;
+	int32 StressPeakVoices = 0;
+	int32 StressStartAllocations = 0;
+	int32 StressStartCulled = 0;
+};
@@ -0,0 +1,158 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * The combat state every peer must agree on, packed so it can be hashed and dumped.
+ * Taken right after a combat multicast is applied, when the server's attack flags and multiplier have just been
+ * written on every peer. Guard and the timer driven dodge flags clear at slightly different times and are left out.
+ */
+struct FUltimateSFCombatSnapshot
+{
+	/* The last FUltimateSFHitEvent taken: move, direction, damage and flags, one byte each */
+	uint32 LastHit = 0;
+	/* bIsPunching in bit 0, bIsKicking in bit 1 */
+	uint32 AttackFlags = 0;
+	float DamageDealt = 0.f;
+	float DamageRecieved = 0.f;
+	float DamageMultiplier = 1.f;
+
+	FString ToString() const
+	{
+		return FString::Printf(TEXT("LastHit=0x%08x AttackFlags=0x%x DamageDealt=%.3f DamageRecieved=%.3f DamageMultiplier=%.3f"),
+			LastHit, AttackFlags, DamageDealt, DamageRecieved, DamageMultiplier);
+	}
+};
+
+/**
+ * Hash of a character's combat state per combat frame.
+ * A combat frame is one applied combat multicast. The server numbers them and sends the number with the multicast,
+ * so a client that joined late or missed frames still keys its snapshots to the server's frames. Each frame's hash
+ * folds in the previous frame's hash, so one matching frame vouches for the whole history before it. A client that
+ * did not see the previous frame continues the chain from the server's hash of it when that already arrived,
+ * otherwise its frames stay unchained and are not compared until a server batch lets it pick the chain up again.
+ * The hash and the snapshot of the last HistorySize frames are kept so a mismatch can be pinned to its frame and dumped.
+ */
+class FUltimateSFCombatChecksum
+{
+public:
+	static constexpr uint32 HistorySize = 64;
+
+	static uint32 Mix(uint32 Hash, uint32 Value)
+	{
+		//murmur3 style round
+		Value *= 0xCC9E2D51u;
+		Value = (Value << 15) | (Value >> 17);
+		Value *= 0x1B873593u;
+		Hash ^= Value;
+		Hash = (Hash << 13) | (Hash >> 19);
+		return Hash * 5u + 0xE6546B64u;
+	}
+
+	static uint32 HashSnapshot(uint32 Seed, const FUltimateSFCombatSnapshot& Snapshot)
+	{
+		uint32 Hash = Mix(Seed, Snapshot.LastHit);
+		Hash = Mix(Hash, Snapshot.AttackFlags);
+		Hash = Mix(Hash, BitCast(Snapshot.DamageDealt));
+		Hash = Mix(Hash, BitCast(Snapshot.DamageRecieved));
+		Hash = Mix(Hash, BitCast(Snapshot.DamageMultiplier));
+		return Hash;
+	}
+
+	/* Records the server's combat frame InFrame, returns it */
+	uint32 Advance(const FUltimateSFCombatSnapshot& Snapshot, uint32 InFrame)
+	{
+		//The server started counting again, e.g. the fighter came back from the pool
+		if (InFrame <= Frame)
+		{
+			*this = FUltimateSFCombatChecksum();
+		}
+
+		//Frame 1 starts the chain from 0 on every peer
+		const uint32 PrevFrame = InFrame - 1;
+		const uint32 PrevSlot = PrevFrame % HistorySize;
+		uint32 PrevHash = 0;
+		bool bPrevChained = PrevFrame == 0;
+		if (!bPrevChained && HasFrame(PrevFrame) && Chained[PrevSlot])
+		{
+			PrevHash = HashHistory[PrevSlot];
+			bPrevChained = true;
+		}
+		else if (!bPrevChained && RemoteFrames[PrevSlot] == PrevFrame)
+		{
+			PrevHash = RemoteHashes[PrevSlot];
+			bPrevChained = true;
+		}
+
+		Frame = InFrame;
+		const uint32 Slot = Frame % HistorySize;
+		LocalFrames[Slot] = Frame;
+		Chained[Slot] = bPrevChained;
+		HashHistory[Slot] = HashSnapshot(Mix(PrevHash, Frame), Snapshot);
+		SnapshotHistory[Slot] = Snapshot;
+		return Frame;
+	}
+
+	uint32 GetFrame() const { return Frame; }
+	uint32 GetHash() const { return HashHistory[Frame % HistorySize]; }
+
+	bool HasFrame(uint32 InFrame) const { return InFrame > 0 && InFrame <= Frame && Frame - InFrame < HistorySize && LocalFrames[InFrame % HistorySize] == InFrame; }
+	uint32 GetHashAt(uint32 InFrame) const { return HashHistory[InFrame % HistorySize]; }
+	const FUltimateSFCombatSnapshot& GetSnapshotAt(uint32 InFrame) const { return SnapshotHistory[InFrame % HistorySize]; }
+
+	/* Remembers a hash the server computed for one of our frames */
+	void AddRemote(uint32 InFrame, uint32 Hash)
+	{
+		const uint32 Slot = InFrame % HistorySize;
+		RemoteFrames[Slot] = InFrame;
+		RemoteHashes[Slot] = Hash;
+		NewestRemote = FMath::Max(NewestRemote, InFrame);
+	}
+
+	/* Compares every frame both sides have computed since the last check, returns the first divergent frame or 0 */
+	uint32 CheckRemote()
+	{
+		const uint32 LastFrame = FMath::Min(Frame, NewestRemote);
+		const uint32 FirstUnchecked = FMath::Max(LastChecked + 1, LastFrame >= HistorySize ? LastFrame - HistorySize + 1 : 1u);
+		for (uint32 Check = FirstUnchecked; Check <= LastFrame; ++Check)
+		{
+			LastChecked = Check;
+
+			//Applied before we joined, the server's hash was lost with a dropped batch, or our chain has a gap here
+			const uint32 Slot = Check % HistorySize;
+			if (LocalFrames[Slot] != Check || RemoteFrames[Slot] != Check || !Chained[Slot])
+			{
+				continue;
+			}
+			if (RemoteHashes[Slot] != HashHistory[Slot])
+			{
+				bDesynced = true;
+				return Check;
+			}
+		}
+		return 0;
+	}
+
+	/* Once a desync is reported the peer stops comparing, the first divergent frame is the interesting one */
+	bool bDesynced = false;
+
+private:
+	static uint32 BitCast(float Value)
+	{
+		uint32 Bits;
+		FMemory::Memcpy(&Bits, &Value, sizeof(Bits));
+		return Bits;
+	}
+
+	uint32 Frame = 0;
+	uint32 LastChecked = 0;
+	uint32 NewestRemote = 0;
+	uint32 LocalFrames[HistorySize] = {};
+	uint32 HashHistory[HistorySize] = {};
+	bool Chained[HistorySize] = {};
+	FUltimateSFCombatSnapshot SnapshotHistory[HistorySize];
+	uint32 RemoteFrames[HistorySize] = {};
+	uint32 RemoteHashes[HistorySize] = {};
+};
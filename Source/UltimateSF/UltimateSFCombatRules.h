@@ -0,0 +1,207 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+// No engine includes on purpose: these rules are shared by AUltimateSFCharacter, the batch simulation and any
+// tool that wants to exercise combat without a UObject, a world or a UE build.
+#include <cstdint>
+
+namespace UltimateSFCombatRules
+{
+	/* Same order as EUltimateSFMove */
+	enum class EMove : uint8_t
+	{
+		None,
+
+		//Punches
+		Jab,
+		LeftHook,
+		RightHook,
+		Straight,
+		UpperCut,
+
+		//Kicks
+		LowKick,
+		LeftMiddleKick,
+		RightMiddleKick,
+		HighKick,
+
+		Count
+	};
+
+	enum class EDodge : uint8_t
+	{
+		None,
+		Right,
+		Left
+	};
+
+	//Attack and dodge windows, in seconds
+	constexpr float PunchWindow = 0.5f;
+	constexpr float KickWindow = 1.1f;
+	constexpr float DodgeTime = 1.5f;
+	constexpr float DodgeBonusTime = 1.f;
+
+	//Montage play rates
+	constexpr float JabPlayRate = 1.5f;
+	constexpr float LowKickPlayRate = 1.5f;
+	constexpr float AttackPlayRate = 1.3f;
+	constexpr float DodgePlayRate = 1.f;
+
+	//Damage modifiers
+	constexpr float DodgeDamageMultiplier = 2.f;
+	constexpr float GuardDamageReducingValue = 3.f;
+
+	//MouseYVal thresholds
+	constexpr float StraightMouseY = -0.15f;
+	constexpr float UpperCutMouseY = 0.05f;
+	constexpr float HighKickMouseY = -0.05f;
+
+	/* Held keys and mouse at the moment of the attack */
+	struct FInput
+	{
+		bool bW = false;
+		bool bA = false;
+		bool bS = false;
+		bool bD = false;
+		float MouseY = 0.f;
+	};
+
+	/* The fighter's combat flags that gate attacks */
+	struct FFighter
+	{
+		bool bCombatMode = false;
+		bool bPunching = false;
+		bool bKicking = false;
+		bool bDodging = false;
+	};
+
+	struct FAttack
+	{
+		EMove Move = EMove::None;
+		float Damage = 0.f;
+		bool bLeftAttack = false;
+	};
+
+	/* Base damage of every move, indexed by EMove. The server caps the damage an attack RPC claims to this */
+	constexpr float MoveDamage[] = { 0.f, 5.f, 8.f, 8.f, 10.f, 15.f, 5.f, 10.f, 10.f, 20.f };
+	static_assert(sizeof(MoveDamage) / sizeof(MoveDamage[0]) == static_cast<int>(EMove::Count), "MoveDamage needs one entry per EMove");
+
+	inline float GetMoveDamage(EMove Move)
+	{
+		return Move < EMove::Count ? MoveDamage[static_cast<int>(Move)] : 0.f;
+	}
+
+	inline FAttack MakeAttack(EMove Move, bool bLeftAttack)
+	{
+		return { Move, GetMoveDamage(Move), bLeftAttack };
+	}
+
+	inline bool IsPunch(EMove Move)
+	{
+		return Move >= EMove::Jab && Move <= EMove::UpperCut;
+	}
+
+	inline bool IsKick(EMove Move)
+	{
+		return Move >= EMove::LowKick && Move <= EMove::HighKick;
+	}
+
+	/* Side the move comes from, the bLeftAttack SelectPunch and SelectKick give it */
+	inline bool IsLeftAttack(EMove Move)
+	{
+		return Move == EMove::Jab || Move == EMove::LeftHook || Move == EMove::UpperCut || Move == EMove::LeftMiddleKick;
+	}
+
+	/**
+	 * Whether the fighter may start the move at all, the gate of SelectPunch and SelectKick before the input picks one.
+	 * The server checks attack RPCs against it since it only learns the move, never the keys that chose it.
+	 */
+	inline bool CanStartAttack(EMove Move, const FFighter& Fighter)
+	{
+		if (!Fighter.bCombatMode)
+		{
+			return false;
+		}
+		if (IsPunch(Move))
+		{
+			return !Fighter.bPunching && !Fighter.bDodging;
+		}
+		//The low kick is the only attack that can come out while dodging
+		return IsKick(Move) && !Fighter.bKicking && (!Fighter.bDodging || Move == EMove::LowKick);
+	}
+
+	inline float GetPlayRate(EMove Move)
+	{
+		return Move == EMove::Jab ? JabPlayRate : (Move == EMove::LowKick ? LowKickPlayRate : AttackPlayRate);
+	}
+
+	/**
+	 * LeftMouse Click Or LeftMouse Click + W -> Jab
+	 * LeftMouse Click + A Or LeftMouse Click + W + A Or LeftMouse Click + S + A  -> LeftHook
+	 * LeftMouse Click + D Or LeftMouse Click + W + D Or LeftMouse Click + S + D  -> RightHook
+	 * LeftMouse Click + Mouse Forward -> Straight
+	 * LeftMouse Click + Mouse Back -> UpperCut
+	 */
+	inline FAttack SelectPunch(const FInput& Input, const FFighter& Fighter)
+	{
+		if (!CanStartAttack(EMove::Jab, Fighter))
+		{
+			return FAttack();
+		}
+		if (Input.bA)							{ return MakeAttack(EMove::LeftHook, true); }
+		if (Input.bD)							{ return MakeAttack(EMove::RightHook, false); }
+		if (Input.MouseY < StraightMouseY)		{ return MakeAttack(EMove::Straight, false); }
+		if (Input.MouseY > UpperCutMouseY)		{ return MakeAttack(EMove::UpperCut, true); }
+		return MakeAttack(EMove::Jab, true);
+	}
+
+	/**
+	 * RightMouse Click Or RightMouse Click + W -> LowKick
+	 * RightMouse Click + A Or RightMouse Click + W + A -> LeftMiddleKick
+	 * RightMouse Click + D Or RightMouse Click + W + D -> RightMiddleKick
+	 * RightMouse Click + Mouse Forward -> HighKick
+	 * The low kick is the only attack that can come out while dodging.
+	 */
+	inline FAttack SelectKick(const FInput& Input, const FFighter& Fighter)
+	{
+		if (!CanStartAttack(EMove::LowKick, Fighter))
+		{
+			return FAttack();
+		}
+		if (!Fighter.bDodging)
+		{
+			if (Input.bA)						{ return MakeAttack(EMove::LeftMiddleKick, true); }
+			if (Input.bD)						{ return MakeAttack(EMove::RightMiddleKick, false); }
+			if (Input.MouseY < HighKickMouseY)	{ return MakeAttack(EMove::HighKick, false); }
+		}
+		return MakeAttack(EMove::LowKick, false);
+	}
+
+	/* D or W dodges right, anything else left. Not possible mid attack */
+	inline EDodge SelectDodge(const FInput& Input, const FFighter& Fighter)
+	{
+		if (!Fighter.bCombatMode || Fighter.bKicking || Fighter.bPunching)
+		{
+			return EDodge::None;
+		}
+		return (Input.bD || Input.bW) ? EDodge::Right : EDodge::Left;
+	}
+
+	/* Guarding is blueprint driven on the character, but it is never allowed mid kick */
+	inline bool CanGuard(const FFighter& Fighter)
+	{
+		return Fighter.bCombatMode && !Fighter.bKicking;
+	}
+
+	/* Damage landing on the defender: boosted by the attacker's dodge multiplier, divided by the defender's guard */
+	inline float ApplyDamage(float Damage, float AttackerDamageMultiplier, float DefenderDamageReducingValue)
+	{
+		return Damage * AttackerDamageMultiplier / (DefenderDamageReducingValue > 1.f ? DefenderDamageReducingValue : 1.f);
+	}
+
+	inline float GetAttackWindow(EMove Move)
+	{
+		return IsKick(Move) ? KickWindow : PunchWindow;
+	}
+}
@@ -0,0 +1,315 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFCombatSim.h"
+#include "UltimateSF.h"
+#include "UltimateSFCombatRules.h"
+#include "Async/ParallelFor.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+
+namespace
+{
+	//UltimateSFCombatRules windows, in frames at 60 Hz
+	constexpr uint16 PunchFrameCount = static_cast<uint16>(UltimateSFCombatRules::PunchWindow * FUltimateSFCombatSim::FrameRate + 0.5f);
+	constexpr uint16 KickFrameCount = static_cast<uint16>(UltimateSFCombatRules::KickWindow * FUltimateSFCombatSim::FrameRate + 0.5f);
+	constexpr uint16 DodgeFrameCount = static_cast<uint16>(UltimateSFCombatRules::DodgeTime * FUltimateSFCombatSim::FrameRate + 0.5f);
+	constexpr uint16 DodgeBonusFrameCount = static_cast<uint16>(UltimateSFCombatRules::DodgeBonusTime * FUltimateSFCombatSim::FrameRate + 0.5f);
+
+	constexpr float CombatSpeed = 100.f;		// DefaultCombatSpeed
+	constexpr float CombatDashSpeed = 200.f;	// DefaultCombatDashSpeed
+
+	constexpr float MaxHealth = 100.f;
+	constexpr float PunchReach = 110.f;
+	constexpr float KickReach = 140.f;
+	constexpr float MinDistance = 40.f;
+
+	constexpr int32 EnvsPerTask = 256;
+
+	/* Turns an action word into the held keys and mouse the rules expect */
+	UltimateSFCombatRules::FInput MakeRulesInput(uint16 Action)
+	{
+		UltimateSFCombatRules::FInput Input;
+		Input.bW = (Action & FUltimateSFCombatSim::Action_W) != 0;
+		Input.bA = (Action & FUltimateSFCombatSim::Action_A) != 0;
+		Input.bS = (Action & FUltimateSFCombatSim::Action_S) != 0;
+		Input.bD = (Action & FUltimateSFCombatSim::Action_D) != 0;
+		Input.MouseY = (Action & FUltimateSFCombatSim::Action_MouseForward) ? -1.f : ((Action & FUltimateSFCombatSim::Action_MouseBack) ? 1.f : 0.f);
+		return Input;
+	}
+
+	uint32 NextRandom(uint32& State)
+	{
+		//xorshift32
+		State ^= State << 13;
+		State ^= State >> 17;
+		State ^= State << 5;
+		return State;
+	}
+}
+
+FUltimateSFCombatSim::FUltimateSFCombatSim(int32 InNumEnvs, uint32 Seed)
+	: NumEnvs(FMath::Max(1, InNumEnvs))
+{
+	const int32 NumFighters = GetNumFighters();
+
+	Position.SetNumZeroed(NumFighters);
+	Health.SetNumZeroed(NumFighters);
+	DamageMultiplier.SetNumZeroed(NumFighters);
+	DamageReducingValue.SetNumZeroed(NumFighters);
+	AttackFrames.SetNumZeroed(NumFighters);
+	DodgeFrames.SetNumZeroed(NumFighters);
+	DodgeBonusFrames.SetNumZeroed(NumFighters);
+	PrevActions.SetNumZeroed(NumFighters);
+	Flags.SetNumZeroed(NumFighters);
+	CurrentMove.SetNumZeroed(NumFighters);
+
+	EpisodeFrame.SetNumZeroed(NumEnvs);
+	RandomState.SetNumUninitialized(NumEnvs);
+	for (int32 Env = 0; Env < NumEnvs; ++Env)
+	{
+		RandomState[Env] = (Seed + 1) * 0x9E3779B9u ^ (Env + 1) * 0x85EBCA6Bu;
+		RandomState[Env] = RandomState[Env] != 0 ? RandomState[Env] : 1;
+	}
+
+	Actions.SetNumZeroed(NumFighters);
+	Observations.SetNumZeroed(NumFighters * ObservationSize);
+	Rewards.SetNumZeroed(NumFighters);
+	Dones.SetNumZeroed(NumEnvs);
+
+	Reset();
+}
+
+void FUltimateSFCombatSim::Reset()
+{
+	for (int32 Env = 0; Env < NumEnvs; ++Env)
+	{
+		ResetEnv(Env);
+		WriteObservations(Env);
+	}
+}
+
+void FUltimateSFCombatSim::ResetEnv(int32 Env)
+{
+	const float StartDistance = 200.f + (NextRandom(RandomState[Env]) % 200);
+
+	for (int32 Side = 0; Side < FightersPerEnv; ++Side)
+	{
+		const int32 Fighter = Env * FightersPerEnv + Side;
+		Position[Fighter] = Side == 0 ? -StartDistance * 0.5f : StartDistance * 0.5f;
+		Health[Fighter] = MaxHealth;
+		DamageMultiplier[Fighter] = 1.f;
+		DamageReducingValue[Fighter] = 1.f;
+		AttackFrames[Fighter] = 0;
+		DodgeFrames[Fighter] = 0;
+		DodgeBonusFrames[Fighter] = 0;
+		PrevActions[Fighter] = 0;
+		Flags[Fighter] = 0;
+		CurrentMove[Fighter] = static_cast<uint8>(UltimateSFCombatRules::EMove::None);
+	}
+	EpisodeFrame[Env] = 0;
+}
+
+void FUltimateSFCombatSim::Step()
+{
+	const int32 NumTasks = FMath::DivideAndRoundUp(NumEnvs, EnvsPerTask);
+	ParallelFor(NumTasks, [this](int32 Task)
+	{
+		StepEnvs(Task * EnvsPerTask, FMath::Min(NumEnvs, (Task + 1) * EnvsPerTask));
+	});
+}
+
+void FUltimateSFCombatSim::StepEnvs(int32 FirstEnv, int32 EndEnv)
+{
+	constexpr uint16 DirectionKeys = Action_W | Action_A | Action_S | Action_D;
+
+	for (int32 Env = FirstEnv; Env < EndEnv; ++Env)
+	{
+		const int32 First = Env * FightersPerEnv;
+		const float Distance = Position[First + 1] - Position[First];
+		float PendingDamage[FightersPerEnv] = { 0.f, 0.f };
+
+		for (int32 Side = 0; Side < FightersPerEnv; ++Side)
+		{
+			const int32 Fighter = First + Side;
+			const uint16 Action = Actions[Fighter];
+			uint8 FighterFlags = Flags[Fighter];
+
+			Rewards[Fighter] = 0.f;
+
+			//Timers
+			if (AttackFrames[Fighter] > 0 && --AttackFrames[Fighter] == 0)
+			{
+				FighterFlags &= ~(Flag_Punching | Flag_Kicking | Flag_LeftAttack);
+				CurrentMove[Fighter] = static_cast<uint8>(UltimateSFCombatRules::EMove::None);
+			}
+			if (DodgeFrames[Fighter] > 0 && --DodgeFrames[Fighter] == 0)
+			{
+				FighterFlags &= ~Flag_Dodging;
+				DodgeBonusFrames[Fighter] = DodgeBonusFrameCount;
+			}
+			else if (DodgeBonusFrames[Fighter] > 0 && --DodgeBonusFrames[Fighter] == 0)
+			{
+				FighterFlags &= ~Flag_HasDodged;
+				DamageMultiplier[Fighter] = 1.f;
+			}
+
+			//IsWPressed/IsWReleased and friends clear the attack flags
+			if ((Action ^ PrevActions[Fighter]) & DirectionKeys)
+			{
+				FighterFlags &= ~(Flag_Punching | Flag_Kicking);
+			}
+			PrevActions[Fighter] = Action;
+
+			const UltimateSFCombatRules::FInput Input = MakeRulesInput(Action);
+			UltimateSFCombatRules::FFighter Rules;
+			Rules.bCombatMode = true;
+			Rules.bPunching = (FighterFlags & Flag_Punching) != 0;
+			Rules.bKicking = (FighterFlags & Flag_Kicking) != 0;
+			Rules.bDodging = (FighterFlags & Flag_Dodging) != 0;
+
+			//Guard
+			const bool bGuarding = (Action & Action_Guard) && UltimateSFCombatRules::CanGuard(Rules);
+			FighterFlags = bGuarding ? (FighterFlags | Flag_Guarding) : (FighterFlags & ~Flag_Guarding);
+			DamageReducingValue[Fighter] = bGuarding ? UltimateSFCombatRules::GuardDamageReducingValue : 1.f;
+
+			//DodgingFire
+			if ((Action & Action_Dodge) && UltimateSFCombatRules::SelectDodge(Input, Rules) != UltimateSFCombatRules::EDodge::None)
+			{
+				FighterFlags |= Flag_Dodging | Flag_HasDodged;
+				DamageMultiplier[Fighter] = UltimateSFCombatRules::DodgeDamageMultiplier;
+				DodgeFrames[Fighter] = DodgeFrameCount;
+				DodgeBonusFrames[Fighter] = 0;
+				Rules.bDodging = true;
+			}
+
+			//LeftMouseAttack / RightMouseAttack
+			UltimateSFCombatRules::FAttack Attack;
+			if (Action & Action_LeftMouse)
+			{
+				Attack = UltimateSFCombatRules::SelectPunch(Input, Rules);
+			}
+			if (Attack.Move == UltimateSFCombatRules::EMove::None && (Action & Action_RightMouse))
+			{
+				Attack = UltimateSFCombatRules::SelectKick(Input, Rules);
+			}
+			if (Attack.Move != UltimateSFCombatRules::EMove::None)
+			{
+				const bool bKick = UltimateSFCombatRules::IsKick(Attack.Move);
+				FighterFlags = (FighterFlags | (bKick ? Flag_Kicking : Flag_Punching)) & ~Flag_LeftAttack;
+				FighterFlags |= Attack.bLeftAttack ? Flag_LeftAttack : 0;
+				AttackFrames[Fighter] = bKick ? KickFrameCount : PunchFrameCount;
+				CurrentMove[Fighter] = static_cast<uint8>(Attack.Move);
+				PendingDamage[Side] = Distance <= (bKick ? KickReach : PunchReach) ? Attack.Damage : 0.f;
+			}
+
+			//Movement along the fight line, W towards the opponent and S away
+			const float Speed = (Action & Action_Sprint) ? CombatDashSpeed : CombatSpeed;
+			const float Direction = ((Action & Action_W) ? 1.f : 0.f) - ((Action & Action_S) ? 1.f : 0.f);
+			Position[Fighter] += Direction * Speed * (Side == 0 ? 1.f : -1.f) / FrameRate;
+
+			Flags[Fighter] = FighterFlags;
+		}
+
+		//Fighters cannot walk through each other
+		const float NewDistance = Position[First + 1] - Position[First];
+		if (NewDistance < MinDistance)
+		{
+			const float Push = (MinDistance - NewDistance) * 0.5f;
+			Position[First] -= Push;
+			Position[First + 1] += Push;
+		}
+
+		//Hits resolve simultaneously as AUltimateSFCharacter::ReceiveHit does: a dodge gives no cover, the attacker's
+		//multiplier boosts the damage and the defender's guard divides it
+		for (int32 Side = 0; Side < FightersPerEnv; ++Side)
+		{
+			const int32 Attacker = First + Side;
+			const int32 Defender = First + (Side ^ 1);
+			const float Damage = UltimateSFCombatRules::ApplyDamage(PendingDamage[Side], DamageMultiplier[Attacker], DamageReducingValue[Defender]);
+
+			Health[Defender] -= Damage;
+			Rewards[Attacker] += Damage / MaxHealth;
+			Rewards[Defender] -= Damage / MaxHealth;
+		}
+
+		++EpisodeFrame[Env];
+
+		const bool bKnockout = Health[First] <= 0.f || Health[First + 1] <= 0.f;
+		const bool bDone = bKnockout || EpisodeFrame[Env] >= MaxEpisodeFrames;
+		Dones[Env] = bDone ? 1 : 0;
+		if (bDone)
+		{
+			//The fighter with more health left wins the round
+			const float Margin = Health[First] - Health[First + 1];
+			const float Outcome = Margin > 0.f ? 1.f : (Margin < 0.f ? -1.f : 0.f);
+			Rewards[First] += Outcome;
+			Rewards[First + 1] -= Outcome;
+
+			ResetEnv(Env);
+		}
+
+		WriteObservations(Env);
+	}
+}
+
+void FUltimateSFCombatSim::WriteObservations(int32 Env)
+{
+	const int32 First = Env * FightersPerEnv;
+	const float Distance = Position[First + 1] - Position[First];
+	const float TimeLeft = 1.f - static_cast<float>(EpisodeFrame[Env]) / MaxEpisodeFrames;
+
+	for (int32 Side = 0; Side < FightersPerEnv; ++Side)
+	{
+		const int32 Self = First + Side;
+		const int32 Other = First + (Side ^ 1);
+		float* Obs = &Observations[Self * ObservationSize];
+
+		Obs[0] = Health[Self] / MaxHealth;
+		Obs[1] = Health[Other] / MaxHealth;
+		Obs[2] = Distance / 1000.f;
+		Obs[3] = TimeLeft;
+		Obs[4] = DamageMultiplier[Self] - 1.f;
+		Obs[5] = AttackFrames[Self] / static_cast<float>(KickFrameCount);
+		Obs[6] = (Flags[Self] & Flag_Punching) ? 1.f : 0.f;
+		Obs[7] = (Flags[Self] & Flag_Kicking) ? 1.f : 0.f;
+		Obs[8] = (Flags[Self] & Flag_Dodging) ? 1.f : 0.f;
+		Obs[9] = (Flags[Self] & Flag_HasDodged) ? 1.f : 0.f;
+		Obs[10] = (Flags[Self] & Flag_Guarding) ? 1.f : 0.f;
+		Obs[11] = (Flags[Other] & Flag_Punching) ? 1.f : 0.f;
+		Obs[12] = (Flags[Other] & Flag_Kicking) ? 1.f : 0.f;
+		Obs[13] = (Flags[Other] & Flag_Dodging) ? 1.f : 0.f;
+		Obs[14] = (Flags[Other] & Flag_Guarding) ? 1.f : 0.f;
+		Obs[15] = CurrentMove[Other] / static_cast<float>(UltimateSFCombatRules::EMove::Count);
+	}
+}
+
+//Throughput check, e.g. "usf.Sim.Bench 16384 2000"
+static FAutoConsoleCommand SimBenchCommand(
+	TEXT("usf.Sim.Bench"),
+	TEXT("Steps N envs of random play for M frames and logs simulated frames per second. Args: [NumEnvs] [Frames]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const int32 NumEnvs = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 16384;
+		const int32 NumFrames = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 1000;
+
+		FUltimateSFCombatSim Sim(NumEnvs);
+		uint32 ActionSeed = 12345;
+
+		double StepSeconds = 0.0;
+		for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+		{
+			uint16* Actions = Sim.GetActions();
+			for (int32 Fighter = 0; Fighter < Sim.GetNumFighters(); ++Fighter)
+			{
+				Actions[Fighter] = static_cast<uint16>(NextRandom(ActionSeed) & 0x7FF);
+			}
+
+			const double Start = FPlatformTime::Seconds();
+			Sim.Step();
+			StepSeconds += FPlatformTime::Seconds() - Start;
+		}
+
+		const double EnvFrames = static_cast<double>(NumEnvs) * NumFrames;
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.Sim.Bench: %d envs x %d frames in %.3f s -> %.2f M env frames/s"),
+			NumEnvs, NumFrames, StepSeconds, EnvFrames / FMath::Max(StepSeconds, 1e-9) / 1e6);
+	}));
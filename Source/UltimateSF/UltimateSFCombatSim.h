@@ -0,0 +1,103 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Headless batch simulation of 1v1 fights for training fighting AIs.
+ * Thousands of independent fights are stepped in lockstep at a fixed 60 Hz using the same attack selection,
+ * damage, dodge multiplier and guard rules as AUltimateSFCharacter, without a world, actors or timers.
+ *
+ * All state lives in flat arrays indexed by fighter (Env * 2 + Side). Callers write one action word per fighter
+ * into GetActions(), call Step(), and read observations, rewards and done flags back from contiguous buffers.
+ * Envs that finish are reset automatically; their observation row already belongs to the next episode.
+ */
+class FUltimateSFCombatSim
+{
+public:
+	/* Action word bits, mirroring the character's input bindings */
+	enum EActionBits : uint16
+	{
+		Action_W			= 1 << 0,
+		Action_A			= 1 << 1,
+		Action_S			= 1 << 2,
+		Action_D			= 1 << 3,
+		Action_LeftMouse	= 1 << 4,
+		Action_RightMouse	= 1 << 5,
+		Action_Dodge		= 1 << 6,
+		Action_Guard		= 1 << 7,
+		Action_Sprint		= 1 << 8,
+		Action_MouseForward	= 1 << 9,	// MouseYVal pushed forward (negative)
+		Action_MouseBack	= 1 << 10	// MouseYVal pulled back (positive)
+	};
+
+	static constexpr int32 FightersPerEnv = 2;
+	static constexpr int32 ObservationSize = 16;
+	static constexpr float FrameRate = 60.f;
+
+	explicit FUltimateSFCombatSim(int32 InNumEnvs, uint32 Seed = 1);
+
+	int32 GetNumEnvs() const { return NumEnvs; }
+	int32 GetNumFighters() const { return NumEnvs * FightersPerEnv; }
+
+	/* [NumFighters] action words, written by the caller before Step() */
+	uint16* GetActions() { return Actions.GetData(); }
+
+	/* [NumFighters * ObservationSize] floats */
+	const float* GetObservations() const { return Observations.GetData(); }
+
+	/* [NumFighters] reward earned during the last Step() */
+	const float* GetRewards() const { return Rewards.GetData(); }
+
+	/* [NumEnvs] 1 if the env finished during the last Step() and was reset */
+	const uint8* GetDones() const { return Dones.GetData(); }
+
+	/* Starts a new episode in every env */
+	void Reset();
+
+	/* Advances every env one frame, spread across worker threads */
+	void Step();
+
+	/* Fights are capped at this many frames (99 seconds) */
+	int32 MaxEpisodeFrames = 99 * 60;
+
+private:
+	enum EFlagBits : uint8
+	{
+		Flag_Punching	= 1 << 0,
+		Flag_Kicking	= 1 << 1,
+		Flag_Dodging	= 1 << 2,
+		Flag_HasDodged	= 1 << 3,
+		Flag_Guarding	= 1 << 4,
+		Flag_LeftAttack	= 1 << 5
+	};
+
+	void StepEnvs(int32 FirstEnv, int32 EndEnv);
+	void ResetEnv(int32 Env);
+	void WriteObservations(int32 Env);
+
+	int32 NumEnvs;
+
+	//Per fighter
+	TArray<float> Position;
+	TArray<float> Health;
+	TArray<float> DamageMultiplier;
+	TArray<float> DamageReducingValue;
+	TArray<uint16> AttackFrames;
+	TArray<uint16> DodgeFrames;
+	TArray<uint16> DodgeBonusFrames;
+	TArray<uint16> PrevActions;
+	TArray<uint8> Flags;
+	TArray<uint8> CurrentMove;
+
+	//Per env
+	TArray<int32> EpisodeFrame;
+	TArray<uint32> RandomState;
+
+	//Caller facing buffers
+	TArray<uint16> Actions;
+	TArray<float> Observations;
+	TArray<float> Rewards;
+	TArray<uint8> Dones;
+};
@@ -0,0 +1,270 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UltimateSFCombatRules.h"
+#include "UltimateSFCombatTypes.generated.h"
+
+/* Every move in the fighter's move set, in the order the attack handlers check them */
+UENUM(BlueprintType)
+enum class EUltimateSFMove : uint8
+{
+	None,
+
+	//Punches
+	Jab,
+	LeftHook,
+	RightHook,
+	Straight,
+	UpperCut,
+
+	//Kicks
+	LowKick,
+	LeftMiddleKick,
+	RightMiddleKick,
+	HighKick,
+
+	MAX UMETA(Hidden)
+};
+
+static_assert(static_cast<uint8>(EUltimateSFMove::MAX) == static_cast<uint8>(UltimateSFCombatRules::EMove::Count), "EUltimateSFMove must mirror UltimateSFCombatRules::EMove");
+static_assert(static_cast<uint8>(EUltimateSFMove::UpperCut) == static_cast<uint8>(UltimateSFCombatRules::EMove::UpperCut), "EUltimateSFMove must mirror UltimateSFCombatRules::EMove");
+static_assert(static_cast<uint8>(EUltimateSFMove::HighKick) == static_cast<uint8>(UltimateSFCombatRules::EMove::HighKick), "EUltimateSFMove must mirror UltimateSFCombatRules::EMove");
+
+FORCEINLINE EUltimateSFMove ToUltimateSFMove(UltimateSFCombatRules::EMove Move)
+{
+	return static_cast<EUltimateSFMove>(Move);
+}
+
+FORCEINLINE UltimateSFCombatRules::EMove ToRulesMove(EUltimateSFMove Move)
+{
+	return static_cast<UltimateSFCombatRules::EMove>(Move);
+}
+
+/* Phases of an attack marked on its montage by UUltimateSFHitWindowNotifyState */
+UENUM(BlueprintType)
+enum class EUltimateSFHitWindow : uint8
+{
+	/* The strike can land */
+	Active,
+	/* Follow through, no new attack until it ends */
+	Recovery
+};
+
+/* Attack timing resolved from a montage at a play rate, in seconds from the montage start */
+USTRUCT(BlueprintType)
+struct FUltimateSFAttackFrameData
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = Combat)
+	float ActiveStart = 0.f;
+
+	UPROPERTY(BlueprintReadOnly, Category = Combat)
+	float ActiveEnd = 0.f;
+
+	/* The attack flags clear here */
+	UPROPERTY(BlueprintReadOnly, Category = Combat)
+	float RecoveryEnd = 0.f;
+
+	/* False when the montage has no hit window notifies and the timing falls back to its length */
+	UPROPERTY(BlueprintReadOnly, Category = Combat)
+	bool bFromNotifies = false;
+};
+
+/* What a HUD has to redraw, coalesced per frame by AUltimateSFCharacter */
+UENUM(BlueprintType, meta = (Bitflags, UseEnumValuesAsMaskValuesInEditor = "true"))
+enum class EUltimateSFHUDChange : uint8
+{
+	None = 0 UMETA(Hidden),
+
+	/* DamageRecieved, round health in AUltimateSFGameState */
+	Health = 1 << 0,
+	/* DamageDealt by the last attack, DamageMultiplier and bHasDodged, the dodge bonus carried into the next attack */
+	Combo = 1 << 1,
+	/* bIsCombatMode, bIsGuarding, bIsSprinting */
+	State = 1 << 2
+};
+ENUM_CLASS_FLAGS(EUltimateSFHUDChange);
+
+/* Side of the victim the hit came from, relative to the victim's facing */
+UENUM(BlueprintType)
+enum class EUltimateSFHitDirection : uint8
+{
+	Front,
+	Right,
+	Back,
+	Left
+};
+
+/**
+ * Compact hit event sent from the server to every client.
+ * Four bytes on the wire: move, quantized direction, quantized damage and flags.
+ */
+USTRUCT(BlueprintType)
+struct FUltimateSFHitEvent
+{
+	GENERATED_BODY()
+
+	/* EUltimateSFMove of the attack that landed */
+	UPROPERTY()
+	uint8 Move = 0;
+
+	/* Attacker direction relative to the victim's facing, 256 steps per turn */
+	UPROPERTY()
+	uint8 Direction = 0;
+
+	/* Damage in half point steps */
+	UPROPERTY()
+	uint8 Damage = 0;
+
+	/* Bit 0: knockdown, bit 1: guarded */
+	UPROPERTY()
+	uint8 Flags = 0;
+
+	static constexpr uint8 FlagKnockdown = 1 << 0;
+	static constexpr uint8 FlagGuarded = 1 << 1;
+
+	EUltimateSFMove GetMove() const { return static_cast<EUltimateSFMove>(Move); }
+	float GetDamage() const { return Damage * 0.5f; }
+	float GetDirectionYaw() const { return Direction * (360.f / 256.f); }
+	bool IsKnockdown() const { return (Flags & FlagKnockdown) != 0; }
+	bool IsGuarded() const { return (Flags & FlagGuarded) != 0; }
+
+	/* Maps the relative yaw onto one of four reaction directions */
+	EUltimateSFHitDirection GetHitDirection() const
+	{
+		return static_cast<EUltimateSFHitDirection>(((Direction + 32) & 0xFF) >> 6);
+	}
+
+	static FUltimateSFHitEvent Make(EUltimateSFMove InMove, float RelativeYaw, float InDamage, bool bKnockdown, bool bGuarded)
+	{
+		FUltimateSFHitEvent Event;
+		Event.Move = static_cast<uint8>(InMove);
+		Event.Direction = static_cast<uint8>(FMath::RoundToInt(FRotator::ClampAxis(RelativeYaw) * (256.f / 360.f)) & 0xFF);
+		Event.Damage = static_cast<uint8>(FMath::Clamp(FMath::RoundToInt(InDamage * 2.f), 0, 255));
+		Event.Flags = (bKnockdown ? FlagKnockdown : 0) | (bGuarded ? FlagGuarded : 0);
+		return Event;
+	}
+};
+
+/**
+ * Carried by every attack RPC so each hop of input -> server -> multicast -> montage can be timed.
+ * Times are on the replicated server clock (AGameStateBase::GetServerWorldTimeSeconds), so the hops stay
+ * measurable under Net PktLag / PktLagVariance emulation.
+ */
+USTRUCT()
+struct FUltimateSFInputStamp
+{
+	GENERATED_BODY()
+
+	/* Per character attack counter, wraps */
+	UPROPERTY()
+	uint16 Sequence = 0;
+
+	/* Server clock when the owning client sampled the input. Double: a float has only ~8 ms steps after a day of uptime */
+	UPROPERTY()
+	double InputTime = 0.0;
+
+	/* Server clock when the server sent the multicast */
+	UPROPERTY()
+	double ServerTime = 0.0;
+
+	/* The owner already started the montage, Sequence is its prediction key */
+	UPROPERTY()
+	bool bPredicted = false;
+
+	/* Server combat frame of the multicast carrying this stamp, see FUltimateSFCombatChecksum */
+	UPROPERTY()
+	uint32 CombatFrame = 0;
+};
+
+/**
+ * Quantized descriptor of a character's combat state, replicated as one property instead of one per flag and float.
+ * Flags are packed in bit order of the character's combat flag list, damage is in quarter points and the two
+ * damage modifiers in sixteenths, which holds every value the combat rules produce except a guarded fraction.
+ */
+USTRUCT()
+struct FUltimateSFNetCombatState
+{
+	GENERATED_BODY()
+
+	static constexpr int32 NumFlags = 19;
+	static constexpr uint8 ModifierOne = 16;
+
+	UPROPERTY()
+	uint32 Flags = 0;
+
+	UPROPERTY()
+	uint16 DamageDealt = 0;
+
+	UPROPERTY()
+	uint16 DamageRecieved = 0;
+
+	UPROPERTY()
+	uint8 DamageMultiplier = ModifierOne;
+
+	UPROPERTY()
+	uint8 DamageReducingValue = ModifierOne;
+
+	static uint16 QuantizeDamage(float Damage) { return (uint16)FMath::Clamp(FMath::RoundToInt(Damage * 4.f), 0, (int32)MAX_uint16); }
+	static float DequantizeDamage(uint16 Damage) { return Damage * 0.25f; }
+	static uint8 QuantizeModifier(float Modifier) { return (uint8)FMath::Clamp(FMath::RoundToInt(Modifier * 16.f), 0, 255); }
+	static float DequantizeModifier(uint8 Modifier) { return Modifier / 16.f; }
+
+	bool operator==(const FUltimateSFNetCombatState& Other) const
+	{
+		return Flags == Other.Flags && DamageDealt == Other.DamageDealt && DamageRecieved == Other.DamageRecieved
+			&& DamageMultiplier == Other.DamageMultiplier && DamageReducingValue == Other.DamageReducingValue;
+	}
+
+	bool NetSerialize(FArchive& Ar, class UPackageMap* Map, bool& bOutSuccess)
+	{
+		if (Ar.IsLoading())
+		{
+			Flags = 0;
+		}
+		Ar.SerializeBits(&Flags, NumFlags);
+
+		uint32 Dealt = DamageDealt;
+		uint32 Recieved = DamageRecieved;
+		Ar.SerializeIntPacked(Dealt);
+		Ar.SerializeIntPacked(Recieved);
+		DamageDealt = (uint16)Dealt;
+		DamageRecieved = (uint16)Recieved;
+
+		//Both modifiers sit at one outside of guards and dodge bonuses, a single bit each then
+		uint8 DefaultModifiers = Ar.IsLoading() ? 0 : (DamageMultiplier == ModifierOne ? 1 : 0) | (DamageReducingValue == ModifierOne ? 2 : 0);
+		Ar.SerializeBits(&DefaultModifiers, 2);
+		if (!(DefaultModifiers & 1))
+		{
+			Ar << DamageMultiplier;
+		}
+		else
+		{
+			DamageMultiplier = ModifierOne;
+		}
+		if (!(DefaultModifiers & 2))
+		{
+			Ar << DamageReducingValue;
+		}
+		else
+		{
+			DamageReducingValue = ModifierOne;
+		}
+
+		bOutSuccess = !Ar.IsError();
+		return true;
+	}
+};
+
+template<>
+struct TStructOpsTypeTraits<FUltimateSFNetCombatState> : public TStructOpsTypeTraitsBase2<FUltimateSFNetCombatState>
+{
+	enum
+	{
+		WithNetSerializer = true,
+		WithIdenticalViaEquality = true
+	};
+};
@@ -0,0 +1,940 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFCrowd.h"
+#include "UltimateSF.h"
+#include "UltimateSFCharacter.h"
+#include "UltimateSFBotController.h"
+#include "UltimateSFCombatRules.h"
+#include "UltimateSFFighterGridSubsystem.h"
+#include "UltimateSFGameMode.h"
+#include "MassCommonFragments.h"
+#include "MassEntitySubsystem.h"
+#include "MassExecutionContext.h"
+#include "Algo/Sort.h"
+#include "Animation/AnimInstance.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "Containers/Ticker.h"
+#include "Engine/World.h"
+#include "GameFramework/GameModeBase.h"
+#include "GameFramework/GameStateBase.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+#include "Misc/App.h"
+#include "Net/UnrealNetwork.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF Crowd"), STATGROUP_UltimateSFCrowd, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Crowd Combat"), STAT_UltimateSFCrowdCombat, STATGROUP_UltimateSFCrowd);
+DECLARE_CYCLE_STAT(TEXT("Crowd Movement"), STAT_UltimateSFCrowdMovement, STATGROUP_UltimateSFCrowd);
+DECLARE_CYCLE_STAT(TEXT("Crowd Representation"), STAT_UltimateSFCrowdRepresentation, STATGROUP_UltimateSFCrowd);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Crowd Fighters"), STAT_UltimateSFCrowdFighters, STATGROUP_UltimateSFCrowd);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Crowd Visible"), STAT_UltimateSFCrowdVisible, STATGROUP_UltimateSFCrowd);
+
+static TAutoConsoleVariable<float> CVarCrowdEngageRadius(
+	TEXT("usf.Crowd.EngageRadius"),
+	250.f,
+	TEXT("A player in combat mode this close to an ambient fighter promotes it to a full character, 0 disables promotion."));
+
+static TAutoConsoleVariable<int32> CVarCrowdMaxVisible(
+	TEXT("usf.Crowd.MaxVisible"),
+	256,
+	TEXT("Ambient fighters drawn at once, the nearest to the view win."));
+
+static TAutoConsoleVariable<float> CVarCrowdDrawDistance(
+	TEXT("usf.Crowd.DrawDistance"),
+	6000.f,
+	TEXT("Ambient fighters further than this from the view are not drawn."));
+
+namespace
+{
+	using FCombatFragment = FUltimateSFCrowdCombatFragment;
+
+	constexpr float MaxHealth = 100.f;
+	constexpr float KnockdownSeconds = 4.f;
+
+	constexpr float CombatSpeed = 100.f;		// DefaultCombatSpeed
+	constexpr float CombatDashSpeed = 200.f;	// DefaultCombatDashSpeed
+	constexpr float StrafeSpeed = 40.f;
+
+	constexpr float PunchReach = 110.f;
+	constexpr float KickReach = 140.f;
+	constexpr float FightRange = 100.f;
+	constexpr float MinDistance = 60.f;
+	constexpr float LeashRadius = 300.f;
+
+	constexpr float PromotionInterval = 0.25f;
+
+	//Processing time of both processors, read by usf.Crowd.Bench
+	double CrowdProcessingSeconds = 0.0;
+
+	uint32 NextRandom(uint32& State)
+	{
+		//xorshift32
+		State ^= State << 13;
+		State ^= State >> 17;
+		State ^= State << 5;
+		return State;
+	}
+
+	float RandomUnit(uint32& State)
+	{
+		return (NextRandom(State) & 0xFFFF) / 65535.f;
+	}
+
+	UltimateSFCombatRules::FFighter MakeRulesFighter(const FCombatFragment& Fighter)
+	{
+		UltimateSFCombatRules::FFighter Rules;
+		Rules.bCombatMode = true;
+		Rules.bPunching = (Fighter.Flags & FCombatFragment::Flag_Punching) != 0;
+		Rules.bKicking = (Fighter.Flags & FCombatFragment::Flag_Kicking) != 0;
+		Rules.bDodging = (Fighter.Flags & FCombatFragment::Flag_Dodging) != 0;
+		return Rules;
+	}
+
+	/* Held keys and mouse a player could have had, one direction key at most */
+	UltimateSFCombatRules::FInput MakeRandomInput(uint32& State)
+	{
+		UltimateSFCombatRules::FInput Input;
+		const uint32 Keys = NextRandom(State) % 6;
+		Input.bW = Keys == 1;
+		Input.bA = Keys == 2;
+		Input.bS = Keys == 3;
+		Input.bD = Keys == 4;
+		const uint32 Mouse = NextRandom(State) % 3;
+		Input.MouseY = Mouse == 0 ? -1.f : (Mouse == 1 ? 1.f : 0.f);
+		return Input;
+	}
+
+	/* Lands the attack started HitTime ago unless the defender walked out of reach, the way AUltimateSFCharacter::ReceiveHit does */
+	void ResolveHit(UMassEntitySubsystem& EntitySubsystem, FCombatFragment& Attacker, const FVector& AttackerLocation)
+	{
+		FCombatFragment* Defender = EntitySubsystem.IsEntityValid(Attacker.Opponent) ? EntitySubsystem.GetFragmentDataPtr<FCombatFragment>(Attacker.Opponent) : nullptr;
+		const FTransformFragment* DefenderTransform = Defender ? EntitySubsystem.GetFragmentDataPtr<FTransformFragment>(Attacker.Opponent) : nullptr;
+		if (Defender == nullptr || DefenderTransform == nullptr || (Defender->Flags & FCombatFragment::Flag_Knockdown))
+		{
+			return;
+		}
+
+		const float Reach = UltimateSFCombatRules::IsKick((UltimateSFCombatRules::EMove)Attacker.Move) ? KickReach : PunchReach;
+		if (FVector::DistSquared2D(AttackerLocation, DefenderTransform->GetTransform().GetLocation()) > FMath::Square(Reach))
+		{
+			return;
+		}
+
+		//A dodge gives no cover, only the attacker's multiplier as the hit lands and the defender's guard count
+		const float Damage = UltimateSFCombatRules::ApplyDamage(Attacker.PendingDamage, Attacker.DamageMultiplier, Defender->DamageReducingValue);
+		Attacker.DamageDealt += Damage;
+		Defender->DamageRecieved += Damage;
+		Defender->Health -= Damage;
+		if (Defender->Health <= 0.f)
+		{
+			Defender->Flags = FCombatFragment::Flag_Knockdown;
+			Defender->KnockdownTime = KnockdownSeconds;
+			Defender->HitTime = -1.f;
+			Defender->Move = 0;
+		}
+	}
+
+	void StepFighter(UMassEntitySubsystem& EntitySubsystem, FCombatFragment& Fighter, const FVector& Location, float DeltaTime)
+	{
+		if (Fighter.Flags & FCombatFragment::Flag_Knockdown)
+		{
+			Fighter.KnockdownTime -= DeltaTime;
+			if (Fighter.KnockdownTime <= 0.f)
+			{
+				//Back up for the next round
+				Fighter.Health = MaxHealth;
+				Fighter.Flags = 0;
+				Fighter.DamageMultiplier = 1.f;
+				Fighter.DamageReducingValue = 1.f;
+			}
+			return;
+		}
+
+		//Timers
+		if (Fighter.AttackTime > 0.f && (Fighter.AttackTime -= DeltaTime) <= 0.f)
+		{
+			Fighter.Flags &= ~(FCombatFragment::Flag_Punching | FCombatFragment::Flag_Kicking);
+			Fighter.Move = 0;
+		}
+		if (Fighter.DodgeTime > 0.f)
+		{
+			if ((Fighter.DodgeTime -= DeltaTime) <= 0.f)
+			{
+				Fighter.Flags &= ~FCombatFragment::Flag_Dodging;
+				Fighter.DodgeBonusTime = UltimateSFCombatRules::DodgeBonusTime;
+			}
+		}
+		else if (Fighter.DodgeBonusTime > 0.f && (Fighter.DodgeBonusTime -= DeltaTime) <= 0.f)
+		{
+			Fighter.Flags &= ~FCombatFragment::Flag_HasDodged;
+			Fighter.DamageMultiplier = 1.f;
+		}
+		if (Fighter.HitTime >= 0.f && (Fighter.HitTime -= DeltaTime) < 0.f)
+		{
+			ResolveHit(EntitySubsystem, Fighter, Location);
+		}
+
+		const FCombatFragment* Opponent = EntitySubsystem.IsEntityValid(Fighter.Opponent) ? EntitySubsystem.GetFragmentDataPtr<FCombatFragment>(Fighter.Opponent) : nullptr;
+		if (Opponent == nullptr || (Opponent->Flags & FCombatFragment::Flag_Knockdown))
+		{
+			//Nobody to fight, drop the guard and watch
+			Fighter.Flags &= ~FCombatFragment::Flag_Guarding;
+			Fighter.DamageReducingValue = 1.f;
+			return;
+		}
+
+		if ((Fighter.ThinkTime -= DeltaTime) > 0.f)
+		{
+			return;
+		}
+		Fighter.ThinkTime = 0.2f + RandomUnit(Fighter.RandomState) * 0.4f;
+
+		const UltimateSFCombatRules::FInput Input = MakeRandomInput(Fighter.RandomState);
+		const UltimateSFCombatRules::FFighter Rules = MakeRulesFighter(Fighter);
+		const uint32 Choice = NextRandom(Fighter.RandomState) % 100;
+
+		//Guard is held until the next decision
+		const bool bGuarding = Choice < 15 && UltimateSFCombatRules::CanGuard(Rules);
+		Fighter.Flags = bGuarding ? (Fighter.Flags | FCombatFragment::Flag_Guarding) : (Fighter.Flags & ~FCombatFragment::Flag_Guarding);
+		Fighter.DamageReducingValue = bGuarding ? UltimateSFCombatRules::GuardDamageReducingValue : 1.f;
+
+		if (Choice >= 15 && Choice < 25)
+		{
+			if (UltimateSFCombatRules::SelectDodge(Input, Rules) != UltimateSFCombatRules::EDodge::None)
+			{
+				Fighter.Flags |= FCombatFragment::Flag_Dodging | FCombatFragment::Flag_HasDodged;
+				Fighter.DamageMultiplier = UltimateSFCombatRules::DodgeDamageMultiplier;
+				Fighter.DodgeTime = UltimateSFCombatRules::DodgeTime;
+				Fighter.DodgeBonusTime = 0.f;
+			}
+		}
+		else if (Choice >= 25 && Choice < 85)
+		{
+			const UltimateSFCombatRules::FAttack Attack = Choice < 60 ? UltimateSFCombatRules::SelectPunch(Input, Rules) : UltimateSFCombatRules::SelectKick(Input, Rules);
+			if (Attack.Move != UltimateSFCombatRules::EMove::None)
+			{
+				const bool bKick = UltimateSFCombatRules::IsKick(Attack.Move);
+				Fighter.Flags |= bKick ? FCombatFragment::Flag_Kicking : FCombatFragment::Flag_Punching;
+				Fighter.Move = (uint8)Attack.Move;
+				Fighter.AttackTime = UltimateSFCombatRules::GetAttackWindow(Attack.Move);
+				//No montage to read the hit window from, the strike lands halfway through the window
+				Fighter.HitTime = Fighter.AttackTime * 0.5f;
+				Fighter.PendingDamage = Attack.Damage;
+			}
+		}
+	}
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Processors***
+/// </summary>
+
+UUltimateSFCrowdCombatProcessor::UUltimateSFCrowdCombatProcessor()
+{
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Standalone | EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Client);
+	ProcessingPhase = EMassProcessingPhase::PrePhysics;
+}
+
+void UUltimateSFCrowdCombatProcessor::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FUltimateSFCrowdCombatFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddTagRequirement<FUltimateSFCrowdFighterTag>(EMassFragmentPresence::All);
+}
+
+void UUltimateSFCrowdCombatProcessor::Execute(UMassEntitySubsystem& EntitySubsystem, FMassExecutionContext& Context)
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFCrowdCombat);
+	const double StartTime = FPlatformTime::Seconds();
+
+	//Chunks run one after another, so reaching into the opponent's fragments is safe
+	EntityQuery.ForEachEntityChunk(EntitySubsystem, Context, [&EntitySubsystem](FMassExecutionContext& ChunkContext)
+	{
+		const float DeltaTime = ChunkContext.GetDeltaTimeSeconds();
+		const TConstArrayView<FTransformFragment> Transforms = ChunkContext.GetFragmentView<FTransformFragment>();
+		const TArrayView<FUltimateSFCrowdCombatFragment> Fighters = ChunkContext.GetMutableFragmentView<FUltimateSFCrowdCombatFragment>();
+
+		for (int32 Index = 0; Index < ChunkContext.GetNumEntities(); ++Index)
+		{
+			StepFighter(EntitySubsystem, Fighters[Index], Transforms[Index].GetTransform().GetLocation(), DeltaTime);
+		}
+	});
+
+	CrowdProcessingSeconds += FPlatformTime::Seconds() - StartTime;
+}
+
+UUltimateSFCrowdMovementProcessor::UUltimateSFCrowdMovementProcessor()
+{
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Standalone | EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Client);
+	ProcessingPhase = EMassProcessingPhase::PrePhysics;
+	ExecutionOrder.ExecuteAfter.Add(UUltimateSFCrowdCombatProcessor::StaticClass()->GetFName());
+}
+
+void UUltimateSFCrowdMovementProcessor::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FUltimateSFCrowdMovementFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FUltimateSFCrowdCombatFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddTagRequirement<FUltimateSFCrowdFighterTag>(EMassFragmentPresence::All);
+}
+
+void UUltimateSFCrowdMovementProcessor::Execute(UMassEntitySubsystem& EntitySubsystem, FMassExecutionContext& Context)
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFCrowdMovement);
+	const double StartTime = FPlatformTime::Seconds();
+
+	EntityQuery.ForEachEntityChunk(EntitySubsystem, Context, [&EntitySubsystem](FMassExecutionContext& ChunkContext)
+	{
+		const float DeltaTime = ChunkContext.GetDeltaTimeSeconds();
+		const TArrayView<FTransformFragment> Transforms = ChunkContext.GetMutableFragmentView<FTransformFragment>();
+		const TArrayView<FUltimateSFCrowdMovementFragment> Movements = ChunkContext.GetMutableFragmentView<FUltimateSFCrowdMovementFragment>();
+		const TConstArrayView<FUltimateSFCrowdCombatFragment> Fighters = ChunkContext.GetFragmentView<FUltimateSFCrowdCombatFragment>();
+
+		for (int32 Index = 0; Index < ChunkContext.GetNumEntities(); ++Index)
+		{
+			FTransform& Transform = Transforms[Index].GetMutableTransform();
+			FUltimateSFCrowdMovementFragment& Movement = Movements[Index];
+			const FCombatFragment& Fighter = Fighters[Index];
+
+			FVector Location = Transform.GetLocation();
+			const FTransformFragment* OpponentTransform = EntitySubsystem.IsEntityValid(Fighter.Opponent) ? EntitySubsystem.GetFragmentDataPtr<FTransformFragment>(Fighter.Opponent) : nullptr;
+			const FVector Target = OpponentTransform ? OpponentTransform->GetTransform().GetLocation() : Movement.Anchor;
+
+			FVector ToTarget = Target - Location;
+			ToTarget.Z = 0.f;
+			const float Distance = ToTarget.Size();
+			const FVector Forward = Distance > KINDA_SMALL_NUMBER ? ToTarget / Distance : Transform.GetRotation().GetForwardVector();
+			const FVector Side(-Forward.Y, Forward.X, 0.f);
+
+			FVector Velocity = FVector::ZeroVector;
+			if (OpponentTransform && !(Fighter.Flags & FCombatFragment::Flag_Knockdown))
+			{
+				if (Fighter.Flags & FCombatFragment::Flag_Dodging)
+				{
+					Velocity = Side * Movement.StrafeDirection * CombatDashSpeed;
+				}
+				else if (Distance > FightRange)
+				{
+					Velocity = Forward * (Distance > LeashRadius ? CombatDashSpeed : CombatSpeed);
+				}
+				else if (Distance < MinDistance)
+				{
+					Velocity = -Forward * CombatSpeed;
+				}
+				else if (!(Fighter.Flags & (FCombatFragment::Flag_Punching | FCombatFragment::Flag_Kicking)))
+				{
+					Velocity = Side * Movement.StrafeDirection * StrafeSpeed;
+				}
+			}
+
+			//Circling drifts, turn around at the end of the leash
+			if (FVector::DistSquared2D(Location + Velocity * DeltaTime, Movement.Anchor) > FMath::Square(LeashRadius))
+			{
+				Movement.StrafeDirection = -Movement.StrafeDirection;
+				Velocity = (Movement.Anchor - Location).GetSafeNormal2D() * CombatSpeed;
+			}
+
+			Location += Velocity * DeltaTime;
+			Movement.Speed = Velocity.Size();
+			Transform.SetLocation(Location);
+			Transform.SetRotation(FRotator(0.f, Forward.Rotation().Yaw, 0.f).Quaternion());
+		}
+	});
+
+	CrowdProcessingSeconds += FPlatformTime::Seconds() - StartTime;
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Crowd State***
+/// </summary>
+
+AUltimateSFCrowdState::AUltimateSFCrowdState()
+{
+	bReplicates = true;
+	bAlwaysRelevant = true;
+	//Changes are pushed with ForceNetUpdate
+	NetUpdateFrequency = 1.f;
+}
+
+void AUltimateSFCrowdState::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME(AUltimateSFCrowdState, Batches);
+	DOREPLIFETIME(AUltimateSFCrowdState, PromotedIds);
+	DOREPLIFETIME(AUltimateSFCrowdState, ClearCount);
+}
+
+void AUltimateSFCrowdState::OnRep_Crowd()
+{
+	if (UUltimateSFCrowdSubsystem* Crowd = GetWorld()->GetSubsystem<UUltimateSFCrowdSubsystem>())
+	{
+		Crowd->ApplyReplicatedState(*this);
+	}
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Crowd Subsystem***
+/// </summary>
+
+TStatId UUltimateSFCrowdSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UUltimateSFCrowdSubsystem, STATGROUP_Tickables);
+}
+
+void UUltimateSFCrowdSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Collection.InitializeDependency(UMassEntitySubsystem::StaticClass());
+	Super::Initialize(Collection);
+}
+
+void UUltimateSFCrowdSubsystem::Deinitialize()
+{
+	//The entities go with the world's entity subsystem, the state actor with the world
+	Fighters.Reset();
+	FightersById.Reset();
+	State = nullptr;
+	Super::Deinitialize();
+}
+
+int32 UUltimateSFCrowdSubsystem::SpawnBrawls(int32 NumFighters, const FVector& Center, float Radius)
+{
+	if (GetWorld()->GetNetMode() == NM_Client)
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Crowd: the server spawns the crowd, clients follow it"));
+		return 0;
+	}
+
+	FUltimateSFCrowdBatch Batch;
+	Batch.Seed = FMath::Rand();
+	Batch.FirstId = NextId;
+	Batch.NumFighters = NumFighters / 2 * 2;
+	Batch.Center = Center;
+	Batch.Radius = Radius;
+	const int32 Spawned = SpawnBatch(Batch);
+	if (Spawned > 0)
+	{
+		AUltimateSFCrowdState* CrowdState = GetOrSpawnState();
+		CrowdState->Batches.Add(Batch);
+		CrowdState->ForceNetUpdate();
+	}
+	return Spawned;
+}
+
+AUltimateSFCrowdState* UUltimateSFCrowdSubsystem::GetOrSpawnState()
+{
+	if (State == nullptr)
+	{
+		FActorSpawnParameters SpawnParams;
+		SpawnParams.ObjectFlags |= RF_Transient;
+		State = GetWorld()->SpawnActor<AUltimateSFCrowdState>(SpawnParams);
+	}
+	return State;
+}
+
+int32 UUltimateSFCrowdSubsystem::SpawnBatch(const FUltimateSFCrowdBatch& Batch)
+{
+	UMassEntitySubsystem* EntitySubsystem = GetWorld()->GetSubsystem<UMassEntitySubsystem>();
+	const int32 NumBrawls = Batch.NumFighters / 2;
+	if (EntitySubsystem == nullptr || NumBrawls <= 0)
+	{
+		return 0;
+	}
+	//Every draw below comes from the batch's seed, in the same order on every peer
+	FRandomStream Random(Batch.Seed);
+
+	const UScriptStruct* FragmentsAndTags[] = { FTransformFragment::StaticStruct(), FUltimateSFCrowdCombatFragment::StaticStruct(),
+		FUltimateSFCrowdMovementFragment::StaticStruct(), FUltimateSFCrowdFighterTag::StaticStruct() };
+	const FMassArchetypeHandle Archetype = EntitySubsystem->CreateArchetype(MakeArrayView(FragmentsAndTags));
+
+	TArray<FMassEntityHandle> NewFighters;
+	EntitySubsystem->BatchCreateEntities(Archetype, NumBrawls * 2, NewFighters);
+
+	for (int32 Brawl = 0; Brawl < NumBrawls; ++Brawl)
+	{
+		//Uniform over the disc
+		const float Angle = Random.FRandRange(0.f, 2.f * PI);
+		const FVector Anchor = Batch.Center + FVector(FMath::Cos(Angle), FMath::Sin(Angle), 0.f) * Batch.Radius * FMath::Sqrt(Random.FRand());
+		const FVector Line = FRotator(0.f, Random.FRandRange(0.f, 360.f), 0.f).Vector();
+
+		for (int32 Side = 0; Side < 2; ++Side)
+		{
+			const FMassEntityHandle Entity = NewFighters[Brawl * 2 + Side];
+			const FVector Facing = Side == 0 ? Line : -Line;
+
+			EntitySubsystem->GetFragmentDataChecked<FTransformFragment>(Entity).SetTransform(FTransform(Facing.Rotation(), Anchor - Facing * FightRange * 0.5f));
+
+			FUltimateSFCrowdCombatFragment& Fighter = EntitySubsystem->GetFragmentDataChecked<FUltimateSFCrowdCombatFragment>(Entity);
+			Fighter = FUltimateSFCrowdCombatFragment();
+			Fighter.Opponent = NewFighters[Brawl * 2 + (Side ^ 1)];
+			Fighter.CrowdId = Batch.FirstId + Brawl * 2 + Side;
+			Fighter.RandomState = Random.GetUnsignedInt() * 0x9E3779B9u | 1u;
+			//Spread the decisions so brawls do not move in step
+			Fighter.ThinkTime = Random.FRand() * 0.5f;
+			FightersById.Add(Fighter.CrowdId, Entity);
+
+			FUltimateSFCrowdMovementFragment& Movement = EntitySubsystem->GetFragmentDataChecked<FUltimateSFCrowdMovementFragment>(Entity);
+			Movement.Anchor = Anchor;
+			Movement.StrafeDirection = Random.RandHelper(2) == 0 ? 1.f : -1.f;
+		}
+	}
+
+	NextId = FMath::Max(NextId, Batch.FirstId + (uint32)NewFighters.Num());
+	Fighters.Append(NewFighters);
+	SET_DWORD_STAT(STAT_UltimateSFCrowdFighters, Fighters.Num());
+	return NewFighters.Num();
+}
+
+void UUltimateSFCrowdSubsystem::Clear()
+{
+	if (GetWorld()->GetNetMode() == NM_Client)
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Crowd: the server clears the crowd, clients follow it"));
+		return;
+	}
+
+	DestroyFighters();
+	NextId = 0;
+	if (State)
+	{
+		++State->ClearCount;
+		State->Batches.Reset();
+		State->PromotedIds.Reset();
+		State->ForceNetUpdate();
+	}
+}
+
+void UUltimateSFCrowdSubsystem::ApplyReplicatedState(const AUltimateSFCrowdState& InState)
+{
+	if (InState.ClearCount != AppliedClearCount)
+	{
+		DestroyFighters();
+		AppliedClearCount = InState.ClearCount;
+		NumAppliedBatches = 0;
+	}
+	for (; NumAppliedBatches < InState.Batches.Num(); ++NumAppliedBatches)
+	{
+		SpawnBatch(InState.Batches[NumAppliedBatches]);
+	}
+
+	//Ids already removed are not found again
+	for (const uint32 Id : InState.PromotedIds)
+	{
+		if (const FMassEntityHandle* Entity = FightersById.Find(Id))
+		{
+			RemoveFighter(*Entity);
+		}
+	}
+}
+
+void UUltimateSFCrowdSubsystem::RemoveFighter(FMassEntityHandle Entity)
+{
+	UMassEntitySubsystem* EntitySubsystem = GetWorld()->GetSubsystem<UMassEntitySubsystem>();
+	if (EntitySubsystem == nullptr || !EntitySubsystem->IsEntityValid(Entity))
+	{
+		return;
+	}
+
+	const FUltimateSFCrowdCombatFragment& Combat = EntitySubsystem->GetFragmentDataChecked<FUltimateSFCrowdCombatFragment>(Entity);
+	//The old opponent stays behind as a spectator
+	if (FUltimateSFCrowdCombatFragment* Opponent = EntitySubsystem->IsEntityValid(Combat.Opponent) ? EntitySubsystem->GetFragmentDataPtr<FUltimateSFCrowdCombatFragment>(Combat.Opponent) : nullptr)
+	{
+		Opponent->Opponent = FMassEntityHandle();
+	}
+	FightersById.Remove(Combat.CrowdId);
+	EntitySubsystem->DestroyEntity(Entity);
+	Fighters.RemoveSingleSwap(Entity, false);
+	SET_DWORD_STAT(STAT_UltimateSFCrowdFighters, Fighters.Num());
+}
+
+void UUltimateSFCrowdSubsystem::DestroyFighters()
+{
+	if (UMassEntitySubsystem* EntitySubsystem = GetWorld()->GetSubsystem<UMassEntitySubsystem>())
+	{
+		for (const FMassEntityHandle Entity : Fighters)
+		{
+			if (EntitySubsystem->IsEntityValid(Entity))
+			{
+				EntitySubsystem->DestroyEntity(Entity);
+			}
+		}
+	}
+	Fighters.Reset();
+	FightersById.Reset();
+	SET_DWORD_STAT(STAT_UltimateSFCrowdFighters, 0);
+
+	for (USkeletalMeshComponent* Follower : Followers)
+	{
+		Follower->SetVisibility(false);
+	}
+}
+
+AUltimateSFCharacter* UUltimateSFCrowdSubsystem::Promote(FMassEntityHandle Entity)
+{
+	UWorld* World = GetWorld();
+	UMassEntitySubsystem* EntitySubsystem = World->GetSubsystem<UMassEntitySubsystem>();
+	AUltimateSFGameMode* GameMode = World->GetAuthGameMode<AUltimateSFGameMode>();
+	if (EntitySubsystem == nullptr || GameMode == nullptr || !EntitySubsystem->IsEntityValid(Entity))
+	{
+		return nullptr;
+	}
+
+	const FTransform Transform = EntitySubsystem->GetFragmentDataChecked<FTransformFragment>(Entity).GetTransform();
+	const FUltimateSFCrowdCombatFragment Combat = EntitySubsystem->GetFragmentDataChecked<FUltimateSFCrowdCombatFragment>(Entity);
+
+	AUltimateSFCharacter* Fighter = GameMode->AcquireFighter(Transform);
+	if (Fighter == nullptr)
+	{
+		return nullptr;
+	}
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	AUltimateSFBotController* Bot = World->SpawnActor<AUltimateSFBotController>(SpawnParams);
+	Bot->Possess(Fighter);
+
+	//A new life: the crowd's totals are not the character's per hit fields, and no timer would end a dodge bonus
+	Fighter->DamageDealt = 0.f;
+	Fighter->DamageRecieved = 0.f;
+	Fighter->DamageMultiplier = 1.f;
+	Fighter->S_SetCombatMode(true);
+
+	RemoveFighter(Entity);
+	//Clients remove the same fighter, or they would keep drawing it next to the character
+	AUltimateSFCrowdState* CrowdState = GetOrSpawnState();
+	CrowdState->PromotedIds.Add(Combat.CrowdId);
+	CrowdState->ForceNetUpdate();
+
+	UE_LOG(LogUltimateSF, Verbose, TEXT("Crowd: promoted an ambient fighter to %s"), *Fighter->GetName());
+	return Fighter;
+}
+
+void UUltimateSFCrowdSubsystem::Tick(float DeltaTime)
+{
+	if (Fighters.Num() == 0)
+	{
+		return;
+	}
+
+	if (GetWorld()->GetNetMode() != NM_Client && (PromotionTime -= DeltaTime) <= 0.f)
+	{
+		PromotionTime = PromotionInterval;
+		UpdatePromotions();
+	}
+
+	if (GetWorld()->GetNetMode() != NM_DedicatedServer && FApp::CanEverRender())
+	{
+		UpdateRepresentation();
+	}
+}
+
+void UUltimateSFCrowdSubsystem::UpdatePromotions()
+{
+	const float EngageRadius = CVarCrowdEngageRadius.GetValueOnGameThread();
+	const UUltimateSFFighterGridSubsystem* Grid = GetWorld()->GetSubsystem<UUltimateSFFighterGridSubsystem>();
+	UMassEntitySubsystem* EntitySubsystem = GetWorld()->GetSubsystem<UMassEntitySubsystem>();
+	if (EngageRadius <= 0.f || Grid == nullptr || EntitySubsystem == nullptr)
+	{
+		return;
+	}
+
+	TArray<FVector, TInlineAllocator<16>> Players;
+	Grid->ForEachFighter([&Players](AUltimateSFCharacter* Fighter)
+	{
+		if (Fighter->IsPlayerControlled() && Fighter->bIsCombatMode && !Fighter->IsPooled())
+		{
+			Players.Add(Fighter->GetActorLocation());
+		}
+	});
+	if (Players.Num() == 0)
+	{
+		return;
+	}
+
+	TArray<FMassEntityHandle, TInlineAllocator<8>> Engaged;
+	const float EngageRadiusSquared = FMath::Square(EngageRadius);
+	for (const FMassEntityHandle Entity : Fighters)
+	{
+		const FTransformFragment* Transform = EntitySubsystem->IsEntityValid(Entity) ? EntitySubsystem->GetFragmentDataPtr<FTransformFragment>(Entity) : nullptr;
+		if (Transform == nullptr)
+		{
+			continue;
+		}
+		const FVector Location = Transform->GetTransform().GetLocation();
+		for (const FVector& Player : Players)
+		{
+			if (FVector::DistSquared(Location, Player) <= EngageRadiusSquared)
+			{
+				Engaged.Add(Entity);
+				break;
+			}
+		}
+	}
+
+	for (const FMassEntityHandle Entity : Engaged)
+	{
+		Promote(Entity);
+	}
+}
+
+bool UUltimateSFCrowdSubsystem::CreateLeaders()
+{
+	UWorld* World = GetWorld();
+	const AGameStateBase* GameState = World->GetGameState();
+	const AGameModeBase* GameModeCDO = GameState ? GameState->GetDefaultGameMode() : nullptr;
+	const AUltimateSFCharacter* FighterCDO = GameModeCDO && GameModeCDO->DefaultPawnClass ? Cast<AUltimateSFCharacter>(GameModeCDO->DefaultPawnClass->GetDefaultObject()) : nullptr;
+	if (FighterCDO == nullptr || FighterCDO->GetMesh()->SkeletalMesh == nullptr)
+	{
+		return false;
+	}
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.ObjectFlags |= RF_Transient;
+	RepresentationHost = World->SpawnActor<AActor>(SpawnParams);
+	MeshOffset = FighterCDO->GetMesh()->GetRelativeTransform();
+
+	for (uint8 Move = 0; Move < (uint8)EUltimateSFMove::MAX; ++Move)
+	{
+		//Leaders are never drawn but have to keep animating for their followers
+		USkeletalMeshComponent* Leader = NewObject<USkeletalMeshComponent>(RepresentationHost);
+		Leader->SetSkeletalMesh(FighterCDO->GetMesh()->SkeletalMesh);
+		Leader->SetAnimInstanceClass(FighterCDO->GetMesh()->GetAnimClass());
+		Leader->SetVisibility(false);
+		Leader->VisibilityBasedAnimTickOption = EVisibilityBasedAnimTickOption::AlwaysTickPoseAndRefreshBones;
+		Leader->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+		Leader->RegisterComponent();
+		Leaders.Add(Leader);
+	}
+	return true;
+}
+
+void UUltimateSFCrowdSubsystem::UpdateRepresentation()
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFCrowdRepresentation);
+
+	UWorld* World = GetWorld();
+	UMassEntitySubsystem* EntitySubsystem = World->GetSubsystem<UMassEntitySubsystem>();
+	APlayerController* Viewer = World->GetFirstPlayerController();
+	if (EntitySubsystem == nullptr || Viewer == nullptr || bLeadersFailed)
+	{
+		return;
+	}
+	if (Leaders.Num() == 0 && !CreateLeaders())
+	{
+		bLeadersFailed = true;
+		return;
+	}
+
+	//Loop every leader's move so any follower can pick it up mid swing
+	const AGameModeBase* GameModeCDO = World->GetGameState()->GetDefaultGameMode();
+	const AUltimateSFCharacter* FighterCDO = Cast<AUltimateSFCharacter>(GameModeCDO->DefaultPawnClass->GetDefaultObject());
+	for (uint8 Move = 1; Move < Leaders.Num(); ++Move)
+	{
+		UAnimInstance* AnimInstance = Leaders[Move]->GetAnimInstance();
+		UAnimMontage* Montage = FighterCDO->GetMoveMontage((EUltimateSFMove)Move);
+		if (AnimInstance && Montage && !AnimInstance->Montage_IsPlaying(Montage))
+		{
+			AnimInstance->Montage_Play(Montage, UltimateSFCombatRules::GetPlayRate((UltimateSFCombatRules::EMove)Move));
+		}
+	}
+
+	FVector ViewLocation;
+	FRotator ViewRotation;
+	Viewer->GetPlayerViewPoint(ViewLocation, ViewRotation);
+	const float DrawDistanceSquared = FMath::Square(CVarCrowdDrawDistance.GetValueOnGameThread());
+
+	//Nearest first
+	TArray<TPair<float, int32>> Visible;
+	for (int32 Index = 0; Index < Fighters.Num(); ++Index)
+	{
+		const FTransformFragment* Transform = EntitySubsystem->IsEntityValid(Fighters[Index]) ? EntitySubsystem->GetFragmentDataPtr<FTransformFragment>(Fighters[Index]) : nullptr;
+		const float DistanceSquared = Transform ? FVector::DistSquared(Transform->GetTransform().GetLocation(), ViewLocation) : MAX_flt;
+		if (DistanceSquared <= DrawDistanceSquared)
+		{
+			Visible.Emplace(DistanceSquared, Index);
+		}
+	}
+	const int32 NumVisible = FMath::Min(Visible.Num(), FMath::Max(CVarCrowdMaxVisible.GetValueOnGameThread(), 0));
+	if (Visible.Num() > NumVisible)
+	{
+		Algo::Sort(Visible, [](const TPair<float, int32>& A, const TPair<float, int32>& B) { return A.Key < B.Key; });
+	}
+
+	while (Followers.Num() < NumVisible)
+	{
+		USkeletalMeshComponent* Follower = NewObject<USkeletalMeshComponent>(RepresentationHost);
+		Follower->SetSkeletalMesh(Leaders[0]->SkeletalMesh);
+		Follower->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+		Follower->RegisterComponent();
+		Follower->SetMasterPoseComponent(Leaders[0]);
+		Followers.Add(Follower);
+		FollowerMoves.Add(0);
+	}
+
+	for (int32 Slot = 0; Slot < Followers.Num(); ++Slot)
+	{
+		USkeletalMeshComponent* Follower = Followers[Slot];
+		if (Slot >= NumVisible)
+		{
+			Follower->SetVisibility(false);
+			continue;
+		}
+
+		const FMassEntityHandle Entity = Fighters[Visible[Slot].Value];
+		const uint8 Move = EntitySubsystem->GetFragmentDataChecked<FUltimateSFCrowdCombatFragment>(Entity).Move;
+		if (FollowerMoves[Slot] != Move)
+		{
+			Follower->SetMasterPoseComponent(Leaders[Move]);
+			FollowerMoves[Slot] = Move;
+		}
+		Follower->SetWorldTransform(MeshOffset * EntitySubsystem->GetFragmentDataChecked<FTransformFragment>(Entity).GetTransform());
+		Follower->SetVisibility(true);
+	}
+	SET_DWORD_STAT(STAT_UltimateSFCrowdVisible, NumVisible);
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Console Commands***
+/// </summary>
+
+static FVector GetCrowdCenter(UWorld* World)
+{
+	const APlayerController* Player = World->GetFirstPlayerController();
+	return Player && Player->GetPawn() ? Player->GetPawn()->GetActorLocation() : FVector::ZeroVector;
+}
+
+static FAutoConsoleCommandWithWorldAndArgs CrowdSpawnCommand(
+	TEXT("usf.Crowd.Spawn"),
+	TEXT("Spawns ambient brawls around the first player, or the world origin. Args: [NumFighters=100] [Radius=3000]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (UUltimateSFCrowdSubsystem* Crowd = World ? World->GetSubsystem<UUltimateSFCrowdSubsystem>() : nullptr)
+		{
+			const int32 Spawned = Crowd->SpawnBrawls(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 100, GetCrowdCenter(World), Args.Num() > 1 ? FCString::Atof(*Args[1]) : 3000.f);
+			UE_LOG(LogUltimateSF, Log, TEXT("usf.Crowd.Spawn: spawned %d ambient fighters, %d total"), Spawned, Crowd->GetNumFighters());
+		}
+	}));
+
+static FAutoConsoleCommandWithWorldAndArgs CrowdClearCommand(
+	TEXT("usf.Crowd.Clear"),
+	TEXT("Removes every ambient fighter"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (UUltimateSFCrowdSubsystem* Crowd = World ? World->GetSubsystem<UUltimateSFCrowdSubsystem>() : nullptr)
+		{
+			Crowd->Clear();
+		}
+	}));
+
+/* Spawns a crowd, measures the Mass processors and the game thread for a while, then removes it again */
+struct FUltimateSFCrowdBench
+{
+	TWeakObjectPtr<UWorld> World;
+	int32 NumFighters = 1000;
+	float Seconds = 30.f;
+	double StartTime = 0.0;
+	bool bMeasuring = false;
+	double StartProcessingSeconds = 0.0;
+	double FrameWorkSeconds = 0.0;
+	int32 NumFrames = 0;
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	//Archetype creation and the first chunks settle before measuring
+	static constexpr double WarmupSeconds = 2.0;
+
+	bool Tick(float DeltaTime)
+	{
+		UUltimateSFCrowdSubsystem* Crowd = World.IsValid() ? World->GetSubsystem<UUltimateSFCrowdSubsystem>() : nullptr;
+		if (Crowd == nullptr)
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("usf.Crowd.Bench: the world went away"));
+			delete this;
+			return false;
+		}
+
+		const double Elapsed = FPlatformTime::Seconds() - StartTime;
+		if (!bMeasuring)
+		{
+			if (Elapsed >= WarmupSeconds)
+			{
+				bMeasuring = true;
+				StartTime = FPlatformTime::Seconds();
+				StartProcessingSeconds = CrowdProcessingSeconds;
+			}
+			return true;
+		}
+
+		FrameWorkSeconds += FMath::Max(0.0, FApp::GetDeltaTime() - FApp::GetIdleTime());
+		++NumFrames;
+		if (Elapsed < Seconds)
+		{
+			return true;
+		}
+
+		const double Processing = CrowdProcessingSeconds - StartProcessingSeconds;
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.Crowd.Bench: %d ambient fighters, %.3f ms Mass processing and %.2f ms game thread per frame over %d frames, %.2f us per fighter per frame"),
+			Crowd->GetNumFighters(), Processing * 1000.0 / FMath::Max(NumFrames, 1), FrameWorkSeconds * 1000.0 / FMath::Max(NumFrames, 1), NumFrames,
+			Processing * 1000000.0 / FMath::Max(NumFrames, 1) / FMath::Max(Crowd->GetNumFighters(), 1));
+
+		Crowd->Clear();
+		//Nothing touches this after the delete, returning false removes the ticker
+		delete this;
+		return false;
+	}
+};
+
+//e.g. "usf.Crowd.Bench 1000 30" on a server started with -server -nullrhi
+static FAutoConsoleCommandWithWorldAndArgs CrowdBenchCommand(
+	TEXT("usf.Crowd.Bench"),
+	TEXT("Measures the cost of N ambient fighters. Args: [NumFighters=1000] [Seconds=30]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UUltimateSFCrowdSubsystem* Crowd = World ? World->GetSubsystem<UUltimateSFCrowdSubsystem>() : nullptr;
+		if (Crowd == nullptr)
+		{
+			return;
+		}
+
+		FUltimateSFCrowdBench* Bench = new FUltimateSFCrowdBench();
+		Bench->World = World;
+		Bench->NumFighters = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 2) : 1000;
+		Bench->Seconds = Args.Num() > 1 ? FMath::Max(FCString::Atof(*Args[1]), 1.f) : 30.f;
+		Bench->StartTime = FPlatformTime::Seconds();
+
+		//Spread like a street, about one brawl per 10x10 m
+		Crowd->SpawnBrawls(Bench->NumFighters, GetCrowdCenter(World), FMath::Sqrt(Bench->NumFighters / 2.f) * 1000.f / FMath::Sqrt(PI));
+		Bench->TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(Bench, &FUltimateSFCrowdBench::Tick));
+	}));
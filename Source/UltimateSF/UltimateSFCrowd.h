@@ -0,0 +1,247 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Info.h"
+#include "MassEntityTypes.h"
+#include "MassProcessor.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UltimateSFCrowd.generated.h"
+
+class AUltimateSFCharacter;
+class USkeletalMeshComponent;
+
+/* Brawl state of an ambient fighter, the crowd's counterpart of AUltimateSFCharacter's combat flags and damage */
+USTRUCT()
+struct FUltimateSFCrowdCombatFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	enum EFlagBits : uint8
+	{
+		Flag_Punching	= 1 << 0,
+		Flag_Kicking	= 1 << 1,
+		Flag_Dodging	= 1 << 2,
+		Flag_HasDodged	= 1 << 3,
+		Flag_Guarding	= 1 << 4,
+		Flag_Knockdown	= 1 << 5
+	};
+
+	/* The other half of the brawl, unset once it was promoted or removed */
+	FMassEntityHandle Opponent;
+
+	float Health = 100.f;
+	float DamageDealt = 0.f;
+	float DamageRecieved = 0.f;
+	float DamageMultiplier = 1.f;
+	float DamageReducingValue = 1.f;
+
+	/* Seconds left in the current attack, dodge, dodge bonus and knockdown */
+	float AttackTime = 0.f;
+	float DodgeTime = 0.f;
+	float DodgeBonusTime = 0.f;
+	float KnockdownTime = 0.f;
+
+	/* Seconds until the pending attack lands, negative when nothing is pending */
+	float HitTime = -1.f;
+	float PendingDamage = 0.f;
+
+	/* Seconds until the next decision */
+	float ThinkTime = 0.f;
+
+	uint32 RandomState = 1;
+
+	/* Same on every peer for the same fighter, see AUltimateSFCrowdState */
+	uint32 CrowdId = 0;
+
+	/* EUltimateSFMove of the attack in progress, picks the shared pose */
+	uint8 Move = 0;
+	uint8 Flags = 0;
+};
+
+/* Where an ambient fighter stands and how it moves around its opponent */
+USTRUCT()
+struct FUltimateSFCrowdMovementFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	/* Centre of the brawl, fighters never drift further than LeashRadius from it */
+	FVector Anchor = FVector::ZeroVector;
+
+	/* -1 or 1, the way the fighter circles its opponent */
+	float StrafeDirection = 1.f;
+
+	float Speed = 0.f;
+};
+
+USTRUCT()
+struct FUltimateSFCrowdFighterTag : public FMassTag
+{
+	GENERATED_BODY()
+};
+
+/**
+ * Ambient fighter decisions and combat: random inputs go through the same UltimateSFCombatRules move selection,
+ * windows, dodge bonus and guard division as AUltimateSFCharacter. A knocked down fighter gets up with full health.
+ */
+UCLASS()
+class UUltimateSFCrowdCombatProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UUltimateSFCrowdCombatProcessor();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(UMassEntitySubsystem& EntitySubsystem, FMassExecutionContext& Context) override;
+
+private:
+	FMassEntityQuery EntityQuery;
+};
+
+/* Keeps ambient fighters at fighting range of their opponent, circling it, facing it and on their leash */
+UCLASS()
+class UUltimateSFCrowdMovementProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UUltimateSFCrowdMovementProcessor();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(UMassEntitySubsystem& EntitySubsystem, FMassExecutionContext& Context) override;
+
+private:
+	FMassEntityQuery EntityQuery;
+};
+
+/* One usf.Crowd.Spawn call, enough for every peer to spawn the same fighters */
+USTRUCT()
+struct FUltimateSFCrowdBatch
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+		int32 Seed = 0;
+
+	/* CrowdId of the batch's first fighter, the rest follow in spawn order */
+	UPROPERTY()
+		uint32 FirstId = 0;
+
+	UPROPERTY()
+		int32 NumFighters = 0;
+
+	UPROPERTY()
+		FVector Center = FVector::ZeroVector;
+
+	UPROPERTY()
+		float Radius = 0.f;
+};
+
+/**
+ * The crowd as the server spawned it: the batches, whose seeds every client spawns the same fighters from,
+ * and the ids of the fighters the server promoted, which every client removes as well.
+ * Only what was decided is sent, each peer steps its own fighters, so brawls drift apart but nobody keeps
+ * an ambient fighter next to the character it was promoted to. Spawned by UUltimateSFCrowdSubsystem on the server.
+ */
+UCLASS(NotPlaceable, Transient)
+class AUltimateSFCrowdState : public AInfo
+{
+	GENERATED_BODY()
+
+public:
+	AUltimateSFCrowdState();
+
+	UPROPERTY(ReplicatedUsing = OnRep_Crowd)
+		TArray<FUltimateSFCrowdBatch> Batches;
+
+	UPROPERTY(ReplicatedUsing = OnRep_Crowd)
+		TArray<uint32> PromotedIds;
+
+	/* Bumped by every usf.Crowd.Clear, clients drop their fighters when it changes */
+	UPROPERTY(ReplicatedUsing = OnRep_Crowd)
+		uint8 ClearCount = 0;
+
+	// AActor interface
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+	// End of AActor interface
+
+protected:
+	UFUNCTION()
+		void OnRep_Crowd();
+};
+
+/**
+ * Background brawls for street scenes as Mass entities instead of AUltimateSFCharacters: no capsule, camera boom,
+ * character movement or replication, three fragments per fighter stepped by the processors above.
+ * Where something renders, the nearest fighters are drawn with skeletal mesh components that copy the pose of
+ * one leader component per move (shared pose), so the animation cost does not grow with the crowd.
+ * On the server, an ambient fighter a player walks up to in combat mode is promoted to a full bot driven
+ * AUltimateSFCharacter starting a fresh life. The server spawns and promotes, AUltimateSFCrowdState
+ * has every client spawn the same fighters and remove the promoted ones.
+ */
+UCLASS()
+class UUltimateSFCrowdSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/* Spawns NumFighters / 2 brawls scattered within Radius of Center, returns the fighters spawned. Server only */
+	int32 SpawnBrawls(int32 NumFighters, const FVector& Center, float Radius);
+
+	/* Removes every ambient fighter. Server only */
+	void Clear();
+
+	/* Replaces an ambient fighter with a bot driven AUltimateSFCharacter, server only */
+	AUltimateSFCharacter* Promote(FMassEntityHandle Entity);
+
+	/* Client only, catches up with the batches, clears and promotions the server replicated */
+	void ApplyReplicatedState(const AUltimateSFCrowdState& InState);
+
+	int32 GetNumFighters() const { return Fighters.Num(); }
+
+private:
+	int32 SpawnBatch(const FUltimateSFCrowdBatch& Batch);
+	void RemoveFighter(FMassEntityHandle Entity);
+	void DestroyFighters();
+	AUltimateSFCrowdState* GetOrSpawnState();
+
+	void UpdatePromotions();
+	void UpdateRepresentation();
+	bool CreateLeaders();
+
+	TArray<FMassEntityHandle> Fighters;
+	TMap<uint32, FMassEntityHandle> FightersById;
+	uint32 NextId = 0;
+
+	float PromotionTime = 0.f;
+
+	/* Server: what it replicates. Clients: how much of it they applied */
+	UPROPERTY(Transient)
+		AUltimateSFCrowdState* State = nullptr;
+	uint8 AppliedClearCount = 0;
+	int32 NumAppliedBatches = 0;
+
+	/* Shared pose rendering, only created where something renders */
+	UPROPERTY(Transient)
+		AActor* RepresentationHost = nullptr;
+
+	/* One per EUltimateSFMove, None is the idle pose */
+	UPROPERTY(Transient)
+		TArray<USkeletalMeshComponent*> Leaders;
+
+	UPROPERTY(Transient)
+		TArray<USkeletalMeshComponent*> Followers;
+
+	TArray<uint8> FollowerMoves;
+	FTransform MeshOffset;
+	bool bLeadersFailed = false;
+};
@@ -0,0 +1,49 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFFighterArchetype.h"
+#include "UltimateSF.h"
+#include "HAL/IConsoleManager.h"
+
+UUltimateSFFighterArchetype* UUltimateSFFighterArchetype::FindById(uint8 ArchetypeId)
+{
+	const UUltimateSFArchetypeSettings* Settings = GetDefault<UUltimateSFArchetypeSettings>();
+	if (!Settings->Archetypes.IsValidIndex(ArchetypeId))
+	{
+		return nullptr;
+	}
+	return Settings->Archetypes[ArchetypeId].LoadSynchronous();
+}
+
+#if WITH_EDITOR
+void UUltimateSFFighterArchetype::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	OnArchetypeChanged.Broadcast();
+}
+#endif
+
+//Hot tuning on a running server, e.g. "usf.Archetype.Set 0 SprintSpeed 650"
+static FAutoConsoleCommand SetArchetypeValueCommand(
+	TEXT("usf.Archetype.Set"),
+	TEXT("Changes one tuning value of a fighter archetype and re-applies it to every fighter using it. Args: <ArchetypeId> <Property> <Value>"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		if (Args.Num() < 3)
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("usf.Archetype.Set <ArchetypeId> <Property> <Value>"));
+			return;
+		}
+
+		UUltimateSFFighterArchetype* Archetype = UUltimateSFFighterArchetype::FindById(static_cast<uint8>(FCString::Atoi(*Args[0])));
+		FProperty* Property = Archetype ? FindFProperty<FProperty>(UUltimateSFFighterArchetype::StaticClass(), *Args[1]) : nullptr;
+		if (Property == nullptr)
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("usf.Archetype.Set: no archetype %s or property %s"), *Args[0], *Args[1]);
+			return;
+		}
+
+		Property->ImportText(*Args[2], Property->ContainerPtrToValuePtr<void>(Archetype), PPF_None, Archetype);
+		Archetype->OnArchetypeChanged.Broadcast();
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.Archetype.Set: %s.%s = %s"), *Archetype->GetName(), *Args[1], *Args[2]);
+	}));
@@ -0,0 +1,91 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "Engine/DeveloperSettings.h"
+#include "UltimateSFFighterArchetype.generated.h"
+
+/**
+ * Tuning shared by every fighter of one kind: speeds, turn rates, capsule and camera boom.
+ * Characters only hold (and replicate) the archetype's index in UUltimateSFArchetypeSettings, so none of
+ * these values are compared or sent per net update.
+ */
+UCLASS(BlueprintType)
+class UUltimateSFFighterArchetype : public UPrimaryDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	//Movement
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Movement)
+		float WalkSpeed = 150.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Movement)
+		float RunSpeed = 300.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Movement)
+		float SprintSpeed = 600.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Movement)
+		float DefaultCombatSpeed = 100.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Movement)
+		float DefaultCombatDashSpeed = 200.f;
+
+	/* Yaw rotation rate while turning towards the movement direction, in deg/sec */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Movement)
+		float RotationRateYaw = 540.f;
+
+	//Turn rates
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Input)
+		float TurnRateGamepad = 50.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Camera)
+		float BaseTurnRate = 10.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Camera)
+		float BaseLookUpRate = 10.f;
+
+	//Capsule
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Capsule)
+		float CapsuleRadius = 42.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Capsule)
+		float CapsuleHalfHeight = 96.f;
+
+	//Camera boom
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Camera)
+		float TargetArmLength = 300.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Camera)
+		bool bEnableCameraLag = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Camera)
+		float CameraLagSpeed = 8.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Camera)
+		float CameraLagMaxDistance = 150.f;
+
+	/* Broadcast when tuning changes on a running game so every fighter using this archetype re-applies it */
+	FSimpleMulticastDelegate OnArchetypeChanged;
+
+	/* Looks the archetype up in the project settings list, loading it if needed */
+	static UUltimateSFFighterArchetype* FindById(uint8 ArchetypeId);
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+};
+
+/* Project Settings > Game > Fighter Archetypes. The index in this list is the replicated archetype ID */
+UCLASS(Config = Game, DefaultConfig, meta = (DisplayName = "Fighter Archetypes"))
+class UUltimateSFArchetypeSettings : public UDeveloperSettings
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(Config, EditAnywhere, Category = Archetypes)
+		TArray<TSoftObjectPtr<UUltimateSFFighterArchetype>> Archetypes;
+};
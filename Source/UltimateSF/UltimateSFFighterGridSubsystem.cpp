@@ -0,0 +1,133 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFFighterGridSubsystem.h"
+#include "UltimateSF.h"
+#include "UltimateSFCharacter.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF Fighter Grid"), STATGROUP_UltimateSFFighterGrid, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Grid Query"), STAT_UltimateSFGridQuery, STATGROUP_UltimateSFFighterGrid);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Grid Fighters"), STAT_UltimateSFGridFighters, STATGROUP_UltimateSFFighterGrid);
+
+static TAutoConsoleVariable<float> CVarFighterGridCellSize(
+	TEXT("usf.FighterGrid.CellSize"),
+	1000.f,
+	TEXT("Edge length of a fighter grid cell in cm. Read when a world starts; roughly the lock-on range works best."),
+	ECVF_Default);
+
+void UUltimateSFFighterGridSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	CellSize = FMath::Max(100.f, CVarFighterGridCellSize.GetValueOnGameThread());
+}
+
+void UUltimateSFFighterGridSubsystem::Deinitialize()
+{
+	for (const TPair<AUltimateSFCharacter*, FFighterEntry>& Pair : FighterCells)
+	{
+		if (IsValid(Pair.Key) && Pair.Key->GetRootComponent())
+		{
+			Pair.Key->GetRootComponent()->TransformUpdated.Remove(Pair.Value.TransformHandle);
+		}
+	}
+	FighterCells.Empty();
+	Cells.Empty();
+
+	Super::Deinitialize();
+}
+
+FIntPoint UUltimateSFFighterGridSubsystem::GetCell(const FVector& Location) const
+{
+	return FIntPoint(FMath::FloorToInt(Location.X / CellSize), FMath::FloorToInt(Location.Y / CellSize));
+}
+
+void UUltimateSFFighterGridSubsystem::AddFighter(AUltimateSFCharacter* Fighter)
+{
+	if (!IsValid(Fighter) || FighterCells.Contains(Fighter) || Fighter->GetRootComponent() == nullptr)
+	{
+		return;
+	}
+
+	FFighterEntry& Entry = FighterCells.Add(Fighter);
+	Entry.Cell = GetCell(Fighter->GetActorLocation());
+	Entry.TransformHandle = Fighter->GetRootComponent()->TransformUpdated.AddUObject(this, &UUltimateSFFighterGridSubsystem::OnFighterMoved, Fighter);
+	Cells.FindOrAdd(Entry.Cell).Add(Fighter);
+
+	SET_DWORD_STAT(STAT_UltimateSFGridFighters, FighterCells.Num());
+}
+
+void UUltimateSFFighterGridSubsystem::RemoveFighter(AUltimateSFCharacter* Fighter)
+{
+	FFighterEntry Entry;
+	if (!FighterCells.RemoveAndCopyValue(Fighter, Entry))
+	{
+		return;
+	}
+
+	if (Fighter->GetRootComponent())
+	{
+		Fighter->GetRootComponent()->TransformUpdated.Remove(Entry.TransformHandle);
+	}
+	RemoveFromCell(Entry.Cell, Fighter);
+
+	SET_DWORD_STAT(STAT_UltimateSFGridFighters, FighterCells.Num());
+}
+
+void UUltimateSFFighterGridSubsystem::RemoveFromCell(const FIntPoint& Cell, AUltimateSFCharacter* Fighter)
+{
+	if (TArray<AUltimateSFCharacter*>* CellFighters = Cells.Find(Cell))
+	{
+		CellFighters->RemoveSingleSwap(Fighter, false);
+		if (CellFighters->Num() == 0)
+		{
+			Cells.Remove(Cell);
+		}
+	}
+}
+
+void UUltimateSFFighterGridSubsystem::OnFighterMoved(USceneComponent* Root, EUpdateTransformFlags Flags, ETeleportType Teleport, AUltimateSFCharacter* Fighter)
+{
+	FFighterEntry* Entry = FighterCells.Find(Fighter);
+	if (Entry == nullptr)
+	{
+		return;
+	}
+
+	const FIntPoint NewCell = GetCell(Root->GetComponentLocation());
+	if (NewCell != Entry->Cell)
+	{
+		RemoveFromCell(Entry->Cell, Fighter);
+		Cells.FindOrAdd(NewCell).Add(Fighter);
+		Entry->Cell = NewCell;
+	}
+}
+
+void UUltimateSFFighterGridSubsystem::QueryRadius(const FVector& Center, float Radius, TArray<AUltimateSFCharacter*>& OutFighters, const AUltimateSFCharacter* Ignore) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFGridQuery);
+
+	const FIntPoint MinCell = GetCell(Center - FVector(Radius, Radius, 0.f));
+	const FIntPoint MaxCell = GetCell(Center + FVector(Radius, Radius, 0.f));
+	const float RadiusSquared = Radius * Radius;
+
+	for (int32 X = MinCell.X; X <= MaxCell.X; ++X)
+	{
+		for (int32 Y = MinCell.Y; Y <= MaxCell.Y; ++Y)
+		{
+			const TArray<AUltimateSFCharacter*>* CellFighters = Cells.Find(FIntPoint(X, Y));
+			if (CellFighters == nullptr)
+			{
+				continue;
+			}
+
+			for (AUltimateSFCharacter* Fighter : *CellFighters)
+			{
+				if (Fighter != Ignore && FVector::DistSquared2D(Fighter->GetActorLocation(), Center) <= RadiusSquared)
+				{
+					OutFighters.Add(Fighter);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,60 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UltimateSFFighterGridSubsystem.generated.h"
+
+class AUltimateSFCharacter;
+class USceneComponent;
+
+/**
+ * Uniform 2D spatial hash of every active fighter in a world.
+ * Fighters register on BeginPlay and are re-bucketed from their root component's TransformUpdated,
+ * which only costs a cell compare unless they actually cross a cell border. Radius queries visit
+ * the few cells the circle overlaps instead of iterating every actor, so lock-on stays cheap in big lobbies.
+ */
+UCLASS()
+class UUltimateSFFighterGridSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	void AddFighter(AUltimateSFCharacter* Fighter);
+	void RemoveFighter(AUltimateSFCharacter* Fighter);
+
+	/* Appends every fighter within Radius of Center (2D), excluding Ignore */
+	void QueryRadius(const FVector& Center, float Radius, TArray<AUltimateSFCharacter*>& OutFighters, const AUltimateSFCharacter* Ignore = nullptr) const;
+
+	int32 GetNumFighters() const { return FighterCells.Num(); }
+
+	template <typename FunctionType>
+	void ForEachFighter(FunctionType&& Function) const
+	{
+		for (const TPair<AUltimateSFCharacter*, FFighterEntry>& Pair : FighterCells)
+		{
+			Function(Pair.Key);
+		}
+	}
+	int32 GetNumCells() const { return Cells.Num(); }
+
+private:
+	struct FFighterEntry
+	{
+		FIntPoint Cell;
+		FDelegateHandle TransformHandle;
+	};
+
+	FIntPoint GetCell(const FVector& Location) const;
+	void OnFighterMoved(USceneComponent* Root, EUpdateTransformFlags Flags, ETeleportType Teleport, AUltimateSFCharacter* Fighter);
+	void RemoveFromCell(const FIntPoint& Cell, AUltimateSFCharacter* Fighter);
+
+	float CellSize = 1000.f;
+
+	TMap<FIntPoint, TArray<AUltimateSFCharacter*>> Cells;
+	TMap<AUltimateSFCharacter*, FFighterEntry> FighterCells;
+};
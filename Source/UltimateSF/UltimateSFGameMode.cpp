@@ -1,9 +1,38 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "UltimateSFGameMode.h"
+#include "UltimateSF.h"
 #include "UltimateSFCharacter.h"
+#include "UltimateSFBotController.h"
+#include "UltimateSFPlayerController.h"
+#include "UltimateSFGameState.h"
+#include "UltimateSFMetrics.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+#include "Engine/NetDriver.h"
+#include "Kismet/GameplayStatics.h"
+#include "Misc/App.h"
+#include "Misc/Paths.h"
+#include "GameFramework/PlayerState.h"
 #include "UObject/ConstructorHelpers.h"
 
+DECLARE_STATS_GROUP(TEXT("UltimateSF GameMode"), STATGROUP_UltimateSFGameMode, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Fighter Spawn"), STAT_UltimateSFFighterSpawn, STATGROUP_UltimateSFGameMode);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Pooled Fighters"), STAT_UltimateSFPooledFighters, STATGROUP_UltimateSFGameMode);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Server Tick Rate"), STAT_UltimateSFServerTickRate, STATGROUP_UltimateSFGameMode);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Idle CPU Seconds Saved"), STAT_UltimateSFCpuSecondsSaved, STATGROUP_UltimateSFGameMode);
+DECLARE_CYCLE_STAT(TEXT("Arena Checkpoint"), STAT_UltimateSFArenaCheckpoint, STATGROUP_UltimateSFGameMode);
+
+static TAutoConsoleVariable<bool> CVarFighterPoolEnabled(
+	TEXT("usf.FighterPool.Enabled"),
+	true,
+	TEXT("Reuse pooled fighters for match starts and respawns instead of spawning new characters."));
+
+static TAutoConsoleVariable<bool> CVarAdaptiveTickEnabled(
+	TEXT("usf.AdaptiveTick.Enabled"),
+	true,
+	TEXT("Drop the dedicated server to IdleTickRate while no fighter is in combat mode."));
+
 AUltimateSFGameMode::AUltimateSFGameMode()
 {
 	// set default pawn class to our Blueprinted character
@@ -12,4 +41,675 @@ AUltimateSFGameMode::AUltimateSFGameMode()
 	{
 		DefaultPawnClass = PlayerPawnBPClass.Class;
 	}
+	GameStateClass = AUltimateSFGameState::StaticClass();
+	//Hands a leaving player's fighter back to the pool
+	PlayerControllerClass = AUltimateSFPlayerController::StaticClass();
+
+	PrimaryActorTick.bCanEverTick = true;
+}
+
+void AUltimateSFGameMode::InitGame(const FString& MapName, const FString& Options, FString& ErrorMessage)
+{
+	Super::InitGame(MapName, Options, ErrorMessage);
+
+	FighterPoolSize = UGameplayStatics::GetIntOption(Options, TEXT("FighterPoolSize"), FighterPoolSize);
+	IdleTickRate = UGameplayStatics::GetIntOption(Options, TEXT("IdleTickRate"), IdleTickRate);
+}
+
+void AUltimateSFGameMode::StartPlay()
+{
+	Super::StartPlay();
+
+	//Pay for every character construction up front, while nobody is fighting yet
+	if (CVarFighterPoolEnabled.GetValueOnGameThread() && DefaultPawnClass->IsChildOf<AUltimateSFCharacter>())
+	{
+		FighterPool.Reserve(FighterPoolSize);
+		for (int32 Index = FighterPool.Num(); Index < FighterPoolSize; ++Index)
+		{
+			if (AUltimateSFCharacter* Fighter = SpawnFighter(FTransform(FVector(0.f, 0.f, -100000.f))))
+			{
+				Fighter->SetPooled(true);
+				FighterPool.Add(Fighter);
+			}
+		}
+		UE_LOG(LogUltimateSF, Log, TEXT("Fighter pool ready with %d fighters"), FighterPool.Num());
+	}
+
+	if (bRecordMatchResults && GetNetMode() != NM_Client)
+	{
+		MatchResultWriter = MakeUnique<FUltimateSFMatchResultWriter>(FPaths::ProjectSavedDir() / TEXT("MatchResults") / TEXT("UltimateSFMatchResults.jsonl"), MatchResultQueueCapacity);
+		//Unique across restarts of this server without coordinating with anyone
+		NextMatchId = (uint64)FDateTime::UtcNow().GetTicks();
+	}
+
+	if (bCheckpointArena && (GetNetMode() == NM_DedicatedServer || GetNetMode() == NM_ListenServer))
+	{
+		//One file per map and port, so servers sharing a machine do not resume each other
+		const FString Filename = FPaths::ProjectSavedDir() / TEXT("Checkpoints") / FString::Printf(TEXT("%s_%d.usfcp"), *GetWorld()->GetMapName(), GetWorld()->URL.Port);
+		Checkpoint = MakeUnique<FUltimateSFCheckpointFile>();
+		if (Checkpoint->Open(Filename, FMath::Max(CheckpointCapacity, 1)))
+		{
+			for (int32 Slot = Checkpoint->GetNumSlots() - 1; Slot >= 0; --Slot)
+			{
+				FreeCheckpointSlots.Add(Slot);
+			}
+			if (Checkpoint->HasCheckpoint())
+			{
+				ResumeFromCheckpoint();
+			}
+		}
+		else
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("Checkpoint: could not map %s, the arena is not checkpointed"), *Filename);
+			Checkpoint.Reset();
+		}
+	}
+
+	//A resumed match holds the arena, it is offered once that match finishes
+	if (bUseMatchmaking && !bHasMatch && (GetNetMode() == NM_DedicatedServer || GetNetMode() == NM_ListenServer))
+	{
+		RegisterArena();
+	}
+
+	//Process wide, a map travel only points the gauges at the new world
+	const int32 MetricsPort = FUltimateSFMetrics::GetConfiguredPort();
+	if (MetricsPort > 0 && GetNetMode() != NM_Client)
+	{
+		FUltimateSFMetrics::Get().Start(GetWorld(), MetricsPort);
+	}
+}
+
+FUltimateSFArenaBounds AUltimateSFGameMode::GetArenaBounds() const
+{
+	FUltimateSFArenaBounds Bounds;
+	Bounds.Min = ArenaCenter - ArenaExtent;
+	Bounds.Max = ArenaCenter + ArenaExtent;
+	Bounds.Resolution = FMath::Max(ArenaPositionResolution, 0.01f);
+	return Bounds;
+}
+
+void AUltimateSFGameMode::RegisterArena()
+{
+	TWeakObjectPtr<AUltimateSFGameMode> WeakThis(this);
+	ArenaId = FUltimateSFMatchmakingService::Get().RegisterArena([WeakThis](const FUltimateSFMatch& Match)
+	{
+		if (AUltimateSFGameMode* GameMode = WeakThis.Get())
+		{
+			GameMode->OnMatchAssigned(Match);
+		}
+	});
+}
+
+void AUltimateSFGameMode::OnMatchAssigned(const FUltimateSFMatch& Match)
+{
+	CurrentMatch = Match;
+	bHasMatch = true;
+	UE_LOG(LogUltimateSF, Log, TEXT("Matchmaking: arena %d hosts %llu (%d) vs %llu (%d), paired after %.1f s"),
+		Match.ArenaId, Match.PlayerA, Match.SkillA, Match.PlayerB, Match.SkillB, Match.WaitSeconds);
+}
+
+void AUltimateSFGameMode::FinishMatch(AUltimateSFCharacter* ContenderA, AUltimateSFCharacter* ContenderB, AUltimateSFCharacter* Winner, bool bMatchmade)
+{
+	RecordMatchResults(ContenderA, ContenderB, Winner);
+
+	//Fighters that filled in while the matchmaker's players were on their way leave the match waiting
+	if (!bHasMatch || !bMatchmade)
+	{
+		return;
+	}
+
+	bHasMatch = false;
+	//Players of the resumed match that never came back have nothing left to resume
+	ReleaseResumedFighters();
+	if (ArenaId != INDEX_NONE)
+	{
+		FUltimateSFMatchmakingService::Get().ReleaseArena(ArenaId);
+	}
+	else if (bUseMatchmaking)
+	{
+		RegisterArena();
+	}
+}
+
+void AUltimateSFGameMode::RecordMatchResults(AUltimateSFCharacter* ContenderA, AUltimateSFCharacter* ContenderB, AUltimateSFCharacter* Winner)
+{
+	const uint64 MatchId = NextMatchId++;
+	const int64 Timestamp = FDateTime::UtcNow().ToUnixTimestamp();
+	for (AUltimateSFCharacter* Fighter : { ContenderA, ContenderB })
+	{
+		//A contender destroyed mid match has nothing left to record
+		if (Fighter == nullptr)
+		{
+			continue;
+		}
+
+		if (MatchResultWriter)
+		{
+			const APlayerState* PlayerState = Fighter->GetPlayerState();
+			FUltimateSFMatchRecord& Record = HeldMatchResults.AddDefaulted_GetRef();
+			Record.Timestamp = Timestamp;
+			Record.MatchId = MatchId;
+			Record.ArenaId = ArenaId;
+			Record.FighterId = PlayerState && PlayerState->GetUniqueId().IsValid() ? PlayerState->GetUniqueId().ToString() : Fighter->GetName();
+			Record.Outcome = Winner == nullptr ? EUltimateSFMatchOutcome::Draw : (Winner == Fighter ? EUltimateSFMatchOutcome::Win : EUltimateSFMatchOutcome::Loss);
+			Record.Stats = Fighter->MatchStats;
+		}
+		Fighter->MatchStats.Reset();
+	}
+	FlushHeldMatchResults();
+}
+
+void AUltimateSFGameMode::FlushHeldMatchResults()
+{
+	int32 NumQueued = 0;
+	while (NumQueued < HeldMatchResults.Num() && MatchResultWriter->TryEnqueue(MoveTemp(HeldMatchResults[NumQueued])))
+	{
+		++NumQueued;
+	}
+	HeldMatchResults.RemoveAt(0, NumQueued, false);
+}
+
+AUltimateSFCharacter* AUltimateSFGameMode::SpawnFighter(const FTransform& SpawnTransform)
+{
+	FActorSpawnParameters SpawnInfo;
+	SpawnInfo.Instigator = GetInstigator();
+	SpawnInfo.ObjectFlags |= RF_Transient;
+	SpawnInfo.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+	return GetWorld()->SpawnActor<AUltimateSFCharacter>(DefaultPawnClass, SpawnTransform, SpawnInfo);
+}
+
+AUltimateSFCharacter* AUltimateSFGameMode::AcquireFighter(const FTransform& SpawnTransform)
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFFighterSpawn);
+
+	while (FighterPool.Num() > 0)
+	{
+		AUltimateSFCharacter* Fighter = FighterPool.Pop(false);
+		SET_DWORD_STAT(STAT_UltimateSFPooledFighters, FighterPool.Num());
+		if (IsValid(Fighter))
+		{
+			Fighter->TeleportTo(SpawnTransform.GetLocation(), SpawnTransform.Rotator(), false, true);
+			Fighter->SetPooled(false);
+			return Fighter;
+		}
+	}
+
+	return SpawnFighter(SpawnTransform);
+}
+
+void AUltimateSFGameMode::ReleaseFighter(AUltimateSFCharacter* Fighter)
+{
+	if (!IsValid(Fighter) || Fighter->IsPooled())
+	{
+		return;
+	}
+
+	if (!CVarFighterPoolEnabled.GetValueOnGameThread() || FighterPool.Num() >= FighterPoolSize)
+	{
+		Fighter->Destroy();
+		return;
+	}
+
+	if (AController* Controller = Fighter->GetController())
+	{
+		Controller->UnPossess();
+	}
+
+	Fighter->SetPooled(true);
+	FighterPool.Add(Fighter);
+	SET_DWORD_STAT(STAT_UltimateSFPooledFighters, FighterPool.Num());
+}
+
+APawn* AUltimateSFGameMode::SpawnDefaultPawnFor_Implementation(AController* NewPlayer, AActor* StartSpot)
+{
+	if (!CVarFighterPoolEnabled.GetValueOnGameThread() || !DefaultPawnClass->IsChildOf<AUltimateSFCharacter>())
+	{
+		SCOPE_CYCLE_COUNTER(STAT_UltimateSFFighterSpawn);
+		APawn* Pawn = Super::SpawnDefaultPawnFor_Implementation(NewPlayer, StartSpot);
+		RestoreResumedFighter(NewPlayer, Pawn);
+		return Pawn;
+	}
+
+	FRotator StartRotation(ForceInit);
+	FVector StartLocation = FVector::ZeroVector;
+	if (StartSpot)
+	{
+		StartRotation.Yaw = StartSpot->GetActorRotation().Yaw;
+		StartLocation = StartSpot->GetActorLocation();
+	}
+
+	AUltimateSFCharacter* Fighter = AcquireFighter(FTransform(StartRotation, StartLocation));
+	if (Fighter)
+	{
+		Fighter->SetInstigator(NewPlayer ? NewPlayer->GetPawn() : nullptr);
+		RestoreResumedFighter(NewPlayer, Fighter);
+	}
+	return Fighter;
+}
+
+bool AUltimateSFGameMode::IsAnyFighterInCombat() const
+{
+	for (TActorIterator<AUltimateSFCharacter> It(GetWorld()); It; ++It)
+	{
+		if (It->bIsCombatMode && !It->IsPooled())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void AUltimateSFGameMode::SetTickThrottled(bool bThrottled)
+{
+	UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	if (NetDriver == nullptr || bThrottled == bTickThrottled)
+	{
+		return;
+	}
+
+	if (FullTickRate == 0)
+	{
+		FullTickRate = NetDriver->NetServerMaxTickRate;
+	}
+
+	bTickThrottled = bThrottled;
+	NetDriver->NetServerMaxTickRate = bThrottled ? FMath::Min(IdleTickRate, FullTickRate) : FullTickRate;
+	SET_DWORD_STAT(STAT_UltimateSFServerTickRate, NetDriver->NetServerMaxTickRate);
+	UE_LOG(LogUltimateSF, Verbose, TEXT("Server tick rate %d"), NetDriver->NetServerMaxTickRate);
+}
+
+void AUltimateSFGameMode::NotifyCombatActivity()
+{
+	LastCombatTime = GetWorld()->GetTimeSeconds();
+	SetTickThrottled(false);
+}
+
+void AUltimateSFGameMode::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+
+	if (HeldMatchResults.Num() > 0)
+	{
+		FlushHeldMatchResults();
+	}
+
+	if (ResumedFighters.Num() > 0 && GetWorld()->GetTimeSeconds() >= ResumedFightersDeadline)
+	{
+		UE_LOG(LogUltimateSF, Log, TEXT("Checkpoint: %d players did not reconnect in time"), ResumedFighters.Num());
+		ReleaseResumedFighters();
+	}
+
+	if (Checkpoint && GetWorld()->GetTimeSeconds() - LastCheckpointTime >= CheckpointInterval)
+	{
+		WriteCheckpoint();
+	}
+
+	if (GetNetMode() != NM_DedicatedServer)
+	{
+		return;
+	}
+
+	if (!bTickThrottled)
+	{
+		//Sleep time is not work, only what the frame actually spent counts
+		const double FrameWork = FMath::Max(0.0, FApp::GetDeltaTime() - FApp::GetIdleTime());
+		AverageFrameWorkSeconds = AverageFrameWorkSeconds == 0.0 ? FrameWork : FMath::Lerp(AverageFrameWorkSeconds, FrameWork, 0.05);
+	}
+	else if (FullTickRate > 0)
+	{
+		//Frames the full rate would have run in this delta, minus the one that did run
+		const double SkippedFrames = FMath::Max(0.0, DeltaSeconds * FullTickRate - 1.0);
+		CpuSecondsSaved += SkippedFrames * AverageFrameWorkSeconds;
+		SET_FLOAT_STAT(STAT_UltimateSFCpuSecondsSaved, CpuSecondsSaved);
+	}
+
+	if (!CVarAdaptiveTickEnabled.GetValueOnGameThread())
+	{
+		SetTickThrottled(false);
+		return;
+	}
+
+	//Combat mode is toggled from blueprint, so it is polled here as well as pushed by NotifyCombatActivity
+	const float Now = GetWorld()->GetTimeSeconds();
+	if (IsAnyFighterInCombat())
+	{
+		LastCombatTime = Now;
+	}
+	SetTickThrottled(Now - LastCombatTime > IdleDelay);
+}
+
+void AUltimateSFGameMode::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (CpuSecondsSaved > 0.0)
+	{
+		UE_LOG(LogUltimateSF, Log, TEXT("Adaptive server tick saved an estimated %.1f CPU seconds"), CpuSecondsSaved);
+	}
+	SetTickThrottled(false);
+
+	if (ArenaId != INDEX_NONE)
+	{
+		FUltimateSFMatchmakingService::Get().UnregisterArena(ArenaId);
+		ArenaId = INDEX_NONE;
+	}
+
+	//A server that quits, crashes or is redeployed leaves the checkpoint for the next one on this map. Travelling to
+	//another map or ending a PIE session is the arena closing, and a finished match is already out of the file
+	if (Checkpoint)
+	{
+		if (EndPlayReason == EEndPlayReason::LevelTransition || EndPlayReason == EEndPlayReason::EndPlayInEditor)
+		{
+			Checkpoint->Reset();
+		}
+		Checkpoint->Flush();
+		UE_LOG(LogUltimateSF, Log, TEXT("Checkpoint: %llu bytes written to %s, %.3f ms average, %.3f ms max"),
+			Checkpoint->GetBytesWritten(), *Checkpoint->GetFilename(), AverageCheckpointSeconds * 1000.0, MaxCheckpointSeconds * 1000.0);
+		Checkpoint.Reset();
+	}
+
+	//Waits a bounded time for the writer to drain, a held back result would otherwise be lost with the server.
+	//A writer whose thread never started cannot drain, and a stuck disk must not hang the shutdown
+	if (MatchResultWriter)
+	{
+		const double Deadline = FPlatformTime::Seconds() + 5.0;
+		while (HeldMatchResults.Num() > 0 && MatchResultWriter->IsRunning() && FPlatformTime::Seconds() < Deadline)
+		{
+			FlushHeldMatchResults();
+			FPlatformProcess::Sleep(0.001f);
+		}
+		if (HeldMatchResults.Num() > 0)
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("Match results: %d records could not be queued before shutdown and are lost"), HeldMatchResults.Num());
+			HeldMatchResults.Reset();
+		}
+		MatchResultWriter->Shutdown();
+		UE_LOG(LogUltimateSF, Log, TEXT("Match results: %llu records written to %s"), MatchResultWriter->GetNumWritten(), *MatchResultWriter->GetFilename());
+		MatchResultWriter.Reset();
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Checkpoint***
+/// </summary>
+
+uint64 AUltimateSFGameMode::GetFighterId(const AController* Controller)
+{
+	const APlayerState* PlayerState = Controller ? Controller->GetPlayerState<APlayerState>() : nullptr;
+	return PlayerState && PlayerState->GetUniqueId().IsValid() ? FUltimateSFFighterCheckpoint::MakeFighterId(PlayerState->GetUniqueId().ToString()) : 0;
 }
+
+void AUltimateSFGameMode::ResumeFromCheckpoint()
+{
+	FUltimateSFArenaCheckpoint Arena;
+	if (!Checkpoint->ReadArena(Arena, ResumedCheckpointTime))
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Checkpoint: %s holds no valid arena state, starting fresh"), *Checkpoint->GetFilename());
+		Checkpoint->Reset();
+		return;
+	}
+
+	if (Arena.NextMatchId != 0)
+	{
+		NextMatchId = Arena.NextMatchId;
+	}
+	if (Arena.bHasMatch)
+	{
+		CurrentMatch = FUltimateSFMatch();
+		CurrentMatch.PlayerA = Arena.PlayerA;
+		CurrentMatch.PlayerB = Arena.PlayerB;
+		CurrentMatch.SkillA = Arena.SkillA;
+		CurrentMatch.SkillB = Arena.SkillB;
+		bHasMatch = true;
+	}
+	AUltimateSFGameState* RoundState = GetGameState<AUltimateSFGameState>();
+	if (RoundState)
+	{
+		RoundState->RestoreCheckpoint(Arena, ResumedCheckpointTime);
+	}
+	ResumedFightersDeadline = GetWorld()->GetTimeSeconds() + (RoundState ? RoundState : GetDefault<AUltimateSFGameState>())->ResumeTimeout;
+
+	int32 NumBots = 0;
+	int32 NumDropped = 0;
+	for (int32 Slot = 0; Slot < Checkpoint->GetNumSlots(); ++Slot)
+	{
+		FUltimateSFFighterCheckpoint Fighter;
+		if (!Checkpoint->ReadFighter(Slot, Fighter))
+		{
+			continue;
+		}
+
+		//Bots come back right away, players get their fighter back when they reconnect
+		if (Fighter.ControlFlags & FUltimateSFFighterCheckpoint::Control_Bot)
+		{
+			AUltimateSFCharacter* Character = AcquireFighter(FTransform(FRotator(0.f, Fighter.Yaw, 0.f), FVector(Fighter.Location)));
+			if (Character)
+			{
+				FActorSpawnParameters SpawnParams;
+				SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+				AUltimateSFBotController* Bot = GetWorld()->SpawnActor<AUltimateSFBotController>(SpawnParams);
+				Bot->Possess(Character);
+				Character->RestoreCheckpoint(Fighter, ResumedCheckpointTime);
+				if (RoundState && Fighter.Contender != 0)
+				{
+					RoundState->RestoreContender(Character, Fighter.Contender - 1, Fighter.Health);
+				}
+				CheckpointSlots.Add(Character).Slot = Slot;
+				FreeCheckpointSlots.Remove(Slot);
+				++NumBots;
+				continue;
+			}
+		}
+		else if (Fighter.FighterId != 0)
+		{
+			FResumedFighter& Resumed = ResumedFighters.Add(Fighter.FighterId);
+			Resumed.Checkpoint = Fighter;
+			Resumed.Slot = Slot;
+			FreeCheckpointSlots.Remove(Slot);
+
+			//The slot's timers count from the old server's clock, the checkpoints this server writes from its own
+			const double Rebase = GetWorld()->GetTimeSeconds() - ResumedCheckpointTime;
+			for (uint32* TimerEnd : { &Fighter.CombatTimerEnd, &Fighter.HitReactionEnd })
+			{
+				*TimerEnd = *TimerEnd != 0 ? FUltimateSFFighterCheckpoint::ToMilliseconds(*TimerEnd / 1000.0 + Rebase) : 0;
+			}
+			Checkpoint->WriteFighter(Slot, Fighter);
+			continue;
+		}
+
+		Checkpoint->ClearFighter(Slot);
+		++NumDropped;
+	}
+
+	UE_LOG(LogUltimateSF, Log, TEXT("Checkpoint: resumed %s from %s at %.2f s, %d bots restored, %d players awaited, %d fighters dropped"),
+		bHasMatch ? TEXT("a match") : TEXT("the arena"), *Checkpoint->GetFilename(), ResumedCheckpointTime, NumBots, ResumedFighters.Num(), NumDropped);
+
+	//The file now follows this server. Restored bots keep their slots, and so do awaited players until they are back
+}
+
+void AUltimateSFGameMode::RestoreResumedFighter(AController* NewPlayer, APawn* Pawn)
+{
+	AUltimateSFCharacter* Fighter = Cast<AUltimateSFCharacter>(Pawn);
+	const uint64 FighterId = ResumedFighters.Num() > 0 && Fighter ? GetFighterId(NewPlayer) : 0;
+	FResumedFighter Resumed;
+	if (FighterId != 0 && ResumedFighters.RemoveAndCopyValue(FighterId, Resumed))
+	{
+		Fighter->RestoreCheckpoint(Resumed.Checkpoint, ResumedCheckpointTime);
+		AUltimateSFGameState* RoundState = GetGameState<AUltimateSFGameState>();
+		if (RoundState && Resumed.Checkpoint.Contender != 0)
+		{
+			RoundState->RestoreContender(Fighter, Resumed.Checkpoint.Contender - 1, Resumed.Checkpoint.Health);
+		}
+
+		//The fighter takes over the slot it was kept in
+		if (const FCheckpointSlot* Previous = CheckpointSlots.Find(Fighter))
+		{
+			Checkpoint->ClearFighter(Previous->Slot);
+			FreeCheckpointSlots.Add(Previous->Slot);
+		}
+		CheckpointSlots.Add(Fighter).Slot = Resumed.Slot;
+		UE_LOG(LogUltimateSF, Log, TEXT("Checkpoint: %s reconnected into its checkpointed fighter"), *GetNameSafe(NewPlayer));
+	}
+}
+
+void AUltimateSFGameMode::ReleaseResumedFighters()
+{
+	for (const TPair<uint64, FResumedFighter>& Resumed : ResumedFighters)
+	{
+		if (Checkpoint)
+		{
+			Checkpoint->ClearFighter(Resumed.Value.Slot);
+			FreeCheckpointSlots.Add(Resumed.Value.Slot);
+		}
+	}
+	ResumedFighters.Reset();
+}
+
+void AUltimateSFGameMode::WriteCheckpoint()
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFArenaCheckpoint);
+	const double StartTime = FPlatformTime::Seconds();
+	const double Now = GetWorld()->GetTimeSeconds();
+	LastCheckpointTime = Now;
+
+	//Fighters that went back to the pool or away give their slot up
+	for (auto It = CheckpointSlots.CreateIterator(); It; ++It)
+	{
+		const AUltimateSFCharacter* Fighter = It.Key().Get();
+		if (!IsValid(Fighter) || Fighter->IsPooled())
+		{
+			Checkpoint->ClearFighter(It.Value().Slot);
+			FreeCheckpointSlots.Add(It.Value().Slot);
+			It.RemoveCurrent();
+		}
+	}
+
+	const AUltimateSFGameState* RoundState = GetGameState<AUltimateSFGameState>();
+	FUltimateSFFighterCheckpoint Data;
+	for (TActorIterator<AUltimateSFCharacter> It(GetWorld()); It; ++It)
+	{
+		AUltimateSFCharacter* Fighter = *It;
+		if (Fighter->IsPooled())
+		{
+			continue;
+		}
+
+		FCheckpointSlot* Slot = CheckpointSlots.Find(Fighter);
+		if (Slot == nullptr)
+		{
+			if (FreeCheckpointSlots.Num() == 0)
+			{
+				UE_LOG(LogUltimateSF, Verbose, TEXT("Checkpoint: no free slot for %s"), *Fighter->GetName());
+				continue;
+			}
+			Slot = &CheckpointSlots.Add(Fighter);
+			Slot->Slot = FreeCheckpointSlots.Pop(false);
+		}
+
+		//A null controller costs nothing to look up, and a stale weak pointer must not pass for it
+		const AController* Controller = Fighter->GetController();
+		if (Controller == nullptr || Slot->IdController.Get() != Controller)
+		{
+			Slot->IdController = Controller;
+			Slot->FighterId = GetFighterId(Controller);
+		}
+
+		Fighter->SaveCheckpoint(Data);
+		Data.FighterId = Slot->FighterId;
+		if (RoundState)
+		{
+			Data.Contender = (uint8)(RoundState->GetContenderIndex(Fighter) + 1);
+			Data.Health = RoundState->GetQuantizedHealth(Fighter);
+		}
+		Checkpoint->WriteFighter(Slot->Slot, Data);
+	}
+
+	FUltimateSFArenaCheckpoint Arena;
+	Arena.NextMatchId = NextMatchId;
+	if (bHasMatch)
+	{
+		Arena.PlayerA = CurrentMatch.PlayerA;
+		Arena.PlayerB = CurrentMatch.PlayerB;
+		Arena.SkillA = CurrentMatch.SkillA;
+		Arena.SkillB = CurrentMatch.SkillB;
+		Arena.bHasMatch = 1;
+	}
+	if (RoundState)
+	{
+		RoundState->SaveCheckpoint(Arena);
+	}
+	Checkpoint->WriteArena(Arena, Now);
+
+	const double Elapsed = FPlatformTime::Seconds() - StartTime;
+	AverageCheckpointSeconds = AverageCheckpointSeconds == 0.0 ? Elapsed : FMath::Lerp(AverageCheckpointSeconds, Elapsed, 0.05);
+	MaxCheckpointSeconds = FMath::Max(MaxCheckpointSeconds, Elapsed);
+}
+
+static FAutoConsoleCommandWithWorldAndArgs CheckpointStatusCommand(
+	TEXT("usf.Checkpoint.Status"),
+	TEXT("Logs the arena checkpoint file, bytes written and the game thread cost of a checkpoint (server only)."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		const AUltimateSFGameMode* GameMode = World ? World->GetAuthGameMode<AUltimateSFGameMode>() : nullptr;
+		const FUltimateSFCheckpointFile* Checkpoint = GameMode ? GameMode->GetCheckpoint() : nullptr;
+		if (Checkpoint == nullptr)
+		{
+			UE_LOG(LogUltimateSF, Log, TEXT("usf.Checkpoint.Status: this world does not checkpoint its arena"));
+			return;
+		}
+
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.Checkpoint.Status: %s, %d slots, %llu bytes written, %.4f ms average, %.4f ms max per checkpoint"),
+			*Checkpoint->GetFilename(), Checkpoint->GetNumSlots(), Checkpoint->GetBytesWritten(),
+			GameMode->GetAverageCheckpointSeconds() * 1000.0, GameMode->GetMaxCheckpointSeconds() * 1000.0);
+	}));
+
+//Spawn hitch measurement, e.g. "usf.FighterPool.Stress 32" with usf.FighterPool.Enabled 0 and 1
+static FAutoConsoleCommandWithWorldAndArgs FighterPoolStressCommand(
+	TEXT("usf.FighterPool.Stress"),
+	TEXT("Starts N fighters in one frame, returns them and logs how long the starts took (server only)."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		AUltimateSFGameMode* GameMode = World ? World->GetAuthGameMode<AUltimateSFGameMode>() : nullptr;
+		if (GameMode == nullptr)
+		{
+			return;
+		}
+
+		const int32 Count = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 32;
+		const bool bPooled = CVarFighterPoolEnabled.GetValueOnGameThread();
+
+		TArray<AUltimateSFCharacter*> Fighters;
+		const double Start = FPlatformTime::Seconds();
+		for (int32 Index = 0; Index < Count; ++Index)
+		{
+			const FTransform SpawnTransform(FVector(Index * 200.f, 0.f, 200.f));
+			Fighters.Add(bPooled ? GameMode->AcquireFighter(SpawnTransform) : GameMode->GetWorld()->SpawnActor<AUltimateSFCharacter>(GameMode->DefaultPawnClass, SpawnTransform));
+		}
+		const double Elapsed = FPlatformTime::Seconds() - Start;
+
+		for (AUltimateSFCharacter* Fighter : Fighters)
+		{
+			if (bPooled)
+			{
+				GameMode->ReleaseFighter(Fighter);
+			}
+			else if (Fighter)
+			{
+				Fighter->Destroy();
+			}
+		}
+
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.FighterPool.Stress: %d %s fighter starts took %.3f ms"),
+			Count, bPooled ? TEXT("pooled") : TEXT("spawned"), Elapsed * 1000.0);
+	}));
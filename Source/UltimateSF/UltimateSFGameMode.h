@@ -4,8 +4,14 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/GameModeBase.h"
+#include "UltimateSFMatchmaker.h"
+#include "UltimateSFArenaMovement.h"
+#include "UltimateSFMatchResults.h"
+#include "UltimateSFCheckpoint.h"
 #include "UltimateSFGameMode.generated.h"
 
+class AUltimateSFCharacter;
+
 UCLASS(minimalapi)
 class AUltimateSFGameMode : public AGameModeBase
 {
@@ -13,7 +19,161 @@ class AUltimateSFGameMode : public AGameModeBase
 
 public:
 	AUltimateSFGameMode();
-};
 
+	/* Fighters spawned when the server starts and reused for every match start and respawn */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = FighterPool)
+		int32 FighterPoolSize = 32;
+
+	/* Takes a fighter out of the pool, spawning a new one only if the pool is empty */
+	AUltimateSFCharacter* AcquireFighter(const FTransform& SpawnTransform);
+
+	/* Hands a fighter back to the pool instead of destroying it */
+	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = FighterPool)
+		void ReleaseFighter(AUltimateSFCharacter* Fighter);
+
+	int32 GetNumPooledFighters() const { return FighterPool.Num(); }
+
+	/* Dedicated server tick rate while every fighter is out of combat */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = AdaptiveTick)
+		int32 IdleTickRate = 5;
+
+	/* Seconds without combat before the server drops to IdleTickRate */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = AdaptiveTick)
+		float IdleDelay = 3.f;
+
+	/* Called by the server side combat RPCs, restores the full tick rate before the next frame */
+	void NotifyCombatActivity();
+
+	bool IsTickThrottled() const { return bTickThrottled; }
+	double GetCpuSecondsSaved() const { return CpuSecondsSaved; }
+
+	/* Box fighters are replicated relative to, see FUltimateSFArenaMovement. Positions outside it cost full precision */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Arena)
+		FVector ArenaCenter = FVector::ZeroVector;
+
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Arena)
+		FVector ArenaExtent = FVector(4000.f, 4000.f, 1000.f);
+
+	/* Replicated position step in cm */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Arena)
+		float ArenaPositionResolution = 1.f;
+
+	FUltimateSFArenaBounds GetArenaBounds() const;
+
+	/* Offers this server's arena to the matchmaking service, which sends one pair at a time */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Matchmaking)
+		bool bUseMatchmaking = true;
+
+	/**
+	 * A match is over: both contenders' results are recorded, no winner is a draw. Once the pair the matchmaker sent
+	 * has played, it may send the next one; bMatchmade is false for fighters that filled in while no pair was sent.
+	 */
+	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = Matchmaking)
+		void FinishMatch(AUltimateSFCharacter* ContenderA, AUltimateSFCharacter* ContenderB, AUltimateSFCharacter* Winner, bool bMatchmade = true);
+
+	/* The id matchmaking and checkpoints know a player by, 0 for bots and players without a unique net id */
+	static uint64 GetFighterId(const AController* Controller);
+
+	/* Appends match results to Saved/MatchResults/UltimateSFMatchResults.jsonl from a background thread */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = MatchResults)
+		bool bRecordMatchResults = true;
+
+	/* Records in flight before the writer pushes back and the game mode holds them for a later tick */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = MatchResults)
+		int32 MatchResultQueueCapacity = 4096;
+
+	/* Keeps the arena in Saved/Checkpoints so a restarted server resumes fights where they stood */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Checkpoint)
+		bool bCheckpointArena = true;
 
+	/* Seconds between checkpoints */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Checkpoint)
+		float CheckpointInterval = 0.1f;
 
+	/* Fighters the checkpoint file has room for, the rest are not checkpointed */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Checkpoint)
+		int32 CheckpointCapacity = 64;
+
+	const FUltimateSFCheckpointFile* GetCheckpoint() const { return Checkpoint.Get(); }
+	double GetAverageCheckpointSeconds() const { return AverageCheckpointSeconds; }
+	double GetMaxCheckpointSeconds() const { return MaxCheckpointSeconds; }
+
+	bool HasMatch() const { return bHasMatch; }
+	const FUltimateSFMatch& GetCurrentMatch() const { return CurrentMatch; }
+
+	// AGameModeBase interface
+	virtual void InitGame(const FString& MapName, const FString& Options, FString& ErrorMessage) override;
+	virtual void StartPlay() override;
+	virtual APawn* SpawnDefaultPawnFor_Implementation(AController* NewPlayer, AActor* StartSpot) override;
+	virtual void Tick(float DeltaSeconds) override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	// End of AGameModeBase interface
+
+private:
+	AUltimateSFCharacter* SpawnFighter(const FTransform& SpawnTransform);
+
+	void RegisterArena();
+	void OnMatchAssigned(const FUltimateSFMatch& Match);
+
+	void RecordMatchResults(AUltimateSFCharacter* ContenderA, AUltimateSFCharacter* ContenderB, AUltimateSFCharacter* Winner);
+	void FlushHeldMatchResults();
+
+	void ResumeFromCheckpoint();
+	void WriteCheckpoint();
+	void RestoreResumedFighter(AController* NewPlayer, APawn* Pawn);
+	/* Gives the slots of players that did not come back to the fighters that are here */
+	void ReleaseResumedFighters();
+
+	bool IsAnyFighterInCombat() const;
+	void SetTickThrottled(bool bThrottled);
+
+	/* NetServerMaxTickRate from the net driver config, restored whenever a fight is on */
+	int32 FullTickRate = 0;
+	bool bTickThrottled = false;
+	float LastCombatTime = 0.f;
+
+	/* Average game thread work per frame at the full rate, used to estimate what the skipped frames would have cost */
+	double AverageFrameWorkSeconds = 0.0;
+	double CpuSecondsSaved = 0.0;
+
+	int32 ArenaId = INDEX_NONE;
+	FUltimateSFMatch CurrentMatch;
+	bool bHasMatch = false;
+
+	TUniquePtr<FUltimateSFMatchResultWriter> MatchResultWriter;
+	/* Records the writer refused while full, retried every tick in order */
+	TArray<FUltimateSFMatchRecord> HeldMatchResults;
+	uint64 NextMatchId = 0;
+
+	struct FCheckpointSlot
+	{
+		int32 Slot = INDEX_NONE;
+		/* The fighter id of IdController, a string and a hash away, so it is only worked out when the fighter changes hands */
+		uint64 FighterId = 0;
+		TWeakObjectPtr<const AController> IdController;
+	};
+
+	TUniquePtr<FUltimateSFCheckpointFile> Checkpoint;
+	TMap<TWeakObjectPtr<AUltimateSFCharacter>, FCheckpointSlot> CheckpointSlots;
+	TArray<int32> FreeCheckpointSlots;
+	double LastCheckpointTime = 0.0;
+	double AverageCheckpointSeconds = 0.0;
+	double MaxCheckpointSeconds = 0.0;
+
+	struct FResumedFighter
+	{
+		FUltimateSFFighterCheckpoint Checkpoint;
+		/* Kept in the file until the player is back or the wait is over, so another restart still finds it */
+		int32 Slot = INDEX_NONE;
+	};
+
+	/* Fighters of players that have not reconnected since the resume, by fighter id */
+	TMap<uint64, FResumedFighter> ResumedFighters;
+	/* World time the awaited players give their slots up, AUltimateSFGameState::ResumeTimeout after the resume */
+	double ResumedFightersDeadline = 0.0;
+	/* World time of the checkpoint resumed from, the resumed timers count from it */
+	double ResumedCheckpointTime = 0.0;
+
+	UPROPERTY(Transient)
+		TArray<AUltimateSFCharacter*> FighterPool;
+};
@@ -0,0 +1,838 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFGameState.h"
+#include "UltimateSF.h"
+#include "UltimateSFCharacter.h"
+#include "UltimateSFCheckpoint.h"
+#include "UltimateSFBotSubsystem.h"
+#include "UltimateSFGameMode.h"
+#include "Engine/Engine.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/AutomationTest.h"
+#include "Net/UnrealNetwork.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF GameState"), STATGROUP_UltimateSFGameState, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Damage Batch"), STAT_UltimateSFDamageBatch, STATGROUP_UltimateSFGameState);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Hits Per Batch"), STAT_UltimateSFHitsPerBatch, STATGROUP_UltimateSFGameState);
+
+void FUltimateSFFighterHealth::PostReplicatedAdd(const FUltimateSFArenaHealth& InArraySerializer)
+{
+	PostReplicatedChange(InArraySerializer);
+}
+
+void FUltimateSFFighterHealth::PostReplicatedChange(const FUltimateSFArenaHealth& InArraySerializer)
+{
+	if (Fighter)
+	{
+		Fighter->MarkHUDDirty((int32)EUltimateSFHUDChange::Health);
+	}
+}
+
+AUltimateSFGameState::AUltimateSFGameState()
+{
+	PrimaryActorTick.bCanEverTick = true;
+}
+
+void AUltimateSFGameState::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME(AUltimateSFGameState, MatchPhase);
+	DOREPLIFETIME(AUltimateSFGameState, RoundNumber);
+	DOREPLIFETIME(AUltimateSFGameState, LastWinner);
+	DOREPLIFETIME(AUltimateSFGameState, PhaseEndTime);
+	DOREPLIFETIME(AUltimateSFGameState, ArenaHealth);
+}
+
+void AUltimateSFGameState::BeginPlay()
+{
+	Super::BeginPlay();
+
+	//Clients only follow the replicated state
+	SetActorTickEnabled(HasAuthority());
+	if (HasAuthority())
+	{
+		PostActorTickHandle = FWorldDelegates::OnWorldPostActorTick.AddUObject(this, &AUltimateSFGameState::OnWorldPostActorTick);
+	}
+}
+
+void AUltimateSFGameState::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	FWorldDelegates::OnWorldPostActorTick.Remove(PostActorTickHandle);
+	PendingDamage.Reset();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+float AUltimateSFGameState::GetPhaseTimeRemaining() const
+{
+	return PhaseEndTime > 0.f ? FMath::Max(PhaseEndTime - (float)GetServerWorldTimeSeconds(), 0.f) : 0.f;
+}
+
+AUltimateSFCharacter* AUltimateSFGameState::GetContender(int32 Index) const
+{
+	return ArenaHealth.Items.IsValidIndex(Index) ? ArenaHealth.Items[Index].Fighter : nullptr;
+}
+
+int32 AUltimateSFGameState::GetContenderIndex(const AUltimateSFCharacter* Fighter) const
+{
+	if (Fighter != nullptr)
+	{
+		for (int32 Index = 0; Index < ArenaHealth.Items.Num(); ++Index)
+		{
+			if (ArenaHealth.Items[Index].Fighter == Fighter)
+			{
+				return Index;
+			}
+		}
+	}
+	return INDEX_NONE;
+}
+
+int32 AUltimateSFGameState::GetRoundWins(int32 Index) const
+{
+	return ArenaHealth.Items.IsValidIndex(Index) ? ArenaHealth.Items[Index].RoundWins : 0;
+}
+
+float AUltimateSFGameState::GetHealth(const AUltimateSFCharacter* Fighter) const
+{
+	const int32 Index = GetContenderIndex(Fighter);
+	return Index != INDEX_NONE ? ArenaHealth.Items[Index].GetHealth() : MaxHealth;
+}
+
+uint16 AUltimateSFGameState::GetQuantizedHealth(const AUltimateSFCharacter* Fighter) const
+{
+	const int32 Index = GetContenderIndex(Fighter);
+	return Index != INDEX_NONE ? ArenaHealth.Items[Index].Health : FUltimateSFNetCombatState::QuantizeDamage(MaxHealth);
+}
+
+bool AUltimateSFGameState::IsContenderPresent(int32 Index) const
+{
+	const AUltimateSFCharacter* Fighter = GetContender(Index);
+	return IsValid(Fighter) && !Fighter->IsPooled();
+}
+
+void AUltimateSFGameState::OnRep_MatchState()
+{
+	OnMatchStateChanged.Broadcast();
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Round State Machine***
+/// </summary>
+
+void AUltimateSFGameState::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+
+	if (bResuming)
+	{
+		UpdateResume();
+		return;
+	}
+
+	const bool bPhaseOver = PhaseEndTime > 0.f && GetServerWorldTimeSeconds() >= PhaseEndTime;
+	switch (MatchPhase)
+	{
+	case EUltimateSFMatchPhase::WaitingForFighters:
+		if (PairContenders())
+		{
+			StartRound();
+		}
+		break;
+
+	case EUltimateSFMatchPhase::RoundStarting:
+	case EUltimateSFMatchPhase::RoundInProgress:
+	case EUltimateSFMatchPhase::RoundOver:
+		//A contender that logged out or went back to the pool forfeits
+		if (!IsContenderPresent(0) || !IsContenderPresent(1))
+		{
+			EndMatch(IsContenderPresent(0) ? 0 : (IsContenderPresent(1) ? 1 : INDEX_NONE));
+		}
+		else if (bPhaseOver)
+		{
+			if (MatchPhase == EUltimateSFMatchPhase::RoundStarting)
+			{
+				BeginFight();
+			}
+			else if (MatchPhase == EUltimateSFMatchPhase::RoundInProgress)
+			{
+				//Time is up, the round goes to whoever has more health left
+				const uint16 HealthA = ArenaHealth.Items[0].Health;
+				const uint16 HealthB = ArenaHealth.Items[1].Health;
+				EndRound(HealthA > HealthB ? 0 : (HealthB > HealthA ? 1 : INDEX_NONE));
+			}
+			else
+			{
+				StartRound();
+			}
+		}
+		break;
+
+	case EUltimateSFMatchPhase::MatchOver:
+		if (bPhaseOver)
+		{
+			ResetMatch();
+		}
+		break;
+	}
+}
+
+void AUltimateSFGameState::SetPhase(EUltimateSFMatchPhase Phase, float Duration)
+{
+	MatchPhase = Phase;
+	PhaseEndTime = Duration > 0.f ? (float)GetServerWorldTimeSeconds() + Duration : 0.f;
+	ForceNetUpdate();
+
+	//Listen servers see their own changes
+	OnRep_MatchState();
+}
+
+bool AUltimateSFGameState::PairContenders()
+{
+	AUltimateSFGameMode* GameMode = GetWorld()->GetAuthGameMode<AUltimateSFGameMode>();
+	if (GameMode && GameMode->HasMatch())
+	{
+		return PairMatchmadePlayers(*GameMode);
+	}
+	JoinDeadline = 0.0;
+
+	TArray<AUltimateSFCharacter*, TInlineAllocator<8>> Candidates;
+	for (TActorIterator<AUltimateSFCharacter> It(GetWorld()); It; ++It)
+	{
+		if (!It->IsPooled() && It->GetController() != nullptr)
+		{
+			Candidates.Add(*It);
+		}
+	}
+	if (Candidates.Num() < 2)
+	{
+		return false;
+	}
+
+	//Whoever has waited longest since their last match goes first, so the last pair does not keep the arena to themselves
+	Candidates.StableSort([this](const AUltimateSFCharacter& A, const AUltimateSFCharacter& B)
+	{
+		const uint32* LastA = LastMatchOf.Find(A.GetController());
+		const uint32* LastB = LastMatchOf.Find(B.GetController());
+		return (LastA ? *LastA : 0) < (LastB ? *LastB : 0);
+	});
+	SetContenders(Candidates[0], Candidates[1], false);
+	return true;
+}
+
+bool AUltimateSFGameState::PairMatchmadePlayers(AUltimateSFGameMode& GameMode)
+{
+	const FUltimateSFMatch& Match = GameMode.GetCurrentMatch();
+	AUltimateSFCharacter* Players[2] = {};
+	for (TActorIterator<AUltimateSFCharacter> It(GetWorld()); It; ++It)
+	{
+		const uint64 FighterId = !It->IsPooled() ? AUltimateSFGameMode::GetFighterId(It->GetController()) : 0;
+		if (FighterId != 0 && (FighterId == Match.PlayerA || FighterId == Match.PlayerB))
+		{
+			Players[FighterId == Match.PlayerA ? 0 : 1] = *It;
+		}
+	}
+	if (Players[0] && Players[1])
+	{
+		JoinDeadline = 0.0;
+		SetContenders(Players[0], Players[1], true);
+		return true;
+	}
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (JoinDeadline == 0.0)
+	{
+		JoinDeadline = Now + JoinTimeout;
+	}
+	else if (Now >= JoinDeadline)
+	{
+		//Whoever showed up wins by forfeit, and the matchmaker can send the next pair
+		JoinDeadline = 0.0;
+		AUltimateSFCharacter* Present = Players[0] ? Players[0] : Players[1];
+		UE_LOG(LogUltimateSF, Warning, TEXT("Match: %llu vs %llu not in the arena after %.0f s, %s"), Match.PlayerA, Match.PlayerB, JoinTimeout,
+			Present ? *FString::Printf(TEXT("%s wins by forfeit"), *Present->GetName()) : TEXT("abandoned"));
+		GameMode.FinishMatch(Players[0], Players[1], Present, true);
+	}
+	return false;
+}
+
+void AUltimateSFGameState::SetContenders(AUltimateSFCharacter* ContenderA, AUltimateSFCharacter* ContenderB, bool bInMatchmade)
+{
+	ArenaHealth.Items.Reset();
+	for (AUltimateSFCharacter* Fighter : { ContenderA, ContenderB })
+	{
+		FUltimateSFFighterHealth& Item = ArenaHealth.Items.AddDefaulted_GetRef();
+		Item.Fighter = Fighter;
+		Item.Health = FUltimateSFNetCombatState::QuantizeDamage(MaxHealth);
+		ArenaHealth.MarkItemDirty(Item);
+	}
+	RoundNumber = 0;
+	bMatchmade = bInMatchmade;
+
+	//Players that logged out have no match left to wait for
+	for (auto It = LastMatchOf.CreateIterator(); It; ++It)
+	{
+		if (!It.Key().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+	++NumMatchesPaired;
+	LastMatchOf.Add(ContenderA->GetController(), NumMatchesPaired);
+	LastMatchOf.Add(ContenderB->GetController(), NumMatchesPaired);
+
+	UE_LOG(LogUltimateSF, Log, TEXT("Match: %s vs %s%s"), *ContenderA->GetName(), *ContenderB->GetName(), bMatchmade ? TEXT(", sent by the matchmaker") : TEXT(""));
+}
+
+void AUltimateSFGameState::StartRound()
+{
+	++RoundNumber;
+	LastWinner = INDEX_NONE;
+	PendingDamage.Reset();
+
+	const AUltimateSFGameMode* GameMode = GetWorld()->GetAuthGameMode<AUltimateSFGameMode>();
+	const FVector Center = GameMode ? GameMode->ArenaCenter : FVector::ZeroVector;
+	for (int32 Index = 0; Index < ArenaHealth.Items.Num(); ++Index)
+	{
+		FUltimateSFFighterHealth& Item = ArenaHealth.Items[Index];
+		Item.Health = FUltimateSFNetCombatState::QuantizeDamage(MaxHealth);
+		ArenaHealth.MarkItemDirty(Item);
+
+		//Facing each other across the centre, at the height the fighter stands at
+		AUltimateSFCharacter* Fighter = Item.Fighter;
+		const FRotator Rotation(0.f, Index == 0 ? 0.f : 180.f, 0.f);
+		const FVector Location(Center.X + (Index == 0 ? -0.5f : 0.5f) * StartDistance, Center.Y, Fighter->GetActorLocation().Z);
+		Fighter->ResetCombatState();
+		Fighter->TeleportTo(Location, Rotation, false, true);
+		if (AController* Controller = Fighter->GetController())
+		{
+			Controller->ClientSetRotation(Rotation);
+		}
+	}
+
+	SetPhase(EUltimateSFMatchPhase::RoundStarting, RoundStartDelay);
+}
+
+void AUltimateSFGameState::BeginFight()
+{
+	for (const FUltimateSFFighterHealth& Item : ArenaHealth.Items)
+	{
+		if (!Item.Fighter->bIsCombatMode)
+		{
+			Item.Fighter->S_SetCombatMode(true);
+		}
+	}
+
+	SetPhase(EUltimateSFMatchPhase::RoundInProgress, RoundTime);
+}
+
+void AUltimateSFGameState::EndRound(int32 WinnerIndex)
+{
+	PendingDamage.Reset();
+	LastWinner = (int8)WinnerIndex;
+
+	int32 WinsA = ArenaHealth.Items[0].RoundWins;
+	int32 WinsB = ArenaHealth.Items[1].RoundWins;
+	if (WinnerIndex != INDEX_NONE)
+	{
+		FUltimateSFFighterHealth& Winner = ArenaHealth.Items[WinnerIndex];
+		++Winner.RoundWins;
+		ArenaHealth.MarkItemDirty(Winner);
+		(WinnerIndex == 0 ? WinsA : WinsB) = Winner.RoundWins;
+	}
+
+	UE_LOG(LogUltimateSF, Log, TEXT("Match: round %d to %s, %d - %d"), RoundNumber,
+		WinnerIndex != INDEX_NONE ? *GetNameSafe(GetContender(WinnerIndex)) : TEXT("nobody"), WinsA, WinsB);
+
+	if (WinsA >= RoundsToWin || WinsB >= RoundsToWin || RoundNumber >= MaxRounds)
+	{
+		EndMatch(WinsA > WinsB ? 0 : (WinsB > WinsA ? 1 : INDEX_NONE));
+		return;
+	}
+
+	SetPhase(EUltimateSFMatchPhase::RoundOver, RoundEndDelay);
+}
+
+void AUltimateSFGameState::EndMatch(int32 WinnerIndex)
+{
+	PendingDamage.Reset();
+	LastWinner = (int8)WinnerIndex;
+	AUltimateSFCharacter* Winner = GetContender(WinnerIndex);
+
+	UE_LOG(LogUltimateSF, Log, TEXT("Match: %s after %d rounds"), Winner ? *FString::Printf(TEXT("%s wins"), *Winner->GetName()) : TEXT("draw"), RoundNumber);
+
+	SetPhase(EUltimateSFMatchPhase::MatchOver, MatchEndDelay);
+	if (AUltimateSFGameMode* GameMode = GetWorld()->GetAuthGameMode<AUltimateSFGameMode>())
+	{
+		GameMode->FinishMatch(GetContender(0), GetContender(1), Winner, bMatchmade);
+	}
+}
+
+void AUltimateSFGameState::ResetMatch()
+{
+	ArenaHealth.Items.Reset();
+	ArenaHealth.MarkArrayDirty();
+	RoundNumber = 0;
+	LastWinner = INDEX_NONE;
+	bMatchmade = false;
+	SetPhase(EUltimateSFMatchPhase::WaitingForFighters, 0.f);
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Batched Damage***
+/// </summary>
+
+void AUltimateSFGameState::QueueDamage(AUltimateSFCharacter* Victim, float Damage)
+{
+	if (MatchPhase != EUltimateSFMatchPhase::RoundInProgress || bResuming || GetContenderIndex(Victim) == INDEX_NONE)
+	{
+		return;
+	}
+
+	FPendingDamage& Hit = PendingDamage.AddDefaulted_GetRef();
+	Hit.Victim = Victim;
+	Hit.Damage = FUltimateSFNetCombatState::QuantizeDamage(Damage);
+}
+
+void AUltimateSFGameState::OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+	//After every actor ticked and before the net driver replicates the frame
+	if (World == GetWorld() && PendingDamage.Num() > 0)
+	{
+		if (MatchPhase == EUltimateSFMatchPhase::RoundInProgress)
+		{
+			ApplyPendingDamage();
+		}
+		PendingDamage.Reset();
+	}
+}
+
+void AUltimateSFGameState::ApplyPendingDamage()
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFDamageBatch);
+	SET_DWORD_STAT(STAT_UltimateSFHitsPerBatch, PendingDamage.Num());
+	++NumDamageBatches;
+	NumBatchedHits += PendingDamage.Num();
+
+	uint32 Changed = 0;
+	for (const FPendingDamage& Hit : PendingDamage)
+	{
+		const int32 Index = GetContenderIndex(Hit.Victim.Get());
+		if (Index != INDEX_NONE)
+		{
+			FUltimateSFFighterHealth& Item = ArenaHealth.Items[Index];
+			Item.Health = Item.Health > Hit.Damage ? Item.Health - Hit.Damage : 0;
+			Changed |= 1u << Index;
+		}
+	}
+	PendingDamage.Reset();
+
+	//One dirty mark per contender, however many hits it took this frame
+	for (int32 Index = 0; Index < ArenaHealth.Items.Num(); ++Index)
+	{
+		if (Changed & (1u << Index))
+		{
+			ArenaHealth.MarkItemDirty(ArenaHealth.Items[Index]);
+			ArenaHealth.Items[Index].Fighter->MarkHUDDirty((int32)EUltimateSFHUDChange::Health);
+		}
+	}
+
+	//Both down in the same frame is a draw, whichever hit the server received first
+	const bool bDownA = ArenaHealth.Items[0].Health == 0;
+	const bool bDownB = ArenaHealth.Items[1].Health == 0;
+	if (bDownA || bDownB)
+	{
+		EndRound(bDownA && bDownB ? INDEX_NONE : (bDownA ? 1 : 0));
+	}
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Checkpoint***
+/// </summary>
+
+void AUltimateSFGameState::SaveCheckpoint(FUltimateSFArenaCheckpoint& OutArena) const
+{
+	//A finished match has nothing to resume
+	if (MatchPhase == EUltimateSFMatchPhase::WaitingForFighters || MatchPhase == EUltimateSFMatchPhase::MatchOver)
+	{
+		return;
+	}
+
+	OutArena.MatchPhase = (uint8)MatchPhase;
+	OutArena.RoundNumber = RoundNumber;
+	OutArena.RoundWinsA = (uint8)GetRoundWins(0);
+	OutArena.RoundWinsB = (uint8)GetRoundWins(1);
+
+	const double Now = GetServerWorldTimeSeconds();
+	const double PhaseEnd = bResuming ? (ResumedPhaseTime > 0.f ? Now + ResumedPhaseTime : 0.0) : PhaseEndTime;
+	OutArena.PhaseEnd = PhaseEnd > 0.0 ? FUltimateSFFighterCheckpoint::ToMilliseconds(PhaseEnd) : 0;
+}
+
+void AUltimateSFGameState::RestoreCheckpoint(const FUltimateSFArenaCheckpoint& Arena, double CheckpointTime)
+{
+	const EUltimateSFMatchPhase Phase = (EUltimateSFMatchPhase)Arena.MatchPhase;
+	if (Phase == EUltimateSFMatchPhase::WaitingForFighters || Phase == EUltimateSFMatchPhase::MatchOver)
+	{
+		return;
+	}
+
+	MatchPhase = Phase;
+	RoundNumber = Arena.RoundNumber;
+	LastWinner = INDEX_NONE;
+	PhaseEndTime = 0.f;
+	//The game mode restored the matchmaker's pair before the round, if there was one
+	const AUltimateSFGameMode* GameMode = GetWorld()->GetAuthGameMode<AUltimateSFGameMode>();
+	bMatchmade = GameMode && GameMode->HasMatch();
+
+	ArenaHealth.Items.SetNum(2);
+	ArenaHealth.Items[0].RoundWins = Arena.RoundWinsA;
+	ArenaHealth.Items[1].RoundWins = Arena.RoundWinsB;
+	for (FUltimateSFFighterHealth& Item : ArenaHealth.Items)
+	{
+		Item.Fighter = nullptr;
+		Item.Health = FUltimateSFNetCombatState::QuantizeDamage(MaxHealth);
+		ArenaHealth.MarkItemDirty(Item);
+	}
+
+	//The phase clock stands still until both contenders are back
+	ResumedPhaseTime = Arena.PhaseEnd != 0 ? FMath::Max((float)(Arena.PhaseEnd / 1000.0 - CheckpointTime), 0.001f) : 0.f;
+	ResumeDeadline = GetWorld()->GetTimeSeconds() + ResumeTimeout;
+	bResuming = true;
+}
+
+void AUltimateSFGameState::RestoreContender(AUltimateSFCharacter* Fighter, int32 Index, uint16 Health)
+{
+	if (!bResuming || !ArenaHealth.Items.IsValidIndex(Index))
+	{
+		return;
+	}
+
+	FUltimateSFFighterHealth& Item = ArenaHealth.Items[Index];
+	Item.Fighter = Fighter;
+	Item.Health = Health;
+	ArenaHealth.MarkItemDirty(Item);
+}
+
+void AUltimateSFGameState::UpdateResume()
+{
+	const bool bHasA = IsContenderPresent(0);
+	const bool bHasB = IsContenderPresent(1);
+	if (bHasA && bHasB)
+	{
+		bResuming = false;
+		SetPhase(MatchPhase, ResumedPhaseTime);
+		UE_LOG(LogUltimateSF, Log, TEXT("Match: round %d resumed with %.1f s left"), RoundNumber, ResumedPhaseTime);
+	}
+	else if (GetWorld()->GetTimeSeconds() >= ResumeDeadline)
+	{
+		bResuming = false;
+		EndMatch(bHasA ? 0 : (bHasB ? 1 : INDEX_NONE));
+	}
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Bot Match Test***
+/// </summary>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+static TAutoConsoleVariable<int32> CVarMatchBotTestMatches(
+	TEXT("usf.Match.BotTestMatches"),
+	1,
+	TEXT("Best of three matches UltimateSF.Match.BotMatches plays."));
+
+static TAutoConsoleVariable<float> CVarMatchBotTestTimeout(
+	TEXT("usf.Match.BotTestTimeout"),
+	900.f,
+	TEXT("Seconds UltimateSF.Match.BotMatches gives its matches before it fails."));
+
+/**
+ * State of the UltimateSF.Match.BotMatches automation test, shared by its latent commands.
+ * Plays full matches between two bots through the round state machine and checks every round and match result.
+ * Hits land through the character blueprint's overlaps, which a -nullrhi server does not always animate, so the test
+ * also lands an attack that ended next to the opponent without having hit anything, the way the overlap would have.
+ * Those referee hits are reported apart from the bots' own and fail the test once they outnumber them.
+ */
+struct FUltimateSFBotMatchTest
+{
+	FAutomationTestBase* Test = nullptr;
+	TWeakObjectPtr<AUltimateSFGameState> GameState;
+	int32 Matches = 1;
+	double StartTime = 0.0;
+	double Deadline = 0.0;
+
+	int32 MatchesPlayed = 0;
+	int32 RoundsPlayed = 0;
+	int32 RefereeHits = 0;
+
+	EUltimateSFMatchPhase LastPhase = EUltimateSFMatchPhase::WaitingForFighters;
+	uint64 StartBatches = 0;
+	uint64 StartHits = 0;
+
+	/* Per contender, the attack in progress and the hits its fighter had landed when it began */
+	bool bAttacking[2] = {};
+	int32 AttackStartHits[2] = {};
+	EUltimateSFMove AttackMove[2] = {};
+
+	/* The game state's round settings from before the test shortened them, put back however the test ends */
+	int32 SavedRoundsToWin = 0;
+	float SavedRoundStartDelay = 0.f;
+	float SavedRoundEndDelay = 0.f;
+	float SavedMatchEndDelay = 0.f;
+	bool bSettingsSaved = false;
+
+	//Bots fight at PreferredRange, an attack further out than this whiffs
+	static constexpr float StrikeRange = 180.f;
+
+	~FUltimateSFBotMatchTest()
+	{
+		RestoreSettings();
+	}
+
+	void ShortenSettings(AUltimateSFGameState* InGameState)
+	{
+		SavedRoundsToWin = InGameState->RoundsToWin;
+		SavedRoundStartDelay = InGameState->RoundStartDelay;
+		SavedRoundEndDelay = InGameState->RoundEndDelay;
+		SavedMatchEndDelay = InGameState->MatchEndDelay;
+		bSettingsSaved = true;
+
+		InGameState->RoundsToWin = 2;
+		InGameState->RoundStartDelay = 0.5f;
+		InGameState->RoundEndDelay = 0.5f;
+		InGameState->MatchEndDelay = 0.5f;
+	}
+
+	void RestoreSettings()
+	{
+		AUltimateSFGameState* State = GameState.Get();
+		if (!bSettingsSaved || State == nullptr)
+		{
+			return;
+		}
+
+		State->RoundsToWin = SavedRoundsToWin;
+		State->RoundStartDelay = SavedRoundStartDelay;
+		State->RoundEndDelay = SavedRoundEndDelay;
+		State->MatchEndDelay = SavedMatchEndDelay;
+		bSettingsSaved = false;
+	}
+
+	void Check(bool bCondition, const FString& What)
+	{
+		if (!bCondition)
+		{
+			Test->AddError(What);
+		}
+	}
+
+	void Referee(AUltimateSFGameState* State)
+	{
+		for (int32 Index = 0; Index < 2; ++Index)
+		{
+			AUltimateSFCharacter* Attacker = State->GetContender(Index);
+			AUltimateSFCharacter* Opponent = State->GetContender(1 - Index);
+			if (Attacker == nullptr || Opponent == nullptr)
+			{
+				bAttacking[Index] = false;
+				continue;
+			}
+
+			const bool bNowAttacking = Attacker->bIsPunching || Attacker->bIsKicking;
+			if (bNowAttacking && !bAttacking[Index])
+			{
+				AttackStartHits[Index] = Attacker->MatchStats.Hits;
+				AttackMove[Index] = Attacker->GetActiveMove();
+			}
+			else if (!bNowAttacking && bAttacking[Index] && Attacker->MatchStats.Hits == AttackStartHits[Index]
+				&& State->GetMatchPhase() == EUltimateSFMatchPhase::RoundInProgress
+				&& FVector::Dist2D(Attacker->GetActorLocation(), Opponent->GetActorLocation()) <= StrikeRange)
+			{
+				const EUltimateSFMove Move = AttackMove[Index] != EUltimateSFMove::None ? AttackMove[Index] : EUltimateSFMove::Jab;
+				Opponent->ReceiveHit(Attacker, Move, Attacker->DamageDealt, false);
+				++RefereeHits;
+			}
+			bAttacking[Index] = bNowAttacking;
+		}
+	}
+
+	void OnPhaseChanged(AUltimateSFGameState* State)
+	{
+		const EUltimateSFMatchPhase Phase = State->GetMatchPhase();
+		const int32 WinsA = State->GetRoundWins(0);
+		const int32 WinsB = State->GetRoundWins(1);
+
+		if (Phase == EUltimateSFMatchPhase::RoundOver || Phase == EUltimateSFMatchPhase::MatchOver)
+		{
+			++RoundsPlayed;
+			Check(State->GetRoundNumber() <= State->MaxRounds, FString::Printf(TEXT("round %d is past MaxRounds"), State->GetRoundNumber()));
+		}
+
+		if (Phase == EUltimateSFMatchPhase::MatchOver)
+		{
+			++MatchesPlayed;
+			const int32 Winner = State->GetContender(0) == State->GetLastWinner() ? 0 : (State->GetContender(1) == State->GetLastWinner() ? 1 : INDEX_NONE);
+			const int32 WinnerWins = Winner == 0 ? WinsA : WinsB;
+			const int32 LoserWins = Winner == 0 ? WinsB : WinsA;
+			Check(Winner == INDEX_NONE || WinnerWins > LoserWins, FString::Printf(TEXT("match %d went to the contender with fewer rounds, %d - %d"), MatchesPlayed, WinsA, WinsB));
+			Check(Winner == INDEX_NONE ? WinsA == WinsB : (WinnerWins >= State->RoundsToWin || State->GetRoundNumber() >= State->MaxRounds),
+				FString::Printf(TEXT("match %d ended early at %d - %d after %d rounds"), MatchesPlayed, WinsA, WinsB, State->GetRoundNumber()));
+			Check(State->GetRoundNumber() >= State->RoundsToWin, FString::Printf(TEXT("match %d ended after %d rounds"), MatchesPlayed, State->GetRoundNumber()));
+			Test->AddInfo(FString::Printf(TEXT("match %d over, %d - %d after %d rounds"), MatchesPlayed, WinsA, WinsB, State->GetRoundNumber()));
+		}
+
+		if (Phase == EUltimateSFMatchPhase::RoundInProgress)
+		{
+			Check(State->GetHealth(State->GetContender(0)) == State->MaxHealth && State->GetHealth(State->GetContender(1)) == State->MaxHealth,
+				FString::Printf(TEXT("round %d did not start at full health"), State->GetRoundNumber()));
+		}
+	}
+
+	/* Returns true once every match is played, the time is up or the world went away */
+	bool Update()
+	{
+		AUltimateSFGameState* State = GameState.Get();
+		if (State == nullptr)
+		{
+			Test->AddError(TEXT("the world went away"));
+			return true;
+		}
+
+		Referee(State);
+
+		if (State->GetMatchPhase() != LastPhase)
+		{
+			LastPhase = State->GetMatchPhase();
+			OnPhaseChanged(State);
+		}
+
+		if (FPlatformTime::Seconds() > Deadline)
+		{
+			Test->AddError(FString::Printf(TEXT("timed out in round %d after %d matches"), State->GetRoundNumber(), MatchesPlayed));
+			return true;
+		}
+		return MatchesPlayed >= Matches;
+	}
+
+	void Report()
+	{
+		RestoreSettings();
+		const AUltimateSFGameState* State = GameState.Get();
+		if (State == nullptr)
+		{
+			return;
+		}
+
+		const uint64 Batches = State->GetNumDamageBatches() - StartBatches;
+		const uint64 Hits = State->GetNumBatchedHits() - StartHits;
+		const uint64 BotHits = Hits - FMath::Min(Hits, (uint64)RefereeHits);
+		Test->AddInfo(FString::Printf(TEXT("%d matches and %d rounds in %.1f s, %llu hits landed by the bots and %d by the referee in %llu damage batches"),
+			MatchesPlayed, RoundsPlayed, FPlatformTime::Seconds() - StartTime, BotHits, RefereeHits, Batches));
+
+		//The referee only stands in for overlaps the server missed, results decided by it say nothing about the bots' fights
+		Check(Hits > 0, FString::Printf(TEXT("no hit landed in %d rounds"), RoundsPlayed));
+		Check((uint64)RefereeHits <= BotHits, FString::Printf(TEXT("the referee landed %d of %llu hits, more than the bots did"), RefereeHits, Hits));
+	}
+};
+
+DEFINE_LATENT_AUTOMATION_COMMAND_ONE_PARAMETER(FUltimateSFPlayBotMatchesCommand, TSharedRef<FUltimateSFBotMatchTest>, MatchTest);
+
+bool FUltimateSFPlayBotMatchesCommand::Update()
+{
+	return MatchTest->Update();
+}
+
+DEFINE_LATENT_AUTOMATION_COMMAND_ONE_PARAMETER(FUltimateSFReportBotMatchesCommand, TSharedRef<FUltimateSFBotMatchTest>, MatchTest);
+
+bool FUltimateSFReportBotMatchesCommand::Update()
+{
+	MatchTest->Report();
+	return true;
+}
+
+//e.g. a server started with -server -nullrhi -ExecCmds="Automation RunTests UltimateSF.Match.BotMatches; Quit"
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUltimateSFBotMatchesTest, "UltimateSF.Match.BotMatches",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FUltimateSFBotMatchesTest::RunTest(const FString& Parameters)
+{
+	UWorld* World = nullptr;
+	for (const FWorldContext& Context : GEngine->GetWorldContexts())
+	{
+		UWorld* ContextWorld = Context.World();
+		if (ContextWorld && ContextWorld->IsGameWorld() && ContextWorld->GetNetMode() != NM_Client && ContextWorld->GetGameState<AUltimateSFGameState>())
+		{
+			World = ContextWorld;
+			break;
+		}
+	}
+	if (World == nullptr)
+	{
+		AddError(TEXT("needs a server world with AUltimateSFGameState, a dedicated server or a listen server in PIE"));
+		return false;
+	}
+
+	//Two bots of their own unless a match is already on
+	int32 NumFighters = 0;
+	for (TActorIterator<AUltimateSFCharacter> It(World); It; ++It)
+	{
+		NumFighters += !It->IsPooled() && It->GetController() != nullptr ? 1 : 0;
+	}
+	UUltimateSFBotSubsystem* BotSubsystem = World->GetSubsystem<UUltimateSFBotSubsystem>();
+	if (NumFighters < 2 && BotSubsystem)
+	{
+		BotSubsystem->SpawnBots(2 - NumFighters);
+	}
+
+	AUltimateSFGameState* GameState = World->GetGameState<AUltimateSFGameState>();
+	TSharedRef<FUltimateSFBotMatchTest> MatchTest = MakeShared<FUltimateSFBotMatchTest>();
+	MatchTest->Test = this;
+	MatchTest->GameState = GameState;
+	MatchTest->Matches = FMath::Max(CVarMatchBotTestMatches.GetValueOnGameThread(), 1);
+	MatchTest->StartTime = FPlatformTime::Seconds();
+	MatchTest->Deadline = MatchTest->StartTime + FMath::Max(CVarMatchBotTestTimeout.GetValueOnGameThread(), 1.f);
+	MatchTest->LastPhase = GameState->GetMatchPhase();
+	MatchTest->StartBatches = GameState->GetNumDamageBatches();
+	MatchTest->StartHits = GameState->GetNumBatchedHits();
+	MatchTest->ShortenSettings(GameState);
+
+	ADD_LATENT_AUTOMATION_COMMAND(FUltimateSFPlayBotMatchesCommand(MatchTest));
+	ADD_LATENT_AUTOMATION_COMMAND(FUltimateSFReportBotMatchesCommand(MatchTest));
+	return true;
+}
+
+#endif
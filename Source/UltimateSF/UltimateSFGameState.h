@@ -0,0 +1,246 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/GameStateBase.h"
+#include "Net/Serialization/FastArraySerializer.h"
+#include "UltimateSFCombatTypes.h"
+#include "UltimateSFGameState.generated.h"
+
+class AUltimateSFCharacter;
+class AUltimateSFGameMode;
+struct FUltimateSFArenaCheckpoint;
+struct FUltimateSFArenaHealth;
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE(FUltimateSFMatchStateChangedSignature);
+
+/* Where the arena is in its best of N match */
+UENUM(BlueprintType)
+enum class EUltimateSFMatchPhase : uint8
+{
+	/* Fewer than two fighters to pair up */
+	WaitingForFighters,
+	/* Contenders placed at full health, counting down */
+	RoundStarting,
+	RoundInProgress,
+	/* A knockout or the round time ran out, the next round starts after a delay */
+	RoundOver,
+	/* A contender won the match or forfeited it, the arena frees up after a delay */
+	MatchOver
+};
+
+/* One contender's round health and wins, an entry of FUltimateSFArenaHealth */
+USTRUCT()
+struct FUltimateSFFighterHealth : public FFastArraySerializerItem
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+		AUltimateSFCharacter* Fighter = nullptr;
+
+	/* Quarter points, the steps FUltimateSFNetCombatState quantizes damage to */
+	UPROPERTY()
+		uint16 Health = 0;
+
+	UPROPERTY()
+		uint8 RoundWins = 0;
+
+	float GetHealth() const { return FUltimateSFNetCombatState::DequantizeDamage(Health); }
+
+	void PostReplicatedAdd(const FUltimateSFArenaHealth& InArraySerializer);
+	void PostReplicatedChange(const FUltimateSFArenaHealth& InArraySerializer);
+};
+
+/**
+ * Health of the arena's two contenders as a fast array: a hit only sends the entry it changed,
+ * and a frame of hits on the same contender sends it once since damage is applied in one batch.
+ */
+USTRUCT()
+struct FUltimateSFArenaHealth : public FFastArraySerializer
+{
+	GENERATED_BODY()
+
+	/* Contender A then B, empty while no match is on */
+	UPROPERTY()
+		TArray<FUltimateSFFighterHealth> Items;
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms)
+	{
+		return FFastArraySerializer::FastArrayDeltaSerialize<FUltimateSFFighterHealth, FUltimateSFArenaHealth>(Items, DeltaParms, *this);
+	}
+};
+
+template<>
+struct TStructOpsTypeTraits<FUltimateSFArenaHealth> : public TStructOpsTypeTraitsBase2<FUltimateSFArenaHealth>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true
+	};
+};
+
+/**
+ * Round and match state of the arena. The server pairs the two players the matchmaker sent, or while it sent none the
+ * two fighters that have waited longest, plays rounds until one of them has won RoundsToWin, reports both contenders
+ * and the winner to AUltimateSFGameMode::FinishMatch and waits for the next pair.
+ * Hits are queued by AUltimateSFCharacter::ReceiveHit and applied together once the frame's actors ticked,
+ * so a double knockout is a draw no matter which RPC arrived first.
+ */
+UCLASS()
+class AUltimateSFGameState : public AGameStateBase
+{
+	GENERATED_BODY()
+
+public:
+	AUltimateSFGameState();
+
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Round)
+		float MaxHealth = 100.f;
+
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Round)
+		int32 RoundsToWin = 2;
+
+	/* Rounds played before drawn rounds stop the match, which then goes to the contender with more wins */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Round)
+		int32 MaxRounds = 5;
+
+	/* Seconds before a round goes to the contender with more health */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Round)
+		float RoundTime = 99.f;
+
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Round)
+		float RoundStartDelay = 3.f;
+
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Round)
+		float RoundEndDelay = 3.f;
+
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Round)
+		float MatchEndDelay = 5.f;
+
+	/* Distance between the contenders at the start of a round, around the game mode's ArenaCenter */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Round)
+		float StartDistance = 400.f;
+
+	/* Seconds the arena waits for the pair the matchmaker sent, after which whoever showed up wins by forfeit */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Round)
+		float JoinTimeout = 60.f;
+
+	/* Seconds a round resumed from a checkpoint waits for its contenders to come back */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Round)
+		float ResumeTimeout = 30.f;
+
+	UFUNCTION(BlueprintPure, Category = Round)
+		EUltimateSFMatchPhase GetMatchPhase() const { return MatchPhase; }
+
+	UFUNCTION(BlueprintPure, Category = Round)
+		int32 GetRoundNumber() const { return RoundNumber; }
+
+	/* Seconds left in the current phase on the server clock, 0 when it has no limit */
+	UFUNCTION(BlueprintPure, Category = Round)
+		float GetPhaseTimeRemaining() const;
+
+	/* Contender 0 or 1, null outside of a match */
+	UFUNCTION(BlueprintPure, Category = Round)
+		AUltimateSFCharacter* GetContender(int32 Index) const;
+
+	int32 GetContenderIndex(const AUltimateSFCharacter* Fighter) const;
+
+	UFUNCTION(BlueprintPure, Category = Round)
+		int32 GetRoundWins(int32 Index) const;
+
+	/* Round health of a contender, MaxHealth for everyone else */
+	UFUNCTION(BlueprintPure, Category = Round)
+		float GetHealth(const AUltimateSFCharacter* Fighter) const;
+
+	uint16 GetQuantizedHealth(const AUltimateSFCharacter* Fighter) const;
+
+	/* Winner of the last round or match, null on a draw */
+	UFUNCTION(BlueprintPure, Category = Round)
+		AUltimateSFCharacter* GetLastWinner() const { return GetContender(LastWinner); }
+
+	/* Fired on every peer when the phase, round or winner changes */
+	UPROPERTY(BlueprintAssignable, Category = Round)
+		FUltimateSFMatchStateChangedSignature OnMatchStateChanged;
+
+	/* Server only. Damage is applied with the rest of the frame's hits after the actors ticked */
+	void QueueDamage(AUltimateSFCharacter* Victim, float Damage);
+
+	uint64 GetNumDamageBatches() const { return NumDamageBatches; }
+	uint64 GetNumBatchedHits() const { return NumBatchedHits; }
+
+	/* Server only, see AUltimateSFGameMode's arena checkpoint */
+	void SaveCheckpoint(FUltimateSFArenaCheckpoint& OutArena) const;
+	void RestoreCheckpoint(const FUltimateSFArenaCheckpoint& Arena, double CheckpointTime);
+
+	/* A fighter of the resumed match is back, the round goes on once both are */
+	void RestoreContender(AUltimateSFCharacter* Fighter, int32 Index, uint16 Health);
+
+	// AActor interface
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual void Tick(float DeltaSeconds) override;
+	// End of AActor interface
+
+protected:
+	UFUNCTION()
+		void OnRep_MatchState();
+
+private:
+	void SetPhase(EUltimateSFMatchPhase Phase, float Duration);
+	bool PairContenders();
+	bool PairMatchmadePlayers(AUltimateSFGameMode& GameMode);
+	void SetContenders(AUltimateSFCharacter* ContenderA, AUltimateSFCharacter* ContenderB, bool bInMatchmade);
+	bool IsContenderPresent(int32 Index) const;
+	void StartRound();
+	void BeginFight();
+	void EndRound(int32 WinnerIndex);
+	void EndMatch(int32 WinnerIndex);
+	void ResetMatch();
+	void UpdateResume();
+
+	void OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds);
+	void ApplyPendingDamage();
+
+	UPROPERTY(ReplicatedUsing = OnRep_MatchState)
+		EUltimateSFMatchPhase MatchPhase = EUltimateSFMatchPhase::WaitingForFighters;
+
+	UPROPERTY(ReplicatedUsing = OnRep_MatchState)
+		uint8 RoundNumber = 0;
+
+	/* Contender index, INDEX_NONE on a draw */
+	UPROPERTY(ReplicatedUsing = OnRep_MatchState)
+		int8 LastWinner = INDEX_NONE;
+
+	/* Server world time the phase ends at, 0 when it has no limit */
+	UPROPERTY(Replicated)
+		float PhaseEndTime = 0.f;
+
+	UPROPERTY(Replicated)
+		FUltimateSFArenaHealth ArenaHealth;
+
+	struct FPendingDamage
+	{
+		TWeakObjectPtr<AUltimateSFCharacter> Victim;
+		uint16 Damage;
+	};
+	TArray<FPendingDamage> PendingDamage;
+	FDelegateHandle PostActorTickHandle;
+
+	uint64 NumDamageBatches = 0;
+	uint64 NumBatchedHits = 0;
+
+	/* The contenders are the pair the matchmaker sent rather than fighters filling in */
+	bool bMatchmade = false;
+	/* World time the matchmaker's pair forfeits if it is not in the arena, 0 until the arena waits for it */
+	double JoinDeadline = 0.0;
+	/* Pairing number of each controller's last match, the longest waiting fighters are paired first */
+	TMap<TWeakObjectPtr<const AController>, uint32> LastMatchOf;
+	uint32 NumMatchesPaired = 0;
+
+	/* A checkpointed round waiting for its contenders, the phase time left when they are back */
+	bool bResuming = false;
+	float ResumedPhaseTime = 0.f;
+	double ResumeDeadline = 0.0;
+};
@@ -0,0 +1,101 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFHitWindowNotifyState.h"
+#include "UltimateSFCharacter.h"
+#include "Animation/AnimMontage.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "HAL/IConsoleManager.h"
+#include "UObject/ObjectKey.h"
+
+namespace
+{
+	/* Game thread only: montages start from the combat code, never from worker threads */
+	TMap<TPair<TObjectKey<UAnimMontage>, float>, FUltimateSFAttackFrameData> FrameDataCache;
+}
+
+void UUltimateSFHitWindowNotifyState::NotifyBegin(USkeletalMeshComponent* MeshComp, UAnimSequenceBase* Animation, float TotalDuration, const FAnimNotifyEventReference& EventReference)
+{
+	Super::NotifyBegin(MeshComp, Animation, TotalDuration, EventReference);
+
+	if (AUltimateSFCharacter* Character = MeshComp ? Cast<AUltimateSFCharacter>(MeshComp->GetOwner()) : nullptr)
+	{
+		Character->OnHitWindow(Window, true);
+	}
+}
+
+void UUltimateSFHitWindowNotifyState::NotifyEnd(USkeletalMeshComponent* MeshComp, UAnimSequenceBase* Animation, const FAnimNotifyEventReference& EventReference)
+{
+	Super::NotifyEnd(MeshComp, Animation, EventReference);
+
+	//Also called when the montage is interrupted, so the flags can never get stuck
+	if (AUltimateSFCharacter* Character = MeshComp ? Cast<AUltimateSFCharacter>(MeshComp->GetOwner()) : nullptr)
+	{
+		Character->OnHitWindow(Window, false);
+	}
+}
+
+FString UUltimateSFHitWindowNotifyState::GetNotifyName_Implementation() const
+{
+	return Window == EUltimateSFHitWindow::Active ? TEXT("Hit Active") : TEXT("Hit Recovery");
+}
+
+FUltimateSFAttackFrameData UUltimateSFHitWindowNotifyState::GetFrameData(const UAnimMontage* Montage, float PlayRate)
+{
+	check(IsInGameThread());
+
+	const TPair<TObjectKey<UAnimMontage>, float> Key(Montage, PlayRate);
+	if (const FUltimateSFAttackFrameData* Cached = FrameDataCache.Find(Key))
+	{
+		return *Cached;
+	}
+
+	FUltimateSFAttackFrameData FrameData;
+	if (Montage)
+	{
+		const float Rate = FMath::Max(PlayRate * Montage->RateScale, KINDA_SMALL_NUMBER);
+		float RecoveryEnd = 0.f;
+		bool bHasActive = false;
+
+		for (const FAnimNotifyEvent& Notify : Montage->Notifies)
+		{
+			const UUltimateSFHitWindowNotifyState* HitWindow = Cast<UUltimateSFHitWindowNotifyState>(Notify.NotifyStateClass);
+			if (HitWindow == nullptr)
+			{
+				continue;
+			}
+
+			FrameData.bFromNotifies = true;
+			if (HitWindow->Window == EUltimateSFHitWindow::Active)
+			{
+				FrameData.ActiveStart = bHasActive ? FMath::Min(FrameData.ActiveStart, Notify.GetTriggerTime()) : Notify.GetTriggerTime();
+				FrameData.ActiveEnd = FMath::Max(FrameData.ActiveEnd, Notify.GetEndTriggerTime());
+				bHasActive = true;
+			}
+			RecoveryEnd = FMath::Max(RecoveryEnd, Notify.GetEndTriggerTime());
+		}
+
+		if (!FrameData.bFromNotifies)
+		{
+			//Unmarked montage: the whole animation is the attack
+			FrameData.ActiveEnd = Montage->GetPlayLength();
+			RecoveryEnd = Montage->GetPlayLength();
+		}
+
+		FrameData.ActiveStart /= Rate;
+		FrameData.ActiveEnd /= Rate;
+		FrameData.RecoveryEnd = RecoveryEnd / Rate;
+	}
+
+	return FrameDataCache.Add(Key, FrameData);
+}
+
+void UUltimateSFHitWindowNotifyState::ResetFrameDataCache()
+{
+	check(IsInGameThread());
+	FrameDataCache.Reset();
+}
+
+static FAutoConsoleCommand HitWindowsFlushCommand(
+	TEXT("usf.HitWindows.Flush"),
+	TEXT("Drops the cached attack frame data so edited hit window notifies are picked up"),
+	FConsoleCommandDelegate::CreateStatic(&UUltimateSFHitWindowNotifyState::ResetFrameDataCache));
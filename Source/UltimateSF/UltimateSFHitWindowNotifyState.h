@@ -0,0 +1,35 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Animation/AnimNotifies/AnimNotifyState.h"
+#include "UltimateSFCombatTypes.h"
+#include "UltimateSFHitWindowNotifyState.generated.h"
+
+class UAnimMontage;
+
+/**
+ * Marks the hit-active or recovery window of an attack montage.
+ * Begin and end are forwarded straight to the owning AUltimateSFCharacter, so the attack flags follow
+ * the animation at whatever rate it plays instead of a wall clock timer.
+ */
+UCLASS(meta = (DisplayName = "UltimateSF Hit Window"))
+class UUltimateSFHitWindowNotifyState : public UAnimNotifyState
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = Combat)
+		EUltimateSFHitWindow Window = EUltimateSFHitWindow::Active;
+
+	virtual void NotifyBegin(USkeletalMeshComponent* MeshComp, UAnimSequenceBase* Animation, float TotalDuration, const FAnimNotifyEventReference& EventReference) override;
+	virtual void NotifyEnd(USkeletalMeshComponent* MeshComp, UAnimSequenceBase* Animation, const FAnimNotifyEventReference& EventReference) override;
+	virtual FString GetNotifyName_Implementation() const override;
+
+	/* Frame data of Montage played at PlayRate, resolved once per (montage, rate) pair and cached */
+	static FUltimateSFAttackFrameData GetFrameData(const UAnimMontage* Montage, float PlayRate);
+
+	/* Drops the cache, e.g. after editing the notifies of a montage */
+	static void ResetFrameDataCache();
+};
@@ -0,0 +1,321 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFKillcam.h"
+#include "UltimateSF.h"
+#include "UltimateSFCharacter.h"
+#include "UltimateSFFighterGridSubsystem.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/Compression.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF Killcam"), STATGROUP_UltimateSFKillcam, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Killcam Sample"), STAT_UltimateSFKillcamSample, STATGROUP_UltimateSFKillcam);
+DECLARE_CYCLE_STAT(TEXT("Killcam Blob"), STAT_UltimateSFKillcamBlob, STATGROUP_UltimateSFKillcam);
+DECLARE_MEMORY_STAT(TEXT("Killcam Memory"), STAT_UltimateSFKillcamMemory, STATGROUP_UltimateSFKillcam);
+
+static TAutoConsoleVariable<float> CVarKillcamSeconds(
+	TEXT("usf.Killcam.Seconds"),
+	10.f,
+	TEXT("History kept per fighter. Buffers are sized when a fighter is first sampled."));
+
+static TAutoConsoleVariable<float> CVarKillcamSampleRate(
+	TEXT("usf.Killcam.SampleRate"),
+	30.f,
+	TEXT("Killcam samples per second. With usf.Killcam.Seconds this fixes the memory per fighter at Seconds * SampleRate * 16 bytes."));
+
+//Caps the memory per fighter, what a blob carries is capped by UUltimateSFKillcamSubsystem::MaxBlobBytes
+static constexpr int32 MaxKillcamFrames = 1 << 12;
+
+//A frame is at most 13 bytes on the wire, on top of the frame count and the first position
+static constexpr int32 MaxSerializedFrameBytes = 13;
+static constexpr int32 SerializedHeaderBytes = 16;
+
+void FUltimateSFKillcamBuffer::Init(int32 InCapacity)
+{
+	const int32 Capacity = FMath::Clamp(Align(InCapacity, KeyframeInterval), KeyframeInterval, MaxKillcamFrames);
+	Frames.SetNumZeroed(Capacity);
+	Keyframes.SetNumZeroed(Capacity / KeyframeInterval);
+	Reset();
+}
+
+void FUltimateSFKillcamBuffer::Reset()
+{
+	NumWritten = 0;
+	LastPosition = FIntVector::ZeroValue;
+}
+
+void FUltimateSFKillcamBuffer::Write(const FVector& Location, float Yaw, EUltimateSFMove Move, const FUltimateSFHitEvent* HitEvent)
+{
+	const FIntVector Quantized(FMath::RoundToInt(Location.X), FMath::RoundToInt(Location.Y), FMath::RoundToInt(Location.Z));
+
+	//Deltas are taken from the reconstructed position, a clamped teleport converges over the next frames
+	const FIntVector Delta = NumWritten == 0 ? FIntVector::ZeroValue : Quantized - LastPosition;
+	FFrame& Frame = Frames[NumWritten % Frames.Num()];
+	Frame.DeltaX = (int16)FMath::Clamp(Delta.X, (int32)MIN_int16, (int32)MAX_int16);
+	Frame.DeltaY = (int16)FMath::Clamp(Delta.Y, (int32)MIN_int16, (int32)MAX_int16);
+	Frame.DeltaZ = (int16)FMath::Clamp(Delta.Z, (int32)MIN_int16, (int32)MAX_int16);
+	Frame.Yaw = (uint8)(FMath::RoundToInt(FRotator::ClampAxis(Yaw) * (256.f / 360.f)) & 0xFF);
+	Frame.Move = (uint8)Move;
+	Frame.bHit = HitEvent != nullptr;
+	Frame.HitEvent = HitEvent ? *HitEvent : FUltimateSFHitEvent();
+
+	LastPosition = NumWritten == 0 ? Quantized : LastPosition + FIntVector(Frame.DeltaX, Frame.DeltaY, Frame.DeltaZ);
+	if (NumWritten % KeyframeInterval == 0)
+	{
+		Keyframes[(NumWritten / KeyframeInterval) % Keyframes.Num()] = LastPosition;
+	}
+	++NumWritten;
+}
+
+int64 FUltimateSFKillcamBuffer::GetFirstValidFrame() const
+{
+	if (NumWritten <= Frames.Num())
+	{
+		return 0;
+	}
+	//The interval the oldest frame sits in has already lost its keyframe
+	return Align(NumWritten - Frames.Num(), (int64)KeyframeInterval);
+}
+
+void FUltimateSFKillcamBuffer::Decode(TArray<FUltimateSFKillcamSample>& OutSamples) const
+{
+	OutSamples.Reset();
+	if (Frames.Num() == 0)
+	{
+		return;
+	}
+
+	const int64 First = GetFirstValidFrame();
+	OutSamples.Reserve(NumWritten - First);
+
+	FIntVector Position = Keyframes[(First / KeyframeInterval) % Keyframes.Num()];
+	for (int64 FrameIndex = First; FrameIndex < NumWritten; ++FrameIndex)
+	{
+		const FFrame& Frame = Frames[FrameIndex % Frames.Num()];
+		if (FrameIndex != First)
+		{
+			Position += FIntVector(Frame.DeltaX, Frame.DeltaY, Frame.DeltaZ);
+		}
+
+		FUltimateSFKillcamSample& Sample = OutSamples.AddDefaulted_GetRef();
+		Sample.Location = FVector(Position);
+		Sample.Yaw = Frame.Yaw * (360.f / 256.f);
+		Sample.Move = (EUltimateSFMove)FMath::Min<uint8>(Frame.Move, (uint8)EUltimateSFMove::MAX - 1);
+		Sample.bHit = Frame.bHit != 0;
+		Sample.HitEvent = Frame.HitEvent;
+	}
+}
+
+void FUltimateSFKillcamBuffer::Serialize(FArchive& Ar, int32 MaxFrames)
+{
+	//Starting on a keyframe, so a trimmed buffer still has an absolute position to start from
+	int64 First = Ar.IsLoading() ? 0 : FMath::Max(GetFirstValidFrame(), Align(FMath::Max(NumWritten - MaxFrames, (int64)0), (int64)KeyframeInterval));
+	int32 NumFrames = Ar.IsLoading() ? 0 : (int32)(NumWritten - First);
+	Ar << NumFrames;
+
+	if (Ar.IsLoading())
+	{
+		//Loaded buffers are never written to: one keyframe at the start, exactly the frames received
+		NumFrames = FMath::Clamp(NumFrames, 0, MaxKillcamFrames);
+		Frames.SetNumZeroed(FMath::Max(NumFrames, 1));
+		Keyframes.SetNumZeroed(1);
+		NumWritten = NumFrames;
+	}
+
+	FIntVector& Start = Keyframes[(First / KeyframeInterval) % Keyframes.Num()];
+	Ar << Start.X << Start.Y << Start.Z;
+
+	for (int64 FrameIndex = First; FrameIndex < First + NumFrames && !Ar.IsError(); ++FrameIndex)
+	{
+		FFrame& Frame = Frames[FrameIndex % Frames.Num()];
+		Ar << Frame.DeltaX << Frame.DeltaY << Frame.DeltaZ << Frame.Yaw << Frame.Move << Frame.bHit;
+		if (Frame.bHit)
+		{
+			Ar << Frame.HitEvent.Move << Frame.HitEvent.Direction << Frame.HitEvent.Damage << Frame.HitEvent.Flags;
+		}
+	}
+}
+
+
+void UUltimateSFKillcamSubsystem::Deinitialize()
+{
+	HistoryIndices.Reset();
+	Histories.Reset();
+	FreeHistories.Reset();
+
+	Super::Deinitialize();
+}
+
+TStatId UUltimateSFKillcamSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UUltimateSFKillcamSubsystem, STATGROUP_Tickables);
+}
+
+SIZE_T UUltimateSFKillcamSubsystem::GetAllocatedSize() const
+{
+	SIZE_T Size = Histories.GetAllocatedSize() + HistoryIndices.GetAllocatedSize();
+	for (const FFighterHistory& History : Histories)
+	{
+		Size += History.Buffer.GetAllocatedSize();
+	}
+	return Size;
+}
+
+UUltimateSFKillcamSubsystem::FFighterHistory& UUltimateSFKillcamSubsystem::FindOrAddHistory(AUltimateSFCharacter* Fighter)
+{
+	if (const int32* Index = HistoryIndices.Find(Fighter))
+	{
+		return Histories[*Index];
+	}
+
+	//Recycle a released buffer before allocating a new one
+	int32 Index;
+	if (FreeHistories.Num() > 0)
+	{
+		Index = FreeHistories.Pop(false);
+	}
+	else
+	{
+		Index = Histories.AddDefaulted();
+		const int32 Capacity = FMath::CeilToInt(CVarKillcamSeconds.GetValueOnGameThread() * CVarKillcamSampleRate.GetValueOnGameThread());
+		Histories[Index].Buffer.Init(Capacity);
+		SET_MEMORY_STAT(STAT_UltimateSFKillcamMemory, GetAllocatedSize());
+	}
+
+	FFighterHistory& History = Histories[Index];
+	History.Buffer.Reset();
+	History.bPendingHit = false;
+	HistoryIndices.Add(Fighter, Index);
+	return History;
+}
+
+void UUltimateSFKillcamSubsystem::RecordHit(AUltimateSFCharacter* Fighter, const FUltimateSFHitEvent& HitEvent)
+{
+	if (const int32* Index = HistoryIndices.Find(Fighter))
+	{
+		Histories[*Index].PendingHit = HitEvent;
+		Histories[*Index].bPendingHit = true;
+	}
+}
+
+void UUltimateSFKillcamSubsystem::RemoveFighter(AUltimateSFCharacter* Fighter)
+{
+	int32 Index;
+	if (HistoryIndices.RemoveAndCopyValue(Fighter, Index))
+	{
+		FreeHistories.Add(Index);
+	}
+}
+
+void UUltimateSFKillcamSubsystem::Tick(float DeltaTime)
+{
+	if (GetWorld()->GetNetMode() == NM_Client)
+	{
+		return;
+	}
+
+	const float SampleRate = FMath::Max(1.f, CVarKillcamSampleRate.GetValueOnGameThread());
+	SampleAccumulator += DeltaTime;
+	if (SampleAccumulator < 1.f / SampleRate)
+	{
+		return;
+	}
+	SampleAccumulator = FMath::Fmod(SampleAccumulator, 1.f / SampleRate);
+
+	const UUltimateSFFighterGridSubsystem* Grid = GetWorld()->GetSubsystem<UUltimateSFFighterGridSubsystem>();
+	if (Grid == nullptr)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFKillcamSample);
+
+	++SampleCount;
+	Grid->ForEachFighter([this](AUltimateSFCharacter* Fighter)
+	{
+		FFighterHistory& History = FindOrAddHistory(Fighter);
+		History.Buffer.Write(Fighter->GetActorLocation(), Fighter->GetActorRotation().Yaw, Fighter->GetActiveMove(), History.bPendingHit ? &History.PendingHit : nullptr);
+		History.bPendingHit = false;
+		History.LastSeenSample = SampleCount;
+	});
+
+	//Fighters that left the grid (pooled, destroyed) hand their buffer back
+	for (auto It = HistoryIndices.CreateIterator(); It; ++It)
+	{
+		if (!It->Key.IsValid() || Histories[It->Value].LastSeenSample != SampleCount)
+		{
+			FreeHistories.Add(It->Value);
+			It.RemoveCurrent();
+		}
+	}
+}
+
+bool UUltimateSFKillcamSubsystem::BuildBlob(const TArray<AUltimateSFCharacter*>& Fighters, TArray<AUltimateSFCharacter*>& OutFighters, TArray<uint8>& OutBlob, int32& OutUncompressedSize)
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFKillcamBlob);
+
+	OutFighters.Reset();
+	TArray<int32, TInlineAllocator<4>> Indices;
+	for (AUltimateSFCharacter* Fighter : Fighters)
+	{
+		const int32* Index = Fighter ? HistoryIndices.Find(Fighter) : nullptr;
+		if (Index && !OutFighters.Contains(Fighter))
+		{
+			OutFighters.Add(Fighter);
+			Indices.Add(*Index);
+		}
+	}
+	if (OutFighters.Num() == 0)
+	{
+		return false;
+	}
+
+	//Every fighter gets an equal share of the cap even before compression, so the blob fits whatever the frames hold
+	const int32 MaxFrames = FMath::Max((MaxBlobBytes / OutFighters.Num() - SerializedHeaderBytes) / MaxSerializedFrameBytes, 0);
+
+	TArray<uint8> Uncompressed;
+	FMemoryWriter Writer(Uncompressed);
+	for (int32 Index : Indices)
+	{
+		Histories[Index].Buffer.Serialize(Writer, MaxFrames);
+	}
+
+	OutUncompressedSize = Uncompressed.Num();
+	int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, Uncompressed.Num());
+	OutBlob.SetNumUninitialized(CompressedSize);
+	if (!FCompression::CompressMemory(NAME_Zlib, OutBlob.GetData(), CompressedSize, Uncompressed.GetData(), Uncompressed.Num()))
+	{
+		OutBlob.Reset();
+		return false;
+	}
+	OutBlob.SetNum(CompressedSize);
+	return true;
+}
+
+bool UUltimateSFKillcamSubsystem::DecodeBlob(const TArray<uint8>& Blob, int32 UncompressedSize, int32 NumFighters, TArray<TArray<FUltimateSFKillcamSample>>& OutSamples)
+{
+	OutSamples.Reset();
+
+	if (UncompressedSize <= 0 || UncompressedSize > MaxBlobBytes)
+	{
+		return false;
+	}
+
+	TArray<uint8> Uncompressed;
+	Uncompressed.SetNumUninitialized(UncompressedSize);
+	if (!FCompression::UncompressMemory(NAME_Zlib, Uncompressed.GetData(), UncompressedSize, Blob.GetData(), Blob.Num()))
+	{
+		return false;
+	}
+
+	FMemoryReader Reader(Uncompressed);
+	OutSamples.SetNum(NumFighters);
+	for (int32 Index = 0; Index < NumFighters && !Reader.IsError(); ++Index)
+	{
+		FUltimateSFKillcamBuffer Buffer;
+		Buffer.Serialize(Reader);
+		Buffer.Decode(OutSamples[Index]);
+	}
+	return !Reader.IsError();
+}
@@ -0,0 +1,137 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UltimateSFCombatTypes.h"
+#include "UltimateSFKillcam.generated.h"
+
+class AUltimateSFCharacter;
+
+/* One decoded killcam sample of one fighter */
+USTRUCT(BlueprintType)
+struct FUltimateSFKillcamSample
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = Killcam)
+	FVector Location = FVector::ZeroVector;
+
+	UPROPERTY(BlueprintReadOnly, Category = Killcam)
+	float Yaw = 0.f;
+
+	UPROPERTY(BlueprintReadOnly, Category = Killcam)
+	EUltimateSFMove Move = EUltimateSFMove::None;
+
+	UPROPERTY(BlueprintReadOnly, Category = Killcam)
+	bool bHit = false;
+
+	UPROPERTY(BlueprintReadOnly, Category = Killcam)
+	FUltimateSFHitEvent HitEvent;
+};
+
+/**
+ * Fixed capacity history of one fighter.
+ * Frames are 16 byte records holding a cm delta from the previous frame, the quantized yaw, the active move
+ * and an optional hit event; every KeyframeInterval frames the absolute position is kept in a side ring.
+ * Writing a frame is one slot store, and the whole buffer is allocated up front, so the memory per
+ * fighter is Capacity * 16 bytes plus one FIntVector per keyframe and never grows.
+ */
+class FUltimateSFKillcamBuffer
+{
+public:
+	struct FFrame
+	{
+		int16 DeltaX = 0;
+		int16 DeltaY = 0;
+		int16 DeltaZ = 0;
+		uint8 Yaw = 0;
+		uint8 Move = 0;
+		uint8 bHit = 0;
+		uint8 Padding[3] = {};
+		FUltimateSFHitEvent HitEvent;
+	};
+	static_assert(sizeof(FFrame) == 16, "Killcam frames are sized for the memory cap");
+
+	static constexpr int32 KeyframeInterval = 32;
+
+	/* Capacity is rounded up to whole keyframe intervals */
+	void Init(int32 InCapacity);
+	void Reset();
+
+	void Write(const FVector& Location, float Yaw, EUltimateSFMove Move, const FUltimateSFHitEvent* HitEvent);
+
+	/* Oldest to newest. The oldest partial keyframe interval is skipped once the ring has wrapped */
+	void Decode(TArray<FUltimateSFKillcamSample>& OutSamples) const;
+
+	/* Compact form of the newest MaxFrames valid frames: the first absolute position then the raw frames */
+	void Serialize(FArchive& Ar, int32 MaxFrames = MAX_int32);
+
+	int32 GetCapacity() const { return Frames.Num(); }
+	SIZE_T GetAllocatedSize() const { return Frames.GetAllocatedSize() + Keyframes.GetAllocatedSize(); }
+
+private:
+	int64 GetFirstValidFrame() const;
+
+	TArray<FFrame> Frames;
+	TArray<FIntVector> Keyframes;
+
+	/* Frames written so far, the next frame goes to NumWritten % Capacity */
+	int64 NumWritten = 0;
+
+	/* Position the last delta was taken from, so rounding never accumulates */
+	FIntVector LastPosition = FIntVector::ZeroValue;
+};
+
+/**
+ * Server side killcam: samples every active fighter at usf.Killcam.SampleRate into a preallocated
+ * FUltimateSFKillcamBuffer covering usf.Killcam.Seconds, and packs the fighters a client asks about into one
+ * compressed blob of at most MaxBlobBytes (AUltimateSFCharacter::S_RequestKillcam), dropping their oldest frames first.
+ */
+UCLASS()
+class UUltimateSFKillcamSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/* Blobs are sent in one reliable RPC, well under the size the net driver assembles a bunch to */
+	static constexpr int32 MaxBlobBytes = 32 * 1024;
+
+	/* Server only. Attached to the fighter's next sample */
+	void RecordHit(AUltimateSFCharacter* Fighter, const FUltimateSFHitEvent& HitEvent);
+
+	/* Server only. Hands the fighter's buffer back, its history must not outlive it */
+	void RemoveFighter(AUltimateSFCharacter* Fighter);
+
+	/* The requested fighters that have a history, in blob order, plus their zlib compressed buffers */
+	bool BuildBlob(const TArray<AUltimateSFCharacter*>& Fighters, TArray<AUltimateSFCharacter*>& OutFighters, TArray<uint8>& OutBlob, int32& OutUncompressedSize);
+
+	/* Client side: unpacks a blob received from the server, one sample array per fighter */
+	static bool DecodeBlob(const TArray<uint8>& Blob, int32 UncompressedSize, int32 NumFighters, TArray<TArray<FUltimateSFKillcamSample>>& OutSamples);
+
+	SIZE_T GetAllocatedSize() const;
+
+private:
+	struct FFighterHistory
+	{
+		FUltimateSFKillcamBuffer Buffer;
+		FUltimateSFHitEvent PendingHit;
+		bool bPendingHit = false;
+		uint32 LastSeenSample = 0;
+	};
+
+	FFighterHistory& FindOrAddHistory(AUltimateSFCharacter* Fighter);
+
+	/* Weak so a destroyed fighter is never packed and a new one at its address starts a history of its own */
+	TMap<TWeakObjectPtr<AUltimateSFCharacter>, int32> HistoryIndices;
+	TArray<FFighterHistory> Histories;
+	TArray<int32> FreeHistories;
+
+	float SampleAccumulator = 0.f;
+	uint32 SampleCount = 0;
+};
@@ -0,0 +1,383 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFLatencyTracker.h"
+#include "UltimateSF.h"
+#include "UltimateSFCharacter.h"
+#include "UltimateSFCombatRules.h"
+#include "Containers/Ticker.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF Latency"), STATGROUP_UltimateSFLatency, STATCAT_Advanced);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Client To Server p50 (ms)"), STAT_UltimateSFClientToServerP50, STATGROUP_UltimateSFLatency);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Client To Server p99 (ms)"), STAT_UltimateSFClientToServerP99, STATGROUP_UltimateSFLatency);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Server To Montage p50 (ms)"), STAT_UltimateSFServerToMontageP50, STATGROUP_UltimateSFLatency);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Server To Montage p99 (ms)"), STAT_UltimateSFServerToMontageP99, STATGROUP_UltimateSFLatency);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Input To Montage p50 (ms)"), STAT_UltimateSFInputToMontageP50, STATGROUP_UltimateSFLatency);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Input To Montage p99 (ms)"), STAT_UltimateSFInputToMontageP99, STATGROUP_UltimateSFLatency);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Prediction Confirm p50 (ms)"), STAT_UltimateSFPredictionConfirmP50, STATGROUP_UltimateSFLatency);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Prediction Confirm p99 (ms)"), STAT_UltimateSFPredictionConfirmP99, STATGROUP_UltimateSFLatency);
+
+CSV_DEFINE_CATEGORY(UltimateSFLatency, true);
+
+FUltimateSFLatencyTracker& FUltimateSFLatencyTracker::Get()
+{
+	static FUltimateSFLatencyTracker Tracker;
+	return Tracker;
+}
+
+const TCHAR* FUltimateSFLatencyTracker::GetHopName(EHop Hop)
+{
+	switch (Hop)
+	{
+	case EHop::ClientToServer:		return TEXT("ClientToServer");
+	case EHop::ServerToMontage:		return TEXT("ServerToMontage");
+	case EHop::InputToMontage:		return TEXT("InputToMontage");
+	case EHop::PredictionConfirm:	return TEXT("PredictionConfirm");
+	default:						return TEXT("Unknown");
+	}
+}
+
+void FUltimateSFLatencyTracker::Record(EHop Hop, float Seconds)
+{
+	//Clock sync noise can put a sample slightly below zero
+	const float Ms = FMath::Max(0.f, Seconds * 1000.f);
+	FHistogram& Histogram = Histograms[(int32)Hop];
+	const int32 Bucket = FMath::Min(FMath::FloorToInt(Ms), NumBuckets);
+	++Histogram.Buckets[Bucket];
+	++Histogram.NumSamples;
+	AdvanceCursor(Histogram, Histogram.P50, 0.5f, Bucket);
+	AdvanceCursor(Histogram, Histogram.P99, 0.99f, Bucket);
+
+	switch (Hop)
+	{
+	case EHop::ClientToServer:		CSV_CUSTOM_STAT(UltimateSFLatency, ClientToServerMs, Ms, ECsvCustomStatOp::Max); break;
+	case EHop::ServerToMontage:		CSV_CUSTOM_STAT(UltimateSFLatency, ServerToMontageMs, Ms, ECsvCustomStatOp::Max); break;
+	case EHop::InputToMontage:		CSV_CUSTOM_STAT(UltimateSFLatency, InputToMontageMs, Ms, ECsvCustomStatOp::Max); break;
+	case EHop::PredictionConfirm:	CSV_CUSTOM_STAT(UltimateSFLatency, PredictionConfirmMs, Ms, ECsvCustomStatOp::Max); break;
+	default: break;
+	}
+
+	UpdateStats(Hop);
+}
+
+float FUltimateSFLatencyTracker::GetPercentileMs(EHop Hop, float Percentile) const
+{
+	const FHistogram& Histogram = Histograms[(int32)Hop];
+	if (Histogram.NumSamples == 0)
+	{
+		return 0.f;
+	}
+
+	const uint32 Target = FMath::Max<uint32>(1, FMath::CeilToInt(Histogram.NumSamples * Percentile));
+	uint32 Seen = 0;
+	for (int32 Bucket = 0; Bucket <= NumBuckets; ++Bucket)
+	{
+		Seen += Histogram.Buckets[Bucket];
+		if (Seen >= Target)
+		{
+			return Bucket + 1.f;
+		}
+	}
+	return NumBuckets;
+}
+
+void FUltimateSFLatencyTracker::AdvanceCursor(const FHistogram& Histogram, FPercentileCursor& Cursor, float Percentile, int32 NewBucket)
+{
+	//Histogram already holds the new sample. The target rank moves by at most one per sample, so the cursor only
+	//steps over the empty buckets between neighbouring samples
+	if (NewBucket <= Cursor.Bucket)
+	{
+		++Cursor.AtOrBelow;
+	}
+	const uint32 Target = FMath::Max<uint32>(1, FMath::CeilToInt(Histogram.NumSamples * Percentile));
+	while (Cursor.AtOrBelow < Target)
+	{
+		Cursor.AtOrBelow += Histogram.Buckets[++Cursor.Bucket];
+	}
+	while (Cursor.Bucket > 0 && Cursor.AtOrBelow - Histogram.Buckets[Cursor.Bucket] >= Target)
+	{
+		Cursor.AtOrBelow -= Histogram.Buckets[Cursor.Bucket--];
+	}
+}
+
+void FUltimateSFLatencyTracker::UpdateStats(EHop Hop) const
+{
+#if STATS
+	//Same values as GetPercentileMs, read from the cursors
+	const FHistogram& Histogram = Histograms[(int32)Hop];
+	const float P50 = Histogram.P50.Bucket + 1.f;
+	const float P99 = Histogram.P99.Bucket + 1.f;
+	switch (Hop)
+	{
+	case EHop::ClientToServer:		SET_FLOAT_STAT(STAT_UltimateSFClientToServerP50, P50); SET_FLOAT_STAT(STAT_UltimateSFClientToServerP99, P99); break;
+	case EHop::ServerToMontage:		SET_FLOAT_STAT(STAT_UltimateSFServerToMontageP50, P50); SET_FLOAT_STAT(STAT_UltimateSFServerToMontageP99, P99); break;
+	case EHop::InputToMontage:		SET_FLOAT_STAT(STAT_UltimateSFInputToMontageP50, P50); SET_FLOAT_STAT(STAT_UltimateSFInputToMontageP99, P99); break;
+	case EHop::PredictionConfirm:	SET_FLOAT_STAT(STAT_UltimateSFPredictionConfirmP50, P50); SET_FLOAT_STAT(STAT_UltimateSFPredictionConfirmP99, P99); break;
+	default: break;
+	}
+#endif
+}
+
+void FUltimateSFLatencyTracker::Reset()
+{
+	for (FHistogram& Histogram : Histograms)
+	{
+		Histogram = FHistogram();
+	}
+}
+
+bool FUltimateSFLatencyTracker::WriteCsv(const FString& Filename) const
+{
+	//One row per 1 ms bucket, one column per hop; the last bucket collects everything above a second
+	FString Csv = TEXT("BucketMs");
+	for (int32 Hop = 0; Hop < (int32)EHop::Count; ++Hop)
+	{
+		Csv += FString::Printf(TEXT(",%s"), GetHopName((EHop)Hop));
+	}
+	Csv += LINE_TERMINATOR;
+
+	for (int32 Bucket = 0; Bucket <= NumBuckets; ++Bucket)
+	{
+		Csv += FString::FromInt(Bucket);
+		for (int32 Hop = 0; Hop < (int32)EHop::Count; ++Hop)
+		{
+			Csv += FString::Printf(TEXT(",%u"), Histograms[Hop].Buckets[Bucket]);
+		}
+		Csv += LINE_TERMINATOR;
+	}
+
+	return FFileHelper::SaveStringToFile(Csv, *Filename);
+}
+
+static FAutoConsoleCommand LatencyDumpCommand(
+	TEXT("usf.Latency.Dump"),
+	TEXT("Logs p50/p99 of every attack latency hop and writes the histograms to Saved/Profiling/UltimateSFLatency.csv"),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		const FUltimateSFLatencyTracker& Tracker = FUltimateSFLatencyTracker::Get();
+		for (int32 Hop = 0; Hop < (int32)FUltimateSFLatencyTracker::EHop::Count; ++Hop)
+		{
+			const FUltimateSFLatencyTracker::EHop HopType = (FUltimateSFLatencyTracker::EHop)Hop;
+			UE_LOG(LogUltimateSF, Log, TEXT("%-16s samples=%6u p50=%6.1f ms p99=%6.1f ms"), FUltimateSFLatencyTracker::GetHopName(HopType),
+				Tracker.GetNumSamples(HopType), Tracker.GetPercentileMs(HopType, 0.5f), Tracker.GetPercentileMs(HopType, 0.99f));
+		}
+
+		const FString Filename = FPaths::ProfilingDir() / TEXT("UltimateSFLatency.csv");
+		if (Tracker.WriteCsv(Filename))
+		{
+			UE_LOG(LogUltimateSF, Log, TEXT("Wrote %s"), *Filename);
+		}
+	}));
+
+static FAutoConsoleCommand LatencyResetCommand(
+	TEXT("usf.Latency.Reset"),
+	TEXT("Clears the attack latency histograms"),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		FUltimateSFLatencyTracker::Get().Reset();
+	}));
+
+/**
+ * Measures the attack latency the local player perceives at 50, 100 and 200 ms round trip, each once with
+ * usf.Attack.Predict on and once off. Lag is emulated on this client only, half on outgoing and half on incoming
+ * packets, so run it on a client of a loopback server that emulates nothing itself.
+ * Passes when predicted jabs start their montage within a frame of the input and the server confirms every one
+ * about a round trip later, and when unpredicted jabs wait for that round trip (which shows the emulation applied).
+ */
+struct FUltimateSFLatencyValidation
+{
+	struct FRun
+	{
+		int32 RttMs = 0;
+		bool bPredict = true;
+	};
+
+	TWeakObjectPtr<UWorld> World;
+	TArray<FRun> Runs;
+	int32 RunIndex = 0;
+	int32 AttacksPerRun = 20;
+	int32 AttacksFired = 0;
+	double RunStart = 0.0;
+	double NextAttackTime = 0.0;
+	bool bMeasuring = false;
+	bool bOriginalPredict = true;
+	int32 NumFailedRuns = 0;
+	FString Csv;
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	//Packets queued under the previous lag are delivered before a run starts counting
+	static constexpr double SettleSeconds = 1.0;
+	//A predicted montage starts in the input's frame, this allows a 30 Hz client one frame of slack
+	static constexpr float FrameBudgetMs = 34.f;
+	//Server and client frames the confirmation may wait for on top of the round trip
+	static constexpr float ConfirmSlackMs = 100.f;
+
+	static IConsoleVariable* GetPredictVariable()
+	{
+		return IConsoleManager::Get().FindConsoleVariable(TEXT("usf.Attack.Predict"));
+	}
+
+	AUltimateSFCharacter* GetFighter() const
+	{
+		const APlayerController* PlayerController = World.IsValid() ? World->GetFirstPlayerController() : nullptr;
+		return PlayerController ? Cast<AUltimateSFCharacter>(PlayerController->GetPawn()) : nullptr;
+	}
+
+	void SetLag(int32 RttMs) const
+	{
+		const int32 OneWayMs = RttMs / 2;
+		GEngine->Exec(World.Get(), *FString::Printf(TEXT("Net PktLag=%d PktIncomingLagMin=%d PktIncomingLagMax=%d"), OneWayMs, OneWayMs, OneWayMs));
+	}
+
+	void StartRun()
+	{
+		SetLag(Runs[RunIndex].RttMs);
+		GetPredictVariable()->Set(Runs[RunIndex].bPredict, ECVF_SetByConsole);
+		RunStart = FPlatformTime::Seconds();
+		bMeasuring = false;
+		AttacksFired = 0;
+	}
+
+	bool Tick(float DeltaTime)
+	{
+		AUltimateSFCharacter* Fighter = GetFighter();
+		if (Fighter == nullptr || World->GetNetMode() != NM_Client)
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("usf.Latency.Validate: lost the connection or the local fighter"));
+			++NumFailedRuns;
+			Finish();
+			delete this;
+			return false;
+		}
+
+		const FRun& Run = Runs[RunIndex];
+		const double Now = FPlatformTime::Seconds();
+		if (!bMeasuring)
+		{
+			if (!Fighter->bIsCombatMode)
+			{
+				Fighter->bIsCombatMode = true;
+				Fighter->S_SetCombatMode(true);
+			}
+			if (Now - RunStart >= SettleSeconds + Run.RttMs / 1000.0)
+			{
+				FUltimateSFLatencyTracker::Get().Reset();
+				bMeasuring = true;
+				NextAttackTime = Now;
+			}
+			return true;
+		}
+
+		if (AttacksFired < AttacksPerRun)
+		{
+			if (Now >= NextAttackTime && !Fighter->bIsPunching && !Fighter->bIsKicking && !Fighter->bIsDodging)
+			{
+				//No keys held and the mouse centered select a jab
+				Fighter->bIsW = Fighter->bIsA = Fighter->bIsS = Fighter->bIsD = false;
+				Fighter->MouseYVal = 0.f;
+				Fighter->LeftMouseAttack();
+				++AttacksFired;
+				//The next jab waits for this one's confirmation and attack window
+				NextAttackTime = Now + (Run.RttMs + ConfirmSlackMs) / 1000.0 + UltimateSFCombatRules::PunchWindow;
+			}
+			return true;
+		}
+		if (Now < NextAttackTime)
+		{
+			return true;
+		}
+
+		Report(Run);
+		if (++RunIndex < Runs.Num())
+		{
+			StartRun();
+			return true;
+		}
+
+		Finish();
+		//Nothing touches this after the delete, returning false removes the ticker
+		delete this;
+		return false;
+	}
+
+	void Report(const FRun& Run)
+	{
+		using EHop = FUltimateSFLatencyTracker::EHop;
+		const FUltimateSFLatencyTracker& Tracker = FUltimateSFLatencyTracker::Get();
+		const uint32 Montages = Tracker.GetNumSamples(EHop::InputToMontage);
+		const uint32 Confirms = Tracker.GetNumSamples(EHop::PredictionConfirm);
+		const float MontageP50 = Tracker.GetPercentileMs(EHop::InputToMontage, 0.5f);
+		const float MontageP99 = Tracker.GetPercentileMs(EHop::InputToMontage, 0.99f);
+		const float ConfirmP50 = Tracker.GetPercentileMs(EHop::PredictionConfirm, 0.5f);
+		const float ConfirmP99 = Tracker.GetPercentileMs(EHop::PredictionConfirm, 0.99f);
+
+		bool bPassed = Montages == (uint32)AttacksFired;
+		if (Run.bPredict)
+		{
+			bPassed &= MontageP50 <= FrameBudgetMs && Confirms == (uint32)AttacksFired
+				&& ConfirmP50 >= Run.RttMs * 0.8f && ConfirmP50 <= Run.RttMs + ConfirmSlackMs;
+		}
+		else
+		{
+			bPassed &= MontageP50 >= Run.RttMs * 0.8f;
+		}
+		NumFailedRuns += bPassed ? 0 : 1;
+
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.Latency.Validate: %3d ms RTT, prediction %-3s: %d jabs, %u montages, input to montage p50=%5.1f p99=%5.1f ms, %u confirms p50=%5.1f p99=%5.1f ms: %s"),
+			Run.RttMs, Run.bPredict ? TEXT("on") : TEXT("off"), AttacksFired, Montages, MontageP50, MontageP99, Confirms, ConfirmP50, ConfirmP99,
+			bPassed ? TEXT("pass") : TEXT("FAIL"));
+		Csv += FString::Printf(TEXT("%d,%d,%d,%u,%.1f,%.1f,%u,%.1f,%.1f,%d%s"), Run.RttMs, Run.bPredict ? 1 : 0, AttacksFired, Montages,
+			MontageP50, MontageP99, Confirms, ConfirmP50, ConfirmP99, bPassed ? 1 : 0, LINE_TERMINATOR);
+	}
+
+	void Finish()
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+		if (World.IsValid())
+		{
+			SetLag(0);
+		}
+		GetPredictVariable()->Set(bOriginalPredict, ECVF_SetByConsole);
+
+		const FString Filename = FPaths::ProfilingDir() / TEXT("UltimateSFLatencyValidation.csv");
+		FFileHelper::SaveStringToFile(FString(TEXT("RttMs,Predict,Jabs,Montages,InputToMontageP50,InputToMontageP99,Confirms,ConfirmP50,ConfirmP99,Passed")) + LINE_TERMINATOR + Csv, *Filename);
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.Latency.Validate: %s, %d of %d runs failed, wrote %s"), NumFailedRuns == 0 ? TEXT("PASSED") : TEXT("FAILED"),
+			NumFailedRuns, Runs.Num(), *Filename);
+	}
+};
+
+static FAutoConsoleCommandWithWorldAndArgs LatencyValidateCommand(
+	TEXT("usf.Latency.Validate"),
+	TEXT("Client only. Jabs with and without prediction at 50/100/200 ms emulated round trip and checks the perceived latency. usf.Latency.Validate [JabsPerRun=20]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (World == nullptr || World->GetNetMode() != NM_Client || FUltimateSFLatencyValidation::GetPredictVariable() == nullptr)
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("usf.Latency.Validate runs on a connected client"));
+			return;
+		}
+
+		FUltimateSFLatencyValidation* Validation = new FUltimateSFLatencyValidation();
+		Validation->World = World;
+		Validation->AttacksPerRun = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 20;
+		Validation->bOriginalPredict = FUltimateSFLatencyValidation::GetPredictVariable()->GetBool();
+		for (const int32 RttMs : { 50, 100, 200 })
+		{
+			Validation->Runs.Add({ RttMs, true });
+			Validation->Runs.Add({ RttMs, false });
+		}
+		if (Validation->GetFighter() == nullptr)
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("usf.Latency.Validate needs a possessed UltimateSF fighter"));
+			delete Validation;
+			return;
+		}
+		Validation->StartRun();
+		Validation->TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(Validation, &FUltimateSFLatencyValidation::Tick));
+	}));
@@ -0,0 +1,68 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Latency histograms for the attack path
+ * LeftMouseAttack -> S_LeftMouseAttack -> M_LeftMouseAttack -> PlayAnimMontage (and the kick equivalents).
+ * Each hop is recorded in 1 ms buckets; p50/p99 go to the UltimateSF Latency stat group and the CSV profiler,
+ * and usf.Latency.Dump writes the full histograms to Saved/Profiling.
+ * Run with "Net PktLag=100" and "Net PktLagVariance=20" (or the -PktLag= command line) to see the hops under emulated lag,
+ * or usf.Latency.Validate on a client to measure the owner's attacks at 50/100/200 ms round trip with and without prediction.
+ */
+class FUltimateSFLatencyTracker
+{
+public:
+	enum class EHop : uint8
+	{
+		/* Input sampled on the owning client -> S_ RPC received on the server (synced server clock) */
+		ClientToServer,
+		/* S_ RPC received on the server -> montage started on a remote client (synced server clock) */
+		ServerToMontage,
+		/* Input sampled -> montage started on the owning client (local clock, end to end) */
+		InputToMontage,
+		/* Input sampled -> server confirmation of the predicted montage on the owning client (local clock) */
+		PredictionConfirm,
+
+		Count
+	};
+
+	static constexpr int32 NumBuckets = 1000;
+
+	static FUltimateSFLatencyTracker& Get();
+
+	void Record(EHop Hop, float Seconds);
+
+	/* Milliseconds below which the given fraction of samples fall */
+	float GetPercentileMs(EHop Hop, float Percentile) const;
+	uint32 GetNumSamples(EHop Hop) const { return Histograms[(int32)Hop].NumSamples; }
+
+	void Reset();
+	bool WriteCsv(const FString& Filename) const;
+
+	static const TCHAR* GetHopName(EHop Hop);
+
+private:
+	/* Bucket holding a percentile and the samples at or below it, moved along as samples come in */
+	struct FPercentileCursor
+	{
+		int32 Bucket = -1;
+		uint32 AtOrBelow = 0;
+	};
+
+	struct FHistogram
+	{
+		uint32 Buckets[NumBuckets + 1] = {};
+		uint32 NumSamples = 0;
+		/* The p50 and p99 the stats show, kept up to date by Record instead of walking the buckets per sample */
+		FPercentileCursor P50;
+		FPercentileCursor P99;
+	};
+
+	static void AdvanceCursor(const FHistogram& Histogram, FPercentileCursor& Cursor, float Percentile, int32 NewBucket);
+	void UpdateStats(EHop Hop) const;
+
+	FHistogram Histograms[(int32)EHop::Count];
+};
@@ -0,0 +1,200 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFMatchResults.h"
+#include "UltimateSF.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+#include "HAL/Event.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/Paths.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF Match Results"), STATGROUP_UltimateSFMatchResults, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Match Result Batch"), STAT_UltimateSFMatchResultBatch, STATGROUP_UltimateSFMatchResults);
+
+FUltimateSFMatchResultWriter::FUltimateSFMatchResultWriter(const FString& InFilename, int32 InCapacity)
+	: Filename(InFilename)
+	, Capacity(FMath::Max(InCapacity, 1))
+{
+	WorkEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	Thread = FRunnableThread::Create(this, TEXT("UltimateSFMatchResultWriter"), 0, TPri_BelowNormal);
+}
+
+FUltimateSFMatchResultWriter::~FUltimateSFMatchResultWriter()
+{
+	Shutdown();
+	FPlatformProcess::ReturnSynchEventToPool(WorkEvent);
+}
+
+bool FUltimateSFMatchResultWriter::TryEnqueue(FUltimateSFMatchRecord&& Record)
+{
+	//Reserve a slot first so concurrent producers can never overshoot Capacity
+	const int32 Pending = NumPending.fetch_add(1, std::memory_order_relaxed);
+	if (Pending >= Capacity || bStopping.load(std::memory_order_relaxed))
+	{
+		NumPending.fetch_sub(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	Queue.Enqueue(MoveTemp(Record));
+
+	//Only a full batch wakes the writer early, the rest waits for its timeout instead of paying for a wake up each
+	if ((Pending + 1) % BatchSize == 0)
+	{
+		WorkEvent->Trigger();
+	}
+	return true;
+}
+
+void FUltimateSFMatchResultWriter::Shutdown()
+{
+	if (Thread == nullptr)
+	{
+		return;
+	}
+
+	Stop();
+	Thread->WaitForCompletion();
+	delete Thread;
+	Thread = nullptr;
+}
+
+void FUltimateSFMatchResultWriter::Stop()
+{
+	bStopping.store(true);
+	WorkEvent->Trigger();
+}
+
+uint32 FUltimateSFMatchResultWriter::Run()
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	PlatformFile.CreateDirectoryTree(*FPaths::GetPath(Filename));
+	File.Reset(PlatformFile.OpenWrite(*Filename, true));
+	if (!File)
+	{
+		UE_LOG(LogUltimateSF, Error, TEXT("Match results: could not open %s, results are not persisted"), *Filename);
+	}
+
+	while (!bStopping.load())
+	{
+		WorkEvent->Wait(100);
+		while (WriteBatch() > 0)
+		{
+		}
+	}
+
+	//Producers are refused once stopping, so this drains everything that made it in
+	while (WriteBatch() > 0)
+	{
+	}
+	File.Reset();
+	return 0;
+}
+
+static const TCHAR* GetOutcomeName(EUltimateSFMatchOutcome Outcome)
+{
+	switch (Outcome)
+	{
+	case EUltimateSFMatchOutcome::Win:	return TEXT("win");
+	case EUltimateSFMatchOutcome::Loss:	return TEXT("loss");
+	default:							return TEXT("draw");
+	}
+}
+
+int32 FUltimateSFMatchResultWriter::WriteBatch()
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFMatchResultBatch);
+
+	const UEnum* MoveEnum = StaticEnum<EUltimateSFMove>();
+	FString Lines;
+	int32 NumRecords = 0;
+	FUltimateSFMatchRecord Record;
+	while (NumRecords < BatchSize && Queue.Dequeue(Record))
+	{
+		++NumRecords;
+		Lines += FString::Printf(TEXT("{\"time\":%lld,\"match\":%llu,\"arena\":%d,\"fighter\":\"%s\",\"outcome\":\"%s\",\"damage_dealt\":{"),
+			Record.Timestamp, Record.MatchId, Record.ArenaId, *Record.FighterId.ReplaceCharWithEscapedChar(), GetOutcomeName(Record.Outcome));
+		bool bFirst = true;
+		for (int32 Move = 1; Move < (int32)EUltimateSFMove::MAX; ++Move)
+		{
+			if (Record.Stats.DamageDealtByMove[Move] > 0.f)
+			{
+				Lines += FString::Printf(TEXT("%s\"%s\":%.2f"), bFirst ? TEXT("") : TEXT(","), *MoveEnum->GetNameStringByValue(Move), Record.Stats.DamageDealtByMove[Move]);
+				bFirst = false;
+			}
+		}
+		Lines += FString::Printf(TEXT("},\"damage_recieved\":%.2f,\"hits\":%d,\"dodges\":%d}\n"), Record.Stats.DamageRecieved, Record.Stats.Hits, Record.Stats.Dodges);
+	}
+
+	if (NumRecords == 0)
+	{
+		return 0;
+	}
+
+	if (File)
+	{
+		const FTCHARToUTF8 Utf8(*Lines);
+		File->Write((const uint8*)Utf8.Get(), Utf8.Length());
+		File->Flush();
+	}
+	NumPending.fetch_sub(NumRecords, std::memory_order_relaxed);
+	NumWritten.fetch_add(NumRecords, std::memory_order_relaxed);
+	return NumRecords;
+}
+
+/**
+ * The game thread's side is TryEnqueue only, timed per record. A full queue counts as a backpressure stall and the
+ * producer yields and retries, the way the game mode retries on its next tick. Records/s is end to end, until
+ * Shutdown returns with everything flushed.
+ */
+static FAutoConsoleCommand MatchResultsBenchCommand(
+	TEXT("usf.MatchResults.Bench"),
+	TEXT("Benchmarks the match result writer into Saved/MatchResults/Bench.jsonl. usf.MatchResults.Bench [Records=200000] [Capacity=4096]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const int32 NumRecords = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 200000;
+		const int32 Capacity = Args.Num() > 1 ? FMath::Max(FCString::Atoi(*Args[1]), 1) : 4096;
+		const FString Filename = FPaths::ProjectSavedDir() / TEXT("MatchResults") / TEXT("Bench.jsonl");
+		IFileManager::Get().Delete(*Filename);
+
+		FUltimateSFMatchRecord Template;
+		Template.FighterId = TEXT("BenchFighter");
+		Template.Stats.DamageDealtByMove[(int32)EUltimateSFMove::Jab] = 25.f;
+		Template.Stats.DamageDealtByMove[(int32)EUltimateSFMove::HighKick] = 40.f;
+		Template.Stats.DamageRecieved = 52.5f;
+		Template.Stats.Hits = 9;
+		Template.Stats.Dodges = 3;
+
+		const double Start = FPlatformTime::Seconds();
+		double EnqueueSeconds = 0.0;
+		uint64 Stalls = 0;
+		{
+			FUltimateSFMatchResultWriter Writer(Filename, Capacity);
+			for (int32 Index = 0; Index < NumRecords; ++Index)
+			{
+				for (;;)
+				{
+					FUltimateSFMatchRecord Record = Template;
+					Record.MatchId = Index / 2;
+					Record.Outcome = Index % 2 ? EUltimateSFMatchOutcome::Loss : EUltimateSFMatchOutcome::Win;
+
+					const double EnqueueStart = FPlatformTime::Seconds();
+					const bool bQueued = Writer.TryEnqueue(MoveTemp(Record));
+					EnqueueSeconds += FPlatformTime::Seconds() - EnqueueStart;
+					if (bQueued)
+					{
+						break;
+					}
+					++Stalls;
+					FPlatformProcess::Yield();
+				}
+			}
+			Writer.Shutdown();
+		}
+		const double Elapsed = FPlatformTime::Seconds() - Start;
+
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.MatchResults.Bench: %d records, %.3f us game thread per enqueue, %llu backpressure stalls, %.0f records/s to disk, %.1f MB file"),
+			NumRecords, EnqueueSeconds * 1000000.0 / (NumRecords + Stalls), Stalls, NumRecords / Elapsed, IFileManager::Get().FileSize(*Filename) / (1024.0 * 1024.0));
+		IFileManager::Get().Delete(*Filename);
+	}));
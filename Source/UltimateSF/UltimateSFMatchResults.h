@@ -0,0 +1,89 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "HAL/Runnable.h"
+#include "UltimateSFCombatTypes.h"
+#include <atomic>
+
+class FRunnableThread;
+class FEvent;
+
+/* Server side running totals of one fighter for the current match, reset when a result is recorded */
+struct FUltimateSFFighterMatchStats
+{
+	/* Damage landed with each move, indexed by EUltimateSFMove */
+	float DamageDealtByMove[(int32)EUltimateSFMove::MAX] = {};
+	float DamageRecieved = 0.f;
+	int32 Hits = 0;
+	int32 Dodges = 0;
+
+	void Reset() { *this = FUltimateSFFighterMatchStats(); }
+};
+
+enum class EUltimateSFMatchOutcome : uint8
+{
+	Win,
+	Loss,
+	Draw
+};
+
+/* One fighter's result in one match, as persisted for ranking */
+struct FUltimateSFMatchRecord
+{
+	int64 Timestamp = 0;
+	uint64 MatchId = 0;
+	int32 ArenaId = INDEX_NONE;
+	FString FighterId;
+	EUltimateSFMatchOutcome Outcome = EUltimateSFMatchOutcome::Draw;
+	FUltimateSFFighterMatchStats Stats;
+};
+
+/**
+ * Appends match records to a JSON lines file from a background thread.
+ * Producers push into a lock-free MPSC queue and never touch the file; the writer thread wakes every
+ * BatchSize records or 100 ms, formats the whole batch and appends it with one write and one flush.
+ * At most Capacity records are in flight: TryEnqueue fails beyond that and the producer keeps the record
+ * to retry. Shutdown, called once producers are done, drains the queue and flushes before the thread exits.
+ */
+class FUltimateSFMatchResultWriter : public FRunnable
+{
+public:
+	static constexpr int32 BatchSize = 256;
+
+	FUltimateSFMatchResultWriter(const FString& InFilename, int32 InCapacity);
+	virtual ~FUltimateSFMatchResultWriter();
+
+	/* Any thread. False when Capacity records are already waiting */
+	bool TryEnqueue(FUltimateSFMatchRecord&& Record);
+
+	/* Blocks until every queued record is on disk */
+	void Shutdown();
+
+	/* False when the thread could not be created (no multithreading) or after Shutdown, nothing drains the queue then */
+	bool IsRunning() const { return Thread != nullptr; }
+	int32 GetNumPending() const { return NumPending.load(std::memory_order_relaxed); }
+	uint64 GetNumWritten() const { return NumWritten.load(std::memory_order_relaxed); }
+	const FString& GetFilename() const { return Filename; }
+
+	// FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	// End of FRunnable interface
+
+private:
+	/* Returns the number of records written */
+	int32 WriteBatch();
+
+	FString Filename;
+	int32 Capacity = 0;
+	TQueue<FUltimateSFMatchRecord, EQueueMode::Mpsc> Queue;
+	std::atomic<int32> NumPending { 0 };
+	std::atomic<uint64> NumWritten { 0 };
+	std::atomic<bool> bStopping { false };
+	FEvent* WorkEvent = nullptr;
+	FRunnableThread* Thread = nullptr;
+	TUniquePtr<class IFileHandle> File;
+};
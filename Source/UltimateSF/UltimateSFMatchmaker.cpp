@@ -0,0 +1,513 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFMatchmaker.h"
+#include "UltimateSF.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF Matchmaking"), STATGROUP_UltimateSFMatchmaking, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Matchmaking Tick"), STAT_UltimateSFMatchmakingTick, STATGROUP_UltimateSFMatchmaking);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Waiting Players"), STAT_UltimateSFMatchmakingWaiting, STATGROUP_UltimateSFMatchmaking);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Pairs Waiting For Arena"), STAT_UltimateSFMatchmakingPaired, STATGROUP_UltimateSFMatchmaking);
+
+static TAutoConsoleVariable<float> CVarMatchmakingBaseWindow(
+	TEXT("usf.Matchmaking.BaseWindow"),
+	50.f,
+	TEXT("Skill difference accepted as soon as a player queues. Read when the matchmaking service starts."));
+
+static TAutoConsoleVariable<float> CVarMatchmakingWindowGrowth(
+	TEXT("usf.Matchmaking.WindowGrowth"),
+	25.f,
+	TEXT("Extra skill difference accepted per second a player has waited. Read when the matchmaking service starts."));
+
+static TAutoConsoleVariable<float> CVarMatchmakingMaxWindow(
+	TEXT("usf.Matchmaking.MaxWindow"),
+	800.f,
+	TEXT("Largest skill difference the matchmaker will ever accept. Read when the matchmaking service starts."));
+
+FUltimateSFMatchmaker::FUltimateSFMatchmaker(const FSettings& InSettings)
+	: Settings(InSettings)
+{
+	Settings.BucketWidth = FMath::Max(Settings.BucketWidth, 1);
+	Settings.MaxSkill = FMath::Max(Settings.MaxSkill, 0);
+
+	const int32 NumBuckets = Settings.MaxSkill / Settings.BucketWidth + 1;
+	Buckets.SetNum(NumBuckets);
+	Occupancy.SetNumZeroed(NumBuckets + 1);
+	while (HighestBit * 2 <= NumBuckets)
+	{
+		HighestBit *= 2;
+	}
+}
+
+float FUltimateSFMatchmaker::GetWindow(const FTicket& Ticket, double Now) const
+{
+	return FMath::Min(Settings.BaseWindow + Settings.WindowGrowth * (float)(Now - Ticket.EnqueueTime), Settings.MaxWindow);
+}
+
+bool FUltimateSFMatchmaker::Enqueue(uint64 PlayerId, int32 Skill, double Now)
+{
+	if (TicketByPlayer.Contains(PlayerId))
+	{
+		return false;
+	}
+
+	Skill = FMath::Clamp(Skill, 0, Settings.MaxSkill);
+	const int32 Bucket = Skill / Settings.BucketWidth;
+
+	const int32 Other = FindNearest(Bucket, Skill, Settings.BaseWindow);
+	if (Other != INDEX_NONE)
+	{
+		Pair(PlayerId, Skill, Now, Other, Now);
+		return true;
+	}
+
+	TicketByPlayer.Add(PlayerId, AddTicket(PlayerId, Skill, Bucket, Now));
+	return true;
+}
+
+bool FUltimateSFMatchmaker::Cancel(uint64 PlayerId)
+{
+	int32 Ticket = INDEX_NONE;
+	if (!TicketByPlayer.RemoveAndCopyValue(PlayerId, Ticket))
+	{
+		return false;
+	}
+	UnlinkTicket(Ticket);
+	FreeTicket(Ticket);
+	return true;
+}
+
+void FUltimateSFMatchmaker::Tick(double Now)
+{
+	//One attempt per occupied bucket, with the window of the oldest player in it
+	for (int32 Bucket = NextOccupied(0); Bucket != INDEX_NONE; Bucket = NextOccupied(Bucket + 1))
+	{
+		const int32 Ticket = Buckets[Bucket].Head;
+		UnlinkTicket(Ticket);
+
+		const FTicket& Searching = Tickets[Ticket];
+		const int32 Other = FindNearest(Bucket, Searching.Skill, GetWindow(Searching, Now));
+		if (Other == INDEX_NONE)
+		{
+			LinkTicket(Ticket, true);
+			continue;
+		}
+
+		TicketByPlayer.Remove(Searching.PlayerId);
+		Pair(Searching.PlayerId, Searching.Skill, Searching.EnqueueTime, Other, Now);
+		FreeTicket(Ticket);
+	}
+}
+
+int32 FUltimateSFMatchmaker::FindNearest(int32 Bucket, int32 Skill, float Window) const
+{
+	int32 Best = INDEX_NONE;
+	float BestDifference = Window;
+
+	//Buckets are ordered by skill, so the closest player is in this bucket or the first occupied bucket on either side.
+	//Those are scanned whole; while BaseWindow covers a bucket they hold one ticket at most, two would have paired on enqueue
+	const int32 Candidates[3] = { Buckets[Bucket].Head != INDEX_NONE ? Bucket : INDEX_NONE, NextOccupied(Bucket + 1), PrevOccupied(Bucket - 1) };
+	for (int32 Candidate : Candidates)
+	{
+		if (Candidate == INDEX_NONE)
+		{
+			continue;
+		}
+		for (int32 Ticket = Buckets[Candidate].Head; Ticket != INDEX_NONE; Ticket = Tickets[Ticket].Next)
+		{
+			const float Difference = FMath::Abs(Tickets[Ticket].Skill - Skill);
+			const bool bOlderTie = Difference == BestDifference && (Best == INDEX_NONE || Tickets[Ticket].EnqueueTime < Tickets[Best].EnqueueTime);
+			if (Difference < BestDifference || bOlderTie)
+			{
+				Best = Ticket;
+				BestDifference = Difference;
+			}
+		}
+	}
+	return Best;
+}
+
+void FUltimateSFMatchmaker::Pair(uint64 PlayerId, int32 Skill, double EnqueueTime, int32 OtherTicket, double Now)
+{
+	const FTicket& Other = Tickets[OtherTicket];
+
+	FUltimateSFMatch& Match = PairedMatches.AddDefaulted_GetRef();
+	Match.PlayerA = Other.PlayerId;
+	Match.PlayerB = PlayerId;
+	Match.SkillA = Other.Skill;
+	Match.SkillB = Skill;
+	Match.WaitSeconds = (float)(Now - FMath::Min(Other.EnqueueTime, EnqueueTime));
+
+	TicketByPlayer.Remove(Other.PlayerId);
+	UnlinkTicket(OtherTicket);
+	FreeTicket(OtherTicket);
+}
+
+int32 FUltimateSFMatchmaker::AddTicket(uint64 PlayerId, int32 Skill, int32 Bucket, double Now)
+{
+	const int32 Ticket = FreeTickets.Num() > 0 ? FreeTickets.Pop(false) : Tickets.AddDefaulted();
+	FTicket& NewTicket = Tickets[Ticket];
+	NewTicket.PlayerId = PlayerId;
+	NewTicket.EnqueueTime = Now;
+	NewTicket.Skill = Skill;
+	NewTicket.Bucket = Bucket;
+	LinkTicket(Ticket, false);
+	return Ticket;
+}
+
+void FUltimateSFMatchmaker::LinkTicket(int32 Ticket, bool bAtHead)
+{
+	FTicket& Linked = Tickets[Ticket];
+	FBucket& Bucket = Buckets[Linked.Bucket];
+	if (Bucket.Head == INDEX_NONE)
+	{
+		Linked.Prev = Linked.Next = INDEX_NONE;
+		Bucket.Head = Bucket.Tail = Ticket;
+		AddOccupancy(Linked.Bucket, 1);
+	}
+	else if (bAtHead)
+	{
+		Linked.Prev = INDEX_NONE;
+		Linked.Next = Bucket.Head;
+		Tickets[Bucket.Head].Prev = Ticket;
+		Bucket.Head = Ticket;
+	}
+	else
+	{
+		Linked.Prev = Bucket.Tail;
+		Linked.Next = INDEX_NONE;
+		Tickets[Bucket.Tail].Next = Ticket;
+		Bucket.Tail = Ticket;
+	}
+}
+
+void FUltimateSFMatchmaker::UnlinkTicket(int32 Ticket)
+{
+	FTicket& Unlinked = Tickets[Ticket];
+	FBucket& Bucket = Buckets[Unlinked.Bucket];
+	(Unlinked.Prev != INDEX_NONE ? Tickets[Unlinked.Prev].Next : Bucket.Head) = Unlinked.Next;
+	(Unlinked.Next != INDEX_NONE ? Tickets[Unlinked.Next].Prev : Bucket.Tail) = Unlinked.Prev;
+	Unlinked.Prev = Unlinked.Next = INDEX_NONE;
+	if (Bucket.Head == INDEX_NONE)
+	{
+		AddOccupancy(Unlinked.Bucket, -1);
+	}
+}
+
+void FUltimateSFMatchmaker::FreeTicket(int32 Ticket)
+{
+	FreeTickets.Add(Ticket);
+}
+
+void FUltimateSFMatchmaker::AddOccupancy(int32 Bucket, int32 Delta)
+{
+	NumOccupied += Delta;
+	for (int32 Index = Bucket + 1; Index < Occupancy.Num(); Index += Index & -Index)
+	{
+		Occupancy[Index] += Delta;
+	}
+}
+
+int32 FUltimateSFMatchmaker::CountOccupied(int32 LastBucket) const
+{
+	int32 Count = 0;
+	for (int32 Index = LastBucket + 1; Index > 0; Index -= Index & -Index)
+	{
+		Count += Occupancy[Index];
+	}
+	return Count;
+}
+
+int32 FUltimateSFMatchmaker::FindOccupied(int32 Rank) const
+{
+	//Descends the tree to the bucket holding the Rank-th occupied bucket, Rank is 1 based
+	int32 Position = 0;
+	for (int32 Step = HighestBit; Step > 0; Step >>= 1)
+	{
+		if (Position + Step < Occupancy.Num() && Occupancy[Position + Step] < Rank)
+		{
+			Position += Step;
+			Rank -= Occupancy[Position];
+		}
+	}
+	return Position;
+}
+
+int32 FUltimateSFMatchmaker::NextOccupied(int32 Bucket) const
+{
+	if (Bucket >= Buckets.Num())
+	{
+		return INDEX_NONE;
+	}
+	const int32 Before = Bucket > 0 ? CountOccupied(Bucket - 1) : 0;
+	return Before < NumOccupied ? FindOccupied(Before + 1) : INDEX_NONE;
+}
+
+int32 FUltimateSFMatchmaker::PrevOccupied(int32 Bucket) const
+{
+	const int32 UpTo = CountOccupied(FMath::Min(Bucket, Buckets.Num() - 1));
+	return UpTo > 0 ? FindOccupied(UpTo) : INDEX_NONE;
+}
+
+void FUltimateSFMatchmaker::AddArena(int32 ArenaId)
+{
+	FreeArenas.AddUnique(ArenaId);
+}
+
+void FUltimateSFMatchmaker::RemoveArena(int32 ArenaId)
+{
+	FreeArenas.RemoveSingleSwap(ArenaId, false);
+}
+
+bool FUltimateSFMatchmaker::PopMatch(FUltimateSFMatch& OutMatch)
+{
+	if (GetNumPaired() == 0 || FreeArenas.Num() == 0)
+	{
+		return false;
+	}
+
+	OutMatch = PairedMatches[PairedHead++];
+	OutMatch.ArenaId = FreeArenas.Pop(false);
+
+	//Compact once the consumed head dominates, amortized O(1) per match
+	if (PairedHead > 1024 && PairedHead * 2 > PairedMatches.Num())
+	{
+		PairedMatches.RemoveAt(0, PairedHead, false);
+		PairedHead = 0;
+	}
+	return true;
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Matchmaking Service***
+/// </summary>
+
+FUltimateSFMatchmakingService& FUltimateSFMatchmakingService::Get()
+{
+	static FUltimateSFMatchmakingService Service;
+	return Service;
+}
+
+static FUltimateSFMatchmaker::FSettings GetServiceSettings()
+{
+	FUltimateSFMatchmaker::FSettings Settings;
+	Settings.BaseWindow = CVarMatchmakingBaseWindow.GetValueOnGameThread();
+	Settings.WindowGrowth = CVarMatchmakingWindowGrowth.GetValueOnGameThread();
+	Settings.MaxWindow = CVarMatchmakingMaxWindow.GetValueOnGameThread();
+	return Settings;
+}
+
+FUltimateSFMatchmakingService::FUltimateSFMatchmakingService()
+	: Matchmaker(GetServiceSettings())
+{
+	//Window growth is per second, four passes a second keep it smooth
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FUltimateSFMatchmakingService::Tick), 0.25f);
+}
+
+bool FUltimateSFMatchmakingService::Enqueue(uint64 PlayerId, int32 Skill)
+{
+	return Matchmaker.Enqueue(PlayerId, Skill, FPlatformTime::Seconds());
+}
+
+bool FUltimateSFMatchmakingService::Cancel(uint64 PlayerId)
+{
+	return Matchmaker.Cancel(PlayerId);
+}
+
+int32 FUltimateSFMatchmakingService::RegisterArena(TFunction<void(const FUltimateSFMatch&)> OnMatch)
+{
+	const int32 ArenaId = NextArenaId++;
+	Arenas.Add(ArenaId, MoveTemp(OnMatch));
+	Matchmaker.AddArena(ArenaId);
+	return ArenaId;
+}
+
+void FUltimateSFMatchmakingService::UnregisterArena(int32 ArenaId)
+{
+	Arenas.Remove(ArenaId);
+	Matchmaker.RemoveArena(ArenaId);
+}
+
+void FUltimateSFMatchmakingService::ReleaseArena(int32 ArenaId)
+{
+	if (Arenas.Contains(ArenaId))
+	{
+		Matchmaker.AddArena(ArenaId);
+	}
+}
+
+bool FUltimateSFMatchmakingService::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFMatchmakingTick);
+
+	Matchmaker.Tick(FPlatformTime::Seconds());
+
+	FUltimateSFMatch Match;
+	while (Matchmaker.PopMatch(Match))
+	{
+		//Copied, the arena may unregister from inside its callback
+		TFunction<void(const FUltimateSFMatch&)> OnMatch = Arenas.FindRef(Match.ArenaId);
+		if (OnMatch)
+		{
+			OnMatch(Match);
+		}
+	}
+
+	SET_DWORD_STAT(STAT_UltimateSFMatchmakingWaiting, Matchmaker.GetNumWaiting());
+	SET_DWORD_STAT(STAT_UltimateSFMatchmakingPaired, Matchmaker.GetNumPaired());
+	return true;
+}
+
+static FAutoConsoleCommand MatchmakingQueueCommand(
+	TEXT("usf.Matchmaking.Queue"),
+	TEXT("Queues a player with the local matchmaking service. usf.Matchmaking.Queue PlayerId Skill"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		if (Args.Num() < 2)
+		{
+			return;
+		}
+		const uint64 PlayerId = FCString::Strtoui64(*Args[0], nullptr, 10);
+		if (!FUltimateSFMatchmakingService::Get().Enqueue(PlayerId, FCString::Atoi(*Args[1])))
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("Matchmaking: player %llu is already queued"), PlayerId);
+		}
+	}));
+
+static FAutoConsoleCommand MatchmakingStatusCommand(
+	TEXT("usf.Matchmaking.Status"),
+	TEXT("Logs the local matchmaking service's queue"),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		const FUltimateSFMatchmaker& Matchmaker = FUltimateSFMatchmakingService::Get().GetMatchmaker();
+		UE_LOG(LogUltimateSF, Log, TEXT("Matchmaking: %d waiting, %d pairs waiting for an arena, %d free arenas"),
+			Matchmaker.GetNumWaiting(), Matchmaker.GetNumPaired(), Matchmaker.GetNumFreeArenas());
+	}));
+
+/**
+ * Simulated time, real cost: keeps about Players waiting, lets players arrive at a steady rate of two per match the
+ * arenas can host, and measures the wall clock spent in the matchmaker. Skills are spread uniformly over a range wide
+ * enough that the queue settles near Players on its own; until it has, players that pairing drained are topped back
+ * up at the start of each step. Every match frees its arena after 60 simulated seconds.
+ */
+static FAutoConsoleCommand MatchmakingBenchCommand(
+	TEXT("usf.Matchmaking.Bench"),
+	TEXT("Benchmarks the matchmaker. usf.Matchmaking.Bench [Players=100000] [MatchesPerMinute=10000] [SimulatedSeconds=300]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const int32 NumPlayers = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 2) : 100000;
+		const int32 NumArenas = Args.Num() > 1 ? FMath::Max(FCString::Atoi(*Args[1]), 1) : 10000;
+		const double SimulatedSeconds = Args.Num() > 2 ? FMath::Max(FCString::Atod(*Args[2]), 1.0) : 300.0;
+		constexpr double MatchSeconds = 60.0;
+		constexpr double Step = 0.1;
+
+		//Tickets further than MaxWindow apart never pair. With arrivals at this rate the waiting tickets settle
+		//about 3.75 windows apart on average, measured with a model of this queue. Wider buckets keep the tree small
+		FUltimateSFMatchmaker::FSettings Settings;
+		Settings.BucketWidth = FMath::Max(FMath::FloorToInt(Settings.MaxWindow / 4.f), 1);
+		Settings.MaxSkill = (int32)FMath::Min(NumPlayers * (double)Settings.MaxWindow * 3.75, (double)(MAX_int32 / 2));
+		FUltimateSFMatchmaker Matchmaker(Settings);
+		FRandomStream Random(0x5F3759DF);
+		uint64 NextPlayerId = 1;
+
+		auto RandomSkill = [&Random, &Settings]()
+		{
+			return Random.RandRange(0, Settings.MaxSkill);
+		};
+
+		//Some of the players pair on enqueue, so a top up takes a few more than it is short
+		uint64 NumToppedUp = 0;
+		auto TopUp = [&](double Now)
+		{
+			for (int32 Attempt = 0; Attempt < NumPlayers * 4 && Matchmaker.GetNumWaiting() < NumPlayers; ++Attempt)
+			{
+				Matchmaker.Enqueue(NextPlayerId++, RandomSkill(), Now);
+				++NumToppedUp;
+			}
+		};
+
+		double WallSeconds = 0.0;
+		double StartTime = FPlatformTime::Seconds();
+		TopUp(0.0);
+		NumToppedUp = 0;
+		for (int32 Arena = 0; Arena < NumArenas; ++Arena)
+		{
+			Matchmaker.AddArena(Arena);
+		}
+		WallSeconds += FPlatformTime::Seconds() - StartTime;
+
+		const double ArrivalsPerSecond = NumArenas * 2.0 / MatchSeconds;
+		double PendingArrivals = 0.0;
+
+		TArray<TPair<double, int32>> RunningMatches;
+		int32 RunningHead = 0;
+		uint64 NumMatches = 0;
+		double SkillDifferenceSum = 0.0;
+		int32 MaxSkillDifference = 0;
+		double WaitSum = 0.0;
+		double MaxTickSeconds = 0.0;
+		double WaitingSum = 0.0;
+		int32 MinWaiting = MAX_int32;
+		int32 MaxWaiting = 0;
+		int32 NumSteps = 0;
+
+		for (double Now = Step; Now <= SimulatedSeconds; Now += Step)
+		{
+			StartTime = FPlatformTime::Seconds();
+
+			//Every match lasts as long, so they end in start order
+			while (RunningHead < RunningMatches.Num() && RunningMatches[RunningHead].Key <= Now)
+			{
+				Matchmaker.AddArena(RunningMatches[RunningHead++].Value);
+			}
+
+			TopUp(Now);
+			PendingArrivals += ArrivalsPerSecond * Step;
+			for (; PendingArrivals >= 1.0; PendingArrivals -= 1.0)
+			{
+				Matchmaker.Enqueue(NextPlayerId++, RandomSkill(), Now);
+			}
+
+			Matchmaker.Tick(Now);
+
+			FUltimateSFMatch Match;
+			while (Matchmaker.PopMatch(Match))
+			{
+				++NumMatches;
+				const int32 Difference = FMath::Abs(Match.SkillA - Match.SkillB);
+				SkillDifferenceSum += Difference;
+				MaxSkillDifference = FMath::Max(MaxSkillDifference, Difference);
+				WaitSum += Match.WaitSeconds;
+				RunningMatches.Emplace(Now + MatchSeconds, Match.ArenaId);
+			}
+
+			const double TickSeconds = FPlatformTime::Seconds() - StartTime;
+			WallSeconds += TickSeconds;
+			MaxTickSeconds = FMath::Max(MaxTickSeconds, TickSeconds);
+
+			const int32 NumWaiting = Matchmaker.GetNumWaiting();
+			WaitingSum += NumWaiting;
+			MinWaiting = FMath::Min(MinWaiting, NumWaiting);
+			MaxWaiting = FMath::Max(MaxWaiting, NumWaiting);
+			++NumSteps;
+		}
+
+		const double MatchesPerMinute = NumMatches / (SimulatedSeconds / 60.0);
+		UE_LOG(LogUltimateSF, Log, TEXT("Matchmaking bench: %llu matches in %.0f simulated s (%.0f per minute), %d waiting and %d paired at the end"),
+			NumMatches, SimulatedSeconds, MatchesPerMinute, Matchmaker.GetNumWaiting(), Matchmaker.GetNumPaired() * 2);
+		UE_LOG(LogUltimateSF, Log, TEXT("Matchmaking bench: queue held %.0f waiting on average (min %d, max %d) over skills 0-%d, %llu players topped up"),
+			NumSteps > 0 ? WaitingSum / NumSteps : 0.0, NumSteps > 0 ? MinWaiting : 0, MaxWaiting, Settings.MaxSkill, NumToppedUp);
+		UE_LOG(LogUltimateSF, Log, TEXT("Matchmaking bench: %.1f ms of matchmaker time (%.3f ms per simulated second, worst step %.3f ms), %.2f us per match"),
+			WallSeconds * 1000.0, WallSeconds * 1000.0 / SimulatedSeconds, MaxTickSeconds * 1000.0, NumMatches > 0 ? WallSeconds * 1000000.0 / NumMatches : 0.0);
+		UE_LOG(LogUltimateSF, Log, TEXT("Matchmaking bench: skill difference avg %.1f max %d, queue wait to pairing avg %.2f s"),
+			NumMatches > 0 ? SkillDifferenceSum / NumMatches : 0.0, MaxSkillDifference, NumMatches > 0 ? WaitSum / NumMatches : 0.0);
+	}));
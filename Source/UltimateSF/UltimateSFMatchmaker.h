@@ -0,0 +1,138 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+
+/* Two queued players paired by the matchmaker, and the arena they were sent to */
+struct FUltimateSFMatch
+{
+	/* AUltimateSFGameMode::GetFighterId of the players */
+	uint64 PlayerA = 0;
+	uint64 PlayerB = 0;
+	int32 SkillA = 0;
+	int32 SkillB = 0;
+	int32 ArenaId = INDEX_NONE;
+	/* Time the longer waiting player spent in the queue before being paired */
+	float WaitSeconds = 0.f;
+};
+
+/**
+ * Skill bucketed matchmaking queue.
+ * Waiting players sit in per bucket FIFOs and a Fenwick tree over the buckets finds the nearest occupied bucket
+ * in O(log buckets), so enqueueing and pairing cost the same with 100 or 100k players queued. A player is paired
+ * on enqueue if someone is inside the base window, otherwise Tick retries with a window that widens with the wait.
+ * Paired players wait in FIFO order for a free arena. Time is passed in, nothing here reads a clock.
+ */
+class FUltimateSFMatchmaker
+{
+public:
+	struct FSettings
+	{
+		int32 MaxSkill = 4000;
+		int32 BucketWidth = 20;
+		/* Skill difference accepted right away */
+		float BaseWindow = 50.f;
+		/* Extra skill difference accepted per second of waiting */
+		float WindowGrowth = 25.f;
+		float MaxWindow = 800.f;
+	};
+
+	explicit FUltimateSFMatchmaker(const FSettings& InSettings = FSettings());
+
+	/* Returns false if the player is already waiting. Players already paired are not checked */
+	bool Enqueue(uint64 PlayerId, int32 Skill, double Now);
+	bool Cancel(uint64 PlayerId);
+
+	/* Widens every waiting player's window and pairs whoever now fits */
+	void Tick(double Now);
+
+	/* Arenas are handed out oldest pair first, an arena comes back through AddArena once its match is over */
+	void AddArena(int32 ArenaId);
+	void RemoveArena(int32 ArenaId);
+	bool PopMatch(FUltimateSFMatch& OutMatch);
+
+	int32 GetNumWaiting() const { return TicketByPlayer.Num(); }
+	int32 GetNumPaired() const { return PairedMatches.Num() - PairedHead; }
+	int32 GetNumFreeArenas() const { return FreeArenas.Num(); }
+
+private:
+	struct FTicket
+	{
+		uint64 PlayerId = 0;
+		double EnqueueTime = 0.0;
+		int32 Skill = 0;
+		int32 Bucket = 0;
+		int32 Prev = INDEX_NONE;
+		int32 Next = INDEX_NONE;
+	};
+
+	struct FBucket
+	{
+		int32 Head = INDEX_NONE;
+		int32 Tail = INDEX_NONE;
+	};
+
+	float GetWindow(const FTicket& Ticket, double Now) const;
+
+	/* Waiting ticket closest to Skill, if within Window, the oldest on a tie */
+	int32 FindNearest(int32 Bucket, int32 Skill, float Window) const;
+
+	int32 AddTicket(uint64 PlayerId, int32 Skill, int32 Bucket, double Now);
+	void LinkTicket(int32 Ticket, bool bAtHead);
+	void UnlinkTicket(int32 Ticket);
+	void FreeTicket(int32 Ticket);
+	void Pair(uint64 PlayerId, int32 Skill, double EnqueueTime, int32 OtherTicket, double Now);
+
+	//Fenwick tree of occupied buckets
+	void AddOccupancy(int32 Bucket, int32 Delta);
+	int32 CountOccupied(int32 LastBucket) const;
+	int32 FindOccupied(int32 Rank) const;
+	int32 NextOccupied(int32 Bucket) const;
+	int32 PrevOccupied(int32 Bucket) const;
+
+	FSettings Settings;
+	TArray<FTicket> Tickets;
+	TArray<int32> FreeTickets;
+	TMap<uint64, int32> TicketByPlayer;
+	TArray<FBucket> Buckets;
+	TArray<int32> Occupancy;
+	int32 NumOccupied = 0;
+	int32 HighestBit = 1;
+
+	TArray<FUltimateSFMatch> PairedMatches;
+	int32 PairedHead = 0;
+	TArray<int32> FreeArenas;
+};
+
+/**
+ * Local stand in for the matchmaking service, shared by every game mode in the process.
+ * Game modes register their arena and are called back with each match sent to it. Ticked on the core ticker,
+ * so a dedicated server with no travel in flight still pairs players.
+ */
+class FUltimateSFMatchmakingService
+{
+public:
+	static FUltimateSFMatchmakingService& Get();
+
+	bool Enqueue(uint64 PlayerId, int32 Skill);
+	bool Cancel(uint64 PlayerId);
+
+	int32 RegisterArena(TFunction<void(const FUltimateSFMatch&)> OnMatch);
+	void UnregisterArena(int32 ArenaId);
+
+	/* The arena's match is over, it can take the next pair */
+	void ReleaseArena(int32 ArenaId);
+
+	const FUltimateSFMatchmaker& GetMatchmaker() const { return Matchmaker; }
+
+private:
+	FUltimateSFMatchmakingService();
+	bool Tick(float DeltaTime);
+
+	FUltimateSFMatchmaker Matchmaker;
+	TMap<int32, TFunction<void(const FUltimateSFMatch&)>> Arenas;
+	int32 NextArenaId = 0;
+	FTSTicker::FDelegateHandle TickerHandle;
+};
@@ -0,0 +1,419 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFMetrics.h"
+#include "UltimateSF.h"
+#include "UltimateSFCharacter.h"
+#include "UltimateSFFighterGridSubsystem.h"
+#include "Engine/NetDriver.h"
+#include "Engine/World.h"
+#include "GameFramework/GameStateBase.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformMemory.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/CommandLine.h"
+#include "Misc/CoreDelegates.h"
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+#include "IPAddress.h"
+
+static TAutoConsoleVariable<int32> CVarMetricsPort(
+	TEXT("usf.Metrics.Port"),
+	0,
+	TEXT("Loopback port the server exposes Prometheus metrics on, 0 disables. -UltimateSFMetricsPort= overrides it."));
+
+//Upper bounds of the frame time histogram buckets in seconds, the last bucket is +Inf
+static const double FrameTimeBounds[] = { 0.005, 0.010, 0.0167, 0.0333, 0.050, 0.100, 0.250 };
+static_assert(UE_ARRAY_COUNT(FrameTimeBounds) == FUltimateSFMetrics::FrameTimeBucketLast - FUltimateSFMetrics::FrameTimeBucketFirst, "One bound per bucket but +Inf");
+
+/**
+ * Minimal HTTP/1.0 responder for the scraper, one request per connection.
+ * It runs on its own thread and only ever reads the counters, so a slow or stuck scraper cannot stall a frame.
+ */
+class FUltimateSFMetricsServer : public FRunnable
+{
+public:
+	FUltimateSFMetricsServer(FSocket* InListenSocket)
+		: ListenSocket(InListenSocket)
+	{
+		Thread = FRunnableThread::Create(this, TEXT("UltimateSFMetricsServer"), 0, TPri_BelowNormal);
+	}
+
+	virtual ~FUltimateSFMetricsServer()
+	{
+		if (Thread)
+		{
+			Stop();
+			Thread->WaitForCompletion();
+			delete Thread;
+		}
+		ListenSocket->Close();
+		ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ListenSocket);
+	}
+
+	int32 GetPort() const { return ListenSocket->GetPortNo(); }
+
+	virtual void Stop() override
+	{
+		bStopping.store(true);
+	}
+
+	virtual uint32 Run() override
+	{
+		while (!bStopping.load())
+		{
+			bool bPending = false;
+			//Wakes up regularly so Stop never waits on a scraper that went away
+			if (!ListenSocket->WaitForPendingConnection(bPending, FTimespan::FromMilliseconds(250.0)) || !bPending)
+			{
+				continue;
+			}
+			if (FSocket* Peer = ListenSocket->Accept(TEXT("UltimateSF Metrics Peer")))
+			{
+				Serve(*Peer);
+				Peer->Close();
+				ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Peer);
+			}
+		}
+		return 0;
+	}
+
+private:
+	void Serve(FSocket& Peer)
+	{
+		//Only the request line matters, read until the end of the headers or give up
+		TArray<uint8> Request;
+		while (Request.Num() < 8 * 1024)
+		{
+			if (!Peer.Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(1.0)))
+			{
+				return;
+			}
+			uint8 Buffer[1024];
+			int32 Read = 0;
+			if (!Peer.Recv(Buffer, sizeof(Buffer), Read) || Read == 0)
+			{
+				return;
+			}
+			Request.Append(Buffer, Read);
+
+			const FUTF8ToTCHAR Converted(reinterpret_cast<const ANSICHAR*>(Request.GetData()), Request.Num());
+			const FString Text(Converted.Length(), Converted.Get());
+			if (Text.Contains(TEXT("\r\n\r\n")) || Text.Contains(TEXT("\n\n")))
+			{
+				FString RequestLine;
+				Text.Split(TEXT("\n"), &RequestLine, nullptr);
+				TArray<FString> Parts;
+				RequestLine.TrimEnd().ParseIntoArray(Parts, TEXT(" "));
+
+				if (Parts.Num() >= 2 && Parts[0] == TEXT("GET") && (Parts[1] == TEXT("/metrics") || Parts[1].StartsWith(TEXT("/metrics?"))))
+				{
+					Respond(Peer, TEXT("200 OK"), FUltimateSFMetrics::Get().Scrape());
+				}
+				else
+				{
+					Respond(Peer, TEXT("404 Not Found"), TEXT("Only /metrics is served\n"));
+				}
+				return;
+			}
+		}
+	}
+
+	static void Respond(FSocket& Peer, const TCHAR* Status, const FString& Body)
+	{
+		const FTCHARToUTF8 BodyUtf8(*Body);
+		const FString Header = FString::Printf(TEXT("HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %d\r\nConnection: close\r\n\r\n"),
+			Status, BodyUtf8.Length());
+		const FTCHARToUTF8 HeaderUtf8(*Header);
+
+		TArray<uint8> Response;
+		Response.Append(reinterpret_cast<const uint8*>(HeaderUtf8.Get()), HeaderUtf8.Length());
+		Response.Append(reinterpret_cast<const uint8*>(BodyUtf8.Get()), BodyUtf8.Length());
+
+		int32 Offset = 0;
+		while (Offset < Response.Num())
+		{
+			int32 Sent = 0;
+			if (!Peer.Send(Response.GetData() + Offset, Response.Num() - Offset, Sent) || Sent <= 0)
+			{
+				return;
+			}
+			Offset += Sent;
+		}
+	}
+
+	FSocket* ListenSocket = nullptr;
+	FRunnableThread* Thread = nullptr;
+	std::atomic<bool> bStopping { false };
+};
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Counters***
+/// </summary>
+
+FUltimateSFMetrics& FUltimateSFMetrics::Get()
+{
+	static FUltimateSFMetrics Metrics;
+	return Metrics;
+}
+
+FUltimateSFMetrics::FUltimateSFMetrics()
+{
+	for (std::atomic<int64>& Gauge : Gauges)
+	{
+		Gauge.store(0, std::memory_order_relaxed);
+	}
+}
+
+FUltimateSFMetrics::~FUltimateSFMetrics()
+{
+	//Blocks stay valid for threads that outlive the metrics, they are reclaimed with the process
+	Server.Reset();
+}
+
+FUltimateSFMetrics::FThreadCounters& FUltimateSFMetrics::GetThreadCounters()
+{
+	static thread_local FThreadCounters* Counters = nullptr;
+	if (Counters == nullptr)
+	{
+		Counters = new FThreadCounters();
+		for (std::atomic<uint64>& Value : Counters->Values)
+		{
+			Value.store(0, std::memory_order_relaxed);
+		}
+
+		//Push onto the list the scraper walks, once per thread
+		FThreadCounters* Head = ThreadCounters.load(std::memory_order_relaxed);
+		do
+		{
+			Counters->Next = Head;
+		}
+		while (!ThreadCounters.compare_exchange_weak(Head, Counters, std::memory_order_release, std::memory_order_relaxed));
+	}
+	return *Counters;
+}
+
+void FUltimateSFMetrics::Add(int32 Counter, uint64 Value)
+{
+	check(Counter >= 0 && Counter < MaxCounters);
+
+	//Only this thread writes its block, a plain load and store is enough and never contends
+	std::atomic<uint64>& Slot = GetThreadCounters().Values[Counter];
+	Slot.store(Slot.load(std::memory_order_relaxed) + Value, std::memory_order_relaxed);
+}
+
+void FUltimateSFMetrics::AddRPC(FName Function, bool bReceived)
+{
+	check(IsInGameThread());
+
+	const TPair<FName, bool> Key(Function, bReceived);
+	int32* Found = RPCCounters.Find(Key);
+	if (Found == nullptr)
+	{
+		const int32 Counter = NumCounters.load(std::memory_order_relaxed);
+		if (Counter >= MaxCounters)
+		{
+			return;
+		}
+		CounterLabels[Counter] = FString::Printf(TEXT("function=\"%s\",direction=\"%s\""), *Function.ToString(), bReceived ? TEXT("received") : TEXT("sent"));
+		NumCounters.store(Counter + 1, std::memory_order_release);
+		Found = &RPCCounters.Add(Key, Counter);
+	}
+	Add(*Found);
+}
+
+bool FUltimateSFMetrics::Tick(float DeltaTime)
+{
+	int32 Bucket = FrameTimeBucketFirst;
+	while (Bucket < FrameTimeBucketLast && DeltaTime > FrameTimeBounds[Bucket - FrameTimeBucketFirst])
+	{
+		++Bucket;
+	}
+	Add(Bucket);
+	Add(FrameTimeSumMicroseconds, (uint64)FMath::Max(0.0, DeltaTime * 1000000.0));
+	Add(FrameCount);
+
+	const double Now = FPlatformTime::Seconds();
+	if (Now - LastGaugeSample >= 1.0)
+	{
+		LastGaugeSample = Now;
+		SampleGauges(SampledWorld.Get());
+	}
+	return true;
+}
+
+void FUltimateSFMetrics::SampleGauges(UWorld* World)
+{
+	if (World == nullptr)
+	{
+		return;
+	}
+
+	const AGameStateBase* GameState = World->GetGameState();
+	SetGauge(Players, GameState ? GameState->PlayerArray.Num() : 0);
+
+	int32 InCombat = 0;
+	if (const UUltimateSFFighterGridSubsystem* Grid = World->GetSubsystem<UUltimateSFFighterGridSubsystem>())
+	{
+		Grid->ForEachFighter([&InCombat](AUltimateSFCharacter* Fighter)
+		{
+			InCombat += Fighter->bIsCombatMode && !Fighter->bIsRagdollMode ? 1 : 0;
+		});
+	}
+	SetGauge(FightersInCombat, InCombat);
+	//Fights are one on one
+	SetGauge(ActiveFights, InCombat / 2);
+
+	const UNetDriver* NetDriver = World->GetNetDriver();
+	SetGauge(ReplicatedBytes, NetDriver ? NetDriver->OutTotalBytes : 0);
+}
+
+
+
+
+
+
+
+
+
+/// <summary>
+/// ***Exposition***
+/// </summary>
+
+bool FUltimateSFMetrics::Start(UWorld* World, int32 Port)
+{
+	check(IsInGameThread());
+
+	SampledWorld = World;
+	if (Server)
+	{
+		return true;
+	}
+
+	ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+	TSharedRef<FInternetAddr> Addr = SocketSubsystem->CreateInternetAddr();
+	//Loopback only, the metrics are for a local agent and the scrape path is unauthenticated
+	Addr->SetLoopbackAddress();
+	Addr->SetPort(Port);
+
+	FSocket* ListenSocket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("UltimateSF Metrics Listen"), Addr->GetProtocolType());
+	if (!ListenSocket)
+	{
+		return false;
+	}
+	ListenSocket->SetReuseAddr(true);
+	if (!ListenSocket->Bind(*Addr) || !ListenSocket->Listen(16))
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("Metrics: could not listen on port %d"), Port);
+		SocketSubsystem->DestroySocket(ListenSocket);
+		return false;
+	}
+
+	Server = MakeUnique<FUltimateSFMetricsServer>(ListenSocket);
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FUltimateSFMetrics::Tick));
+	PreExitHandle = FCoreDelegates::OnPreExit.AddRaw(this, &FUltimateSFMetrics::Stop);
+
+	UE_LOG(LogUltimateSF, Log, TEXT("Metrics: serving http://127.0.0.1:%d/metrics"), GetPort());
+	return true;
+}
+
+void FUltimateSFMetrics::Stop()
+{
+	if (!Server)
+	{
+		return;
+	}
+
+	FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+	FCoreDelegates::OnPreExit.Remove(PreExitHandle);
+	Server.Reset();
+}
+
+int32 FUltimateSFMetrics::GetPort() const
+{
+	return Server ? Server->GetPort() : 0;
+}
+
+int32 FUltimateSFMetrics::GetConfiguredPort()
+{
+	int32 Port = CVarMetricsPort.GetValueOnGameThread();
+	FParse::Value(FCommandLine::Get(), TEXT("UltimateSFMetricsPort="), Port);
+	return Port;
+}
+
+FString FUltimateSFMetrics::Scrape() const
+{
+	//Sum every thread's block, a counter may be one increment behind its writer, never torn
+	const int32 Num = NumCounters.load(std::memory_order_acquire);
+	TArray<uint64, TInlineAllocator<MaxCounters>> Totals;
+	Totals.SetNumZeroed(Num);
+	for (const FThreadCounters* Block = ThreadCounters.load(std::memory_order_acquire); Block; Block = Block->Next)
+	{
+		for (int32 Counter = 0; Counter < Num; ++Counter)
+		{
+			Totals[Counter] += Block->Values[Counter].load(std::memory_order_relaxed);
+		}
+	}
+
+	FString Out;
+	Out.Reserve(4096);
+
+	Out += TEXT("# HELP usf_frame_time_seconds Game thread frame time.\n# TYPE usf_frame_time_seconds histogram\n");
+	uint64 Cumulative = 0;
+	for (int32 Bucket = FrameTimeBucketFirst; Bucket <= FrameTimeBucketLast; ++Bucket)
+	{
+		Cumulative += Totals[Bucket];
+		const FString Bound = Bucket < FrameTimeBucketLast ? FString::Printf(TEXT("%g"), FrameTimeBounds[Bucket - FrameTimeBucketFirst]) : FString(TEXT("+Inf"));
+		Out += FString::Printf(TEXT("usf_frame_time_seconds_bucket{le=\"%s\"} %llu\n"), *Bound, Cumulative);
+	}
+	Out += FString::Printf(TEXT("usf_frame_time_seconds_sum %.6f\n"), Totals[FrameTimeSumMicroseconds] / 1000000.0);
+	//Taken from the buckets rather than FrameCount so the count always matches +Inf within a scrape
+	Out += FString::Printf(TEXT("usf_frame_time_seconds_count %llu\n"), Cumulative);
+
+	Out += FString::Printf(TEXT("# HELP usf_rejected_rpcs_total Attack RPCs the server refused.\n# TYPE usf_rejected_rpcs_total counter\nusf_rejected_rpcs_total %llu\n"), Totals[RejectedRPCs]);
+
+	if (Num > NumFixedCounters)
+	{
+		Out += TEXT("# HELP usf_rpcs_total RPCs fighters sent and received, by function and direction.\n# TYPE usf_rpcs_total counter\n");
+		for (int32 Counter = NumFixedCounters; Counter < Num; ++Counter)
+		{
+			Out += FString::Printf(TEXT("usf_rpcs_total{%s} %llu\n"), *CounterLabels[Counter], Totals[Counter]);
+		}
+	}
+
+	Out += FString::Printf(TEXT("# HELP usf_players Connected players.\n# TYPE usf_players gauge\nusf_players %lld\n"), Gauges[Players].load(std::memory_order_relaxed));
+	Out += FString::Printf(TEXT("# HELP usf_active_fights Fights in progress.\n# TYPE usf_active_fights gauge\nusf_active_fights %lld\n"), Gauges[ActiveFights].load(std::memory_order_relaxed));
+	Out += FString::Printf(TEXT("# HELP usf_fighters_in_combat Fighters in combat mode.\n# TYPE usf_fighters_in_combat gauge\nusf_fighters_in_combat %lld\n"), Gauges[FightersInCombat].load(std::memory_order_relaxed));
+	Out += FString::Printf(TEXT("# HELP usf_replicated_bytes_total Bytes the net driver sent.\n# TYPE usf_replicated_bytes_total counter\nusf_replicated_bytes_total %lld\n"), Gauges[ReplicatedBytes].load(std::memory_order_relaxed));
+
+	const FPlatformMemoryStats Memory = FPlatformMemory::GetStats();
+	Out += FString::Printf(TEXT("# HELP usf_memory_used_bytes Process memory.\n# TYPE usf_memory_used_bytes gauge\nusf_memory_used_bytes{kind=\"physical\"} %llu\nusf_memory_used_bytes{kind=\"virtual\"} %llu\n"),
+		(uint64)Memory.UsedPhysical, (uint64)Memory.UsedVirtual);
+	return Out;
+}
+
+//e.g. "usf.Metrics.Start 9464", then curl http://127.0.0.1:9464/metrics
+static FAutoConsoleCommandWithWorldAndArgs MetricsStartCommand(
+	TEXT("usf.Metrics.Start"),
+	TEXT("Serves Prometheus metrics on the loopback interface. Args: [Port]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		const int32 Port = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : FUltimateSFMetrics::GetConfiguredPort();
+		FUltimateSFMetrics::Get().Start(World, Port);
+	}));
+
+static FAutoConsoleCommand MetricsStopCommand(
+	TEXT("usf.Metrics.Stop"),
+	TEXT("Stops serving metrics"),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		FUltimateSFMetrics::Get().Stop();
+	}));
@@ -0,0 +1,98 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "UObject/WeakObjectPtrTemplates.h"
+#include <atomic>
+
+class FUltimateSFMetricsServer;
+class UWorld;
+
+/**
+ * Server metrics in the Prometheus text format, scraped from http://127.0.0.1:<port>/metrics.
+ * Counters live in per-thread blocks that only their own thread writes, with relaxed atomics, and the HTTP
+ * thread sums the blocks on each scrape: recording a value is a load and a store, never a lock or a shared
+ * cache line. Gauges are sampled on the game thread once a second. Started by the game mode on servers when
+ * -UltimateSFMetricsPort= or usf.Metrics.Port is set.
+ */
+class FUltimateSFMetrics
+{
+public:
+	static FUltimateSFMetrics& Get();
+
+	/* Fixed counters, RPCs per function are registered after these */
+	enum ECounter : int32
+	{
+		FrameTimeBucketFirst,
+		//5, 10, 16.7, 33.3, 50, 100, 250 ms and +Inf
+		FrameTimeBucketLast = FrameTimeBucketFirst + 7,
+		FrameTimeSumMicroseconds,
+		FrameCount,
+		RejectedRPCs,
+		NumFixedCounters
+	};
+
+	enum EGauge : int32
+	{
+		Players,
+		ActiveFights,
+		FightersInCombat,
+		ReplicatedBytes,
+		NumGauges
+	};
+
+	static constexpr int32 MaxCounters = 256;
+
+	/* Any thread */
+	void Add(int32 Counter, uint64 Value = 1);
+	void SetGauge(EGauge Gauge, int64 Value) { Gauges[Gauge].store(Value, std::memory_order_relaxed); }
+
+	/* Game thread. Counts an RPC under its function name and direction, the counter is registered on first use */
+	void AddRPC(FName Function, bool bReceived = false);
+
+	/* Serves /metrics on the loopback interface and samples the gauges from World, which may change on travel */
+	bool Start(UWorld* World, int32 Port);
+	void Stop();
+	bool IsRunning() const { return Server.IsValid(); }
+	int32 GetPort() const;
+
+	/* -UltimateSFMetricsPort= or usf.Metrics.Port, 0 when metrics are off */
+	static int32 GetConfiguredPort();
+
+	/* Prometheus exposition of every counter and gauge, called by the HTTP thread */
+	FString Scrape() const;
+
+private:
+	struct FThreadCounters
+	{
+		std::atomic<uint64> Values[MaxCounters];
+		FThreadCounters* Next = nullptr;
+	};
+
+	FUltimateSFMetrics();
+	~FUltimateSFMetrics();
+
+	FThreadCounters& GetThreadCounters();
+
+	/* Records the frame time every frame and samples the gauges once a second */
+	bool Tick(float DeltaTime);
+	void SampleGauges(UWorld* World);
+
+	/* Blocks are pushed once per thread and never freed, a thread that exits leaves its totals behind */
+	std::atomic<FThreadCounters*> ThreadCounters { nullptr };
+
+	/* Prometheus labels of the RPC counters, written by the game thread before NumCounters publishes them */
+	FString CounterLabels[MaxCounters];
+	std::atomic<int32> NumCounters { NumFixedCounters };
+	TMap<TPair<FName, bool>, int32> RPCCounters;
+
+	std::atomic<int64> Gauges[NumGauges];
+
+	TWeakObjectPtr<UWorld> SampledWorld;
+	double LastGaugeSample = 0.0;
+	FTSTicker::FDelegateHandle TickerHandle;
+	FDelegateHandle PreExitHandle;
+	TUniquePtr<FUltimateSFMetricsServer> Server;
+};
@@ -0,0 +1,502 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFNetProfiler.h"
+#include "UltimateSF.h"
+#include "Engine/NetConnection.h"
+#include "Engine/NetDriver.h"
+#include "Engine/PackageMapClient.h"
+#include "GameFramework/Actor.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/App.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Net/DataBunch.h"
+#include "Net/RepLayout.h"
+#include "UObject/UnrealType.h"
+
+static TAutoConsoleVariable<bool> CVarNetProfileEnabled(
+	TEXT("usf.NetProfile.Enabled"),
+	false,
+	TEXT("Attribute outgoing replication bits to properties and RPCs, see FUltimateSFNetProfiler. Also enabled by -UltimateSFNetProfile."));
+
+static TAutoConsoleVariable<float> CVarNetProfileWindow(
+	TEXT("usf.NetProfile.Window"),
+	5.f,
+	TEXT("Seconds per summary row written to Saved/Profiling/UltimateSFNetProfile.csv."));
+
+static FString GetNetProfileFilename()
+{
+	return FPaths::ProfilingDir() / TEXT("UltimateSFNetProfile.csv");
+}
+
+FUltimateSFNetProfiler& FUltimateSFNetProfiler::Get()
+{
+	static FUltimateSFNetProfiler Profiler;
+	return Profiler;
+}
+
+bool FUltimateSFNetProfiler::IsEnabled()
+{
+	static const bool bCommandLine = FParse::Param(FCommandLine::Get(), TEXT("UltimateSFNetProfile"));
+	return bCommandLine || CVarNetProfileEnabled.GetValueOnGameThread();
+}
+
+FUltimateSFNetProfiler::FShadowState::~FShadowState()
+{
+	for (FShadowProperty& Shadow : Properties)
+	{
+		Shadow.Property->DestroyValue(Shadow.Value.GetData());
+	}
+}
+
+void FUltimateSFNetProfiler::GatherConnections(AActor* Actor, FConnectionArray& OutConnections)
+{
+	OutConnections.Reset();
+	UNetDriver* NetDriver = Actor->GetNetDriver();
+	if (NetDriver == nullptr)
+	{
+		return;
+	}
+
+	for (UNetConnection* Connection : NetDriver->ClientConnections)
+	{
+		if (Connection && Connection->FindActorChannelRef(Actor))
+		{
+			OutConnections.Add(Connection);
+		}
+	}
+}
+
+bool FUltimateSFNetProfiler::IsConditionMet(ELifetimeCondition Condition, bool bInitial, bool bOwner, bool bSimulated)
+{
+	//Replay conditions count as their live counterpart, the profiler only looks at client connections
+	switch (Condition)
+	{
+	case COND_InitialOnly:
+		return bInitial;
+	case COND_OwnerOnly:
+	case COND_ReplayOrOwner:
+		return bOwner;
+	case COND_SkipOwner:
+		return !bOwner;
+	case COND_SimulatedOnly:
+	case COND_SimulatedOnlyNoReplay:
+	case COND_SimulatedOrPhysics:
+	case COND_SimulatedOrPhysicsNoReplay:
+		return bSimulated;
+	case COND_AutonomousOnly:
+		return !bSimulated;
+	case COND_InitialOrOwner:
+		return bInitial || bOwner;
+	case COND_ReplayOnly:
+	case COND_Never:
+		return false;
+	default:
+		return true;
+	}
+}
+
+int32 FUltimateSFNetProfiler::MeasureBits(const FProperty* Property, const void* Value, UPackageMap* PackageMap)
+{
+	FNetBitWriter Writer(PackageMap, 0);
+	for (int32 Index = 0; Index < Property->ArrayDim; ++Index)
+	{
+		SerializeValue(Writer, Property, (const uint8*)Value + Index * Property->ElementSize, PackageMap);
+	}
+	return (int32)Writer.GetNumBits();
+}
+
+void FUltimateSFNetProfiler::SerializeValue(FNetBitWriter& Writer, const FProperty* Property, const uint8* Value, UPackageMap* PackageMap)
+{
+	//NetSerializeItem only takes what the rep layout hands it, anything else hits the engine's fatal deprecated path
+	if (const FStructProperty* StructProperty = CastField<FStructProperty>(Property))
+	{
+		const UScriptStruct* Struct = StructProperty->Struct;
+		if (Struct->StructFlags & STRUCT_NetDeltaSerializeNative)
+		{
+			//Fast arrays send only what changed since the last ack, a full write would be a made up number
+			return;
+		}
+		if (!(Struct->StructFlags & STRUCT_NetSerializeNative))
+		{
+			for (TFieldIterator<FProperty> It(Struct); It; ++It)
+			{
+				if (!It->HasAnyPropertyFlags(CPF_RepSkip))
+				{
+					for (int32 Index = 0; Index < It->ArrayDim; ++Index)
+					{
+						SerializeValue(Writer, *It, It->ContainerPtrToValuePtr<uint8>(Value, Index), PackageMap);
+					}
+				}
+			}
+			return;
+		}
+	}
+	else if (const FArrayProperty* ArrayProperty = CastField<FArrayProperty>(Property))
+	{
+		//The rep layout sends the element count as a uint16 ahead of the elements
+		FScriptArrayHelper Helper(ArrayProperty, Value);
+		uint16 Num = (uint16)FMath::Min(Helper.Num(), (int32)MAX_uint16);
+		Writer << Num;
+		for (int32 Index = 0; Index < Num; ++Index)
+		{
+			SerializeValue(Writer, ArrayProperty->Inner, Helper.GetRawPtr(Index), PackageMap);
+		}
+		return;
+	}
+
+	Property->NetSerializeItem(Writer, PackageMap, const_cast<uint8*>(Value));
+}
+
+void FUltimateSFNetProfiler::TrackProperties(AActor* Actor, IRepChangedPropertyTracker& ChangedPropertyTracker)
+{
+	FConnectionArray Connections;
+	GatherConnections(Actor, Connections);
+	if (Connections.Num() == 0)
+	{
+		return;
+	}
+
+	FShadowState* Shadow = Shadows.Find(Actor);
+	const bool bInitial = Shadow == nullptr;
+	if (bInitial)
+	{
+		TArray<FLifetimeProperty> LifetimeProps;
+		Actor->GetLifetimeReplicatedProps(LifetimeProps);
+
+		//First sight of the actor: its initial bunch carries everything the conditions allow, charge it all
+		Shadow = &Shadows.Add(Actor);
+		for (TFieldIterator<FProperty> It(Actor->GetClass()); It; ++It)
+		{
+			if (It->HasAnyPropertyFlags(CPF_Net))
+			{
+				FShadowProperty& ShadowProperty = Shadow->Properties.AddDefaulted_GetRef();
+				ShadowProperty.Property = *It;
+				const FLifetimeProperty* Lifetime = LifetimeProps.FindByPredicate([&](const FLifetimeProperty& Prop) { return Prop.RepIndex == It->RepIndex; });
+				ShadowProperty.Condition = Lifetime ? Lifetime->Condition : COND_Never;
+				ShadowProperty.Value.SetNumZeroed(It->GetSize());
+				It->InitializeValue(ShadowProperty.Value.GetData());
+			}
+		}
+	}
+
+	//The actor's own connection sees it as autonomous when it is possessed that way, every other one as simulated
+	const UNetConnection* OwnerConnection = Actor->GetNetConnection();
+	const bool bOwnerAutonomous = Actor->GetRemoteRole() == ROLE_AutonomousProxy;
+	const FRepChangedPropertyTracker& Tracker = static_cast<const FRepChangedPropertyTracker&>(ChangedPropertyTracker);
+
+	for (FShadowProperty& ShadowProperty : Shadow->Properties)
+	{
+		const void* Value = ShadowProperty.Property->ContainerPtrToValuePtr<void>(Actor);
+		if (ShadowProperty.Property->Identical(Value, ShadowProperty.Value.GetData()))
+		{
+			continue;
+		}
+
+		//Inactive properties are not sent, the shadow keeps the old value so the change is charged once they are active again
+		const uint16 RepIndex = ShadowProperty.Property->RepIndex;
+		if (RepIndex < Tracker.GetParentCount() && !Tracker.IsParentActive(RepIndex))
+		{
+			continue;
+		}
+		ShadowProperty.Property->CopyCompleteValue(ShadowProperty.Value.GetData(), Value);
+
+		int32 Bits = -1;
+		for (UNetConnection* Connection : Connections)
+		{
+			const bool bOwner = Connection == OwnerConnection;
+			if (!IsConditionMet(ShadowProperty.Condition, bInitial, bOwner, !(bOwner && bOwnerAutonomous)))
+			{
+				continue;
+			}
+			if (Bits < 0)
+			{
+				Bits = MeasureBits(ShadowProperty.Property, Value, Connection->PackageMap);
+			}
+			Add(ShadowProperty.Property->GetFName(), false, Bits, Connection);
+		}
+	}
+}
+
+void FUltimateSFNetProfiler::TrackRPC(AActor* Actor, UFunction* Function, void* Parameters)
+{
+	//Multicasts go to every connection with a channel, client and server RPCs down the owning connection
+	FConnectionArray Connections;
+	if (Function->HasAnyFunctionFlags(FUNC_NetMulticast))
+	{
+		GatherConnections(Actor, Connections);
+	}
+	else if (UNetConnection* Connection = Actor->GetNetConnection())
+	{
+		Connections.Add(Connection);
+	}
+	if (Connections.Num() == 0)
+	{
+		return;
+	}
+
+	int32 Bits = 0;
+	for (TFieldIterator<FProperty> It(Function); It && It->HasAnyPropertyFlags(CPF_Parm); ++It)
+	{
+		if (!It->HasAnyPropertyFlags(CPF_ReturnParm))
+		{
+			Bits += MeasureBits(*It, It->ContainerPtrToValuePtr<void>(Parameters), Connections[0]->PackageMap);
+		}
+	}
+	for (UNetConnection* Connection : Connections)
+	{
+		Add(Function->GetFName(), true, Bits, Connection);
+	}
+}
+
+void FUltimateSFNetProfiler::RemoveActor(AActor* Actor)
+{
+	Shadows.Remove(Actor);
+}
+
+void FUltimateSFNetProfiler::Add(FName Name, bool bRPC, int32 Bits, UNetConnection* Connection)
+{
+	if (!TickerHandle.IsValid())
+	{
+		WindowStart = FPlatformTime::Seconds();
+		TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FUltimateSFNetProfiler::Tick));
+	}
+
+	FEntry& Entry = Window.FindOrAdd(TPair<FName, FString>(Name, GetConnectionName(Connection)));
+	Entry.bRPC = bRPC;
+	++Entry.Sends;
+	Entry.Bits += (uint64)Bits;
+}
+
+const FString& FUltimateSFNetProfiler::GetConnectionName(UNetConnection* Connection)
+{
+	//Remote address and port, formatted once per connection instead of once per changed property
+	if (const FString* Name = ConnectionNames.Find(Connection))
+	{
+		return *Name;
+	}
+	return ConnectionNames.Add(Connection, Connection->LowLevelGetRemoteAddress(true).Replace(TEXT(","), TEXT(";")));
+}
+
+bool FUltimateSFNetProfiler::Tick(float DeltaTime)
+{
+	if (FPlatformTime::Seconds() - WindowStart >= CVarNetProfileWindow.GetValueOnGameThread())
+	{
+		FlushWindow();
+	}
+
+	if (!IsEnabled())
+	{
+		FlushWindow();
+		Shadows.Reset();
+		ConnectionNames.Reset();
+		TickerHandle.Reset();
+		return false;
+	}
+	return true;
+}
+
+void FUltimateSFNetProfiler::FlushWindow()
+{
+	const double Now = FPlatformTime::Seconds();
+	if (Window.Num() > 0)
+	{
+		//One row per property / RPC and connection per window
+		FString Csv;
+		if (!bWroteHeader)
+		{
+			Csv = FString(TEXT("WindowStart,WindowSeconds,Connection,Name,Kind,Sends,Bits")) + LINE_TERMINATOR;
+			bWroteHeader = true;
+		}
+		for (const TPair<TPair<FName, FString>, FEntry>& Pair : Window)
+		{
+			Csv += FString::Printf(TEXT("%.3f,%.3f,%s,%s,%s,%u,%llu%s"), WindowStart, Now - WindowStart, *Pair.Key.Value, *Pair.Key.Key.ToString(),
+				Pair.Value.bRPC ? TEXT("RPC") : TEXT("Property"), Pair.Value.Sends, Pair.Value.Bits, LINE_TERMINATOR);
+		}
+		FFileHelper::SaveStringToFile(Csv, *GetNetProfileFilename(), FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), FILEWRITE_Append);
+		Window.Reset();
+	}
+	WindowStart = Now;
+}
+
+bool FUltimateSFNetProfiler::PrintReport(const FString& Filename)
+{
+	TArray<FString> Lines;
+	if (!FFileHelper::LoadFileToStringArray(Lines, *Filename))
+	{
+		UE_LOG(LogUltimateSF, Warning, TEXT("usf.NetProfile.Report: cannot read %s"), *Filename);
+		return false;
+	}
+
+	struct FTotal
+	{
+		FString Kind;
+		uint64 Sends = 0;
+		uint64 Bits = 0;
+	};
+	TMap<FString, FTotal> Totals;
+	TMap<FString, uint64> ConnectionBits;
+	TSet<FString> Windows;
+	double Seconds = 0.0;
+	uint64 AllBits = 0;
+
+	for (const FString& Line : Lines)
+	{
+		TArray<FString> Columns;
+		if (Line.ParseIntoArray(Columns, TEXT(","), false) != 7 || Columns[0] == TEXT("WindowStart"))
+		{
+			continue;
+		}
+
+		bool bSeenWindow = false;
+		Windows.Add(Columns[0], &bSeenWindow);
+		if (!bSeenWindow)
+		{
+			Seconds += FCString::Atod(*Columns[1]);
+		}
+
+		const uint64 Bits = FCString::Strtoui64(*Columns[6], nullptr, 10);
+		FTotal& Total = Totals.FindOrAdd(Columns[3]);
+		Total.Kind = Columns[4];
+		Total.Sends += FCString::Strtoui64(*Columns[5], nullptr, 10);
+		Total.Bits += Bits;
+		ConnectionBits.FindOrAdd(Columns[2]) += Bits;
+		AllBits += Bits;
+	}
+
+	Totals.ValueSort([](const FTotal& A, const FTotal& B) { return A.Bits > B.Bits; });
+	ConnectionBits.ValueSort([](uint64 A, uint64 B) { return A > B; });
+
+	UE_LOG(LogUltimateSF, Log, TEXT("%s: %d windows, %.1f s, %.1f kbit/s total over %d connections"), *Filename, Windows.Num(), Seconds,
+		Seconds > 0.0 ? AllBits / Seconds / 1000.0 : 0.0, ConnectionBits.Num());
+	UE_LOG(LogUltimateSF, Log, TEXT("%-40s %-8s %10s %12s %8s %10s"), TEXT("Name"), TEXT("Kind"), TEXT("Sends"), TEXT("Bits"), TEXT("Share"), TEXT("bit/s"));
+	for (const TPair<FString, FTotal>& Pair : Totals)
+	{
+		UE_LOG(LogUltimateSF, Log, TEXT("%-40s %-8s %10llu %12llu %7.1f%% %10.0f"), *Pair.Key, *Pair.Value.Kind, Pair.Value.Sends, Pair.Value.Bits,
+			AllBits > 0 ? 100.0 * Pair.Value.Bits / AllBits : 0.0, Seconds > 0.0 ? Pair.Value.Bits / Seconds : 0.0);
+	}
+
+	UE_LOG(LogUltimateSF, Log, TEXT("%-40s %12s %8s %10s"), TEXT("Connection"), TEXT("Bits"), TEXT("Share"), TEXT("bit/s"));
+	for (const TPair<FString, uint64>& Pair : ConnectionBits)
+	{
+		UE_LOG(LogUltimateSF, Log, TEXT("%-40s %12llu %7.1f%% %10.0f"), *Pair.Key, Pair.Value,
+			AllBits > 0 ? 100.0 * Pair.Value / AllBits : 0.0, Seconds > 0.0 ? Pair.Value / Seconds : 0.0);
+	}
+	return true;
+}
+
+static FAutoConsoleCommand NetProfileReportCommand(
+	TEXT("usf.NetProfile.Report"),
+	TEXT("Prints replication bits per property and RPC, largest first, from Saved/Profiling/UltimateSFNetProfile.csv or the given file"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		FUltimateSFNetProfiler::PrintReport(Args.Num() > 0 ? Args[0] : GetNetProfileFilename());
+	}));
+
+/**
+ * Runs the server once on each combat state backend (usf.Net.CompactCombatState 0 then 1) and compares them.
+ * Bytes are everything the net driver sent, so both runs need the same load: a headless server with
+ * -UltimateSFBots=N and a fixed set of clients. CPU is the game thread work per frame, sleep excluded.
+ */
+struct FUltimateSFCombatStateBench
+{
+	TWeakObjectPtr<UWorld> World;
+	float PhaseSeconds = 30.f;
+	int32 Phase = 0;
+	double PhaseStart = 0.0;
+	bool bMeasuring = false;
+	uint64 StartBytes = 0;
+	double FrameWorkSeconds = 0.0;
+	int32 NumFrames = 0;
+	int32 ConnectionSamples = 0;
+	bool bOriginalCompact = true;
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	//Connections settle and actor channels open before measuring
+	static constexpr double WarmupSeconds = 2.0;
+
+	static IConsoleVariable* GetBackendVariable()
+	{
+		return IConsoleManager::Get().FindConsoleVariable(TEXT("usf.Net.CompactCombatState"));
+	}
+
+	void StartPhase()
+	{
+		GetBackendVariable()->Set(Phase == 1, ECVF_SetByConsole);
+		PhaseStart = FPlatformTime::Seconds();
+		bMeasuring = false;
+	}
+
+	bool Tick(float DeltaTime)
+	{
+		UNetDriver* NetDriver = World.IsValid() ? World->GetNetDriver() : nullptr;
+		if (NetDriver == nullptr)
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("usf.Net.CombatStateBench: the world has no net driver anymore"));
+			GetBackendVariable()->Set(bOriginalCompact, ECVF_SetByConsole);
+			delete this;
+			return false;
+		}
+
+		const double Elapsed = FPlatformTime::Seconds() - PhaseStart;
+		if (!bMeasuring)
+		{
+			if (Elapsed >= WarmupSeconds)
+			{
+				bMeasuring = true;
+				PhaseStart = FPlatformTime::Seconds();
+				StartBytes = NetDriver->OutTotalBytes;
+				FrameWorkSeconds = 0.0;
+				NumFrames = 0;
+				ConnectionSamples = 0;
+			}
+			return true;
+		}
+
+		FrameWorkSeconds += FMath::Max(0.0, FApp::GetDeltaTime() - FApp::GetIdleTime());
+		ConnectionSamples += NetDriver->ClientConnections.Num();
+		++NumFrames;
+		if (Elapsed < PhaseSeconds)
+		{
+			return true;
+		}
+
+		const double Connections = FMath::Max(1.0, (double)ConnectionSamples / FMath::Max(NumFrames, 1));
+		const double Bytes = (double)(NetDriver->OutTotalBytes - StartBytes);
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.Net.CombatStateBench: %s backend, %.1f ms game thread per frame over %d frames, %.0f bytes/s per connection (%.1f connections)"),
+			Phase == 0 ? TEXT("per property") : TEXT("compact"), NumFrames > 0 ? FrameWorkSeconds * 1000.0 / NumFrames : 0.0, NumFrames,
+			Bytes / Elapsed / Connections, Connections);
+
+		if (++Phase < 2)
+		{
+			StartPhase();
+			return true;
+		}
+
+		GetBackendVariable()->Set(bOriginalCompact, ECVF_SetByConsole);
+		//Nothing touches this after the delete, returning false removes the ticker
+		delete this;
+		return false;
+	}
+};
+
+static FAutoConsoleCommandWithWorldAndArgs CombatStateBenchCommand(
+	TEXT("usf.Net.CombatStateBench"),
+	TEXT("Compares server CPU and bytes per connection of the per property and compact combat state backends. usf.Net.CombatStateBench [SecondsPerBackend=30]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (World == nullptr || World->GetNetDriver() == nullptr || !World->GetNetDriver()->IsServer() || FUltimateSFCombatStateBench::GetBackendVariable() == nullptr)
+		{
+			UE_LOG(LogUltimateSF, Warning, TEXT("usf.Net.CombatStateBench runs on a server with a net driver"));
+			return;
+		}
+
+		FUltimateSFCombatStateBench* Bench = new FUltimateSFCombatStateBench();
+		Bench->World = World;
+		Bench->PhaseSeconds = Args.Num() > 0 ? FMath::Max(FCString::Atof(*Args[0]), 1.f) : 30.f;
+		Bench->bOriginalCompact = FUltimateSFCombatStateBench::GetBackendVariable()->GetBool();
+		Bench->StartPhase();
+		Bench->TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(Bench, &FUltimateSFCombatStateBench::Tick));
+	}));
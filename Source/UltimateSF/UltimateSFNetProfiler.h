@@ -0,0 +1,98 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "UObject/CoreNetTypes.h"
+#include "UObject/ObjectKey.h"
+
+class AActor;
+class FNetBitWriter;
+class IRepChangedPropertyTracker;
+class UFunction;
+class UNetConnection;
+class UPackageMap;
+
+/**
+ * Attributes outgoing replication bits to individual properties and RPCs.
+ * Properties are compared against a shadow copy in PreReplication and every changed one is net serialized
+ * once to measure it, then charged to each connection with an open channel to the actor that would receive it:
+ * inactive properties (DOREPLIFETIME_ACTIVE_OVERRIDE) are skipped and the lifetime condition is checked against
+ * the connection's ownership and role, the way the rep layout filters them. RPCs are
+ * measured from their parameters as they are sent. Payload bits only: bunch and packet headers are not included.
+ * Structs without a native NetSerialize and arrays are measured field by field and element by element, the way
+ * the rep layout sends them; delta serialized structs such as fast arrays are not measured.
+ *
+ * Enable with usf.NetProfile.Enabled 1 or -UltimateSFNetProfile (headless servers with -UltimateSFBots=N).
+ * Every usf.NetProfile.Window seconds the totals per connection are appended to Saved/Profiling/UltimateSFNetProfile.csv;
+ * usf.NetProfile.Report [File] prints the per property / RPC and per connection tables from such a file.
+ */
+class FUltimateSFNetProfiler
+{
+public:
+	static FUltimateSFNetProfiler& Get();
+
+	static bool IsEnabled();
+
+	/* Server side, called at the end of PreReplication once the active overrides are set */
+	void TrackProperties(AActor* Actor, IRepChangedPropertyTracker& ChangedPropertyTracker);
+
+	/* Called from CallRemoteFunction before the RPC is handed to the net driver */
+	void TrackRPC(AActor* Actor, UFunction* Function, void* Parameters);
+
+	/* Forgets the shadow state of a destroyed actor */
+	void RemoveActor(AActor* Actor);
+
+	static bool PrintReport(const FString& Filename);
+
+private:
+	struct FEntry
+	{
+		bool bRPC = false;
+		uint32 Sends = 0;
+		uint64 Bits = 0;
+	};
+
+	struct FShadowProperty
+	{
+		const FProperty* Property = nullptr;
+		ELifetimeCondition Condition = COND_None;
+		TArray<uint8> Value;
+	};
+
+	/* Owns the property values it holds, so it cannot be copied; moving leaves the source empty */
+	struct FShadowState
+	{
+		TArray<FShadowProperty> Properties;
+
+		FShadowState() = default;
+		FShadowState(FShadowState&&) = default;
+		FShadowState(const FShadowState&) = delete;
+		FShadowState& operator=(const FShadowState&) = delete;
+		FShadowState& operator=(FShadowState&&) = delete;
+		~FShadowState();
+	};
+
+	using FConnectionArray = TArray<UNetConnection*, TInlineAllocator<16>>;
+
+	FUltimateSFNetProfiler() = default;
+
+	void Add(FName Name, bool bRPC, int32 Bits, UNetConnection* Connection);
+	bool Tick(float DeltaTime);
+	void FlushWindow();
+	const FString& GetConnectionName(UNetConnection* Connection);
+
+	static void GatherConnections(AActor* Actor, FConnectionArray& OutConnections);
+	static bool IsConditionMet(ELifetimeCondition Condition, bool bInitial, bool bOwner, bool bSimulated);
+	static int32 MeasureBits(const FProperty* Property, const void* Value, UPackageMap* PackageMap);
+	static void SerializeValue(FNetBitWriter& Writer, const FProperty* Property, const uint8* Value, UPackageMap* PackageMap);
+
+	/* Keyed by property or RPC name and connection */
+	TMap<TPair<FName, FString>, FEntry> Window;
+	TMap<TObjectKey<UNetConnection>, FString> ConnectionNames;
+	TMap<TObjectKey<AActor>, FShadowState> Shadows;
+	double WindowStart = 0.0;
+	FTSTicker::FDelegateHandle TickerHandle;
+	bool bWroteHeader = false;
+};
@@ -0,0 +1,18 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFPlayerController.h"
+#include "UltimateSFCharacter.h"
+#include "UltimateSFGameMode.h"
+
+void AUltimateSFPlayerController::PawnLeavingGame()
+{
+	//Pooled or destroyed by the game mode, either way the pawn is no longer ours when Super runs
+	AUltimateSFCharacter* Fighter = Cast<AUltimateSFCharacter>(GetPawn());
+	AUltimateSFGameMode* GameMode = GetWorld() ? GetWorld()->GetAuthGameMode<AUltimateSFGameMode>() : nullptr;
+	if (Fighter && GameMode)
+	{
+		GameMode->ReleaseFighter(Fighter);
+	}
+
+	Super::PawnLeavingGame();
+}
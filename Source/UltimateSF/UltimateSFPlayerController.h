@@ -0,0 +1,23 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/PlayerController.h"
+#include "UltimateSFPlayerController.generated.h"
+
+/**
+ * Player controller of AUltimateSFGameMode.
+ * A leaving player's fighter goes back to the game mode's fighter pool. The engine destroys the pawn from
+ * APlayerController::Destroyed, before the game mode's Logout runs, so this has to happen here.
+ */
+UCLASS()
+class AUltimateSFPlayerController : public APlayerController
+{
+	GENERATED_BODY()
+
+protected:
+	// APlayerController interface
+	virtual void PawnLeavingGame() override;
+	// End of APlayerController interface
+};
@@ -0,0 +1,235 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "UltimateSFRagdollSubsystem.h"
+#include "UltimateSF.h"
+#include "UltimateSFCharacter.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_STATS_GROUP(TEXT("UltimateSF Ragdoll"), STATGROUP_UltimateSFRagdoll, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Ragdoll Tick"), STAT_UltimateSFRagdollTick, STATGROUP_UltimateSFRagdoll);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Active Ragdolls"), STAT_UltimateSFActiveRagdolls, STATGROUP_UltimateSFRagdoll);
+
+static TAutoConsoleVariable<int32> CVarRagdollBudget(
+	TEXT("usf.Ragdoll.Budget"),
+	16,
+	TEXT("Maximum number of characters simulating ragdoll physics at the same time in one world. Read when the world starts."));
+
+static TAutoConsoleVariable<float> CVarRagdollMaxSimulateTime(
+	TEXT("usf.Ragdoll.MaxSimulateTime"),
+	3.f,
+	TEXT("Seconds a ragdoll may simulate before it is blended back to animation even if its bodies are still awake."));
+
+static TAutoConsoleVariable<float> CVarRagdollBlendOutTime(
+	TEXT("usf.Ragdoll.BlendOutTime"),
+	0.4f,
+	TEXT("Seconds spent blending a sleeping ragdoll back to the animated pose."));
+
+static TAutoConsoleVariable<float> CVarRagdollTargetStepMs(
+	TEXT("usf.Ragdoll.TargetStepMs"),
+	16.6f,
+	TEXT("Frame time target. While frames run slower than this the oldest ragdoll is retired early, one per frame."));
+
+void UUltimateSFRagdollSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	const int32 Budget = FMath::Max(1, CVarRagdollBudget.GetValueOnGameThread());
+	Slots.SetNum(Budget);
+	FreeSlots.Reserve(Budget);
+	for (int32 SlotIndex = Budget - 1; SlotIndex >= 0; --SlotIndex)
+	{
+		FreeSlots.Add(SlotIndex);
+	}
+}
+
+void UUltimateSFRagdollSubsystem::Deinitialize()
+{
+	Slots.Reset();
+	FreeSlots.Reset();
+
+	Super::Deinitialize();
+}
+
+TStatId UUltimateSFRagdollSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UUltimateSFRagdollSubsystem, STATGROUP_Tickables);
+}
+
+bool UUltimateSFRagdollSubsystem::RequestRagdoll(AUltimateSFCharacter* Character)
+{
+	if (Character == nullptr)
+	{
+		return false;
+	}
+
+	for (const FRagdollSlot& Slot : Slots)
+	{
+		if (Slot.Character.Get() == Character && Slot.State != ESlotState::Free)
+		{
+			return true;
+		}
+	}
+
+	if (FreeSlots.Num() == 0)
+	{
+		//Pool is exhausted, snap the oldest ragdoll back to animation so the newest knockdown gets physics.
+		//When every slot is already blending out the knockdown plays its montage instead
+		const int32 OldestIndex = FindOldestSlot();
+		if (OldestIndex == INDEX_NONE)
+		{
+			return false;
+		}
+		if (AUltimateSFCharacter* Oldest = Slots[OldestIndex].Character.Get())
+		{
+			Oldest->ExitRagdoll();
+		}
+		FreeSlot(OldestIndex);
+	}
+
+	const int32 SlotIndex = FreeSlots.Pop(false);
+	FRagdollSlot& Slot = Slots[SlotIndex];
+	Slot.Character = Character;
+	Slot.State = ESlotState::Simulating;
+	Slot.SimulatedTime = 0.f;
+	Slot.BlendWeight = 1.f;
+	Slot.StartOrder = NextStartOrder++;
+	return true;
+}
+
+void UUltimateSFRagdollSubsystem::ReleaseRagdoll(AUltimateSFCharacter* Character)
+{
+	for (int32 SlotIndex = 0; SlotIndex < Slots.Num(); ++SlotIndex)
+	{
+		if (Slots[SlotIndex].State != ESlotState::Free && Slots[SlotIndex].Character.Get() == Character)
+		{
+			FreeSlot(SlotIndex);
+			return;
+		}
+	}
+}
+
+void UUltimateSFRagdollSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_UltimateSFRagdollTick);
+	SET_DWORD_STAT(STAT_UltimateSFActiveRagdolls, GetNumActiveRagdolls());
+
+	if (GetNumActiveRagdolls() == 0)
+	{
+		return;
+	}
+
+	const float MaxSimulateTime = CVarRagdollMaxSimulateTime.GetValueOnGameThread();
+	const float BlendOutTime = FMath::Max(KINDA_SMALL_NUMBER, CVarRagdollBlendOutTime.GetValueOnGameThread());
+
+	//Over the frame time target: retire the oldest simulating ragdoll this frame
+	if (DeltaTime * 1000.f > CVarRagdollTargetStepMs.GetValueOnGameThread())
+	{
+		const int32 OldestIndex = FindOldestSlot();
+		if (OldestIndex != INDEX_NONE)
+		{
+			BeginBlendOut(Slots[OldestIndex]);
+		}
+	}
+
+	for (int32 SlotIndex = 0; SlotIndex < Slots.Num(); ++SlotIndex)
+	{
+		FRagdollSlot& Slot = Slots[SlotIndex];
+		if (Slot.State == ESlotState::Free)
+		{
+			continue;
+		}
+
+		AUltimateSFCharacter* Character = Slot.Character.Get();
+		if (Character == nullptr)
+		{
+			FreeSlot(SlotIndex);
+			continue;
+		}
+
+		if (Slot.State == ESlotState::Simulating)
+		{
+			Slot.SimulatedTime += DeltaTime;
+
+			//Sleeping bodies cost nothing to keep around but we want the character back on its feet
+			const USkeletalMeshComponent* Mesh = Character->GetMesh();
+			const bool bAsleep = Mesh == nullptr || !Mesh->IsAnyRigidBodyAwake();
+			if (bAsleep || Slot.SimulatedTime >= MaxSimulateTime)
+			{
+				BeginBlendOut(Slot);
+			}
+		}
+		else if (Slot.State == ESlotState::BlendingOut)
+		{
+			Slot.BlendWeight = FMath::Max(0.f, Slot.BlendWeight - DeltaTime / BlendOutTime);
+			Character->SetRagdollBlendWeight(Slot.BlendWeight);
+
+			if (Slot.BlendWeight <= 0.f)
+			{
+				Character->ExitRagdoll();
+				FreeSlot(SlotIndex);
+			}
+		}
+	}
+}
+
+void UUltimateSFRagdollSubsystem::BeginBlendOut(FRagdollSlot& Slot)
+{
+	Slot.State = ESlotState::BlendingOut;
+	Slot.BlendWeight = 1.f;
+
+	if (AUltimateSFCharacter* Character = Slot.Character.Get())
+	{
+		Character->BeginRagdollRecovery();
+	}
+}
+
+void UUltimateSFRagdollSubsystem::FreeSlot(int32 SlotIndex)
+{
+	FRagdollSlot& Slot = Slots[SlotIndex];
+	if (Slot.State == ESlotState::Free)
+	{
+		return;
+	}
+
+	Slot.Character.Reset();
+	Slot.State = ESlotState::Free;
+	FreeSlots.Add(SlotIndex);
+}
+
+int32 UUltimateSFRagdollSubsystem::FindOldestSlot() const
+{
+	int32 OldestIndex = INDEX_NONE;
+	for (int32 SlotIndex = 0; SlotIndex < Slots.Num(); ++SlotIndex)
+	{
+		//Slots blending out already return on their own, snapping them would pop the pose for nothing
+		if (Slots[SlotIndex].State == ESlotState::Simulating
+			&& (OldestIndex == INDEX_NONE || Slots[SlotIndex].StartOrder < Slots[OldestIndex].StartOrder))
+		{
+			OldestIndex = SlotIndex;
+		}
+	}
+	return OldestIndex;
+}
+
+//Stress test: knock down up to N characters in the world at once, e.g. "usf.Ragdoll.Stress 50"
+static FAutoConsoleCommandWithWorldAndArgs RagdollStressCommand(
+	TEXT("usf.Ragdoll.Stress"),
+	TEXT("Knocks down up to N characters in the current world simultaneously (server only)."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (World == nullptr || World->GetNetMode() == NM_Client)
+		{
+			return;
+		}
+
+		const int32 Count = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 50;
+		int32 Knocked = 0;
+		for (TActorIterator<AUltimateSFCharacter> It(World); It && Knocked < Count; ++It)
+		{
+			It->ReceiveHit(nullptr, EUltimateSFMove::UpperCut, 0.f, true);
+			++Knocked;
+		}
+		UE_LOG(LogUltimateSF, Log, TEXT("usf.Ragdoll.Stress: knocked down %d characters"), Knocked);
+	}));
@@ -0,0 +1,63 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UltimateSFRagdollSubsystem.generated.h"
+
+class AUltimateSFCharacter;
+
+/**
+ * Owns the global ragdoll budget for a world.
+ * Knocked down characters borrow one of a fixed number of preallocated slots, simulate until their
+ * bodies go to sleep (or a time limit runs out), blend back to animation and return the slot.
+ * When the pool is empty the oldest simulating ragdoll is snapped back so the newest knockdown gets physics.
+ */
+UCLASS()
+class UUltimateSFRagdollSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/* Hands out a ragdoll slot, returns false if the character should fall back to a knockdown animation */
+	bool RequestRagdoll(AUltimateSFCharacter* Character);
+
+	/* Returns the slot early, e.g. when the character is destroyed mid ragdoll */
+	void ReleaseRagdoll(AUltimateSFCharacter* Character);
+
+	int32 GetNumActiveRagdolls() const { return Slots.Num() - FreeSlots.Num(); }
+	int32 GetBudget() const { return Slots.Num(); }
+
+private:
+	enum class ESlotState : uint8
+	{
+		Free,
+		Simulating,
+		BlendingOut
+	};
+
+	/* Pooled per-ragdoll physics bookkeeping, allocated once for the whole budget */
+	struct FRagdollSlot
+	{
+		TWeakObjectPtr<AUltimateSFCharacter> Character;
+		ESlotState State = ESlotState::Free;
+		float SimulatedTime = 0.f;
+		float BlendWeight = 0.f;
+		uint32 StartOrder = 0;
+	};
+
+	void BeginBlendOut(FRagdollSlot& Slot);
+	void FreeSlot(int32 SlotIndex);
+	/* Oldest slot still simulating, INDEX_NONE if every busy slot is blending out */
+	int32 FindOldestSlot() const;
+
+	TArray<FRagdollSlot> Slots;
+	TArray<int32> FreeSlots;
+	uint32 NextStartOrder = 0;
+};
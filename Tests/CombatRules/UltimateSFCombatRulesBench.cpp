@@ -0,0 +1,106 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+// Micro benchmarks of UltimateSFCombatRules, built without the engine, see the CMakeLists.txt at the project root.
+// Usage: UltimateSFCombatRulesBench [Iterations], 10000000 by default.
+
+#include "UltimateSFCombatRules.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace UltimateSFCombatRules;
+
+namespace
+{
+	//Same xorshift the batch simulation uses, enough to keep the branches unpredictable
+	uint32_t NextRandom(uint32_t& State)
+	{
+		State ^= State << 13;
+		State ^= State >> 17;
+		State ^= State << 5;
+		return State;
+	}
+
+	/* Keeps results alive so the optimizer cannot drop the loops */
+	volatile float Sink = 0.f;
+
+	template<typename FunctionType>
+	void Run(const char* Name, int Iterations, FunctionType&& Function)
+	{
+		const auto Start = std::chrono::steady_clock::now();
+		float Accumulated = 0.f;
+		for (int Index = 0; Index < Iterations; ++Index)
+		{
+			Accumulated += Function(Index);
+		}
+		const auto End = std::chrono::steady_clock::now();
+		Sink = Sink + Accumulated;
+
+		const double Nanoseconds = std::chrono::duration<double, std::nano>(End - Start).count();
+		std::printf("%-28s %12d calls %10.3f ns/call %10.1f M calls/s\n", Name, Iterations,
+			Nanoseconds / Iterations, Iterations / Nanoseconds * 1000.0);
+	}
+}
+
+int main(int Argc, char** Argv)
+{
+	const int Iterations = Argc > 1 ? std::atoi(Argv[1]) : 10000000;
+	if (Iterations <= 0)
+	{
+		std::printf("Usage: UltimateSFCombatRulesBench [Iterations]\n");
+		return 1;
+	}
+
+	//A power of two table of random inputs and fighters, indexed with a mask inside the timed loops
+	constexpr int TableSize = 4096;
+	std::vector<FInput> Inputs(TableSize);
+	std::vector<FFighter> Fighters(TableSize);
+	std::vector<float> Multipliers(TableSize);
+	std::vector<float> Reducers(TableSize);
+	uint32_t State = 0x9E3779B9u;
+	for (int Index = 0; Index < TableSize; ++Index)
+	{
+		const uint32_t Bits = NextRandom(State);
+		Inputs[Index].bW = (Bits & 1) != 0;
+		Inputs[Index].bA = (Bits & 2) != 0;
+		Inputs[Index].bS = (Bits & 4) != 0;
+		Inputs[Index].bD = (Bits & 8) != 0;
+		Inputs[Index].MouseY = static_cast<float>(static_cast<int>((Bits >> 8) & 0xFF) - 128) / 256.f;
+		//Mostly in combat mode and idle, like a fighter mashing buttons
+		Fighters[Index].bCombatMode = (Bits & 0x10000) == 0 || (Bits & 0x20000) == 0;
+		Fighters[Index].bPunching = (Bits & 0x1C0000) == 0;
+		Fighters[Index].bKicking = (Bits & 0xE00000) == 0;
+		Fighters[Index].bDodging = (Bits & 0x7000000) == 0;
+		Multipliers[Index] = (Bits & 0x8000000) != 0 ? DodgeDamageMultiplier : 1.f;
+		Reducers[Index] = (Bits & 0x10000000) != 0 ? GuardDamageReducingValue : 1.f;
+	}
+
+	constexpr int Mask = TableSize - 1;
+	Run("SelectPunch", Iterations, [&](int Index)
+	{
+		return SelectPunch(Inputs[Index & Mask], Fighters[Index & Mask]).Damage;
+	});
+	Run("SelectKick", Iterations, [&](int Index)
+	{
+		return SelectKick(Inputs[Index & Mask], Fighters[Index & Mask]).Damage;
+	});
+	Run("SelectDodge", Iterations, [&](int Index)
+	{
+		return static_cast<float>(SelectDodge(Inputs[Index & Mask], Fighters[Index & Mask]));
+	});
+	Run("ApplyDamage", Iterations, [&](int Index)
+	{
+		return ApplyDamage(static_cast<float>(Index & 31), Multipliers[Index & Mask], Reducers[(Index >> 3) & Mask]);
+	});
+	//What a fighter does when an attack lands: select, window, play rate and damage
+	Run("Punch + window + damage", Iterations, [&](int Index)
+	{
+		const FAttack Attack = SelectPunch(Inputs[Index & Mask], Fighters[Index & Mask]);
+		return GetAttackWindow(Attack.Move) + GetPlayRate(Attack.Move)
+			+ ApplyDamage(Attack.Damage, Multipliers[Index & Mask], Reducers[(Index >> 3) & Mask]);
+	});
+
+	return 0;
+}
@@ -0,0 +1,243 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+// Unit tests for UltimateSFCombatRules, built without the engine, see the CMakeLists.txt at the project root.
+
+#include "UltimateSFCombatRules.h"
+
+#include <cmath>
+#include <cstdio>
+
+using namespace UltimateSFCombatRules;
+
+namespace
+{
+	int NumChecks = 0;
+	int NumFailures = 0;
+
+	void Check(bool bCondition, const char* Expression, const char* File, int Line)
+	{
+		++NumChecks;
+		if (!bCondition)
+		{
+			++NumFailures;
+			std::printf("%s:%d: check failed: %s\n", File, Line, Expression);
+		}
+	}
+
+	bool NearlyEqual(float A, float B)
+	{
+		return std::fabs(A - B) < 1e-4f;
+	}
+
+	FInput MakeInput(bool bW, bool bA, bool bS, bool bD, float MouseY = 0.f)
+	{
+		FInput Input;
+		Input.bW = bW;
+		Input.bA = bA;
+		Input.bS = bS;
+		Input.bD = bD;
+		Input.MouseY = MouseY;
+		return Input;
+	}
+
+	FFighter MakeFighter(bool bCombatMode, bool bPunching = false, bool bKicking = false, bool bDodging = false)
+	{
+		FFighter Fighter;
+		Fighter.bCombatMode = bCombatMode;
+		Fighter.bPunching = bPunching;
+		Fighter.bKicking = bKicking;
+		Fighter.bDodging = bDodging;
+		return Fighter;
+	}
+}
+
+#define USF_CHECK(Expression) Check((Expression), #Expression, __FILE__, __LINE__)
+
+#define USF_CHECK_ATTACK(Attack, ExpectedMove, ExpectedDamage, bExpectedLeft) \
+	USF_CHECK((Attack).Move == (ExpectedMove) && NearlyEqual((Attack).Damage, (ExpectedDamage)) && (Attack).bLeftAttack == (bExpectedLeft))
+
+
+static void TestSelectPunch()
+{
+	const FFighter Ready = MakeFighter(true);
+
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(false, false, false, false), Ready), EMove::Jab, 5.f, true);
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(true, false, false, false), Ready), EMove::Jab, 5.f, true);
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(false, true, false, false), Ready), EMove::LeftHook, 8.f, true);
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(true, true, false, false), Ready), EMove::LeftHook, 8.f, true);
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(false, true, true, false), Ready), EMove::LeftHook, 8.f, true);
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(false, false, false, true), Ready), EMove::RightHook, 8.f, false);
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(false, false, true, true), Ready), EMove::RightHook, 8.f, false);
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(false, false, false, false, -0.2f), Ready), EMove::Straight, 10.f, false);
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(false, false, false, false, 0.1f), Ready), EMove::UpperCut, 15.f, true);
+
+	//Held A or D wins over the mouse
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(false, true, false, false, 0.1f), Ready), EMove::LeftHook, 8.f, true);
+	USF_CHECK_ATTACK(SelectPunch(MakeInput(false, false, false, true, -0.2f), Ready), EMove::RightHook, 8.f, false);
+
+	//Thresholds are exclusive
+	USF_CHECK(SelectPunch(MakeInput(false, false, false, false, StraightMouseY), Ready).Move == EMove::Jab);
+	USF_CHECK(SelectPunch(MakeInput(false, false, false, false, UpperCutMouseY), Ready).Move == EMove::Jab);
+
+	//Gated by combat mode, an ongoing punch and a dodge, but not by a kick
+	USF_CHECK(SelectPunch(FInput(), MakeFighter(false)).Move == EMove::None);
+	USF_CHECK(SelectPunch(FInput(), MakeFighter(true, true)).Move == EMove::None);
+	USF_CHECK(SelectPunch(FInput(), MakeFighter(true, false, false, true)).Move == EMove::None);
+	USF_CHECK(SelectPunch(FInput(), MakeFighter(true, false, true)).Move == EMove::Jab);
+}
+
+static void TestSelectKick()
+{
+	const FFighter Ready = MakeFighter(true);
+
+	USF_CHECK_ATTACK(SelectKick(MakeInput(false, false, false, false), Ready), EMove::LowKick, 5.f, false);
+	USF_CHECK_ATTACK(SelectKick(MakeInput(true, false, false, false), Ready), EMove::LowKick, 5.f, false);
+	USF_CHECK_ATTACK(SelectKick(MakeInput(false, true, false, false), Ready), EMove::LeftMiddleKick, 10.f, true);
+	USF_CHECK_ATTACK(SelectKick(MakeInput(true, true, false, false), Ready), EMove::LeftMiddleKick, 10.f, true);
+	USF_CHECK_ATTACK(SelectKick(MakeInput(false, false, false, true), Ready), EMove::RightMiddleKick, 10.f, false);
+	USF_CHECK_ATTACK(SelectKick(MakeInput(false, false, false, false, -0.1f), Ready), EMove::HighKick, 20.f, false);
+	USF_CHECK(SelectKick(MakeInput(false, false, false, false, HighKickMouseY), Ready).Move == EMove::LowKick);
+
+	//The low kick is the only kick out of a dodge
+	const FFighter Dodging = MakeFighter(true, false, false, true);
+	USF_CHECK(SelectKick(MakeInput(false, true, false, false), Dodging).Move == EMove::LowKick);
+	USF_CHECK(SelectKick(MakeInput(false, false, false, true), Dodging).Move == EMove::LowKick);
+	USF_CHECK(SelectKick(MakeInput(false, false, false, false, -0.1f), Dodging).Move == EMove::LowKick);
+
+	USF_CHECK(SelectKick(FInput(), MakeFighter(false)).Move == EMove::None);
+	USF_CHECK(SelectKick(FInput(), MakeFighter(true, false, true)).Move == EMove::None);
+	USF_CHECK(SelectKick(FInput(), MakeFighter(true, true)).Move == EMove::LowKick);
+}
+
+static void TestSelectDodge()
+{
+	const FFighter Ready = MakeFighter(true);
+
+	USF_CHECK(SelectDodge(MakeInput(false, false, false, true), Ready) == EDodge::Right);
+	USF_CHECK(SelectDodge(MakeInput(true, false, false, false), Ready) == EDodge::Right);
+	USF_CHECK(SelectDodge(MakeInput(false, true, false, false), Ready) == EDodge::Left);
+	USF_CHECK(SelectDodge(MakeInput(false, false, true, false), Ready) == EDodge::Left);
+	USF_CHECK(SelectDodge(FInput(), Ready) == EDodge::Left);
+
+	USF_CHECK(SelectDodge(FInput(), MakeFighter(false)) == EDodge::None);
+	USF_CHECK(SelectDodge(FInput(), MakeFighter(true, true)) == EDodge::None);
+	USF_CHECK(SelectDodge(FInput(), MakeFighter(true, false, true)) == EDodge::None);
+	//Dodging again while a dodge plays is allowed by the rules, the character's timer gates it
+	USF_CHECK(SelectDodge(FInput(), MakeFighter(true, false, false, true)) == EDodge::Left);
+}
+
+static void TestCanStartAttack()
+{
+	const FFighter Ready = MakeFighter(true);
+	USF_CHECK(CanStartAttack(EMove::Jab, Ready));
+	USF_CHECK(CanStartAttack(EMove::HighKick, Ready));
+	USF_CHECK(!CanStartAttack(EMove::None, Ready));
+	USF_CHECK(!CanStartAttack(EMove::Count, Ready));
+	USF_CHECK(!CanStartAttack(EMove::Jab, MakeFighter(false)));
+
+	//What the server refuses from an attack RPC: a second punch mid punch, a second kick mid kick
+	USF_CHECK(!CanStartAttack(EMove::Straight, MakeFighter(true, true)));
+	USF_CHECK(CanStartAttack(EMove::LowKick, MakeFighter(true, true)));
+	USF_CHECK(!CanStartAttack(EMove::LeftMiddleKick, MakeFighter(true, false, true)));
+	USF_CHECK(CanStartAttack(EMove::UpperCut, MakeFighter(true, false, true)));
+
+	//and anything but the low kick out of a dodge
+	const FFighter Dodging = MakeFighter(true, false, false, true);
+	USF_CHECK(CanStartAttack(EMove::LowKick, Dodging));
+	USF_CHECK(!CanStartAttack(EMove::HighKick, Dodging));
+	USF_CHECK(!CanStartAttack(EMove::Jab, Dodging));
+}
+
+static void TestGuardAndDamage()
+{
+	USF_CHECK(CanGuard(MakeFighter(true)));
+	USF_CHECK(CanGuard(MakeFighter(true, true)));
+	USF_CHECK(!CanGuard(MakeFighter(true, false, true)));
+	USF_CHECK(!CanGuard(MakeFighter(false)));
+
+	USF_CHECK(NearlyEqual(ApplyDamage(10.f, 1.f, 1.f), 10.f));
+	USF_CHECK(NearlyEqual(ApplyDamage(10.f, DodgeDamageMultiplier, 1.f), 20.f));
+	USF_CHECK(NearlyEqual(ApplyDamage(15.f, 1.f, GuardDamageReducingValue), 5.f));
+	USF_CHECK(NearlyEqual(ApplyDamage(15.f, DodgeDamageMultiplier, GuardDamageReducingValue), 10.f));
+	//A reducing value under 1 never amplifies the hit
+	USF_CHECK(NearlyEqual(ApplyDamage(10.f, 1.f, 0.f), 10.f));
+	USF_CHECK(NearlyEqual(ApplyDamage(10.f, 1.f, 0.5f), 10.f));
+}
+
+static void TestMoveTables()
+{
+	int NumPunches = 0;
+	int NumKicks = 0;
+	for (int Move = 0; Move < static_cast<int>(EMove::Count); ++Move)
+	{
+		const EMove AsMove = static_cast<EMove>(Move);
+		USF_CHECK(!(IsPunch(AsMove) && IsKick(AsMove)));
+		NumPunches += IsPunch(AsMove) ? 1 : 0;
+		NumKicks += IsKick(AsMove) ? 1 : 0;
+	}
+	USF_CHECK(NumPunches == 5);
+	USF_CHECK(NumKicks == 4);
+	USF_CHECK(!IsPunch(EMove::None) && !IsKick(EMove::None));
+
+	USF_CHECK(NearlyEqual(GetPlayRate(EMove::Jab), JabPlayRate));
+	USF_CHECK(NearlyEqual(GetPlayRate(EMove::LowKick), LowKickPlayRate));
+	USF_CHECK(NearlyEqual(GetPlayRate(EMove::UpperCut), AttackPlayRate));
+	USF_CHECK(NearlyEqual(GetPlayRate(EMove::HighKick), AttackPlayRate));
+
+	//The cap the server puts on an attack RPC's damage
+	USF_CHECK(GetMoveDamage(EMove::None) == 0.f);
+	USF_CHECK(GetMoveDamage(EMove::Count) == 0.f);
+	USF_CHECK(NearlyEqual(GetMoveDamage(EMove::Jab), 5.f));
+	USF_CHECK(NearlyEqual(GetMoveDamage(EMove::UpperCut), 15.f));
+	USF_CHECK(NearlyEqual(GetMoveDamage(EMove::LowKick), 5.f));
+	USF_CHECK(NearlyEqual(GetMoveDamage(EMove::HighKick), 20.f));
+
+	USF_CHECK(NearlyEqual(GetAttackWindow(EMove::Jab), PunchWindow));
+	USF_CHECK(NearlyEqual(GetAttackWindow(EMove::UpperCut), PunchWindow));
+	USF_CHECK(NearlyEqual(GetAttackWindow(EMove::LowKick), KickWindow));
+	USF_CHECK(NearlyEqual(GetAttackWindow(EMove::HighKick), KickWindow));
+}
+
+static void TestEveryInputSelectsAValidMove()
+{
+	//Every key combination and mouse side either attacks with a move of the right kind or, when gated, does nothing
+	const float MouseYs[] = { -1.f, -0.1f, 0.f, 0.1f, 1.f };
+	for (int Keys = 0; Keys < 16; ++Keys)
+	{
+		for (float MouseY : MouseYs)
+		{
+			const FInput Input = MakeInput((Keys & 1) != 0, (Keys & 2) != 0, (Keys & 4) != 0, (Keys & 8) != 0, MouseY);
+			for (int Flags = 0; Flags < 16; ++Flags)
+			{
+				const FFighter Fighter = MakeFighter((Flags & 1) != 0, (Flags & 2) != 0, (Flags & 4) != 0, (Flags & 8) != 0);
+
+				const FAttack Punch = SelectPunch(Input, Fighter);
+				USF_CHECK(Punch.Move == EMove::None ? Punch.Damage == 0.f : IsPunch(Punch.Move) && Punch.Damage > 0.f);
+				USF_CHECK(Punch.Damage == GetMoveDamage(Punch.Move));
+				USF_CHECK(Punch.Move == EMove::None || Fighter.bCombatMode);
+				//The server accepts whatever the client's rules picked, with the side it derives itself
+				USF_CHECK(Punch.Move == EMove::None || (CanStartAttack(Punch.Move, Fighter) && Punch.bLeftAttack == IsLeftAttack(Punch.Move)));
+
+				const FAttack Kick = SelectKick(Input, Fighter);
+				USF_CHECK(Kick.Move == EMove::None ? Kick.Damage == 0.f : IsKick(Kick.Move) && Kick.Damage > 0.f);
+				USF_CHECK(Kick.Damage == GetMoveDamage(Kick.Move));
+				USF_CHECK(Kick.Move == EMove::None || Fighter.bCombatMode);
+				USF_CHECK(Kick.Move == EMove::None || (CanStartAttack(Kick.Move, Fighter) && Kick.bLeftAttack == IsLeftAttack(Kick.Move)));
+			}
+		}
+	}
+}
+
+int main()
+{
+	TestSelectPunch();
+	TestSelectKick();
+	TestSelectDodge();
+	TestCanStartAttack();
+	TestGuardAndDamage();
+	TestMoveTables();
+	TestEveryInputSelectsAValidMove();
+
+	std::printf("UltimateSFCombatRules: %d checks, %d failed\n", NumChecks, NumFailures);
+	return NumFailures == 0 ? 0 : 1;
+}